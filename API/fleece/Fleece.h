@@ -470,6 +470,7 @@ while (NULL != (value = FLArrayIterator_GetValue(&iter))) {
         kFLDeepCopy           = 1,
         kFLCopyImmutables     = 2,
         kFLDeepCopyImmutables = (kFLDeepCopy | kFLCopyImmutables),
+        kFLCopyOnWrite        = 4,
     } FLCopyFlags;
 
 
@@ -483,6 +484,14 @@ while (NULL != (value = FLArrayIterator_GetValue(&iter))) {
         nested mutable Arrays and Dicts are also copied, recursively; if kFLCopyImmutables is
         also set, immutable values are also copied.
 
+        kFLCopyOnWrite makes a deep copy cheaply: nested mutable Arrays and Dicts are shared by
+        the source and the copy until one of them changes. The source is unaffected; it goes on
+        modifying its nested collections in place, at any depth, and the copy doesn't see the
+        changes. (The first copy of a collection takes time proportional to the number of mutable
+        collections nested in it, but not to their numbers of values.) To modify a nested collection
+        of the copy, get it with FLMutableArray_GetMutableArray or similar, which copies it; one
+        you get with FLArray_Get may still be the source's.
+
         If the source Array is NULL, then NULL is returned. */
     FLMutableArray FLArray_MutableCopy(FLArray, FLCopyFlags) FLAPI;
 
@@ -717,6 +726,9 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
         Copying a mutable Dict is cheap if it's a shallow copy, but if `deepCopy` is true,
         nested mutable Dicts and Arrays are also copied, recursively.
 
+        With kFLCopyOnWrite, nested mutable collections are instead shared with the source until
+        one of them changes (see FLArray_MutableCopy.)
+
         If the source dict is NULL, then NULL is returned. */
     FLMutableDict FLDict_MutableCopy(FLDict source, FLCopyFlags) FLAPI;
 
@@ -867,8 +879,11 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
 
      A leading JSONPath-like `$.` is allowed but ignored.
 
-     A '\' can be used to escape a special character ('.', '[' or '$') at the start of a
+     A '\' can be used to escape a special character ('.', '[', '$' or '*') at the start of a
      property name (but not yet in the middle of a name.)
+
+     JSONPath-like wildcards (`[*]`, `..name`) and filters (`[?(@.x == 1)]`) can match more
+     than one value; evaluating such a path returns the first value it matches.
      */
 
 #ifndef FL_IMPL
@@ -895,12 +910,37 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
     /** Equality test. */
     bool FLKeyPath_Equals(FLKeyPath path1, FLKeyPath path2) FLAPI;
 
-    /** Returns an element of a path, either a key or an array index. */
+    /** Returns an element of a path, either a key or an array index. Returns false if `i` is
+        out of range, or if the element is neither, like a `[*]` wildcard, a `..name`
+        descendant or a filter. */
     bool FLKeyPath_GetElement(FLKeyPath NONNULL,
                               size_t i,
                               FLSlice *outDictKey NONNULL,
                               int32_t *outArrayIndex NONNULL) FLAPI;
 
+#ifndef FL_IMPL
+    typedef struct _FLKeyPathSet*  FLKeyPathSet;    ///< A reference to a set of key paths.
+#endif
+
+    /** Creates a set of key paths, compiled together so that evaluating them traverses each
+        prefix they have in common only once. If any specifier is invalid, returns NULL. */
+    FLKeyPathSet FLKeyPathSet_New(const FLSlice specifiers[] NONNULL,
+                                  size_t count,
+                                  FLError *error) FLAPI;
+
+    /** Frees a set of key paths. (It's ok to pass NULL.) */
+    void FLKeyPathSet_Free(FLKeyPathSet) FLAPI;
+
+    /** Returns the number of key paths in the set. */
+    size_t FLKeyPathSet_Count(FLKeyPathSet NONNULL) FLAPI;
+
+    /** Evaluates all the key paths in a set for a given Fleece root object. The value of each
+        path (or NULL if it has none) is stored in `outValues`, in the order the specifiers were
+        given. Returns the number of paths that have values. */
+    size_t FLKeyPathSet_Eval(FLKeyPathSet NONNULL,
+                             FLValue root,
+                             FLValue outValues[] NONNULL) FLAPI;
+
     //////// SHARED KEYS
 
 
@@ -1047,6 +1087,13 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
     void FLEncoder_Amend(FLEncoder e NONNULL, FLSlice base,
                          bool reuseStrings, bool externPointers) FLAPI;
 
+    /** Like \ref FLEncoder_Amend, but the encoder won't refer to any of the base data before its
+        last `cutoff` bytes. Values that use any of that data are written out again instead of
+        being pointed to, so that the older part of the base is no longer needed.
+        (A cutoff of 0, or one not smaller than the base, means no cutoff.) */
+    void FLEncoder_AmendWithCutoff(FLEncoder e NONNULL, FLSlice base,
+                                   bool reuseStrings, bool externPointers, size_t cutoff) FLAPI;
+
     /** Returns the `base` value passed to FLEncoder_Amend. */
     FLSlice FLEncoder_GetBase(FLEncoder NONNULL) FLAPI;
 
@@ -1283,6 +1330,48 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
                                    FLEncoder encoder) FLAPI;
 
 
+    /** Returns a delta like `FLCreateJSONDelta`, but encoded as Fleece instead of JSON. It's
+        applied by `FLApplyFleeceDelta`, which doesn't have to parse it.
+        @param old  A value that's typically the old/original state of some data.
+        @param nuu  A value that's typically the new/changed state of the `old` data.
+        @return  Fleece data representing the changes from `old` to `nuu`, or NULL on
+                    (extremely unlikely) failure. */
+    FLSliceResult FLCreateFleeceDelta(FLValue old, FLValue nuu) FLAPI;
+
+    /** Writes a Fleece delta describing the changes to turn the value `old` into `nuu`.
+        @param old  A value that's typically the old/original state of some data.
+        @param nuu  A value that's typically the new/changed state of the `old` data.
+        @param encoder  A Fleece encoder to write the delta to, as a single value.
+        @return  True on success, false on (extremely unlikely) failure. */
+    bool FLEncodeFleeceDelta(FLValue old, FLValue nuu, FLEncoder NONNULL encoder) FLAPI;
+
+    /** Applies the Fleece delta created by `FLCreateFleeceDelta` to the value `old`, which must
+        be equal to the `old` value originally passed to `FLCreateFleeceDelta`, and returns a
+        Fleece document equal to the original `nuu` value.
+        @param old  A value that's typically the old/original state of some data. This must be
+                    equal to the `old` value used when creating the `fleeceDelta`.
+        @param fleeceDelta  The root value of a delta created by `FLCreateFleeceDelta` or
+                    `FLEncodeFleeceDelta`.
+        @param error  On failure, error information will be stored where this points, if non-null.
+        @return  The corresponding `nuu` value, encoded as Fleece, or null if an error occurred. */
+    FLSliceResult FLApplyFleeceDelta(FLValue old,
+                                     FLValue fleeceDelta,
+                                     FLError *error) FLAPI;
+
+    /** Applies the Fleece delta created by `FLCreateFleeceDelta` to the value `old`, and writes
+        the corresponding `nuu` value to the encoder.
+        @param old  A value that's typically the old/original state of some data. This must be
+                    equal to the `old` value used when creating the `fleeceDelta`.
+        @param fleeceDelta  The root value of a delta created by `FLCreateFleeceDelta` or
+                    `FLEncodeFleeceDelta`.
+        @param encoder  A Fleece encoder to write the decoded `nuu` value to. (JSON encoding is not
+                    supported.)
+        @return  True on success, false on error; call `FLEncoder_GetError` for details. */
+    bool FLEncodeApplyingFleeceDelta(FLValue old,
+                                     FLValue fleeceDelta,
+                                     FLEncoder encoder) FLAPI;
+
+
     //////// VALUE SLOTS
 
 
@@ -293,6 +293,36 @@ namespace fleece {
     };
 
 
+    /** A set of KeyPaths that are evaluated together, traversing the prefixes they have in
+        common only once. */
+    class KeyPathSet {
+    public:
+        KeyPathSet(const FLSlice specifiers[], size_t count, FLError *err)
+                                                        :_paths(FLKeyPathSet_New(specifiers, count, err)) { }
+        ~KeyPathSet()                                   {FLKeyPathSet_Free(_paths);}
+
+        KeyPathSet(KeyPathSet &&kp)                     :_paths(kp._paths) {kp._paths = nullptr;}
+        KeyPathSet& operator=(KeyPathSet &&kp)          {FLKeyPathSet_Free(_paths); _paths = kp._paths;
+                                                         kp._paths = nullptr; return *this;}
+
+        explicit operator bool() const                  {return _paths != nullptr;}
+        operator FLKeyPathSet() const                   {return _paths;}
+
+        size_t count() const                            {return FLKeyPathSet_Count(_paths);}
+
+        /** Stores the value of each path in `outValues`, which must have room for `count()`
+            items, and returns the number of paths that have values. */
+        size_t eval(Value root, FLValue outValues[]) const {
+            return FLKeyPathSet_Eval(_paths, root, outValues);
+        }
+    private:
+        KeyPathSet(const KeyPathSet&) =delete;
+        KeyPathSet& operator=(const KeyPathSet&) =delete;
+
+        FLKeyPathSet _paths;
+    };
+
+
     /** An iterator that traverses an entire value hierarchy, descending into Arrays and Dicts. */
     class DeepIterator {
     public:
@@ -445,7 +475,8 @@ namespace fleece {
 
         void setSharedKeys(SharedKeys sk)               {FLEncoder_SetSharedKeys(_enc, sk);}
 
-        inline void amend(slice base, bool reuseStrings =false, bool externPointers =false);
+        inline void amend(slice base, bool reuseStrings =false, bool externPointers =false,
+                          size_t cutoff =0);
         slice base() const                              {return FLEncoder_GetBase(_enc);}
 
         void suppressTrailer()                          {FLEncoder_SuppressTrailer(_enc);}
@@ -572,6 +603,17 @@ namespace fleece {
         static inline bool apply(Value old,
                                  slice jsonDelta,
                                  Encoder &encoder);
+
+        /** Fleece-encoded deltas, which can be applied without being parsed. */
+        static inline alloc_slice createFleece(Value old, Value nuu);
+        static inline bool createFleece(Value old, Value nuu, Encoder &encoder);
+
+        static inline alloc_slice applyFleece(Value old,
+                                              Value fleeceDelta,
+                                              FLError *error);
+        static inline bool applyFleece(Value old,
+                                       Value fleeceDelta,
+                                       Encoder &encoder);
     };
 
 
@@ -656,9 +698,9 @@ namespace fleece {
 
     inline void SharedKeys::writeState(const Encoder &enc) {FLSharedKeys_WriteState(_sk, enc);}
 
-    inline void Encoder::amend(slice base, bool reuseStrings, bool externPointers)
-                                                {FLEncoder_Amend(_enc, base,
-                                                                     reuseStrings, externPointers);}
+    inline void Encoder::amend(slice base, bool reuseStrings, bool externPointers,
+                               size_t cutoff)   {FLEncoder_AmendWithCutoff(_enc, base, reuseStrings,
+                                                                           externPointers, cutoff);}
     inline bool Encoder::writeNull()            {return FLEncoder_WriteNull(_enc);}
     inline bool Encoder::writeUndefined()       {return FLEncoder_WriteUndefined(_enc);}
     inline bool Encoder::writeBool(bool b)      {return FLEncoder_WriteBool(_enc, b);}
@@ -703,6 +745,20 @@ namespace fleece {
                                  Encoder &encoder) {
         return FLEncodeApplyingJSONDelta(old, jsonDelta, encoder);
     }
+    inline alloc_slice JSONDelta::createFleece(Value old, Value nuu) {
+        return FLCreateFleeceDelta(old, nuu);
+    }
+    inline bool JSONDelta::createFleece(Value old, Value nuu, Encoder &encoder) {
+        return FLEncodeFleeceDelta(old, nuu, encoder);
+    }
+    inline alloc_slice JSONDelta::applyFleece(Value old, Value fleeceDelta, FLError *error) {
+        return FLApplyFleeceDelta(old, fleeceDelta, error);
+    }
+    inline bool JSONDelta::applyFleece(Value old,
+                                       Value fleeceDelta,
+                                       Encoder &encoder) {
+        return FLEncodeApplyingFleeceDelta(old, fleeceDelta, encoder);
+    }
 
     inline SharedKeys SharedKeys::create(slice state) {
         auto sk = create();
@@ -0,0 +1,488 @@
+//
+// DB.cc
+//
+// Copyright © 2018 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "DB.hh"
+
+#if FL_HAVE_MMAP
+
+#include "Doc.hh"
+#include "FleeceException.hh"
+#include "Endian.hh"
+#include <algorithm>
+#include <fcntl.h>
+#include <optional>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+#include "betterassert.hh"
+
+using namespace std;
+
+namespace fleece::wyhash {
+    #include "wyhash.h"
+}
+
+namespace fleece {
+
+    /*
+        File format:
+
+        Header:                             Commit Trailer:
+            magic    [4 bytes: "FlDB"]          magic     [4 bytes: "FlCm"]
+            version  [1 byte]                   deltaSize [4-byte int]
+            reserved [3 bytes]                  rootPos   [8-byte int]
+                                                checksum  [8-byte int]
+        The header is followed by any number of commits. A commit is the delta written by
+        MutableHashTree::writeTo, whose base is all of the file before it, followed by a trailer.
+        The trailer's `deltaSize` is the length of the delta, and `rootPos` is the position of
+        the end of the delta, i.e. of the trailer itself. Its `checksum` is the wyhash of the
+        trailer's first 16 bytes, seeded with the wyhash of the delta.
+        All numbers are little-endian.
+
+        The file is only appended to, so an interrupted commit can only damage the end of the
+        file. To recover, the file is scanned backwards from its end for the last valid trailer.
+        Normally that's right at the end, so this takes time proportional to the damaged tail,
+        not to the size of the file.
+     */
+
+    struct FileHeader {
+        static constexpr uint8_t kCurrentVersion = 1;
+
+        bool isValid() const            {return memcmp(magic, "FlDB", 4) == 0
+                                                && version == kCurrentVersion;}
+
+        char    magic[4]    {'F', 'l', 'D', 'B'};
+        uint8_t version     {kCurrentVersion};
+        uint8_t reserved[3] {0, 0, 0};
+    };
+
+
+    struct CommitTrailer {
+        CommitTrailer() =default;
+
+        CommitTrailer(slice delta, size_t pos)
+        :deltaSize(uint32_t(delta.size))
+        ,rootPos(pos)
+        {
+            checksum = computeChecksum(delta);
+        }
+
+        // Returns the trailer at `pos` in `file` if it's valid, i.e. it ends a commit.
+        static optional<CommitTrailer> readAt(slice file, size_t pos) {
+            if (memcmp(file.offset(pos), "FlCm", 4) != 0)
+                return nullopt;
+            CommitTrailer trailer;
+            memcpy(&trailer, file.offset(pos), sizeof(trailer));
+            if (trailer.rootPos != pos || trailer.deltaSize > pos - sizeof(FileHeader))
+                return nullopt;
+            slice delta(file.offset(pos - trailer.deltaSize), trailer.deltaSize);
+            if (trailer.checksum != trailer.computeChecksum(delta))
+                return nullopt;
+            return trailer;
+        }
+
+        char      magic[4]  {'F', 'l', 'C', 'm'};
+        endian::uint32_le deltaSize;
+        endian::uint64_le rootPos;
+        endian::uint64_le checksum;
+
+    private:
+        uint64_t computeChecksum(slice delta) const {
+            uint64_t seed = wyhash::wyhash(delta.buf, delta.size, 0, wyhash::_wyp);
+            return wyhash::wyhash(this, offsetof(CommitTrailer, checksum), seed, wyhash::_wyp);
+        }
+    };
+
+    static_assert(sizeof(FileHeader) == 8 && sizeof(CommitTrailer) == 24, "Wrong struct sizes");
+
+
+    // The file is mapped with room to grow, so that most commits don't have to remap it:
+    static constexpr size_t kMinMappingSize = 1 << 20;
+
+    static size_t mappingSizeFor(size_t fileSize) {
+        size_t size = kMinMappingSize;
+        while (size < 2 * fileSize)
+            size *= 2;
+        return size;
+    }
+
+
+    static FILE* openFile(const char *path, DB::OpenMode mode) {
+        static const char* const kModes[] = {"rb", "r+b", "a+b", "w+b"};
+        FILE *f = fopen(path, kModes[mode]);
+        if (!f)
+            FleeceException::_throwErrno("Can't open DB file %s", path);
+        return f;
+    }
+
+
+    static size_t sizeOfFile(FILE *f) {
+        if (fseeko(f, 0, SEEK_END) != 0)
+            FleeceException::_throwErrno("Can't read DB file");
+        return (size_t)ftello(f);
+    }
+
+
+    DB::DB(const char *filePath, OpenMode mode)
+    :_file(openFile(filePath, mode))
+    ,_writeable(mode != kReadOnly)
+    ,_fileSize(sizeOfFile(_file.get()))
+    ,_mapping(_file.get(), mappingSizeFor(_fileSize))
+    {
+        // (If this throws, the members' destructors release the Docs, mappings and file.)
+        recover(filePath, _fileSize);
+        findCommits();
+        for (auto &c : _commits)
+            addDoc(c.first, c.second);
+        if (_dataSize > 0)
+            _tree = committedTree();
+    }
+
+
+    // Finds the end of the last intact commit, and truncates anything after it.
+    void DB::recover(const char *filePath, size_t fileLength) {
+        slice file = _mapping.upTo(fileLength);
+        FileHeader header;
+        if (fileLength >= sizeof(header)) {
+            if (!((const FileHeader*)file.buf)->isValid())
+                FleeceException::_throw(InvalidData, "%s is not a DB file, or is from a newer "
+                                        "version of Fleece", filePath);
+            _fileSize = sizeof(header);
+            for (auto pos = ssize_t(fileLength - sizeof(CommitTrailer));
+                        pos >= ssize_t(sizeof(header)); --pos) {
+                if (auto trailer = CommitTrailer::readAt(file, pos); trailer) {
+                    _dataSize = pos;
+                    _fileSize = pos + sizeof(CommitTrailer);
+                    break;
+                }
+            }
+        } else if (slice(&header, fileLength) == file) {
+            _fileSize = 0;          // empty file, or one whose header was never fully written
+        } else {
+            FleeceException::_throw(InvalidData, "%s is not a DB file", filePath);
+        }
+
+        if (_writeable) {
+            if (_fileSize < fileLength) {
+                if (ftruncate(fileno(_file.get()), _fileSize) != 0)
+                    FleeceException::_throwErrno("Can't truncate DB file %s", filePath);
+            }
+            if (_fileSize == 0) {
+                write({&header, sizeof(header)});
+                sync();
+                _fileSize = sizeof(header);
+            }
+        }
+    }
+
+
+    // Finds the ranges of the commits, by following the trailers back from the last one. (The
+    // header, and any data before the first commit found, count as one more commit.)
+    void DB::findCommits() {
+        size_t end = _fileSize;
+        while (end >= sizeof(FileHeader) + sizeof(CommitTrailer)) {
+            CommitTrailer trailer;
+            size_t pos = end - sizeof(trailer);
+            memcpy(&trailer, _mapping.offset(pos), sizeof(trailer));
+            if (memcmp(trailer.magic, "FlCm", 4) != 0 || trailer.rootPos != pos
+                    || trailer.deltaSize > pos - sizeof(FileHeader))
+                break;      // (the rest has been compacted away)
+            _commits.emplace_back(pos - trailer.deltaSize, end);
+            end = pos - trailer.deltaSize;
+        }
+        if (end > 0)
+            _commits.emplace_back(0, end);
+        reverse(_commits.begin(), _commits.end());
+        _liveStart = min(_fileSize, sizeof(FileHeader));
+    }
+
+
+    DB::~DB() {
+        // Free the tree before the Docs it may retain, and the Docs before the mapped memory.
+        // (Then the members' destructors unmap the file, and close it.)
+        _tree = nullptr;
+        _docs.clear();
+        _oldMappings.clear();
+    }
+
+
+    // Registers a Doc covering a range of the file, so that its Values can be retained.
+    // (Each commit gets its own Doc, since Docs' ranges can't change, and so that the space
+    // of a compacted commit can be deallocated once nothing retains its Doc.)
+    void DB::addDoc(size_t start, size_t end) {
+        slice range(_mapping.offset(start), end - start);
+        _docs.push_back({impl::Doc::fromUnownedData(range, impl::Doc::kDontParse), start, end});
+    }
+
+
+    const HashTree* DB::committedTree() const {
+        return _dataSize ? HashTree::fromData(data()) : nullptr;
+    }
+
+
+    DB::Snapshot::Snapshot(impl::Doc *doc, const HashTree *tree, size_t commitPos)
+    :_doc(doc)
+    ,_tree(tree)
+    ,_commitPos(commitPos)
+    { }
+
+
+    DB::Snapshot DB::snapshot() const {
+        lock_guard<mutex> lock(_mutex);
+        // The last Doc covers the last commit. Retaining it keeps `discardDataBefore` from
+        // deallocating anything the snapshot's tree could use:
+        if (_docs.empty())
+            return Snapshot();
+        assert(_docs.back().end == _fileSize);
+        return Snapshot(_docs.back().doc, committedTree(), _fileSize);
+    }
+
+
+    Dict DB::get(slice key) const {
+        return _tree.get(key).asDict();
+    }
+
+
+    MutableDict DB::getMutable(slice key) {
+        if (!_tree.get(key))
+            return nullptr;
+        return _tree.getMutableDict(key);
+    }
+
+
+    void DB::put(slice key, Dict value) {
+        _tree.set(key, value);
+    }
+
+
+    bool DB::remove(slice key) {
+        return _tree.remove(key);
+    }
+
+
+    void DB::commitChanges() {
+        assert_precondition(_writeable);
+        if (isChanged())
+            commit(0);
+    }
+
+
+    // Appends the changes to the file. If `cutoff` is nonzero, nothing before the last `cutoff`
+    // bytes of the file will be used.
+    void DB::commit(size_t cutoff) {
+        // Encode the changes as a delta, whose pointers to unchanged data refer back into the
+        // mapped file:
+        Encoder enc;
+        enc.amend(_mapping.upTo(_fileSize), false, false, cutoff);
+        enc.suppressTrailer();
+        _tree.writeTo(enc);
+        alloc_slice delta = enc.finish();
+        size_t rootPos = _fileSize + delta.size;
+        CommitTrailer trailer(delta, rootPos);
+
+        try {
+            write(delta);
+            if (_syncMode == kSyncOrdered)
+                sync();
+            write({&trailer, sizeof(trailer)});
+            if (_syncMode != kNoSync)
+                sync();
+        } catch (...) {
+            // Don't leave a partial commit behind, where the next one would be appended:
+            (void)ftruncate(fileno(_file.get()), _fileSize);
+            throw;
+        }
+
+        lock_guard<mutex> lock(_mutex);
+        _commits.emplace_back(_fileSize, rootPos + sizeof(trailer));
+        _fileSize = rootPos + sizeof(trailer);
+        _dataSize = rootPos;
+        if (_fileSize > _mapping.size) {
+            // Map the file again, with more room. The old mapping is kept around, since Values
+            // in it may still be in use; but its Docs can go if nothing else retains them.
+            _oldMappings.push_back(move(_mapping));
+            _mapping = mmap_slice(_file.get(), mappingSizeFor(_fileSize));
+            _minUsedCache.clear();
+            _docs.erase(remove_if(_docs.begin(), _docs.end(), [](const MappedDoc &d) {
+                            return d.doc->refCount() == 1;
+                        }), _docs.end());
+            for (auto &c : _commits)
+                addDoc(c.first, c.second);
+        } else {
+            addDoc(_commits.back().first, _commits.back().second);
+        }
+        _tree = committedTree();
+    }
+
+
+    DB::CompactionStats DB::compact(size_t maxBytes) {
+        assert_precondition(_writeable);
+        assert_precondition(!isChanged());
+        CompactionStats stats;
+        if (_dataSize == 0)
+            return stats;
+
+        // Rewrite whatever uses the data before the cutoff; but leave the last commit alone,
+        // since it has the current root node:
+        size_t cutoffPos = _liveStart + min(maxBytes, _commits.back().first - _liveStart);
+        if (cutoffPos <= _liveStart)
+            return stats;
+        auto mapStart = (const uint8_t*)_mapping.buf;
+        if (_minUsedCache.size() > 4 * size_t(count()) + 1000)
+            _minUsedCache.clear();      // (it's mostly filled with garbage by now)
+        auto minUsed = (const uint8_t*)_tree.rewriteDataBefore(mapStart + cutoffPos,
+                                                               &_minUsedCache);
+        size_t liveStart = minUsed ? size_t(minUsed - mapStart) : SIZE_MAX;
+        if (isChanged()) {
+            size_t oldSize = _fileSize;
+            commit(_fileSize - cutoffPos);
+            stats.bytesWritten = _fileSize - oldSize;
+        }
+
+        // Now nothing before the oldest remaining data (or else the last commit) is in use.
+        // Make sure the new commit is durable before deallocating the data it replaces:
+        liveStart = min(liveStart, _commits.back().first);
+        if (liveStart > _liveStart) {
+            stats.bytesReclaimed = liveStart - _liveStart;
+            _liveStart = liveStart;
+            if (stats.bytesWritten > 0 && _syncMode == kNoSync)
+                sync();
+            discardDataBefore(liveStart);
+        }
+        return stats;
+    }
+
+
+    // Forgets about the commits and Docs before `pos`, and deallocates their space.
+    void DB::discardDataBefore(size_t pos) {
+        lock_guard<mutex> lock(_mutex);
+        _commits.erase(_commits.begin(),
+                       find_if(_commits.begin(), _commits.end(),
+                               [&](auto &c) {return c.second > pos;}));
+
+        // A Doc retained by something else (like a MutableDict) stays, and since its Values may
+        // point to anything before its end, none of that can be deallocated. The other Docs
+        // before `pos` can go, but ones that extend past it have to keep their data intact.
+        size_t start = sizeof(FileHeader), end = pos;
+        for (auto i = _docs.begin(); i != _docs.end(); ) {
+            if (i->doc->refCount() > 1) {
+                start = max(start, i->end);
+                ++i;
+            } else if (i->end <= pos) {
+                i = _docs.erase(i);
+            } else {
+                if (i->start < pos)
+                    end = min(end, i->start);
+                ++i;
+            }
+        }
+        if (start < end)
+            deallocate(start, end);
+    }
+
+
+    // Frees the disk blocks of a range of the file, if the filesystem supports that. (The file
+    // keeps its length; the range reads as zeroes.) Only whole blocks are freed, and never the
+    // header.
+    void DB::deallocate(size_t start, size_t end) {
+        static constexpr size_t kBlockSize = 4096;
+        start = (max(start, sizeof(FileHeader)) + kBlockSize - 1) & ~(kBlockSize - 1);
+        end &= ~(kBlockSize - 1);
+        if (start >= end)
+            return;
+#if defined(__linux__)
+        (void)fallocate(fileno(_file.get()), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                        off_t(start), off_t(end - start));
+#elif defined(__APPLE__)
+        fpunchhole_t hole = {};
+        hole.fp_offset = off_t(start);
+        hole.fp_length = off_t(end - start);
+        (void)fcntl(fileno(_file.get()), F_PUNCHHOLE, &hole);
+#endif
+    }
+
+
+    // Appends data to the file. (It's flushed, so it's visible in the mapping.)
+    void DB::write(slice data) {
+        if (fseeko(_file.get(), 0, SEEK_END) != 0
+                || fwrite(data.buf, 1, data.size, _file.get()) < data.size
+                || fflush(_file.get()) != 0)
+            FleeceException::_throwErrno("Can't write DB file");
+    }
+
+
+    void DB::sync() {
+        if (fsync(fileno(_file.get())) != 0)
+            FleeceException::_throwErrno("Can't sync DB file");
+    }
+
+
+    void DB::revertChanges() {
+        _tree = committedTree();
+    }
+
+
+    void DB::groupCommit(function_ref<void(DB&)> changes) {
+        assert_precondition(_writeable);
+        GroupMember me {changes};
+        unique_lock<mutex> lock(_groupMutex);
+        _groupQueue.push_back(&me);
+        // Wait until another caller has committed my changes, or I can commit them myself:
+        _groupCond.wait(lock, [&] {return me.done || !_groupLeader;});
+        if (me.done) {
+            if (me.error)
+                rethrow_exception(me.error);
+            return;
+        }
+
+        // I'm the leader of this group. Give others a chance to join, then take the group:
+        _groupLeader = true;
+        if (_groupWindow.count() > 0) {
+            lock.unlock();
+            this_thread::sleep_for(_groupWindow);
+            lock.lock();
+        }
+        vector<GroupMember*> group;
+        swap(group, _groupQueue);
+        lock.unlock();
+
+        // While I commit, the next group collects in the queue:
+        exception_ptr error;
+        try {
+            for (GroupMember *member : group)
+                member->changes(*this);
+            commitChanges();
+        } catch (...) {
+            error = current_exception();
+            revertChanges();
+        }
+
+        lock.lock();
+        for (GroupMember *member : group) {
+            member->error = error;
+            member->done = true;
+        }
+        _groupLeader = false;
+        _groupCond.notify_all();
+        if (error)
+            rethrow_exception(error);
+    }
+
+}
+
+#endif // FL_HAVE_MMAP
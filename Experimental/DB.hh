@@ -0,0 +1,229 @@
+//
+// DB.hh
+//
+// Copyright © 2018 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "MutableHashTree.hh"
+#include "sliceIO.hh"
+#include "function_ref.hh"
+#include "fleece/Mutable.hh"
+#include "RefCounted.hh"
+#include "Doc.hh"
+#include <stdio.h>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if FL_HAVE_MMAP
+
+namespace fleece {
+
+    /** A persistent key-value store whose values are Dicts. It's stored as a HashTree in an
+        append-only file, which is memory-mapped, so opening it involves almost no I/O and
+        documents are paged in only as they're accessed.
+        Changes are made in memory, in a MutableHashTree, until `commitChanges` appends them
+        to the file as a delta, followed by a checksummed commit trailer. When the file is
+        opened, anything after the last intact trailer -- the remains of a commit interrupted by
+        a crash -- is ignored, and if the DB is writeable, truncated.
+        Values read from a DB are only valid as long as the DB exists. */
+    class DB {
+    public:
+        enum OpenMode {
+            kReadOnly,              // File must exist; changes can't be committed
+            kWrite,                 // File must exist
+            kCreateAndWrite,        // File is created if it doesn't exist
+            kEraseAndWrite,         // File is created, or truncated if it exists
+        };
+
+        /** How a commit makes sure its data is durable before returning. */
+        enum SyncMode {
+            kNoSync,                // Don't sync; an OS crash may lose recent commits
+            kSync,                  // Sync once after writing the commit
+            kSyncOrdered,           // Also sync the delta before writing its trailer
+        };
+
+        explicit DB(const char *filePath, OpenMode =kWrite);
+        ~DB();
+
+        /** The document with the given key, or nullptr if there isn't one. */
+        Dict get(slice key) const;
+
+        /** A mutable version of the document with the given key, or nullptr if there isn't
+            one. Changes to it are saved by the next `commitChanges`. */
+        MutableDict getMutable(slice key);
+
+        /** Adds or replaces a document. A nullptr value deletes it. */
+        void put(slice key, Dict);
+
+        /** Deletes a document; returns false if there isn't one. */
+        bool remove(slice key);
+
+        unsigned count() const                      {return _tree.count();}
+
+        /** True if there are uncommitted changes. */
+        bool isChanged() const                      {return _tree.isChanged();}
+
+        /** Writes all changes to the end of the file. */
+        void commitChanges();
+
+        /** Discards all uncommitted changes. */
+        void revertChanges();
+
+        /** Makes changes and commits them, from any thread, returning once they're committed.
+            `changes` is called with the DB to make the changes (with `put`, `remove`, etc.)
+            Changes from concurrent callers are grouped into a single commit, with one tree write
+            and one sync: while one commit is in progress, the next group collects. If a group
+            fails, or any of its callers' `changes` throws, the whole group is reverted and every
+            caller gets the exception.
+            While this is in use, the DB's other mutating methods mustn't be called. */
+        void groupCommit(function_ref<void(DB&)> changes);
+
+        /** How long a group commit waits for more callers to join it, before committing. The
+            default is zero; a longer window makes bigger groups at the expense of latency. */
+        void setGroupCommitWindow(std::chrono::microseconds w)  {_groupWindow = w;}
+
+        /** The size of the file's committed data. */
+        size_t dataSize() const                     {return _dataSize;}
+
+        /** The size of the file, up to the end of the last commit. */
+        size_t fileSize() const                     {return _fileSize;}
+
+        /** The default is kSync. With it, a crash can never expose a partly-written commit,
+            since the commit's checksum won't match. kSyncOrdered additionally makes sure that
+            the trailer never reaches the disk before the delta, at the cost of a second sync. */
+        SyncMode syncMode() const                   {return _syncMode;}
+        void setSyncMode(SyncMode m)                {_syncMode = m;}
+
+
+        struct CompactionStats {
+            size_t bytesReclaimed {0};      // Bytes of the file that are no longer in use
+            size_t bytesWritten {0};        // Bytes appended to the file to make that possible
+
+            double writeAmplification() const {
+                return bytesReclaimed ? double(bytesWritten) / bytesReclaimed : 0.0;
+            }
+        };
+
+        /** Runs one step of incremental compaction: copies the documents, tree nodes and key
+            index pages (if the tree has a key index) still in use from the oldest `maxBytes` of
+            the file to a new commit, so that space is no longer in use. Where the filesystem supports it, the space is then deallocated ("punched
+            out" of the file, whose length stays the same.)
+            Keeping steps small avoids long pauses; they can be run between other commits. A full
+            pass is done once `liveDataStart` reaches the `fileSize` from when it started; after
+            that, steps just copy the data the previous steps wrote.
+            There must not be any uncommitted changes. Values read from the DB before the step
+            may be invalid afterwards, unless they're retained (as by a MutableDict.) */
+        CompactionStats compact(size_t maxBytes);
+
+        /** The position in the file of the oldest data still in use. */
+        size_t liveDataStart() const                {return _liveStart;}
+
+
+        /** A read-only view of the DB as of one commit. Its contents never change, and the data
+            it uses won't be reclaimed by compaction while it exists. Snapshots can be made and
+            read on any thread, while another thread writes to the DB. (But Values read from one
+            shouldn't be retained off the writer's thread, and it mustn't outlive the DB.) */
+        class Snapshot {
+        public:
+            Snapshot()                              =default;
+
+            /** The document with the given key, or nullptr if there isn't one. */
+            Dict get(slice key) const               {return _tree ? _tree->get(key).asDict() : nullptr;}
+
+            unsigned count() const                  {return _tree ? _tree->count() : 0;}
+
+            /** The tree, for iterating; nullptr if nothing had been committed. */
+            const HashTree* tree() const            {return _tree;}
+
+            /** The end of the snapshot's commit in the file (the DB's `fileSize` at the time.) */
+            size_t commitPos() const                {return _commitPos;}
+
+        private:
+            friend class DB;
+            Snapshot(impl::Doc*, const HashTree*, size_t commitPos);
+
+            Retained<impl::Doc> _doc;               // Keeps the commit from being reclaimed
+            const HashTree*     _tree {nullptr};
+            size_t              _commitPos {0};
+        };
+
+        /** Returns a Snapshot of the last commit. Uncommitted changes aren't visible in it.
+            Unlike the other methods, this one is thread-safe. */
+        Snapshot snapshot() const;
+
+
+        /** Iterates over the documents, in no particular order. */
+        class iterator : public HashTree::iterator {
+        public:
+            explicit iterator(const DB &db)         :HashTree::iterator(db._tree) { }
+            Dict value() const noexcept             {return HashTree::iterator::value().asDict();}
+        };
+
+    private:
+        DB(const DB&) =delete;
+        DB& operator= (const DB&) =delete;
+
+        struct GroupMember {
+            function_ref<void(DB&)> changes;
+            bool                    done {false};
+            std::exception_ptr      error;
+        };
+
+        struct MappedDoc {
+            Retained<impl::Doc> doc;
+            size_t              start, end;             // The range of the file it covers
+        };
+
+        slice data() const                          {return _mapping.upTo(_dataSize);}
+        void recover(const char *filePath, size_t fileLength);
+        void findCommits();
+        void commit(size_t cutoff);
+        void write(slice);
+        void sync();
+        void addDoc(size_t start, size_t end);
+        void discardDataBefore(size_t pos);
+        void deallocate(size_t start, size_t end);
+        const HashTree* committedTree() const;
+
+        struct FileCloser {void operator() (FILE *f) const {fclose(f);}};
+
+        std::unique_ptr<FILE,FileCloser>    _file;
+        bool const                          _writeable;
+        SyncMode                            _syncMode {kSync};
+        size_t                              _fileSize {0};  // End of the last commit
+        size_t                              _dataSize {0};  // End of the last commit's tree
+        size_t                              _liveStart {0}; // Start of the data still in use
+        mmap_slice                          _mapping;       // The current mapping of the file
+        std::vector<mmap_slice>             _oldMappings;   // Earlier, smaller mappings
+        std::vector<std::pair<size_t,size_t>> _commits;     // Ranges of the live commits
+        std::vector<MappedDoc>              _docs;          // Docs covering the mapped data
+        MutableHashTree::MinUsedCache       _minUsedCache;  // Speeds up compaction
+        mutable std::mutex                  _mutex;         // Guards what `snapshot` uses
+        std::mutex                          _groupMutex;    // Guards the group-commit state:
+        std::condition_variable             _groupCond;
+        std::vector<GroupMember*>           _groupQueue;    // Callers waiting for a commit
+        bool                                _groupLeader {false}; // Is a caller committing?
+        std::chrono::microseconds           _groupWindow {0};
+        MutableHashTree                     _tree;
+    };
+
+}
+
+#endif // FL_HAVE_MMAP
@@ -44,6 +44,7 @@ typedef MutableDict*    FLMutableDict;
 typedef FLEncoderImpl*  FLEncoder;
 typedef SharedKeys*     FLSharedKeys;
 typedef Path*           FLKeyPath;
+typedef PathSet*        FLKeyPathSet;
 typedef DeepIterator*   FLDeepIterator;
 typedef const Doc*      FLDoc;
 
@@ -521,12 +521,37 @@ bool FLKeyPath_GetElement(FLKeyPath path, size_t i, FLSlice *outKey, int32_t *ou
     if (i >= path->size())
         return false;
     auto &element = (*path)[i];
+    if (!element.isSingular())
+        return false;
     *outKey = element.keyStr();
     *outIndex = element.index();
     return true;
 }
 
 
+FLKeyPathSet FLKeyPathSet_New(const FLSlice specifiers[], size_t count, FLError *outError) FLAPI {
+    try {
+        std::unique_ptr<PathSet> paths(new PathSet);
+        for (size_t i = 0; i < count; ++i)
+            paths->add(Path((std::string)(slice)specifiers[i]));
+        return paths.release();
+    } catchError(outError)
+    return nullptr;
+}
+
+void FLKeyPathSet_Free(FLKeyPathSet paths) FLAPI {
+    delete paths;
+}
+
+size_t FLKeyPathSet_Count(FLKeyPathSet paths) FLAPI {
+    return paths->count();
+}
+
+size_t FLKeyPathSet_Eval(FLKeyPathSet paths, FLValue root, FLValue outValues[]) FLAPI {
+    return paths->eval(root, outValues);
+}
+
+
 #pragma mark - ENCODER:
 
 
@@ -563,8 +588,14 @@ void FLEncoder_SuppressTrailer(FLEncoder e) FLAPI {
 }
 
 void FLEncoder_Amend(FLEncoder e, FLSlice base, bool reuseStrings, bool externPointers) FLAPI {
+    FLEncoder_AmendWithCutoff(e, base, reuseStrings, externPointers, 0);
+}
+
+void FLEncoder_AmendWithCutoff(FLEncoder e, FLSlice base, bool reuseStrings, bool externPointers,
+                               size_t cutoff) FLAPI
+{
     if (e->isFleece() && base.size > 0) {
-        e->fleeceEncoder->setBase(base, externPointers);
+        e->fleeceEncoder->setBase(base, externPointers, cutoff);
         if(reuseStrings)
             e->fleeceEncoder->reuseBaseStrings();
     }
@@ -789,3 +820,46 @@ bool FLEncodeApplyingJSONDelta(FLValue old, FLSlice jsonDelta, FLEncoder encoder
         return false;
     }
 }
+
+
+FLSliceResult FLCreateFleeceDelta(FLValue old, FLValue nuu) FLAPI {
+    try {
+        return toSliceResult(JSONDelta::createFleece(old, nuu));
+    } catch (const std::exception&) {
+        return {};
+    }
+}
+
+bool FLEncodeFleeceDelta(FLValue old, FLValue nuu, FLEncoder encoder) FLAPI {
+    try {
+        Encoder *enc = encoder->fleeceEncoder.get();
+        if (!enc)
+            FleeceException::_throw(EncodeError, "FLEncodeFleeceDelta cannot encode JSON");
+        JSONDelta::create(old, nuu, *enc);
+        return true;
+    } catch (const std::exception &x) {
+        encoder->recordException(x);
+        return false;
+    }
+}
+
+
+FLSliceResult FLApplyFleeceDelta(FLValue old, FLValue fleeceDelta, FLError *outError) FLAPI {
+    try {
+        return toSliceResult(JSONDelta::applyFleece(old, fleeceDelta));
+    } catchError(outError);
+    return {};
+}
+
+bool FLEncodeApplyingFleeceDelta(FLValue old, FLValue fleeceDelta, FLEncoder encoder) FLAPI {
+    try {
+        Encoder *enc = encoder->fleeceEncoder.get();
+        if (!enc)
+            FleeceException::_throw(EncodeError, "FLEncodeApplyingFleeceDelta cannot encode JSON");
+        JSONDelta::apply(old, fleeceDelta, *enc);
+        return true;
+    } catch (const std::exception &x) {
+        encoder->recordException(x);
+        return false;
+    }
+}
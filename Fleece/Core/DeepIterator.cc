@@ -9,14 +9,30 @@
 #include "DeepIterator.hh"
 #include "SharedKeys.hh"
 #include <sstream>
+#include <stdio.h>
 
 namespace fleece { namespace impl {
 
     DeepIterator::DeepIterator(const Value *root)
     :_value(root)
     ,_skipChildren(false)
+    ,_dictIt((const Dict*)nullptr)
+    ,_arrayIt(nullptr)
     { }
 
+
+    void DeepIterator::reset(const Value *root) {
+        _value = root;
+        _path.clear();
+        while (!_stack.empty())
+            _stack.pop_back();      // (unlike clear(), this never frees the heap storage)
+        _container = nullptr;
+        _skipChildren = false;
+        _dictIt = Dict::iterator((const Dict*)nullptr);
+        _arrayIt = Array::iterator(nullptr);
+        _sk = nullptr;
+    }
+
     void DeepIterator::next() {
         if (!_value)
             return;
@@ -34,41 +50,33 @@ namespace fleece { namespace impl {
         do {
             if (_arrayIt) {
                 // Next array item:
-                _value = (*_arrayIt).value();
-                if (_value) {
-                    _path.push_back({nullslice, _arrayIndex++});
-                    ++(*_arrayIt);
-                } else {
-                    _arrayIt.reset();
-                }
+                _value = _arrayIt.value();
+                _path.push_back({nullslice, _arrayIndex++});
+                ++_arrayIt;
             } else if (_dictIt) {
                 // Next dict item:
-                _value = (*_dictIt).value();
-                if (_value) {
-                    _path.push_back({(*_dictIt).keyString(), 0});
-                    ++(*_dictIt);
-                } else {
-                    if (!_sk)
-                        _sk = _dictIt->sharedKeys();
-                    _dictIt.reset();
-                }
+                _value = _dictIt.value();
+                _path.push_back({_dictIt.keyString(), 0});
+                if (!_sk)
+                    _sk = _dictIt.sharedKeys();
+                ++_dictIt;
             } else {
                 // End of array/dict, so start another one:
                 _value = nullptr;
                 if (_stack.empty())
                     return; // end of iteration
-                while (_stack.front().second == nullptr) {
+                while (_stack.back().second == nullptr) {
                     // end of a level of hierarchy; pop the path, or stop if it's empty:
                     if (_path.empty())
                         return; // end of iteration
                     _path.pop_back();
-                    _stack.pop_front();
+                    _stack.pop_back();
                 }
 
                 // Pop the next container and its key from the stack:
-                auto container = _stack.front().second;
-                _path.push_back(_stack.front().first);
-                _stack.pop_front();
+                auto container = _stack.back().second;
+                _path.push_back(_stack.back().first);
+                _stack.pop_back();
                 iterateContainer(container);
             }
         } while (!_value);
@@ -76,14 +84,14 @@ namespace fleece { namespace impl {
 
     bool DeepIterator::iterateContainer(const Value *container) {
         _container = container;
-        _stack.push_front({{nullslice, 0}, nullptr});   // Push en end-of-level marker first
+        _stack.push_back({{nullslice, 0}, nullptr});    // Push en end-of-level marker first
         auto type = container->type();
         if (type == kArray) {
-            _arrayIt.reset( new Array::iterator(container->asArray()) );
+            _arrayIt = Array::iterator((const Array*)container);
             _arrayIndex = 0;
             return true;
         } else if (type == kDict) {
-            _dictIt.reset( new Dict::iterator(container->asDict(), _sk) );
+            _dictIt = Dict::iterator((const Dict*)container, _sk);
             return true;
         } else {
             return false;
@@ -93,13 +101,29 @@ namespace fleece { namespace impl {
     void DeepIterator::queueChildren() {
         auto type = _value->type();
         if (type == kDict || type == kArray)
-            _stack.push_front({_path.back(), _value});
+            _stack.push_back({_path.back(), _value});
     }
 
 
     std::string DeepIterator::pathString() const {
-        std::stringstream s;
-        for (auto &component : _path) {
+        std::string s;
+        pathString(_path, s);
+        return s;
+    }
+
+
+    /*static*/ std::string DeepIterator::pathString(const std::vector<PathComponent> &path) {
+        std::string s;
+        pathString(path, s);
+        return s;
+    }
+
+
+    /*static*/ void DeepIterator::pathString(const std::vector<PathComponent> &path,
+                                             std::string &s)
+    {
+        s.clear();
+        for (auto &component : path) {
             if (component.key) {
                 bool quote = false;
                 for (auto c : component.key) {
@@ -108,15 +132,16 @@ namespace fleece { namespace impl {
                         break;
                     }
                 }
-                s << (quote ? "[\"" : ".");
-                s.write((char*)component.key.buf, component.key.size);
+                s += (quote ? "[\"" : ".");
+                s.append((const char*)component.key.buf, component.key.size);
                 if (quote)
-                    s << "\"]";
+                    s += "\"]";
             } else {
-                s << '[' << component.index << ']';
+                char index[16];
+                snprintf(index, sizeof(index), "[%u]", component.index);
+                s += index;
             }
         }
-        return s.str();
     }
 
 
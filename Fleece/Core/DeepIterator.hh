@@ -9,9 +9,9 @@
 #pragma once
 #include "Array.hh"
 #include "Dict.hh"
-#include <memory>
+#include "SmallVector.hh"
+#include <string>
 #include <vector>
-#include <deque>
 #include <utility>
 
 namespace fleece { namespace impl {
@@ -29,12 +29,19 @@ namespace fleece { namespace impl {
         If you want to ignore the root container, either call next() immediately after creating
         the iterator, or during the iteration ignore the current value if path() is empty.
 
-        The iteration is (obviously) not recursive, so it uses minimal stack space. It uses a
-        small amount of heap space, roughly proportional to the number of sub-containers. */
+        The iteration is (obviously) not recursive, so it uses minimal stack space. It keeps the
+        sub-containers waiting to be iterated in a small inline stack, and only uses the heap once
+        there are more of them than fit there (or to iterate a Dict that inherits from another.)
+        To iterate many values, create one iterator and call reset() for each value: its stack
+        and path keep their memory, so once they've grown big enough, no more heap allocations
+        are needed. */
     class DeepIterator {
     public:
         DeepIterator(const Value *root);
 
+        /** Restarts the iteration with a new root, reusing the memory already allocated. */
+        void reset(const Value *root);
+
         inline explicit operator bool() const           {return _value != nullptr;}
         inline DeepIterator& operator++ ()              {next(); return *this;}
 
@@ -61,6 +68,13 @@ namespace fleece { namespace impl {
         /** The path expressed as a string in JavaScript syntax using "." and "[]". */
         std::string pathString() const;
 
+        /** Stores the path string in `out`, replacing its contents but reusing its buffer. */
+        void pathString(std::string &out) const         {pathString(_path, out);}
+
+        /** Converts a path to a string in JavaScript syntax, as `pathString` does. */
+        static std::string pathString(const std::vector<PathComponent>&);
+        static void pathString(const std::vector<PathComponent>&, std::string &out);
+
         /** The path to the current value, in JSONPointer (RFC 6901) syntax. */
         std::string jsonPointer() const;
 
@@ -71,18 +85,20 @@ namespace fleece { namespace impl {
         uint32_t index() const                          {return _path.empty() ? 0 : _path.back().index;}
 
     private:
+        using Pending = std::pair<PathComponent,const Value*>;
+
         bool iterateContainer(const Value *);
         void queueChildren();
 
         const SharedKeys* _sk {nullptr};
         const Value* _value;
         std::vector<PathComponent> _path;
-        std::deque<std::pair<PathComponent,const Value*>> _stack;
+        smallVector<Pending, 16> _stack;    // Containers to iterate, and end-of-level markers
         const Value* _container {nullptr};
         bool _skipChildren;
-        std::unique_ptr<Dict::iterator> _dictIt;
-        std::unique_ptr<Array::iterator> _arrayIt;
-        uint32_t _arrayIndex;
+        Dict::iterator _dictIt;             // Iterates the current container if it's a Dict
+        Array::iterator _arrayIt;           // Iterates the current container if it's an Array
+        uint32_t _arrayIndex {0};
     };
 
 } }
@@ -279,6 +279,13 @@ namespace fleece { namespace impl {
     }
 
 
+    Doc::Doc(slice data, Trust trust, SharedKeys *sk, slice destination) noexcept
+    :Scope(data, sk, destination)
+    {
+        init(trust);
+    }
+
+
     Doc::Doc(const Doc *parentDoc, slice subData, Trust trust) noexcept
     :Scope(*parentDoc, subData)
     ,_parent(parentDoc)                         // Ensure parent is retained
@@ -311,6 +318,10 @@ namespace fleece { namespace impl {
         return new Doc(JSONConverter::convertJSON(json, sk), kTrusted, sk);
     }
 
+    Retained<Doc> Doc::fromUnownedData(slice data, Trust trust, SharedKeys *sk, slice destination) {
+        return new Doc(data, trust, sk, destination);
+    }
+
 
     /*static*/ RetainedConst<Doc> Doc::containing(const Value *src) noexcept {
         src = resolveMutable(src);
@@ -103,6 +103,14 @@ namespace fleece { namespace impl {
         static Retained<Doc> fromFleece(const alloc_slice &fleece, Trust =kUntrusted);
         static Retained<Doc> fromJSON(slice json, SharedKeys* =nullptr);
 
+        /** Creates a Doc on memory it doesn't own, such as a memory-mapped file. Unlike the
+            other constructors, this doesn't retain or copy the data: the memory must remain valid,
+            and unchanged, as long as the Doc exists. */
+        static Retained<Doc> fromUnownedData(slice fleeceData,
+                                             Trust,
+                                             SharedKeys* =nullptr,
+                                             slice externDest =nullslice);
+
         static RetainedConst<Doc> containing(const Value* NONNULL) noexcept;
 
         const Value* root() const FLPURE               {return _root;}
@@ -135,6 +143,7 @@ namespace fleece { namespace impl {
         virtual ~Doc() =default;
 
     private:
+        Doc(slice fleeceData, Trust, SharedKeys*, slice externDest) noexcept;
         void init(Trust) noexcept;
 
         const Value*        _root {nullptr};            // The root object of the Fleece
@@ -98,6 +98,7 @@ namespace fleece { namespace impl {
             _baseCutoff = (char*)base.end() - cutoff;
         }
         _baseMinUsed = _base.end();
+        _unscannedBaseValues.clear();
         _markExternPtrs = markExternPointers;
     }
 
@@ -447,15 +448,15 @@ namespace fleece { namespace impl {
 
 
     // Returns the minimum address used by the given Value (transitively).
-    // If that minimum address comes before _baseCutoff, immediately returns null.
-    const Value* Encoder::minUsed(const Value *value) {
-        if (value < _baseCutoff)
+    // If that minimum address comes before the cutoff, immediately returns null.
+    const Value* Encoder::minUsed(const Value *value, const void *cutoff) {
+        if (value < cutoff)
             return nullptr;
         switch (value->type()) {
         case kArray: {
             const Value *minVal = value;
             for (Array::iterator i((const Array*)value); i; ++i) {
-                minVal = std::min(minVal, minUsed(i.value()));
+                minVal = std::min(minVal, minUsed(i.value(), cutoff));
                 if (minVal == nullptr)
                     break;
             }
@@ -464,8 +465,8 @@ namespace fleece { namespace impl {
         case kDict: {
             const Value *minVal = value;
             for (Dict::iterator i((const Dict*)value, false); i; ++i) {
-                minVal = std::min(minVal, minUsed(i.key()));
-                minVal = std::min(minVal, minUsed(i.value()));
+                minVal = std::min(minVal, minUsed(i.key(), cutoff));
+                minVal = std::min(minVal, minUsed(i.value(), cutoff));
                 if (minVal == nullptr)
                     break;
             }
@@ -477,12 +478,27 @@ namespace fleece { namespace impl {
     }
 
 
+    slice Encoder::baseUsed() const {
+        for (auto value : _unscannedBaseValues)
+            _baseMinUsed = std::min(_baseMinUsed, (const void*)minUsed(value, nullptr));
+        _unscannedBaseValues.clear();
+        return _baseMinUsed != 0 ? slice(_baseMinUsed, _base.end()) : slice();
+    }
+
+
     void Encoder::writeValue(const Value *value,
                              const SharedKeys* &sk,
                              const WriteValueFunc *writeNestedValue)
     {
         if (valueIsInBase(value) && !isNarrowValue(value)) {
-            auto minVal = minUsed(value);
+            if (!_baseCutoff) {
+                // Without a cutoff, any Value in the base can be pointed to. Scanning its contents
+                // now would read all of it, so that's put off until baseUsed() is called:
+                writePointer( (ssize_t)value - (ssize_t)_base.end() );
+                _unscannedBaseValues.push_back(value);
+                return;
+            }
+            auto minVal = minUsed(value, _baseCutoff);
             if (minVal >= _baseCutoff) {
                 // Value is in the base data, and close enough; I can just emit a pointer to it:
                 writePointer( (ssize_t)value - (ssize_t)_base.end() );
@@ -622,8 +638,12 @@ namespace fleece { namespace impl {
         }
         addingKey();
         const void* writtenKey = _writeString(s);
-        if (!writtenKey && _copyingCollection)
-            writtenKey = s.buf;         // Workaround for written strings not being kept in memory by the Writer if it's writing to a file
+        if (!writtenKey && s.size >= kNarrow) {
+            // The key isn't inline, and the string table didn't keep a copy (it's longer than
+            // kMaxSharedStringSize, or uniqueStrings is off.) The Writer doesn't keep it either if
+            // it's writing to a file, but sortDict needs the key:
+            writtenKey = _copyingCollection ? s.buf : _stringStorage.write(s);
+        }
         addedKey({writtenKey, s.size});
     }
 
@@ -711,11 +731,60 @@ namespace fleece { namespace impl {
 
     void Encoder::beginDictionary(const Dict *parent, size_t reserve) {
         throwIf(!valueIsInBase(parent), EncodeError, "parent is not in base");
+        ++_inheritanceStats.inheritedDicts;
+        for (auto dict = parent; dict; dict = dict->getParent())
+            ++_inheritanceStats.ancestors;
         beginDictionary(1 + reserve);
         writeKey(Dict::kMagicParentKey);
         writeValue(parent);
     }
 
+    void Encoder::writeSquashed(const Dict *dict) {
+        if (dict->getParent())
+            ++_inheritanceStats.squashedDicts;
+        // Dict's iterator already merges in the inherited keys, skipping deleted ones:
+        ++_copyingCollection;
+        const SharedKeys *sk = nullptr;
+        auto iter = dict->begin();
+        beginDictionary(iter.count());
+        for (; iter; ++iter) {
+            if (!sk && iter.key()->isInteger())
+                sk = dict->sharedKeys();
+            writeKey(iter.key(), sk);
+            writeValue(iter.value(), sk, nullptr);
+        }
+        endDictionary();
+        --_copyingCollection;
+    }
+
+    // Estimated number of key comparisons to look up a key in a Dict with `count` items, by
+    // binary search, plus one for getting to the Dict.
+    static inline double lookupCost(size_t count) {
+        return log2(count + 1.0) + 1.0;
+    }
+
+    bool Encoder::shouldSquash(const Dict *parent, size_t count) const {
+        // Add up the cost of searching the new Dict (including its parent key) and its ancestors,
+        // and compare it with searching the biggest of them, which is about the size of the
+        // squashed Dict:
+        double cost = lookupCost(count + 1);
+        uint32_t maxCount = 0;
+        unsigned ancestors = 0;
+        for (auto dict = parent; dict; dict = dict->getParent()) {
+            if (++ancestors > _squashPolicy.maxAncestors)
+                return true;
+            auto n = dict->rawCount();
+            cost += lookupCost(n);
+            maxCount = std::max(maxCount, n);
+        }
+        return cost > _squashPolicy.maxLookupCost * lookupCost(maxCount);
+    }
+
+    void Encoder::beginSquashedDictionary(size_t reserve) {
+        ++_inheritanceStats.squashedDicts;
+        beginDictionary(reserve);
+    }
+
     void Encoder::endArray() {
         endCollection(internal::kArrayTag);
     }
@@ -24,6 +24,7 @@
 #include "StringTable.hh"
 #include "SmallVector.hh"
 #include "function_ref.hh"
+#include <vector>
 
 
 namespace fleece { namespace impl {
@@ -134,6 +135,46 @@ namespace fleece { namespace impl {
         /** Begins creating a dictionary which inherits from an existing dictionary. */
         void beginDictionary(const Dict *parent NONNULL, size_t reserve =0);
 
+        /** Writes a dictionary with all of its keys and values, including inherited ones, so
+            that it has no parent; unlike writeValue, this applies even if it's in the base or is
+            a mutable dictionary that would be written as a delta. The values themselves are
+            written as usual. */
+        void writeSquashed(const Dict* NONNULL);
+
+        /** Determines when a dictionary that could be written as a delta to a parent in the base
+            is squashed (written whole) instead. Looking up a key that a dictionary doesn't
+            contain searches its parent, and so on, so readers pay for every ancestor. */
+        struct SquashPolicy {
+            unsigned maxAncestors {2};  ///< Max number of ancestors a dictionary can have
+            double maxLookupCost {3.0}; ///< Max estimated key comparisons per lookup, relative
+                                        ///< to the same keys in a single dictionary
+        };
+
+        void setSquashPolicy(const SquashPolicy &p)     {_squashPolicy = p;}
+        const SquashPolicy& squashPolicy() const        {return _squashPolicy;}
+
+        /** Returns true if a dictionary inheriting from `parent`, with `count` keys of its own,
+            should be squashed according to the SquashPolicy. (`count` may be an estimate.) */
+        bool shouldSquash(const Dict *parent NONNULL, size_t count) const;
+
+        /** Begins a dictionary that is written whole, although it could inherit from one in the
+            base, because shouldSquash returned true. It's the same as `beginDictionary(reserve)`,
+            except that it's counted in the InheritanceStats. */
+        void beginSquashedDictionary(size_t reserve =0);
+
+        /** Counts of dictionaries written as deltas, or squashed, since the encoder was created. */
+        struct InheritanceStats {
+            size_t inheritedDicts {0};  ///< Dictionaries written with a parent
+            size_t ancestors {0};       ///< Total number of ancestors of those dictionaries
+            size_t squashedDicts {0};   ///< Dictionaries with a parent that were written whole
+
+            double averageAncestors() const {
+                return inheritedDicts ? double(ancestors) / inheritedDicts : 0.0;
+            }
+        };
+
+        const InheritanceStats& inheritanceStats() const {return _inheritanceStats;}
+
         /** Ends creating a dictionary. The dict is written to the output and added as a value to
             the next outermost collection (or made the root if there is no collection active.) */
         void endDictionary();
@@ -175,9 +216,16 @@ namespace fleece { namespace impl {
         size_t nextWritePos();
         size_t finishItem();
         slice base() const                      {return _base;}
-        slice baseUsed() const                  {return _baseMinUsed != 0 ? slice(_baseMinUsed, _base.end()) : slice();}
+        /** The part of the base that the output points into. (Without a base cutoff, this
+            reads the contents of every base Value that was written as a pointer.) */
+        slice baseUsed() const;
         const StringTable& strings() const      {return _strings;}
 
+        /** Returns the lowest address used by a Value and everything it points to, including
+            the parent of a Dict delta. Returns nullptr if that's below `cutoff`; a Value like that
+            gets re-encoded by an Encoder whose base has that cutoff. */
+        static const Value* minUsed(const Value* NONNULL, const void *cutoff);
+
         enum class PreWrittenValue : ssize_t { none = 0 };
         PreWrittenValue lastValueWritten() const;   // Opaque reference to last thing written
         void writeValueAgain(PreWrittenValue);         // Writes pointer to an already-written value
@@ -237,7 +285,6 @@ namespace fleece { namespace impl {
         void writeKey(int);
         void writeValue(const Value* NONNULL, const WriteValueFunc*);
         void writeValue(const Value* NONNULL, const SharedKeys* &, const WriteValueFunc*);
-        const Value* minUsed(const Value *value);
 
         Encoder(const Encoder&) = delete;
         Encoder& operator=(const Encoder&) = delete;
@@ -257,12 +304,15 @@ namespace fleece { namespace impl {
         slice _base;                 // Base Fleece data being appended to (if any)
         alloc_slice _ownedBase;      // If I allocated _base, it's stored here too to retain it
         const void* _baseCutoff {0}; // Lowest addr in _base that I can write a ptr to
-        const void* _baseMinUsed {0};// Lowest addr in _base I've written a ptr to
+        mutable const void* _baseMinUsed {0};// Lowest addr in _base I've written a ptr to
+        mutable std::vector<const Value*> _unscannedBaseValues; // Base Values not yet in _baseMinUsed
         int _copyingCollection {0};  // Nonzero inside writeValue when writing array/dict
         bool _writingKey    {false}; // True if Value being written is a key
         bool _blockedOnKey  {false}; // True if writes should be refused
         bool _trailer       {true};  // Write standard trailer at end?
         bool _markExternPtrs{false}; // Mark pointers outside encoded data as 'extern'
+        SquashPolicy _squashPolicy;  // When to write a Dict whole instead of as a delta
+        InheritanceStats _inheritanceStats; // Counts of Dicts written as deltas or squashed
 
         friend class EncoderTests;
 #ifndef NDEBUG
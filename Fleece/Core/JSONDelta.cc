@@ -23,9 +23,10 @@
 #include "JSON5.hh"
 #include "FleeceException.hh"
 #include "TempArray.hh"
-#include "diff_match_patch.hh"
 #include "NumConversion.hh"
+#include "TextDiff.hh"
 #include <sstream>
+#include <unordered_map>
 #include <unordered_set>
 #include "betterassert.hh"
 
@@ -40,24 +41,23 @@ namespace fleece { namespace impl {
 
     size_t JSONDelta::gMinStringDiffLength = 60;
 
+    size_t JSONDelta::gMaxDiffSteps = 10000000;
     float JSONDelta::gTextDiffTimeout = 0.25;
 
+    bool JSONDelta::gArrayEditScripts = false;
+    size_t JSONDelta::gMaxArrayDiffEdits = 1000;
+
     // Codes that appear as the 3rd item of an array item in a diff
     enum {
         kDeletionCode = 0,
         kTextDiffCode = 2,
         kArraymoveCode = 3,
+        kArrayDiffCode = 4,
     };
 
 
-    // Is `c` the 2nd, 3rd, ... byte of a UTF-8 multibyte character?
-    // <https://en.wikipedia.org/wiki/UTF-8#Description>
-    static inline bool isUTF8Continuation(uint8_t c) {
-        return (c & 0xc0) == 0x80;
-    }
-
-
-    static void snapToUTF8Character(long &pos, size_t &length, slice str);
+    // Calls a method of whichever encoder the delta is being written to, JSON or Fleece:
+    #define ENCODE(METHOD) (_fleeceEncoder ? _fleeceEncoder->METHOD : _encoder->METHOD)
 
 
 #pragma mark - CREATING DELTAS:
@@ -72,7 +72,7 @@ namespace fleece { namespace impl {
 
 
     /*static*/ bool JSONDelta::create(const Value *old, const Value *nuu, JSONEncoder &enc) {
-        if (JSONDelta(enc)._write(old, nuu, nullptr))
+        if (JSONDelta(&enc, nullptr)._write(old, nuu, nullptr))
             return true;
         // If there is no difference, write a no-op delta:
         enc.beginDictionary();
@@ -81,8 +81,25 @@ namespace fleece { namespace impl {
     }
 
 
-    JSONDelta::JSONDelta(JSONEncoder &enc)
-    :_encoder(&enc)
+    /*static*/ alloc_slice JSONDelta::createFleece(const Value *old, const Value *nuu) {
+        Encoder enc;
+        create(old, nuu, enc);
+        return enc.finish();
+    }
+
+
+    /*static*/ bool JSONDelta::create(const Value *old, const Value *nuu, Encoder &enc) {
+        if (JSONDelta(nullptr, &enc)._write(old, nuu, nullptr))
+            return true;
+        enc.beginDictionary();
+        enc.endDictionary();
+        return false;
+    }
+
+
+    JSONDelta::JSONDelta(JSONEncoder *enc, Encoder *fleeceEnc)
+    :_encoder(enc)
+    ,_fleeceEncoder(fleeceEnc)
     { }
 
 
@@ -99,10 +116,10 @@ namespace fleece { namespace impl {
         writePath(path->parent);
         path->parent = nullptr;
         if (!path->isOpen) {
-            _encoder->beginDictionary();
+            ENCODE(beginDictionary());
             path->isOpen = true;
         }
-        _encoder->writeKey(path->key);
+        ENCODE(writeKey(path->key));
     }
 
 
@@ -114,13 +131,13 @@ namespace fleece { namespace impl {
             if (!nuu) {
                 // `old` was deleted: write []
                 writePath(path);
-                _encoder->beginArray();
+                ENCODE(beginArray());
                 if (gCompatibleDeltas) {
-                    _encoder->writeValue(old);
-                    _encoder->writeInt(0);
-                    _encoder->writeInt(kDeletionCode);
+                    ENCODE(writeValue(old));
+                    ENCODE(writeInt(0));
+                    ENCODE(writeInt(kDeletionCode));
                 }
-                _encoder->endArray();
+                ENCODE(endArray());
                 return true;
             }
 
@@ -152,12 +169,15 @@ namespace fleece { namespace impl {
                     }
                     if (!curLevel.isOpen)
                         return false;
-                    _encoder->endDictionary();
+                    ENCODE(endDictionary());
                     return true;
 
                 } else if (oldType == kArray) {
-                    // Scan forwards through unchanged items:
                     auto oldArray = (const Array*)old, nuuArray = (const Array*)nuu;
+                    // If items were inserted, removed or moved, write an edit script:
+                    if (!gCompatibleDeltas && writeArrayDiff(oldArray, nuuArray, path))
+                        return true;
+                    // Otherwise scan forwards through unchanged items:
                     auto oldCount = oldArray->count(), nuuCount = nuuArray->count();
                     auto minCount = min(oldCount, nuuCount);
                     if (minCount > 0) {
@@ -174,15 +194,15 @@ namespace fleece { namespace impl {
                             sprintf(key, "%d-", index);
                             curLevel.key = slice(key);
                             writePath(&curLevel);
-                            _encoder->beginArray();
+                            ENCODE(beginArray());
                             for (; index < nuuCount; ++index) {
-                                _encoder->writeValue(nuuArray->get(index));
+                                ENCODE(writeValue(nuuArray->get(index)));
                             }
-                            _encoder->endArray();
+                            ENCODE(endArray());
                         }
                         if (!curLevel.isOpen)
                             return false;
-                        _encoder->endDictionary();
+                        ENCODE(endDictionary());
                         return true;
                     } else if (oldCount == 0 && nuuCount == 0) {
                         return false;
@@ -197,11 +217,11 @@ namespace fleece { namespace impl {
                     string strPatch = createStringDelta(old->asString(), nuu->asString());
                     if (!strPatch.empty()) {
                         writePath(path);
-                        _encoder->beginArray();
-                        _encoder->writeString(strPatch);
-                        _encoder->writeInt(0);
-                        _encoder->writeInt(kTextDiffCode);
-                        _encoder->endArray();
+                        ENCODE(beginArray());
+                        ENCODE(writeString(strPatch));
+                        ENCODE(writeInt(0));
+                        ENCODE(writeInt(kTextDiffCode));
+                        ENCODE(endArray());
                         return true;
                     }
                     // if there's no smart diff, fall through to the generic case...
@@ -212,13 +232,13 @@ namespace fleece { namespace impl {
         // Generic modification/insertion:
         writePath(path);
         if (nuu->type() < kArray && path && !gCompatibleDeltas) {
-            _encoder->writeValue(nuu);
+            ENCODE(writeValue(nuu));
         } else {
-            _encoder->beginArray();
+            ENCODE(beginArray());
             if (gCompatibleDeltas && old)
-                _encoder->writeValue(old);
-            _encoder->writeValue(nuu);
-            _encoder->endArray();
+                ENCODE(writeValue(old));
+            ENCODE(writeValue(nuu));
+            ENCODE(endArray());
         }
         return true;
     }
@@ -252,6 +272,19 @@ namespace fleece { namespace impl {
     }
 
 
+    /*static*/ alloc_slice JSONDelta::applyFleece(const Value *old, const Value *fleeceDelta) {
+        Encoder enc;
+        apply(old, fleeceDelta, enc);
+        return enc.finish();
+    }
+
+
+    /*static*/ void JSONDelta::apply(const Value *old, const Value *fleeceDelta, Encoder &enc) {
+        assert_precondition(fleeceDelta);
+        JSONDelta(enc)._apply(old, fleeceDelta);
+    }
+
+
     JSONDelta::JSONDelta(Encoder &decoder)
     :_decoder(&decoder)
     { }
@@ -312,6 +345,13 @@ namespace fleece { namespace impl {
                         throwIf(!old, InvalidData, "Invalid deletion in delta");
                         _decoder->writeValue(Value::kUndefinedValue);
                         break;
+                    case kArrayDiffCode: {
+                        // Array edit script:
+                        const Array *oldArray = old ? old->asArray() : nullptr;
+                        throwIf(!oldArray, InvalidData, "Invalid array diff in delta");
+                        _patchArrayDiff(oldArray, delta);
+                        break;
+                    }
                     case kTextDiffCode: {
                         // Text diff:
                         slice oldStr;
@@ -337,21 +377,27 @@ namespace fleece { namespace impl {
 
     inline void JSONDelta::_patchDict(const Dict* NONNULL old, const Dict* NONNULL delta) {
         // Dict: Incremental update
-        if (_decoder->valueIsInBase(old)) {
+        bool inBase = _decoder->valueIsInBase(old);
+        bool squash = inBase && _decoder->shouldSquash(old, delta->count());
+        if (inBase && !squash) {
             // If the old dict is in the base, we can create an inherited dict:
             _decoder->beginDictionary(old);
             for (Dict::iterator i(delta); i; ++i) {
                 _decoder->writeKey(i.keyString());
-                _apply(old->get(i.key()), i.value());  // recurse into dict item!
+                _apply(old->get(i.keyString()), i.value());  // recurse into dict item!
             }
             _decoder->endDictionary();
         } else {
             // In the general case, have to write a new dict from scratch:
-            _decoder->beginDictionary();
-            // Process the unaffected, deleted, and modified keys:
+            if (squash)
+                _decoder->beginSquashedDictionary();
+            else
+                _decoder->beginDictionary();
+            // Process the unaffected, deleted, and modified keys. (Keys are looked up as strings,
+            // since a Fleece delta doesn't share `old`'s SharedKeys.)
             unsigned deltaKeysUsed = 0;
             for (Dict::iterator i(old); i; ++i) {
-                const Value *valueDelta = delta->get(i.key());
+                const Value *valueDelta = delta->get(i.keyString());
                 if (valueDelta)
                     ++deltaKeysUsed;
                 if (!isDeltaDeletion(valueDelta)) {                 // skip deletions
@@ -366,7 +412,7 @@ namespace fleece { namespace impl {
             // Now add the inserted keys:
             if (deltaKeysUsed < delta->count()) {
                 for (Dict::iterator i(delta); i; ++i) {
-                    if (old->get(i.key()) == nullptr) {
+                    if (old->get(i.keyString()) == nullptr) {
                         _decoder->writeKey(i.keyString());
                         _apply(nullptr, i.value());  // recurse into insertion
                     }
@@ -433,76 +479,60 @@ namespace fleece { namespace impl {
 #pragma mark - STRING DELTAS:
 
 
-    /*static*/ string JSONDelta::createStringDelta(slice oldStr, slice nuuStr) {
-        if (nuuStr.size < gMinStringDiffLength
-                || (gCompatibleDeltas && oldStr.size > gMinStringDiffLength))
-            return "";
-        diff_match_patch<string> dmp;
-        dmp.Diff_Timeout = gTextDiffTimeout;
-        auto patches = dmp.patch_make(string(oldStr), string(nuuStr));
-
-        if (gCompatibleDeltas)
-            return dmp.patch_toText(patches);
+    // The number of bytes a chunk of a text delta takes up.
+    static size_t encodedSize(const TextDiff::Chunk &c) {
+        auto opSize = [](size_t n) {return n ? to_string(n).size() + 1 : 0;};
+        return opSize(c.equal) + opSize(c.deleted) + opSize(c.inserted)
+                + (c.inserted ? c.inserted + 1 : 0);
+    }
 
-        // Iterate over the diffs, writing the encoded form to the output stream:
-        stringstream diff;
-        long lastOldPos = 0, correction = 0;
-        for (auto patch = patches.begin(); patch != patches.end(); ++patch) {
-            long oldPos = patch->start1 + correction;   // position in oldStr
-            long nuuPos = patch->start2;                // position in nuuStr
-            auto &diffs = patch->diffs;
-            for (auto cur_diff = diffs.begin(); cur_diff != diffs.end(); ++cur_diff) {
-                auto length = cur_diff->text.length();
-                if (cur_diff->operation == diff_match_patch<string>::EQUAL) {
-                    oldPos += narrow_cast<long>(length);
-                    nuuPos += narrow_cast<long>(length);
-                } else {
-                    // Don't break up a UTF-8 multibyte character:
-                    if (cur_diff->operation == diff_match_patch<string>::DELETE)
-                        snapToUTF8Character(oldPos, length, oldStr);
-                    else
-                        snapToUTF8Character(nuuPos, length, nuuStr);
 
-                    assert(oldPos >= lastOldPos);
-                    if (oldPos > lastOldPos) {
-                        // Write the number of matching bytes since the last insert/delete:
-                        diff << (oldPos-lastOldPos) << '=';
-                    }
-                    if (cur_diff->operation == diff_match_patch<string>::DELETE) {
-                        // Write the number of deleted bytes:
-                        diff << length << '-';
-                        oldPos += narrow_cast<long>(length);
-                    } else /* INSERT */ {
-                        // Write an insertion, both the count and the bytes:
-                        diff << length << '+';
-                        diff.write((const char*)&nuuStr[nuuPos], length);
-                        diff << '|';
-                        nuuPos += narrow_cast<long>(length);
-                    }
-                    lastOldPos = oldPos;
+    /*static*/ string JSONDelta::createStringDelta(slice oldStr, slice nuuStr) {
+        if (nuuStr.size < gMinStringDiffLength || gCompatibleDeltas)
+            return "";
+        TextDiff differ(oldStr, nuuStr);
+        differ.diff(gMaxDiffSteps);
+
+        // A minimal diff often has short runs of equal bytes between edits; merge them into the
+        // edits where that makes the delta smaller:
+        vector<TextDiff::Chunk> chunks;
+        for (auto &c : differ.chunks()) {
+            if (!chunks.empty()) {
+                auto &prev = chunks.back();
+                TextDiff::Chunk merged {prev.equal,
+                                        prev.deleted + c.equal + c.deleted,
+                                        prev.inserted + c.equal + c.inserted};
+                if (encodedSize(merged) <= encodedSize(prev) + encodedSize(c)) {
+                    prev = merged;
+                    continue;
                 }
-                if ((size_t)diff.tellp() + 6 >= nuuStr.size)
-                    return "";          // Patch is too long; give up on using a diff
             }
-            correction += patch->length1 - patch->length2;
+            chunks.push_back(c);
         }
-        if (oldStr.size > size_t(lastOldPos)) {
-            // Write a final matching-bytes count:
-            diff << (oldStr.size-lastOldPos) << '=';
+
+        // Write the encoded form:
+        stringstream diff;
+        size_t nuuPos = 0;
+        for (auto &c : chunks) {
+            if (c.equal > 0)
+                diff << c.equal << '=';
+            nuuPos += c.equal;
+            if (c.deleted > 0)
+                diff << c.deleted << '-';
+            if (c.inserted > 0) {
+                diff << c.inserted << '+';
+                diff.write((const char*)&nuuStr[nuuPos], c.inserted);
+                diff << '|';
+                nuuPos += c.inserted;
+            }
+            if ((size_t)diff.tellp() + 6 >= nuuStr.size)
+                return "";          // Patch is too long; give up on using a diff
         }
         return diff.str();
     }
 
 
     /*static*/ string JSONDelta::applyStringDelta(slice oldStr, slice diff) {
-#if 0
-        // Support for JsonDiffPatch-format string diffs:
-        if (diff[0] == '@') {
-            diff_match_patch<string> dmp;
-            return dmp.patch_apply(dmp.patch_fromText(string(diff)), string(oldStr)).first;
-        }
-#endif
-
         stringstream in{string(diff)};
         in.exceptions(stringstream::failbit | stringstream::badbit);
         stringstream nuu;
@@ -538,17 +568,464 @@ namespace fleece { namespace impl {
     }
 
 
-    // Given a byte range (`pos`, `length`) in the slice `str`, if either end of the range falls
-    // in the middle of a UTF-8 multibyte character, push it _outwards_ to include the entire char.
-    static void snapToUTF8Character(long &pos, size_t &length, slice str) {
-        while (isUTF8Continuation(str[pos])) {
-            --pos;
-            throwIf(pos < 0, InvalidData, "Invalid UTF-8 at start of a string");
-            ++length;
+#pragma mark - ARRAY DIFFS:
+
+
+    static inline uint64_t hashMix(uint64_t h, uint64_t v) {
+        return h ^ (v + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2));
+    }
+
+    // A hash of a Value, such that Values that are `itemsEqual` have equal hashes.
+    static uint64_t hashValue(const Value *v) {
+        auto type = v->type();
+        uint64_t h = hashMix(0, type);
+        switch (type) {
+            case kBoolean:
+                return hashMix(h, v->asBool());
+            case kNumber:
+                if (v->isInteger()) {
+                    return hashMix(h, uint64_t(v->asInt()));
+                } else {
+                    double d = v->asDouble();
+                    uint64_t bits = 0;
+                    if (d != 0.0)               // (so that -0.0 and 0.0 hash the same)
+                        memcpy(&bits, &d, sizeof(bits));
+                    return hashMix(h, bits);
+                }
+            case kString:
+                return hashMix(h, v->asString().hash());
+            case kData:
+                return hashMix(h, v->asData().hash());
+            case kArray:
+                for (Array::iterator i((const Array*)v); i; ++i)
+                    h = hashMix(h, hashValue(i.value()));
+                return h;
+            case kDict: {
+                // Key order isn't significant (Dicts with different SharedKeys can be equal),
+                // so combine the items' hashes commutatively:
+                uint64_t sum = 0;
+                for (Dict::iterator i((const Dict*)v); i; ++i)
+                    sum += hashMix(i.keyString().hash(), hashValue(i.value()));
+                return hashMix(h, sum);
+            }
+            default:
+                return h;
+        }
+    }
+
+
+    // Like Value::isEqual, but doesn't care whether collections are wide or narrow, which can
+    // change when they're re-encoded; otherwise most re-encoded array items would never match.
+    static bool itemsEqual(const Value *a, const Value *b) {
+        if (a == b)
+            return true;
+        auto type = a->type();
+        if (type != b->type())
+            return false;
+        switch (type) {
+            case kArray: {
+                Array::iterator i((const Array*)a), j((const Array*)b);
+                if (i.count() != j.count())
+                    return false;
+                for (; i; ++i, ++j)
+                    if (!itemsEqual(i.value(), j.value()))
+                        return false;
+                return true;
+            }
+            case kDict: {
+                unsigned n = 0;
+                for (Dict::iterator i((const Dict*)a); i; ++i, ++n) {
+                    const Value *bValue = ((const Dict*)b)->get(i.keyString());
+                    if (!bValue || !itemsEqual(i.value(), bValue))
+                        return false;
+                }
+                return ((const Dict*)b)->count() == n;
+            }
+            default:
+                return a->isEqual(b);
+        }
+    }
+
+
+    // Computes an edit script that transforms one array into another: a series of edits, each of
+    // which consumes the next item of the old array and/or produces the next item of the new one.
+    // It starts with a Myers diff, which finds the longest common subsequence of items (using
+    // hashes to compare them quickly); insertions of items that were deleted elsewhere are then
+    // turned into copies, and adjacent deletions and insertions into patches.
+    // If the Myers diff takes too many edits or steps, all the differing items are deleted, and the
+    // new ones copied from them where possible.
+    class ArrayDiffer {
+    public:
+        enum Op : char {
+            kKeep   = '=',      // Keeps the next old item
+            kDelete = '-',      // Skips the next old item
+            kInsert = '+',      // Inserts the next new item
+            kPatch  = '~',      // Changes the next old item into the next new item
+            kCopy   = '@',      // Inserts a copy of the old item at index `src`
+        };
+
+        struct Edit {
+            Op       op;
+            uint32_t src;
+        };
+
+        ArrayDiffer(const Array *old, const Array *nuu) {
+            _old.reserve(old->count());
+            for (Array::iterator i(old); i; ++i)
+                _old.push_back(i.value());
+            _nuu.reserve(nuu->count());
+            for (Array::iterator i(nuu); i; ++i)
+                _nuu.push_back(i.value());
         }
-        while (pos+length < str.size && isUTF8Continuation(str[pos+length])) {
-            ++length;
+
+        const vector<Edit>& edits() const       {return _edits;}
+
+        void diff(size_t maxEdits, size_t maxSteps) {
+            // Trim the common prefix and suffix, which are usually most of the array:
+            size_t n = _old.size(), m = _nuu.size();
+            size_t prefix = 0, suffix = 0;
+            while (prefix < n && prefix < m && itemsEqual(_old[prefix], _nuu[prefix]))
+                ++prefix;
+            while (suffix < n - prefix && suffix < m - prefix
+                                       && itemsEqual(_old[n-1-suffix], _nuu[m-1-suffix]))
+                ++suffix;
+            _oldStart = prefix; _oldEnd = n - suffix;
+            _nuuStart = prefix; _nuuEnd = m - suffix;
+
+            _oldHash.resize(n);
+            for (size_t i = _oldStart; i < _oldEnd; ++i)
+                _oldHash[i] = hashValue(_old[i]);
+            _nuuHash.resize(m);
+            for (size_t j = _nuuStart; j < _nuuEnd; ++j)
+                _nuuHash[j] = hashValue(_nuu[j]);
+
+            _edits.assign(prefix, {kKeep, 0});
+            if (!myersDiff(maxEdits, maxSteps)) {
+                _edits.resize(prefix);
+                _edits.insert(_edits.end(), _oldEnd - _oldStart, {kDelete, 0});
+                _edits.insert(_edits.end(), _nuuEnd - _nuuStart, {kInsert, 0});
+            }
+            _edits.insert(_edits.end(), suffix, {kKeep, 0});
+
+            findCopies();
+            pairEdits();
         }
+
+        // Returns true if the script is preferable to a delta that compares items by index, i.e.
+        // if items moved to different indexes, and the script is likely to be smaller. (The sizes
+        // are estimated by assuming each changed item's delta is as long as its JSON.)
+        bool isWorthUsing() const {
+            size_t oldPos = 0, nuuPos = 0, scriptSize = 10;
+            bool aligned = true;
+            for (auto &e : _edits) {
+                switch (e.op) {
+                    case kKeep:
+                    case kPatch:    aligned = aligned && (oldPos == nuuPos);
+                                    if (e.op == kPatch)
+                                        scriptSize += jsonSize(_nuu[nuuPos]) + 1;
+                                    ++oldPos; ++nuuPos; break;
+                    case kDelete:   ++oldPos; break;
+                    case kInsert:   scriptSize += jsonSize(_nuu[nuuPos++]) + 1; break;
+                    case kCopy:     aligned = false; ++nuuPos; break;
+                }
+            }
+            if (aligned)
+                return false;
+            scriptSize += scriptString().size();
+
+            size_t n = _old.size(), m = _nuu.size(), i;
+            size_t indexSize = 2;
+            for (i = _oldStart; i < min(n, m); ++i) {
+                if (!itemsEqual(_old[i], _nuu[i])) {
+                    indexSize += to_string(i).size() + 4 + jsonSize(_nuu[i]);
+                    if (indexSize > scriptSize)
+                        return true;
+                }
+            }
+            if (n != m) {
+                indexSize += to_string(i).size() + 6;
+                for (; i < m && indexSize <= scriptSize; ++i)
+                    indexSize += jsonSize(_nuu[i]) + 1;
+            }
+            return indexSize > scriptSize;
+        }
+
+        // Writes the script in string form: runs of edits, as counts followed by the operation.
+        // Copies are followed by the index of the first item and a '|'.
+        string scriptString() const {
+            stringstream out;
+            for (auto e = _edits.begin(); e != _edits.end(); ) {
+                auto start = e;
+                for (++e; e != _edits.end() && e->op == start->op; ++e) {
+                    if (e->op == kCopy && e->src != e[-1].src + 1)
+                        break;
+                }
+                out << (e - start) << char(start->op);
+                if (start->op == kCopy)
+                    out << start->src << '|';
+            }
+            return out.str();
+        }
+
+    private:
+        static size_t jsonSize(const Value *v) {
+            return v->toJSON().size;
+        }
+
+        bool equal(size_t i, size_t j) const {
+            return _oldHash[i] == _nuuHash[j] && itemsEqual(_old[i], _nuu[j]);
+        }
+
+        // Finds the shortest edit script for the range between the prefix and suffix, using
+        // Myers' O(ND) algorithm, or returns false if it takes more than `maxEdits` edits or
+        // `maxSteps` steps (item comparisons.)
+        // <http://www.xmailserver.org/diff2.pdf>
+        bool myersDiff(size_t maxEdits, size_t maxSteps) {
+            long n = long(_oldEnd - _oldStart), m = long(_nuuEnd - _nuuStart);
+            long maxD = min(n + m, (long)maxEdits);
+            if (labs(n - m) > maxD)
+                return false;
+            // v[k] is the furthest x reached on diagonal k (= x - y); each step's v is saved in
+            // `trace` so the path can be traced back.
+            vector<long> v(2 * maxD + 3, 0);
+            long offset = maxD + 1;
+            vector<vector<long>> trace;
+            size_t steps = 0;
+            for (long d = 0; d <= maxD; ++d) {
+                trace.emplace_back(&v[offset - d], &v[offset + d + 1]);
+                for (long k = -d; k <= d; k += 2) {
+                    long x;
+                    if (k == -d || (k != d && v[offset+k-1] < v[offset+k+1]))
+                        x = v[offset+k+1];
+                    else
+                        x = v[offset+k-1] + 1;
+                    long y = x - k;
+                    while (x < n && y < m && equal(_oldStart + x, _nuuStart + y)) {
+                        ++x; ++y; ++steps;
+                    }
+                    v[offset+k] = x;
+                    if (x >= n && y >= m) {
+                        traceBack(trace, n, m);
+                        return true;
+                    }
+                }
+                steps += d + 1;
+                if (steps > maxSteps)
+                    return false;
+            }
+            return false;
+        }
+
+        void traceBack(const vector<vector<long>> &trace, long x, long y) {
+            vector<Edit> edits;
+            for (long d = long(trace.size()) - 1; d > 0; --d) {
+                auto v = [&](long k) {return trace[d][k + d];};
+                long k = x - y;
+                long prevK = (k == -d || (k != d && v(k-1) < v(k+1))) ? k + 1 : k - 1;
+                long prevX = v(prevK), prevY = prevX - prevK;
+                for (; x > prevX && y > prevY; --x, --y)
+                    edits.push_back({kKeep, 0});
+                edits.push_back({(x == prevX) ? kInsert : kDelete, 0});
+                x = prevX;
+                y = prevY;
+            }
+            for (; x > 0; --x)
+                edits.push_back({kKeep, 0});
+            _edits.insert(_edits.end(), edits.rbegin(), edits.rend());
+        }
+
+        // Turns insertions into copies of deleted items that are equal.
+        void findCopies() {
+            unordered_map<uint64_t, uint32_t> deleted;      // hash -> index of deleted item
+            size_t i = 0;
+            for (auto &e : _edits) {
+                if (e.op == kKeep || e.op == kDelete) {
+                    if (e.op == kDelete)
+                        deleted.emplace(_oldHash[i], uint32_t(i));
+                    ++i;
+                }
+            }
+            if (deleted.empty())
+                return;
+
+            size_t j = 0;
+            for (auto e = _edits.begin(); e != _edits.end(); ++e) {
+                if (e->op == kInsert) {
+                    // Continue the previous copy if possible, else look up the item:
+                    auto prev = (e != _edits.begin()) ? &e[-1] : nullptr;
+                    if (prev && prev->op == kCopy && prev->src + 1 < _old.size()
+                             && equal(prev->src + 1, j)) {
+                        *e = {kCopy, prev->src + 1};
+                    } else {
+                        auto found = deleted.find(_nuuHash[j]);
+                        if (found != deleted.end() && equal(found->second, j))
+                            *e = {kCopy, found->second};
+                    }
+                }
+                if (e->op != kDelete)
+                    ++j;
+            }
+
+            // Copying an item costs a few bytes; change copies of small items back to inserts:
+            j = 0;
+            for (auto e = _edits.begin(); e != _edits.end(); ) {
+                if (e->op != kCopy) {
+                    if (e->op != kDelete)
+                        ++j;
+                    ++e;
+                    continue;
+                }
+                auto start = e;
+                size_t startJ = j;
+                for (++e, ++j; e != _edits.end() && e->op == kCopy && e->src == e[-1].src + 1; ++e)
+                    ++j;
+                size_t copyCost = 4 + to_string(start->src).size() + to_string(e - start).size();
+                size_t valueCost = 0;
+                for (size_t k = startJ; k < j && valueCost <= copyCost; ++k)
+                    valueCost += _nuu[k]->toJSON().size + 1;
+                if (valueCost <= copyCost) {
+                    for (auto c = start; c != e; ++c)
+                        *c = {kInsert, 0};
+                }
+            }
+        }
+
+        // In each stretch of deletions and insertions with no copies, pairs up the deletions and
+        // insertions as patches, since an item is likelier to have been changed than replaced.
+        void pairEdits() {
+            for (auto e = _edits.begin(); e != _edits.end(); ) {
+                if (e->op == kKeep) {
+                    ++e;
+                    continue;
+                }
+                auto start = e;
+                size_t nDel = 0, nIns = 0;
+                bool copies = false;
+                for (; e != _edits.end() && e->op != kKeep; ++e) {
+                    switch (e->op) {
+                        case kDelete: ++nDel; break;
+                        case kInsert: ++nIns; break;
+                        default:      copies = true; break;
+                    }
+                }
+                if (!copies && nDel > 0 && nIns > 0) {
+                    auto nPatch = min(nDel, nIns);
+                    auto c = start;
+                    c = fill_n(c, nPatch, Edit{kPatch, 0});
+                    c = fill_n(c, nDel - nPatch, Edit{kDelete, 0});
+                    c = fill_n(c, nIns - nPatch, Edit{kInsert, 0});
+                    e = _edits.erase(c, e);
+                }
+            }
+        }
+
+        vector<const Value*> _old, _nuu;
+        vector<uint64_t> _oldHash, _nuuHash;        // Only set between the prefix and suffix
+        size_t _oldStart, _oldEnd, _nuuStart, _nuuEnd;
+        vector<Edit> _edits;
+    };
+
+
+    // Writes an edit script for an array, if it's preferable to an index-based delta.
+    bool JSONDelta::writeArrayDiff(const Array *old, const Array *nuu, pathItem *path) {
+        if (!gArrayEditScripts || gMaxArrayDiffEdits == 0 || old->empty() || nuu->empty())
+            return false;
+        ArrayDiffer differ(old, nuu);
+        differ.diff(gMaxArrayDiffEdits, gMaxDiffSteps);
+        if (!differ.isWorthUsing())
+            return false;
+
+        writePath(path);
+        ENCODE(beginArray());
+        ENCODE(writeString(differ.scriptString()));
+        // Then the items inserted, and the deltas of the items patched:
+        ENCODE(beginArray());
+        uint32_t oldPos = 0, nuuPos = 0;
+        for (auto &e : differ.edits()) {
+            switch (e.op) {
+                case ArrayDiffer::kKeep:    ++oldPos; ++nuuPos; break;
+                case ArrayDiffer::kDelete:  ++oldPos; break;
+                case ArrayDiffer::kCopy:    ++nuuPos; break;
+                case ArrayDiffer::kInsert:  ENCODE(writeValue(nuu->get(nuuPos++))); break;
+                case ArrayDiffer::kPatch:   writeItemDelta(old->get(oldPos++), nuu->get(nuuPos++));
+                                            break;
+            }
+        }
+        ENCODE(endArray());
+        ENCODE(writeInt(kArrayDiffCode));
+        ENCODE(endArray());
+        return true;
+    }
+
+
+    // Writes the delta of an array item, as the value of a "~" edit.
+    void JSONDelta::writeItemDelta(const Value *old, const Value *nuu) {
+        if (nuu->type() < kString) {
+            ENCODE(writeValue(nuu));            // A scalar is its own delta, as in a Dict
+        } else if (!_write(old, nuu, nullptr)) {
+            ENCODE(beginArray());               // (items are never equal, but just in case)
+            ENCODE(writeValue(nuu));
+            ENCODE(endArray());
+        }
+    }
+
+
+    void JSONDelta::_patchArrayDiff(const Array *old, const Array *delta) {
+        slice script = delta->get(0)->asString();
+        const Array *values = delta->get(1)->asArray();
+        throwIf(!values, InvalidData, "Invalid array diff in delta");
+        uint32_t oldCount = old->count();
+        Array::iterator iValue(values);
+        stringstream in{string(script)};
+        in.exceptions(stringstream::failbit | stringstream::badbit);
+
+        _decoder->beginArray();
+        uint32_t pos = 0;
+        while (in.peek() >= 0) {
+            uint32_t len;
+            char op;
+            in >> len;
+            in >> op;
+            switch (op) {
+                case '=':
+                    throwIf(len > oldCount - pos, InvalidData, "Invalid length in array delta");
+                    for (; len > 0; --len)
+                        _decoder->writeValue(old->get(pos++));
+                    break;
+                case '-':
+                    throwIf(len > oldCount - pos, InvalidData, "Invalid length in array delta");
+                    pos += len;
+                    break;
+                case '+':
+                    for (; len > 0; --len, ++iValue) {
+                        throwIf(!iValue, InvalidData, "Missing value in array delta");
+                        _decoder->writeValue(iValue.value());
+                    }
+                    break;
+                case '~':
+                    throwIf(len > oldCount - pos, InvalidData, "Invalid length in array delta");
+                    for (; len > 0; --len, ++iValue) {
+                        throwIf(!iValue, InvalidData, "Missing value in array delta");
+                        _apply(old->get(pos++), iValue.value());     // recurse into item!
+                    }
+                    break;
+                case '@': {
+                    uint32_t src;
+                    in >> src;
+                    in >> op;
+                    throwIf(op != '|', InvalidData, "Missing copy delimiter in array delta");
+                    throwIf(src > oldCount || len > oldCount - src,
+                            InvalidData, "Invalid copy in array delta");
+                    for (; len > 0; --len)
+                        _decoder->writeValue(old->get(src++));
+                    break;
+                }
+                default:
+                    FleeceException::_throw(InvalidData, "Unknown op in array delta");
+            }
+        }
+        throwIf(pos != oldCount || iValue, InvalidData, "Length mismatch in array delta");
+        _decoder->endArray();
     }
 
 } }
@@ -23,6 +23,13 @@ namespace fleece { namespace impl {
             If the values are equal, writes nothing and returns false. */
         static bool create(const Value *old, const Value *nuu, JSONEncoder&);
 
+        /** Returns a delta like `create`, but encoded as Fleece instead of JSON. It can be applied
+            directly, without being parsed. */
+        static alloc_slice createFleece(const Value *old, const Value *nuu);
+
+        /** Writes a delta like `create`, but as a Fleece value to a Fleece encoder. */
+        static bool create(const Value *old, const Value *nuu, Encoder&);
+
 
         /** Applies the JSON delta created by `create` to the value `old` (which must be equal
             to the `old` value originally passed to `create`) and returns a Fleece document
@@ -33,20 +40,50 @@ namespace fleece { namespace impl {
         /** Applies the JSON delta created by `create` to the value `old` (which must be equal
             to the `old` value originally passed to `create`) and writes the corresponding
             `nuu` value to the Fleece encoder.
+            If `old` is in the encoder's base, unchanged values are written as pointers to it, so
+            with a base of a large document and an encoder appending to its file, only about as
+            much as the delta is written.
             If the delta is malformed or can't be applied to `old`, throws a FleeceException. */
         static void apply(const Value *old, slice jsonDelta, bool isJSON5, Encoder&);
 
+        /** Applies the Fleece delta created by `createFleece` to the value `old`, and returns a
+            Fleece document equal to the original `nuu` value.
+            If the delta is malformed or can't be applied to `old`, throws a FleeceException. */
+        static alloc_slice applyFleece(const Value *old, const Value* NONNULL fleeceDelta);
+
+        /** Applies the Fleece delta created by `createFleece` to the value `old`, and writes the
+            corresponding `nuu` value to the Fleece encoder. As above, values in the encoder's
+            base are written as pointers. */
+        static void apply(const Value *old, const Value* NONNULL fleeceDelta, Encoder&);
+
         /** Minimum byte length of strings that will be considered for diffing (default 60) */
         static size_t gMinStringDiffLength;
 
-        /** Maximum time (in seconds) that the string-diff algorithm is allowed to run
-            (default 0.25) */
+        /** Maximum number of steps (roughly, byte or item comparisons) that the string- and
+            array-diff algorithms can take on one value (default 10 million.) Past that they settle
+            for a larger delta. Unlike a time limit, this keeps deltas independent of CPU speed
+            and load. */
+        static size_t gMaxDiffSteps;
+
+        /** Deprecated, and ignored: diffs are now limited by `gMaxDiffSteps` instead of time. */
         static float gTextDiffTimeout;
 
+        /** If true, an array whose items were inserted, deleted or moved can be described by an
+            edit script, `[script, [values], 4]`, which is usually much smaller than comparing
+            items by index. Off by default, since older versions of `apply` can't read that form
+            of delta. */
+        static bool gArrayEditScripts;
+
+        /** Maximum number of item insertions and deletions the array-diff algorithm will search
+            for (default 1000.) Arrays that differ by more are diffed by just looking for runs of
+            items that were moved. If 0, array items are only compared to the ones at the same
+            index. (The array diff is also subject to `gMaxDiffSteps`.) */
+        static size_t gMaxArrayDiffEdits;
+
     private:
         struct pathItem;
 
-        JSONDelta(JSONEncoder&);
+        JSONDelta(JSONEncoder*, Encoder*);
         bool _write(const Value *old, const Value *nuu, pathItem *path);
 
         JSONDelta(Encoder&);
@@ -56,11 +93,15 @@ namespace fleece { namespace impl {
         void _patchDict(const Dict* NONNULL old, const Dict* NONNULL delta);
 
         void writePath(pathItem*);
+        bool writeArrayDiff(const Array* NONNULL old, const Array* NONNULL nuu, pathItem *path);
+        void writeItemDelta(const Value* NONNULL old, const Value* NONNULL nuu);
+        void _patchArrayDiff(const Array* NONNULL old, const Array* NONNULL delta);
         static bool isDeltaDeletion(const Value *delta);
         static std::string createStringDelta(slice oldStr, slice nuuStr);
         static std::string applyStringDelta(slice oldStr, slice diff);
 
-        JSONEncoder* _encoder;
-        Encoder* _decoder;
+        JSONEncoder* _encoder {nullptr};
+        Encoder* _fleeceEncoder {nullptr};          // Used instead of _encoder for Fleece deltas
+        Encoder* _decoder {nullptr};
     };
 } }
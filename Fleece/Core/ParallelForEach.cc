@@ -0,0 +1,145 @@
+//
+// ParallelForEach.cc
+//
+// Copyright © 2020 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ParallelForEach.hh"
+#include "Dict.hh"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include "betterassert.hh"
+
+namespace fleece { namespace impl {
+    using namespace std;
+
+
+    // Each thread gets several ranges, so that ones that finish early can take on more:
+    static constexpr size_t kRangesPerThread = 8;
+
+    // But a range has at least this many items, to keep the overhead per range small:
+    static constexpr size_t kMinItemsPerRange = 256;
+
+
+    static unsigned threadLimit(unsigned maxThreads) {
+        return maxThreads ? maxThreads : max(thread::hardware_concurrency(), 1u);
+    }
+
+
+    size_t parallelRangeCount(size_t nItems, unsigned maxThreads) {
+        size_t nRanges = (nItems + kMinItemsPerRange - 1) / kMinItemsPerRange;
+        if (maxThreads != 1)
+            nRanges = min(nRanges, threadLimit(maxThreads) * kRangesPerThread);
+        else
+            nRanges = min(nRanges, size_t(1));
+        return nRanges;
+    }
+
+
+    void parallelForRanges(size_t nItems, size_t nRanges, unsigned maxThreads,
+                           function_ref<void(size_t range, size_t begin, size_t end)> fn)
+    {
+        assert_precondition(nRanges <= nItems);
+        auto rangeStart = [=](size_t range) {return nItems * range / nRanges;};
+        size_t threadCount = min(size_t(threadLimit(maxThreads)), nRanges);
+        if (threadCount <= 1) {
+            for (size_t range = 0; range < nRanges; ++range)
+                fn(range, rangeStart(range), rangeStart(range + 1));
+            return;
+        }
+
+        atomic<size_t> next {0};
+        atomic<bool> failed {false};
+        exception_ptr error;
+        auto work = [&] {
+            try {
+                for (size_t range; !failed && (range = next++) < nRanges; )
+                    fn(range, rangeStart(range), rangeStart(range + 1));
+            } catch (...) {
+                if (!failed.exchange(true))
+                    error = current_exception();
+            }
+        };
+        vector<thread> threads;
+        try {
+            threads.reserve(threadCount - 1);
+            for (size_t t = 1; t < threadCount; ++t)
+                threads.emplace_back(work);
+        } catch (...) {
+            // Couldn't start a thread; stop the ones that did start, since destroying a joinable
+            // thread would terminate the process:
+            failed = true;
+            for (auto &th : threads)
+                th.join();
+            throw;
+        }
+        work();
+        for (auto &th : threads)
+            th.join();
+        if (error)
+            rethrow_exception(error);
+    }
+
+
+    CollectionItems::CollectionItems(const Value *collection) {
+        assert_precondition(!collection->isMutable());
+        if (auto array = collection->asArray()) {
+            _array = array;
+            _count = array->count();
+        } else if (auto dict = collection->asDict()) {
+            _dictItems.reserve(dict->count());
+            for (Dict::iterator i(dict); i; ++i)
+                _dictItems.emplace_back(i.keyString(), i.value());
+            _count = uint32_t(_dictItems.size());
+        }
+    }
+
+
+    void parallelForEach(const Array *array,
+                         function_ref<void(const Value*, uint32_t index)> fn,
+                         unsigned maxThreads)
+    {
+        assert_precondition(!array->isMutable());
+        uint32_t count = array->count();
+        parallelForRanges(count, parallelRangeCount(count, maxThreads), maxThreads,
+                          [&](size_t, size_t begin, size_t end) {
+            Array::iterator i(array);
+            i += uint32_t(begin);
+            for (auto index = uint32_t(begin); index < end; ++index, ++i)
+                fn(i.value(), index);
+        });
+    }
+
+
+    void parallelDeepForEach(const Value *collection,
+                             function_ref<void(DeepIterator&, slice key, uint32_t index)> fn,
+                             unsigned maxThreads)
+    {
+        CollectionItems items(collection);
+        parallelForRanges(items.count(), parallelRangeCount(items.count(), maxThreads), maxThreads,
+                          [&](size_t, size_t begin, size_t end) {
+            // One iterator per range, reset for each item, so iterating doesn't allocate:
+            DeepIterator iter(nullptr);
+            for (auto index = uint32_t(begin); index < end; ++index) {
+                slice key = items.key(index);
+                for (iter.reset(items.value(index)); iter; ++iter)
+                    fn(iter, key, index);
+            }
+        });
+    }
+
+} }
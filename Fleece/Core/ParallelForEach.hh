@@ -0,0 +1,165 @@
+//
+// ParallelForEach.hh
+//
+// Copyright © 2020 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "Array.hh"
+#include "DeepIterator.hh"
+#include "function_ref.hh"
+#include "betterassert.hh"
+#include <utility>
+#include <vector>
+
+namespace fleece { namespace impl {
+
+    /*  Functions that read a large immutable Fleece collection on several threads at once.
+
+        Immutable Fleece data is never modified, so any number of threads can read it at the same
+        time. These functions divide a collection's items into contiguous ranges -- several times
+        as many as there are threads -- and each thread repeatedly takes the next range that no
+        thread has started yet. So a thread whose ranges turn out to be quick takes on more of
+        them, and the threads finish at about the same time.
+
+        The callbacks are called on several threads at once, so they must be thread-safe. The
+        collection must be immutable (not a MutableArray or MutableDict), and a Dict::key must
+        not be used on more than one thread. If a callback throws an exception, no more ranges
+        are started, and the first exception is rethrown once all the threads have stopped.
+
+        `maxThreads` is the most threads to use, including the calling thread; 0 means one per
+        CPU core. Small collections are processed on the calling thread. */
+
+
+    /** Calls `fn` with each item of an array and its index. */
+    void parallelForEach(const Array* NONNULL,
+                         function_ref<void(const Value*, uint32_t index)> fn,
+                         unsigned maxThreads =0);
+
+    /** Iterates each item of an Array or Dict with a DeepIterator, calling `fn` for every value
+        visited, starting with the item itself. The iterator's path is relative to the item, and
+        `fn` may call its skipChildren method. `key` is the item's key if the collection is a
+        Dict, and `index` is the item's position in the collection. */
+    void parallelDeepForEach(const Value* NONNULL collection,
+                             function_ref<void(DeepIterator&, slice key, uint32_t index)> fn,
+                             unsigned maxThreads =0);
+
+    /** Reduces the items of an array to one result. Each range of items is folded into its own
+        copy of `initial` by calling `accumulate(T&, const Value*)` with each item; then the
+        ranges' results are merged in order by `combine(T&, const T&)`.
+        (The ranges depend on the number of threads, so a floating-point sum may differ slightly
+        depending on it.) */
+    template <class T, class ACCUMULATE, class COMBINE>
+    T parallelReduce(const Array* NONNULL, const T &initial,
+                     ACCUMULATE accumulate, COMBINE combine,
+                     unsigned maxThreads =0);
+
+    /** Like parallelReduce, but deep-iterates each item of an Array or Dict like
+        parallelDeepForEach, calling `accumulate(T&, DeepIterator&)` with every value visited. */
+    template <class T, class ACCUMULATE, class COMBINE>
+    T parallelDeepReduce(const Value* NONNULL collection, const T &initial,
+                         ACCUMULATE accumulate, COMBINE combine,
+                         unsigned maxThreads =0);
+
+
+    //////// Building blocks:
+
+
+    /** The number of ranges that `nItems` items are divided into. */
+    size_t parallelRangeCount(size_t nItems, unsigned maxThreads =0);
+
+    /** Divides the indexes [0, nItems) into `nRanges` contiguous ranges, and calls
+        `fn(range, begin, end)` with each, on up to `maxThreads` threads at once. */
+    void parallelForRanges(size_t nItems, size_t nRanges, unsigned maxThreads,
+                           function_ref<void(size_t range, size_t begin, size_t end)> fn);
+
+
+    /** The items of an Array or Dict, by index. A Dict's items are collected first, since a Dict
+        that inherits from another can only be iterated, not indexed. */
+    class CollectionItems {
+    public:
+        explicit CollectionItems(const Value* NONNULL collection);
+
+        uint32_t count() const                      {return _count;}
+        const Value* value(uint32_t i) const        {return _array ? _array->get(i)
+                                                                   : _dictItems[i].second;}
+        slice key(uint32_t i) const                 {return _array ? nullslice
+                                                                   : _dictItems[i].first;}
+    private:
+        const Array* _array {nullptr};
+        std::vector<std::pair<slice, const Value*>> _dictItems;
+        uint32_t _count {0};
+    };
+
+
+    namespace internal {
+    template <class T, class RANGE_FN, class COMBINE>
+    T parallelReduceRanges(size_t nItems, const T &initial, RANGE_FN rangeFn, COMBINE combine,
+                           unsigned maxThreads)
+    {
+        // Each range is reduced into a local variable, so threads don't write to adjacent memory.
+        // (The results are wrapped in a struct so that a vector<bool> can't pack them into bits,
+        // which threads couldn't write at the same time.)
+        struct Result {T value;};
+        size_t nRanges = parallelRangeCount(nItems, maxThreads);
+        if (nRanges == 0)
+            return initial;
+        std::vector<Result> results(nRanges, Result{initial});
+        parallelForRanges(nItems, nRanges, maxThreads, [&](size_t range, size_t begin, size_t end) {
+            T result = initial;
+            rangeFn(result, uint32_t(begin), uint32_t(end));
+            results[range].value = std::move(result);
+        });
+        T result = std::move(results[0].value);
+        for (size_t r = 1; r < nRanges; ++r)
+            combine(result, results[r].value);
+        return result;
+    }
+    }
+
+
+    template <class T, class ACCUMULATE, class COMBINE>
+    T parallelReduce(const Array *array, const T &initial,
+                     ACCUMULATE accumulate, COMBINE combine,
+                     unsigned maxThreads)
+    {
+        assert_precondition(!array->isMutable());
+        return internal::parallelReduceRanges(array->count(), initial,
+                                              [&](T &result, uint32_t begin, uint32_t end) {
+            Array::iterator i(array);
+            i += begin;
+            for (uint32_t n = end - begin; n > 0; --n, ++i)
+                accumulate(result, i.value());
+        }, combine, maxThreads);
+    }
+
+
+    template <class T, class ACCUMULATE, class COMBINE>
+    T parallelDeepReduce(const Value *collection, const T &initial,
+                         ACCUMULATE accumulate, COMBINE combine,
+                         unsigned maxThreads)
+    {
+        CollectionItems items(collection);
+        return internal::parallelReduceRanges(items.count(), initial,
+                                              [&](T &result, uint32_t begin, uint32_t end) {
+            DeepIterator iter(nullptr);
+            for (uint32_t i = begin; i < end; ++i) {
+                for (iter.reset(items.value(i)); iter; ++iter)
+                    accumulate(result, iter);
+            }
+        }, combine, maxThreads);
+    }
+
+} }
@@ -18,9 +18,13 @@
 
 #include "Path.hh"
 #include "SharedKeys.hh"
+#include "Encoder.hh"
 #include "FleeceException.hh"
+#include "NumConversion.hh"
 #include "PlatformCompat.hh"
 #include "slice_stream.hh"
+#include "TempArray.hh"
+#include "betterassert.hh"
 #include <iostream>
 #include <sstream>
 
@@ -29,13 +33,15 @@ using namespace std;
 namespace fleece { namespace impl {
 
     void Path::addComponents(slice components) {
-        forEachComponent(components, _path.empty(), [&](char token, slice component, int32_t index) {
-            if (token == '.')
-                _path.emplace_back(component);
-            else
+        forEachComponent(components, _path.empty(),
+                         [&](Element::Kind kind, slice component, int32_t index) {
+            if (kind == Element::kIndex)
                 _path.emplace_back(index);
+            else
+                _path.push_back(Element(kind, component));  // (constructor may throw)
             return true;
         });
+        checkQueryLength();
     }
 
 
@@ -54,6 +60,7 @@ namespace fleece { namespace impl {
         _path.reserve(_path.size() + other.size());
         for (auto &elem : other._path)
             _path.push_back(elem);
+        checkQueryLength();
         return *this;
     }
 
@@ -68,6 +75,23 @@ namespace fleece { namespace impl {
     }
 
 
+    bool Path::isSingular() const noexcept {
+        for (auto &element : _path) {
+            if (!element.isSingular())
+                return false;
+        }
+        return true;
+    }
+
+
+    // Path::iterator keeps track of which elements a value has matched in the bits of an
+    // integer, so a path that isn't singular can't have more elements than that has bits.
+    void Path::checkQueryLength() const {
+        throwIf(_path.size() > kMaxQueryElements && !isSingular(), PathSyntaxError,
+                "Path with wildcards or filters is too long");
+    }
+
+
 #pragma mark - ENCODING:
 
 
@@ -81,10 +105,7 @@ namespace fleece { namespace impl {
     void Path::writeTo(std::ostream &out) const {
         bool first = true;
         for (auto &element : _path) {
-            if (element.isKey())
-                writeProperty(out, element.key().string(), first);
-            else
-                writeIndex(out, element.index());
+            element.writeTo(out, first);
             first = false;
         }
     }
@@ -97,6 +118,8 @@ namespace fleece { namespace impl {
         } else {
             out << '.';
         }
+        if (key == "*"_sl)
+            out << '\\';                // (otherwise it'd be a wildcard)
         const uint8_t *toQuote;
         while (nullptr != (toQuote = key.findAnyByteOf(".[\\"_sl))) {
             out.write((const char *)key.buf, toQuote - (const uint8_t*)key.buf);
@@ -120,6 +143,8 @@ namespace fleece { namespace impl {
         if (_usuallyFalse(!item))
             return nullptr;
         for (auto &e : _path) {
+            if (_usuallyFalse(!e.isSingular()))
+                return iterator(*this, root).value();
             item = e.eval(item);
             if (!item)
                 break;
@@ -132,10 +157,17 @@ namespace fleece { namespace impl {
         const Value *item = root;
         if (_usuallyFalse(!item))
             return nullptr;
-        forEachComponent(specifier, true, [&](char token, slice component, int32_t index) {
-            item = Element::eval(token, component, index, item);
+        bool singular = true;
+        forEachComponent(specifier, true, [&](Element::Kind kind, slice component, int32_t index) {
+            if (_usuallyFalse(!(kind == Element::kProperty || kind == Element::kIndex))) {
+                singular = false;
+                return false;
+            }
+            item = Element::eval((kind == Element::kProperty ? '.' : '['), component, index, item);
             return (item != nullptr);
         });
+        if (!singular)
+            return Path(specifier).eval(root);
         return item;
     }
 
@@ -181,7 +213,7 @@ namespace fleece { namespace impl {
 #pragma mark - PARSING:
 
 
-    // Parses a path expression, calling the callback for each property or array index.
+    // Parses a path expression, calling the callback for each element.
     void Path::forEachComponent(slice specifier, bool atStart, eachComponentCallback callback) {
         slice_istream in(specifier);
         throwIf(in.size == 0, PathSyntaxError, "Empty path");
@@ -213,56 +245,96 @@ namespace fleece { namespace impl {
             return;                     // "." or "" mean the root
 
         while (true) {
-            // Read parameter (property name or array index):
+            // Read parameter (property name, array index or filter):
+            Element::Kind kind;
             const uint8_t* next;
             slice param;
             alloc_slice unescaped;
             int32_t index = 0;
 
             if (token == '.') {
-                // Find end of property name:
-                next = in.findAnyByteOf(".[\\"_sl);
-                if (next == nullptr) {
-                    param = in;
-                    next = (const uint8_t*)in.end();
-                } else if (*next != '\\') {
-                    param = slice(in.buf, next);
+                kind = Element::kProperty;
+                if (in.hasPrefix('.')) {
+                    // ".." is a recursive descent:
+                    kind = Element::kDescendants;
+                    in.skip(1);
+                }
+                if (in.hasPrefix('*') && (in.size == 1 || in[1] == '.' || in[1] == '[')) {
+                    // ".*" matches every item, and "..*" every descendant:
+                    if (kind == Element::kProperty)
+                        kind = Element::kAllItems;
+                    next = (const uint8_t*)in.buf + 1;
                 } else {
-                    // Name contains escapes -- need to unescape it:
-                    unescaped.reset(in.size);
-                    auto dst = (uint8_t*)unescaped.buf;
-                    for (next = (const uint8_t*)in.buf; next < in.end(); ++next) {
-                        uint8_t c = *next;
-                        if (c == '\\') {
-                            c = *++next;
-                        } else if(c == '.' || c == '[') {
-                            break;
+                    // Find end of property name:
+                    next = in.findAnyByteOf(".[\\"_sl);
+                    if (next == nullptr) {
+                        param = in;
+                        next = (const uint8_t*)in.end();
+                    } else if (*next != '\\') {
+                        param = slice(in.buf, next);
+                    } else {
+                        // Name contains escapes -- need to unescape it:
+                        unescaped.reset(in.size);
+                        auto dst = (uint8_t*)unescaped.buf;
+                        for (next = (const uint8_t*)in.buf; next < in.end(); ++next) {
+                            uint8_t c = *next;
+                            if (c == '\\') {
+                                c = *++next;
+                            } else if(c == '.' || c == '[') {
+                                break;
+                            }
+
+                            *dst++ = c;
                         }
-
-                        *dst++ = c;
+                        param = slice(unescaped.buf, dst);
                     }
-                    param = slice(unescaped.buf, dst);
+                    throwIf(param.size == 0 && kind == Element::kDescendants, PathSyntaxError,
+                            "Missing property name after '..'");
                 }
 
             } else if (token == '[') {
-                // Find end of array index:
-                next = in.findByteOrEnd(']');
-                if (!next)
-                    FleeceException::_throw(PathSyntaxError, "Missing ']'");
-                param = slice(in.buf, next++);
-                // Parse array index:
-                slice_istream n = param;
-                int64_t i = n.readSignedDecimal();
-                throwIf(param.size == 0 || n.size > 0 || i > INT32_MAX || i < INT32_MIN,
-                        PathSyntaxError, "Invalid array index");
-                index = (int32_t)i;
+                if (in.hasPrefix("*]"_sl)) {
+                    // "[*]" matches every item:
+                    kind = Element::kAllItems;
+                    next = (const uint8_t*)in.buf + 2;
+                } else if (in.hasPrefix("?("_sl)) {
+                    // A filter ends at the first ")]" that isn't in a quoted string:
+                    kind = Element::kFilter;
+                    uint8_t quote = 0;
+                    for (next = (const uint8_t*)in.buf + 2; next + 1 < in.end(); ++next) {
+                        if (quote) {
+                            if (*next == quote)
+                                quote = 0;
+                        } else if (*next == '"' || *next == '\'') {
+                            quote = *next;
+                        } else if (*next == ')' && next[1] == ']') {
+                            break;
+                        }
+                    }
+                    throwIf(next + 1 >= in.end(), PathSyntaxError, "Missing ')]' after filter");
+                    param = slice(in.buf, next + 1);
+                    next += 2;
+                } else {
+                    // Find end of array index:
+                    kind = Element::kIndex;
+                    next = in.findByteOrEnd(']');
+                    if (!next)
+                        FleeceException::_throw(PathSyntaxError, "Missing ']'");
+                    param = slice(in.buf, next++);
+                    // Parse array index:
+                    slice_istream n = param;
+                    int64_t i = n.readSignedDecimal();
+                    throwIf(param.size == 0 || n.size > 0 || i > INT32_MAX || i < INT32_MIN,
+                            PathSyntaxError, "Invalid array index");
+                    index = (int32_t)i;
+                }
             } else {
                 FleeceException::_throw(PathSyntaxError, "Invalid path component");
             }
 
-            if (param.size > 0) {
+            if (param.size > 0 || kind != Element::kProperty) {
                 // Invoke the callback:
-                if (_usuallyFalse(!callback(token, param, index)))
+                if (_usuallyFalse(!callback(kind, param, index)))
                     return;
             }
 
@@ -286,9 +358,23 @@ namespace fleece { namespace impl {
     { }
 
 
+    Path::Element::Element(Kind kind, slice param)
+    :_keyBuf(param)
+    ,_kind(kind)
+    {
+        assert_precondition(kind != kIndex);
+        if (kind == kFilter)
+            _filter = make_shared<Filter>(_keyBuf);
+        else if (_keyBuf)
+            _key.reset(new Dict::key(_keyBuf));
+    }
+
+
     Path::Element::Element(const Element &other)
     :_keyBuf(other._keyBuf)
+    ,_filter(other._filter)
     ,_index(other._index)
+    ,_kind(other._kind)
     {
         if (other._key)
             _key.reset(new Dict::key(_keyBuf));
@@ -296,18 +382,25 @@ namespace fleece { namespace impl {
 
 
     bool Path::Element::operator== (const Element &e) const {
-        return _key ? (_key == e._key) : (_index == e._index);
+        if (_kind != e._kind)
+            return false;
+        else if (_kind == kIndex)
+            return _index == e._index;
+        else
+            return _keyBuf == e._keyBuf;
     }
 
 
     const Value* Path::Element::eval(const Value *item) const noexcept {
-        if (_key) {
+        if (_kind == kProperty) {
             auto d = item->asDict();
             if (_usuallyFalse(!d))
                 return nullptr;
             return d->get(*_key);
-        } else {
+        } else if (_kind == kIndex) {
             return getFromArray(item, _index);
+        } else {
+            return nullptr;
         }
     }
 
@@ -337,4 +430,323 @@ namespace fleece { namespace impl {
         return a->get((uint32_t)index);
     }
 
+
+    void Path::Element::writeTo(std::ostream &out, bool first) const {
+        switch (_kind) {
+            case kProperty:
+                writeProperty(out, keyStr(), first);
+                break;
+            case kIndex:
+                writeIndex(out, _index);
+                break;
+            case kAllItems:
+                out << "[*]";
+                break;
+            case kDescendants:
+                out << '.';
+                if (_key)
+                    writeProperty(out, keyStr());
+                else
+                    out << ".*";
+                break;
+            case kFilter:
+                out << '[';
+                out.write((const char*)_keyBuf.buf, _keyBuf.size);
+                out << ']';
+                break;
+        }
+    }
+
+
+#pragma mark - FILTERS:
+
+
+    // A parsed "?(@.path == literal)" expression.
+    struct Path::Element::Filter {
+        Filter(slice expression);
+
+        Path path;                      // Path from the item to the value to test
+        alloc_slice literalData;        // Encoded literal to compare the value with
+        const Value *literal {nullptr}; // The literal, or nullptr to test if the value exists
+        bool notEqual {false};          // True if the operator is "!="
+    };
+
+
+    static void skipSpaces(slice_istream &in) {
+        while (in.size > 0 && isspace(in.peekByte()))
+            in.skip(1);
+    }
+
+
+    // Encodes a filter's literal: a number, a quoted string, true, false or null.
+    static alloc_slice encodeLiteral(slice literal) {
+        Encoder enc;
+        uint8_t quote = literal[0];
+        if (quote == '"' || quote == '\'') {
+            throwIf(literal.size < 2 || literal[literal.size - 1] != quote, PathSyntaxError,
+                    "Unterminated string in filter");
+            enc.writeString(slice(&literal[1], literal.size - 2));
+        } else if (literal == "true"_sl || literal == "false"_sl) {
+            enc.writeBool(literal == "true"_sl);
+        } else if (literal == "null"_sl) {
+            enc.writeNull();
+        } else {
+            string str(literal);
+            int64_t i;
+            if (ParseInteger(str.c_str(), i)) {
+                enc.writeInt(i);
+            } else {
+                throwIf(str.find_first_not_of("0123456789+-.eE") != string::npos,
+                        PathSyntaxError, "Invalid literal in filter");
+                enc.writeDouble(ParseDouble(str.c_str()));
+            }
+        }
+        return enc.finish();
+    }
+
+
+    Path::Element::Filter::Filter(slice expression) {
+        slice_istream in(expression);
+        in.skip(2);                                     // "?("
+        in.setSize(in.size - 1);                        // ")"
+        skipSpaces(in);
+        throwIf(in.readByte() != '@', PathSyntaxError, "Filter must start with '@'");
+        auto pathEnd = in.findAnyByteOf(" \t=!"_sl);
+        slice pathStr(in.buf, pathEnd ? pathEnd : in.end());
+        if (pathStr.size > 0)
+            path.addComponents(pathStr);
+        in.setStart(pathStr.end());
+
+        skipSpaces(in);
+        if (in.size == 0)
+            return;
+        if (in.hasPrefix("!="_sl))
+            notEqual = true;
+        else
+            throwIf(!in.hasPrefix("=="_sl), PathSyntaxError, "Invalid operator in filter");
+        in.skip(2);
+        skipSpaces(in);
+        while (in.size > 0 && isspace(in[in.size - 1]))
+            in.setSize(in.size - 1);
+        throwIf(in.size == 0, PathSyntaxError, "Missing literal in filter");
+        literalData = encodeLiteral(in);
+        literal = Value::fromTrustedData(literalData);
+    }
+
+
+    bool Path::Element::matches(const Value *item) const noexcept {
+        auto value = _filter->path.eval(item);
+        auto literal = _filter->literal;
+        if (!literal)
+            return value != nullptr;
+        bool equal;
+        if (!value)
+            equal = false;
+        else if (value->type() == kNumber && literal->type() == kNumber
+                        && value->isInteger() != literal->isInteger())
+            equal = (value->asDouble() == literal->asDouble());     // e.g. 2 == 2.0
+        else
+            equal = value->isEqual(literal);
+        return equal != _filter->notEqual;
+    }
+
+
+#pragma mark - ITERATOR:
+
+
+    Path::iterator::Frame::Frame(const Value *c, States s, bool lookup_)
+    :container(c)
+    ,states(s)
+    ,lookup(lookup_)
+    ,arrayIt(lookup_ ? nullptr : c->asArray())
+    ,dictIt(lookup_ ? nullptr : c->asDict())
+    { }
+
+
+    Path::iterator::iterator(const Path &path, const Value *root)
+    :_path(path)
+    {
+        if (!root)
+            return;
+        if (path.isSingular()) {
+            _value = path.eval(root);
+            return;
+        }
+        assert_precondition(path.size() <= kMaxQueryElements);
+        if (!visit(root, 1))
+            next();
+    }
+
+
+    void Path::iterator::next() {
+        _value = nullptr;
+        while (!_stack.empty()) {
+            auto &frame = _stack.back();
+            const Value *child = nullptr;
+            States states = 0;
+            if (frame.lookup) {
+                // Look up the property or index, the only element this container can match:
+                if (frame.index++ == 0) {
+                    unsigned s = 0;
+                    while (!(frame.states & (States(1) << s)))
+                        ++s;
+                    child = _path[s].eval(frame.container);
+                    states = frame.states << 1;
+                }
+            } else if (frame.dictIt) {
+                child = frame.dictIt.value();
+                states = childStates(frame.states, frame.dictIt.keyString(), 0, 0, child);
+                ++frame.dictIt;
+            } else if (frame.arrayIt) {
+                child = frame.arrayIt.value();
+                states = childStates(frame.states, nullslice, frame.index++,
+                                     ((const Array*)frame.container)->count(), child);
+                ++frame.arrayIt;
+            }
+
+            if (!child)
+                _stack.pop_back();
+            else if (states && visit(child, states))    // (may push a frame)
+                return;
+        }
+    }
+
+
+    // Given the states of a container, returns the states of one of its children.
+    Path::iterator::States Path::iterator::childStates(States states,
+                                                       slice key, uint32_t index, uint32_t count,
+                                                       const Value *child) const
+    {
+        States result = 0;
+        for (size_t s = 0; states != 0; ++s, states >>= 1) {
+            if (!(states & 1))
+                continue;
+            auto &element = _path[s];
+            bool match = false;
+            switch (element.kind()) {
+                case Element::kProperty:
+                    match = key && key == element.keyStr();
+                    break;
+                case Element::kIndex: {
+                    int64_t i = element.index();
+                    if (i < 0)
+                        i += count;
+                    match = !key && i == index;
+                    break;
+                }
+                case Element::kAllItems:
+                    match = true;
+                    break;
+                case Element::kDescendants:
+                    result |= States(1) << s;       // A descendant may match further down
+                    match = !element.keyStr() || (key && key == element.keyStr());
+                    break;
+                case Element::kFilter:
+                    match = element.matches(child);
+                    break;
+            }
+            if (match)
+                result |= States(2) << s;
+        }
+        return result;
+    }
+
+
+    // Visits a value with the given states. Returns true if it's a match. If the value is a
+    // container that may have matches inside it, pushes a frame to iterate it.
+    bool Path::iterator::visit(const Value *value, States states) {
+        States matched = States(1) << _path.size();
+        States remaining = states & ~matched;
+        if (remaining) {
+            auto type = value->type();
+            if (type == kArray || type == kDict) {
+                bool lookup = false;
+                if ((remaining & (remaining - 1)) == 0) {
+                    // Only one state: if its element is a property or index, look it up
+                    size_t s = 0;
+                    while (!(remaining & (States(1) << s)))
+                        ++s;
+                    lookup = _path[s].isSingular();
+                }
+                _stack.emplace_back(value, remaining, lookup);
+            }
+        }
+        if (states & matched) {
+            _value = value;
+            return true;
+        }
+        return false;
+    }
+
+
+#pragma mark - PATH SET:
+
+
+    size_t PathSet::add(const Path &path) {
+        throwIf(!path.isSingular(), PathSyntaxError,
+                "A PathSet can't contain wildcards or filters");
+        uint32_t parent = kRoot;
+        for (auto &element : path.path()) {
+            // Look for a child of `parent` with the same element:
+            uint32_t child = (parent == kRoot) ? 0 : parent + 1;
+            uint32_t end = (parent == kRoot) ? uint32_t(_steps.size()) : _steps[parent].end;
+            while (child < end && !(_steps[child].element == element))
+                child = _steps[child].end;
+            if (child == end) {
+                // Not found, so insert a new step at the end of the parent's subtree, moving the
+                // steps after it down:
+                for (auto &step : _steps) {
+                    if (step.end > end)
+                        ++step.end;
+                    if (step.parent != kRoot && step.parent >= end)
+                        ++step.parent;
+                }
+                for (auto ancestor = parent; ancestor != kRoot; ancestor = _steps[ancestor].parent) {
+                    if (_steps[ancestor].end == end)
+                        ++_steps[ancestor].end;
+                }
+                for (auto &output : _outputs) {
+                    if (output != kRoot && output >= end)
+                        ++output;
+                }
+                _steps.insert(_steps.begin() + end, Step{element, parent, end + 1});
+            }
+            parent = child;
+        }
+        _outputs.push_back(parent);
+        return _outputs.size() - 1;
+    }
+
+
+    size_t PathSet::eval(const Value *root, const Value* outValues[]) const noexcept {
+        auto nSteps = uint32_t(_steps.size());
+        TempArray(values, const Value*, nSteps);
+        if (root) {
+            for (uint32_t i = 0; i < nSteps; ) {
+                auto &step = _steps[i];
+                auto value = step.element.eval(step.parent == kRoot ? root : values[step.parent]);
+                values[i] = value;
+                if (_usuallyTrue(value != nullptr)) {
+                    ++i;
+                } else {
+                    // Skip the steps that would look inside the missing value:
+                    while (++i < step.end)
+                        values[i] = nullptr;
+                }
+            }
+        } else {
+            for (uint32_t i = 0; i < nSteps; ++i)
+                values[i] = nullptr;
+        }
+
+        size_t found = 0;
+        for (size_t i = 0; i < _outputs.size(); ++i) {
+            auto value = (_outputs[i] == kRoot) ? root : values[_outputs[i]];
+            outValues[i] = value;
+            if (value)
+                ++found;
+        }
+        return found;
+    }
+
 } }
@@ -23,6 +23,7 @@
 #include <iosfwd>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace fleece { namespace impl {
     class SharedKeys;
@@ -33,11 +34,20 @@ namespace fleece { namespace impl {
         It looks like "foo.bar[2][-3].baz" -- that is, properties prefixed with a ".", and array
         indexes in brackets. (Negative indexes count from the end of the array.)
         A leading JSONPath-like "$." is allowed but ignored.
-        A '\' can be used to escape a special character ('.', '[' or '$') at the start of a
-        property name (but not yet in the middle of a name.) */
+        A '\' can be used to escape a special character ('.', '[', '$' or '*') at the start of a
+        property name (but not yet in the middle of a name.)
+
+        Like JSONPath, a path can also match any number of values:
+        - "[*]" or ".*" matches every item of an array or dict;
+        - "..name" matches every "name" property nested at any depth, and "..*" every value;
+        - "[?(@.x == literal)]" matches every item whose "x" property equals the literal (a
+          number, a quoted string, true, false or null.) The operator can also be "!=", or the
+          filter can be just "[?(@.x)]", matching every item that has an "x" property.
+        Use a Path::iterator to visit the values such a path matches. */
     class Path {
     public:
         class Element;
+        class iterator;
 
         //// Construction from a string: (throws FleeceException with code PathSyntaxError)
 
@@ -66,8 +76,13 @@ namespace fleece { namespace impl {
         const Element& operator[] (size_t i) const      {return _path[i];}
         Element& operator[] (size_t i)                  {return _path[i];}
 
+        /** True if the path has only properties and indexes, so it matches at most one value. */
+        bool isSingular() const noexcept;
+
         //// Evaluation:
 
+        /** Returns the value the path matches, or nullptr. If the path isn't singular, returns
+            the first value it matches. */
         const Value* eval(const Value *root) const noexcept;
 
         /** One-shot evaluation; faster if you're only doing it once */
@@ -96,35 +111,139 @@ namespace fleece { namespace impl {
         static void writeIndex(std::ostream&, int arrayIndex);
 
 
-        /** An element of a Path, representing either a named property or an array index. */
+        /** An element of a Path, representing a named property or an array index, or one of
+            the JSONPath-like elements that can match several values. */
         class Element {
         public:
+            enum Kind : uint8_t {
+                kProperty,          // "name": a property of a dict
+                kIndex,             // "[2]": an item of an array
+                kAllItems,          // "[*]" or ".*": every item of an array or dict
+                kDescendants,       // "..name" or "..*": nested values at any depth
+                kFilter,            // "[?(@.x == literal)]": every item matching the filter
+            };
+
             Element(slice property);
-            Element(int32_t arrayIndex)             :_index(arrayIndex) { }
+            Element(int32_t arrayIndex)             :_index(arrayIndex), _kind(kIndex) { }
+            /** Creates an element from a parsed component: a property name for kProperty and
+                kDescendants (nullslice for "..*"), or the "?(...)" expression of a kFilter. */
+            Element(Kind, slice param);
             Element(const Element &e);
+            Element(Element&&) =default;
+            Element& operator= (Element&&) =default;
             bool operator== (const Element &e) const;
-            bool isKey() const                      {return _key != nullptr;}
+            Kind kind() const                       {return _kind;}
+            bool isSingular() const                 {return _kind <= kIndex;}
+            bool isKey() const                      {return _kind == kProperty;}
             Dict::key& key() const                  {return *_key;}
             slice keyStr() const                    {return _key ? _key->string() : slice();}
             int32_t index() const                   {return _index;}
 
+            /** Returns true if a value matches this kFilter element. */
+            bool matches(const Value* NONNULL) const noexcept;
+
+            /** Evaluates a property or index; returns nullptr for other kinds. */
             const Value* eval(const Value* NONNULL) const noexcept;
             static const Value* eval(char token, slice property, int32_t index,
                                      const Value *item NONNULL) noexcept;
 
+            void writeTo(std::ostream&, bool first) const;
+
         private:
+            struct Filter;
             static const Value* getFromArray(const Value* NONNULL, int32_t index) noexcept;
 
-            alloc_slice _keyBuf;
+            alloc_slice _keyBuf;                    // Property name, or filter expression
             std::unique_ptr<Dict::key> _key {nullptr};
+            std::shared_ptr<const Filter> _filter;
             int32_t _index {0};
+            Kind _kind {kProperty};
+        };
+
+
+        /** Iterates over the values a Path matches, in the order they appear in the root.
+            The values are found as the iteration goes, without collecting them first, and only
+            the parts of the tree that could contain a match are visited: a property or index is
+            looked up directly, and a container whose path can't lead to a match is skipped. */
+        class iterator {
+        public:
+            /** Constructs an iterator. The Path must remain valid while it's in use. */
+            iterator(const Path&, const Value *root);
+
+            explicit operator bool() const          {return _value != nullptr;}
+            iterator& operator++ ()                 {next(); return *this;}
+
+            /** The current value, or nullptr when the iteration is finished. */
+            const Value* value() const              {return _value;}
+
+            /** Advances to the next matching value. */
+            void next();
+
+        private:
+            using States = uint64_t;    // Bit i is set if the value matched path elements [0,i)
+
+            struct Frame {
+                Frame(const Value *c, States s, bool lookup);
+                const Value* container;
+                States states;          // The container's states
+                bool lookup;            // Whether to look up the one child instead of iterating
+                Array::iterator arrayIt;
+                Dict::iterator dictIt;
+                uint32_t index {0};
+            };
+
+            States childStates(States, slice key, uint32_t index, uint32_t count,
+                               const Value *child) const;
+            bool visit(const Value *child, States);
+
+            const Path& _path;
+            std::vector<Frame> _stack;
+            const Value* _value {nullptr};
         };
 
     private:
-        using eachComponentCallback = function_ref<bool(char,slice,int32_t)>;
+        /** The most elements a non-singular path can have. */
+        static constexpr size_t kMaxQueryElements = 63;
+
+        using eachComponentCallback = function_ref<bool(Element::Kind,slice,int32_t)>;
         static void forEachComponent(slice in, bool atStart, eachComponentCallback);
+        void checkQueryLength() const;
 
         smallVector<Element, 4> _path;
     };
 
+
+    /** A set of Paths that are evaluated together. They're compiled into a flat list of steps,
+        each looking up a property or index in the value found by an earlier step, and arranged
+        as a trie so that a prefix shared by several paths (like "address" in "address.street"
+        and "address.city") is only evaluated once.
+        Like a Path, it caches information about the keys it looks up, so it shouldn't be
+        evaluated on more than one thread at once. */
+    class PathSet {
+    public:
+        PathSet()                                   =default;
+
+        /** Adds a path, returning its index. The path must be singular. */
+        size_t add(const Path&);
+
+        /** The number of paths that have been added. */
+        size_t count() const                        {return _outputs.size();}
+
+        /** Evaluates all the paths, storing the value of each (or nullptr) in `outValues`, which
+            must have room for `count()` items. Returns the number of paths that have values. */
+        size_t eval(const Value *root, const Value* outValues[]) const noexcept;
+
+    private:
+        static constexpr uint32_t kRoot = UINT32_MAX;
+
+        struct Step {
+            Path::Element element;  // The property or index to look up,
+            uint32_t parent;        // in the value found by this step (or the root)
+            uint32_t end;           // Index past the last step that depends on this one
+        };
+
+        std::vector<Step> _steps;           // The trie, in depth-first order
+        std::vector<uint32_t> _outputs;     // Index of the step each path ends at, or kRoot
+    };
+
 } }
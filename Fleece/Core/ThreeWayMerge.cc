@@ -0,0 +1,268 @@
+//
+// ThreeWayMerge.cc
+//
+// Copyright © 2020 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ThreeWayMerge.hh"
+#include "FleeceImpl.hh"
+#include "betterassert.hh"
+
+
+namespace fleece { namespace impl {
+    using namespace std;
+
+
+    /*static*/ ThreeWayMerge::Conflicts ThreeWayMerge::merge(const Value *base,
+                                                            const Value *ours,
+                                                            const Value *theirs,
+                                                            Encoder &enc)
+    {
+        assert_precondition(ours && theirs);
+        ThreeWayMerge merger(enc);
+        merger.write(base, ours, theirs);
+        return move(merger._conflicts);
+    }
+
+
+    /*static*/ alloc_slice ThreeWayMerge::merge(const Value *base,
+                                              const Value *ours,
+                                              const Value *theirs,
+                                              Conflicts *outConflicts)
+    {
+        Encoder enc;
+        auto conflicts = merge(base, ours, theirs, enc);
+        if (outConflicts)
+            *outConflicts = move(conflicts);
+        return enc.finish();
+    }
+
+
+    // Are the values the same? Collections only count as the same if they're the same object;
+    // otherwise it's up to the merge to look inside them, so that it only has to do so once.
+    static inline bool identical(const Value *a, const Value *b) {
+        if (a == b)
+            return true;
+        else if (!a || !b)
+            return false;
+        auto type = a->type();
+        return type != kArray && type != kDict && a->isEqual(b);
+    }
+
+
+    // Are the values equal, all the way down?
+    static inline bool equal(const Value *a, const Value *b) {
+        return a == b || (a && b && a->isEqual(b));
+    }
+
+
+    // Decides what to do with a value. A nullptr is a value that's missing from its Dict.
+    /*static*/ ThreeWayMerge::Outcome ThreeWayMerge::compare(const Value *base,
+                                                            const Value *ours,
+                                                            const Value *theirs)
+    {
+        if (identical(ours, theirs) || identical(base, theirs))
+            return kOurs;
+        else if (identical(base, ours))
+            return kTheirs;
+        if (ours && theirs) {
+            auto type = ours->type();
+            if ((type == kDict || type == kArray) && theirs->type() == type)
+                return kMerge;
+        }
+        // Collections that aren't being merged still need to be compared:
+        if (equal(ours, theirs) || equal(base, theirs))
+            return kOurs;
+        else if (equal(base, ours))
+            return kTheirs;
+        return kConflict;
+    }
+
+
+    void ThreeWayMerge::write(const Value *base, const Value *ours, const Value *theirs) {
+        writeOutcome(compare(base, ours, theirs), base, ours, theirs);
+    }
+
+
+    void ThreeWayMerge::writeOutcome(Outcome outcome,
+                                     const Value *base, const Value *ours, const Value *theirs)
+    {
+        switch (outcome) {
+            case kConflict:
+                conflict(base, ours, theirs);
+                _enc.writeValue(ours);
+                break;
+            case kOurs:
+                _enc.writeValue(ours);
+                break;
+            case kTheirs:
+                _enc.writeValue(theirs);
+                break;
+            case kMerge:
+                if (ours->type() == kDict)
+                    mergeDicts(base ? base->asDict() : nullptr, (const Dict*)ours,
+                               (const Dict*)theirs);
+                else
+                    mergeArrays(base ? base->asArray() : nullptr, (const Array*)ours,
+                                (const Array*)theirs);
+                break;
+        }
+    }
+
+
+    void ThreeWayMerge::mergeDicts(const Dict *base, const Dict *ours, const Dict *theirs) {
+        if (!base)
+            base = Dict::kEmpty;
+        // If our Dict is in the encoder's base, only the keys whose values aren't ours need to
+        // be written (unless its chain of ancestors is too long):
+        bool inBase = _enc.valueIsInBase(ours);
+        bool squash = inBase && _enc.shouldSquash(ours, 1);
+        bool inherit = inBase && !squash;
+        if (inherit)
+            _enc.beginDictionary(ours);
+        else if (squash)
+            _enc.beginSquashedDictionary(ours->count());
+        else
+            _enc.beginDictionary(ours->count());
+        _path.push_back({nullslice, 0});
+
+        // Iterate our keys:
+        uint32_t theirKeysSeen = 0;
+        for (Dict::iterator i(ours); i; ++i) {
+            slice key = i.keyString();
+            auto ourValue = i.value(), baseValue = base->get(key), theirValue = theirs->get(key);
+            if (theirValue)
+                ++theirKeysSeen;
+            _path.back().key = key;
+            auto outcome = compare(baseValue, ourValue, theirValue);
+            if (outcome == kConflict) {
+                conflict(baseValue, ourValue, theirValue);
+                outcome = kOurs;
+            }
+            if (outcome == kOurs) {
+                if (!inherit) {
+                    _enc.writeKey(key);
+                    _enc.writeValue(ourValue);
+                }
+            } else if (outcome == kTheirs && !theirValue) {
+                // They deleted it:
+                if (inherit) {
+                    _enc.writeKey(key);
+                    _enc.writeValue(Value::kUndefinedValue);
+                }
+            } else {
+                _enc.writeKey(key);
+                writeOutcome(outcome, baseValue, ourValue, theirValue);
+            }
+        }
+
+        // Then the keys only they have:
+        if (theirKeysSeen < theirs->count()) {
+            for (Dict::iterator i(theirs); i; ++i) {
+                slice key = i.keyString();
+                if (ours->get(key))
+                    continue;
+                auto theirValue = i.value(), baseValue = base->get(key);
+                _path.back().key = key;
+                switch (compare(baseValue, nullptr, theirValue)) {
+                    case kTheirs:
+                        // They added it:
+                        _enc.writeKey(key);
+                        _enc.writeValue(theirValue);
+                        break;
+                    case kConflict:
+                        // We deleted it and they changed it:
+                        conflict(baseValue, nullptr, theirValue);
+                        break;
+                    default:
+                        // We deleted it:
+                        break;
+                }
+            }
+        }
+
+        _path.pop_back();
+        _enc.endDictionary();
+    }
+
+
+    void ThreeWayMerge::mergeArrays(const Array *baseArray, const Array *ours, const Array *theirs) {
+        auto base = baseArray ? baseArray : Array::kEmpty;
+        uint32_t count = base->count();
+
+        if (ours->count() == count && theirs->count() == count) {
+            // Neither side inserted or removed items, so merge them pairwise:
+            _enc.beginArray(count);
+            _path.push_back({nullslice, 0});
+            for (uint32_t i = 0; i < count; ++i) {
+                _path.back().index = i;
+                write(base->get(i), ours->get(i), theirs->get(i));
+            }
+            _path.pop_back();
+            _enc.endArray();
+            return;
+        }
+
+        // Otherwise find the range of `base` that each side replaced, by trimming the items
+        // that are the same at the start and end. Items [start, end) of `base` were replaced by
+        // items [start, nuuEnd) of `array`.
+        struct Edit {
+            const Array *array;
+            uint32_t start, end, nuuEnd;
+        };
+        auto findEdit = [&](const Array *array) {
+            uint32_t nuuCount = array->count(), minCount = min(count, nuuCount);
+            uint32_t start = 0, suffix = 0;
+            while (start < minCount && equal(base->get(start), array->get(start)))
+                ++start;
+            while (suffix < minCount - start
+                        && equal(base->get(count - 1 - suffix), array->get(nuuCount - 1 - suffix)))
+                ++suffix;
+            return Edit{array, start, count - suffix, nuuCount - suffix};
+        };
+        auto isBefore = [](const Edit &a, const Edit &b) {
+            // Insertions at the same index are ambiguous, so they don't count:
+            return a.end < b.start || (a.end == b.start && (a.start < a.end || b.start < b.end));
+        };
+        auto writeItems = [&](const Array *array, uint32_t start, uint32_t end) {
+            for (uint32_t i = start; i < end; ++i)
+                _enc.writeValue(array->get(i));
+        };
+
+        Edit ourEdit = findEdit(ours), theirEdit = findEdit(theirs);
+        bool oursFirst = isBefore(ourEdit, theirEdit);
+        if (oursFirst || isBefore(theirEdit, ourEdit)) {
+            // The edits don't overlap, so make both of them:
+            auto &first = oursFirst ? ourEdit : theirEdit, &second = oursFirst ? theirEdit : ourEdit;
+            _enc.beginArray(count);
+            writeItems(base, 0, first.start);
+            writeItems(first.array, first.start, first.nuuEnd);
+            writeItems(base, first.end, second.start);
+            writeItems(second.array, second.start, second.nuuEnd);
+            writeItems(base, second.end, count);
+            _enc.endArray();
+        } else {
+            if (!equal(ours, theirs))
+                conflict(baseArray, ours, theirs);
+            _enc.writeValue(ours);
+        }
+    }
+
+
+    void ThreeWayMerge::conflict(const Value *base, const Value *ours, const Value *theirs) {
+        _conflicts.push_back({DeepIterator::pathString(_path), base, ours, theirs});
+    }
+
+} }
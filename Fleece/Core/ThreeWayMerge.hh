@@ -0,0 +1,84 @@
+//
+// ThreeWayMerge.hh
+//
+// Copyright © 2020 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "FleeceImpl.hh"
+#include "DeepIterator.hh"
+#include <string>
+#include <vector>
+
+namespace fleece { namespace impl {
+
+
+    /** Merges two values that were independently changed from a common ancestor, the way a
+        replicator resolves a conflict between two revisions of a document.
+
+        The three values are walked together. Wherever only one side changed a value, its change
+        is taken; Dicts that both sides changed are merged key by key, and Arrays item by item,
+        or by the ranges of items each side changed if they don't overlap. Anything else that both
+        sides changed differently is a conflict: "ours" is kept, and the conflict is reported.
+
+        Values that are the same object in two versions are skipped without looking inside them,
+        so if the versions share storage -- for example, they're deltas appended to the same
+        base, or mutable copies of it -- the merge takes time proportional to the changes, not
+        to the size of the values. Likewise, if "ours" is in the encoder's base, the merged Dicts
+        are written as deltas to it. */
+    class ThreeWayMerge {
+    public:
+
+        struct Conflict {
+            std::string path;       ///< Path to the value, in the syntax of DeepIterator::pathString
+            const Value *base;      ///< The ancestor's value, or nullptr if it had none
+            const Value *ours;      ///< Our value, or nullptr if we deleted it
+            const Value *theirs;    ///< Their value, or nullptr if they deleted it
+        };
+
+        using Conflicts = std::vector<Conflict>;
+
+        /** Writes the merge of `ours` and `theirs` to the encoder, and returns the conflicts.
+            `base` is their common ancestor; it may be nullptr if there isn't one. */
+        static Conflicts merge(const Value *base,
+                               const Value* NONNULL ours,
+                               const Value* NONNULL theirs,
+                               Encoder&);
+
+        /** Returns the merge of `ours` and `theirs` as a Fleece document. If `outConflicts` is
+            non-null, the conflicts are stored in it. */
+        static alloc_slice merge(const Value *base,
+                                 const Value* NONNULL ours,
+                                 const Value* NONNULL theirs,
+                                 Conflicts *outConflicts =nullptr);
+
+    private:
+        enum Outcome {kOurs, kTheirs, kMerge, kConflict};
+
+        ThreeWayMerge(Encoder &enc)                 :_enc(enc) { }
+        static Outcome compare(const Value *base, const Value *ours, const Value *theirs);
+        void write(const Value *base, const Value* NONNULL ours, const Value* NONNULL theirs);
+        void writeOutcome(Outcome, const Value *base, const Value *ours, const Value *theirs);
+        void mergeDicts(const Dict *base, const Dict* NONNULL ours, const Dict* NONNULL theirs);
+        void mergeArrays(const Array *baseArray,
+                         const Array* NONNULL ours, const Array* NONNULL theirs);
+        void conflict(const Value *base, const Value *ours, const Value *theirs);
+
+        Encoder& _enc;
+        std::vector<DeepIterator::PathComponent> _path;
+        Conflicts _conflicts;
+    };
+
+} }
@@ -60,6 +60,8 @@ namespace fleece { namespace impl {
         kDefaultCopy        = 0,
         kDeepCopy           = 1,
         kCopyImmutables     = 2,
+        kCopyOnWrite        = 4,    // Deep copy that shares nested mutable collections until
+                                    // they're modified
     };
 
 
@@ -0,0 +1,104 @@
+//
+// HeapArena.cc
+//
+// Copyright © 2020 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "HeapArena.hh"
+#include "betterassert.hh"
+
+namespace fleece { namespace impl {
+    using namespace std;
+
+
+    thread_local HeapArena* HeapArena::sCurrent = nullptr;
+
+
+    // Blocks are rounded up to this size, to keep them aligned:
+    static constexpr size_t kAlignment = 8;
+
+    // Blocks larger than this fraction of a slab get a dedicated slab of their own:
+    static constexpr size_t kMaxBlockFraction = 4;
+
+
+    HeapArena::HeapArena(size_t slabSize)
+    :_slabSize(slabSize)
+    {
+        precondition(slabSize >= 1024);
+    }
+
+
+    HeapArena::~HeapArena() =default;
+
+
+    __hot
+    void* HeapArena::alloc(size_t size) {
+        size = (size + kAlignment - 1) & ~(kAlignment - 1);
+        ConcurrentArena *slab = _curSlab.load(memory_order_acquire);
+        while (true) {
+            if (_usuallyTrue(slab != nullptr)) {
+                void *block = slab->alloc(size);
+                if (_usuallyTrue(block != nullptr))
+                    return block;
+            }
+            // Current slab is full (or missing, or the block is too big for a regular slab):
+            slab = addSlab(slab, size);
+        }
+    }
+
+
+    slice HeapArena::copy(slice s) {
+        if (s.size == 0)
+            return s;
+        void *buf = alloc(s.size);
+        s.copyTo(buf);
+        return slice(buf, s.size);
+    }
+
+
+    ConcurrentArena* HeapArena::addSlab(ConcurrentArena *full, size_t minSize) {
+        lock_guard<mutex> lock(_mutex);
+        if (minSize > _slabSize / kMaxBlockFraction) {
+            // Big block: give it its own exactly-sized slab, but don't make that slab current:
+            _slabs.emplace_back(new ConcurrentArena(minSize));
+            return _slabs.back().get();
+        }
+        ConcurrentArena *cur = _curSlab.load(memory_order_acquire);
+        if (cur != full) {
+            // Another thread already replaced the full slab while I was waiting for the lock:
+            return cur;
+        }
+        _slabs.emplace_back(new ConcurrentArena(_slabSize));
+        cur = _slabs.back().get();
+        _curSlab.store(cur, memory_order_release);
+        return cur;
+    }
+
+
+    size_t HeapArena::slabCount() const {
+        lock_guard<mutex> lock(_mutex);
+        return _slabs.size();
+    }
+
+
+    size_t HeapArena::bytesAllocated() const {
+        lock_guard<mutex> lock(_mutex);
+        size_t total = 0;
+        for (auto &slab : _slabs)
+            total += slab->allocated();
+        return total;
+    }
+
+} }
@@ -0,0 +1,126 @@
+//
+// HeapArena.hh
+//
+// Copyright © 2020 Couchbase. All rights reserved.
+//
+
+#pragma once
+#include "ConcurrentArena.hh"
+#include "RefCounted.hh"
+#include "fleece/slice.hh"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace fleece { namespace impl {
+
+    /** A growable, thread-safe arena that supplies the memory for the mutable Values of one
+        document: HeapValues (strings, numbers, HeapArrays, HeapDicts), HeapDict entries, and
+        HeapDict key strings. Building a large mutable document with an arena costs a handful of
+        big slab allocations instead of millions of tiny ones, and the memory is freed in bulk
+        when the arena is destructed.
+
+        The arena is installed on a thread with a `HeapArena::Scope`; while the scope exists, all
+        HeapValues created on that thread are carved out of the arena. Each HeapValue in the arena
+        retains it, so the arena stays alive until the last such Value is released, even after
+        the Scope and any other references go away. Several threads may allocate from the same
+        arena at once.
+
+        Individual blocks are never reused after being freed; an arena is intended for a
+        document that's built up, used, and then released as a whole. */
+    class HeapArena : public RefCounted {
+    public:
+        static constexpr size_t kDefaultSlabSize = 64 * 1024;
+
+        /** Constructs an arena that allocates slabs of the given size as needed. */
+        explicit HeapArena(size_t slabSize =kDefaultSlabSize);
+
+        /** Allocates a block of `size` bytes, 8-byte aligned. The block remains valid until the
+            arena is destructed. Thread-safe and, except when a new slab is needed, lock-free. */
+        void* alloc(size_t size);
+
+        /** Copies a slice into the arena and returns the copy. */
+        slice copy(slice);
+
+        /** The number of slabs allocated from the heap so far. */
+        size_t slabCount() const;
+
+        /** The total number of bytes allocated from the arena's slabs. */
+        size_t bytesAllocated() const;
+
+        /** If set, the Values subsequently created in this arena are thread-confined: they use
+            cheaper non-atomic ref-counting, and may only be used on the thread that created
+            them. (See RefCounted::setThreadConfined.) This suits a mutable document that's built
+            and used on a single thread. */
+        void setValuesThreadConfined(bool c)            {_valuesThreadConfined = c;}
+        bool valuesThreadConfined() const FLPURE        {return _valuesThreadConfined;}
+
+        /** The arena installed on the current thread by a Scope, if any. */
+        static HeapArena* current() noexcept           {return sCurrent;}
+
+        /** Makes an arena current on this thread for the lifetime of the Scope object.
+            Scopes can be nested; the destructor restores the previously current arena. */
+        class Scope {
+        public:
+            explicit Scope(HeapArena *arena) noexcept   :_prev(sCurrent) {sCurrent = arena;}
+            ~Scope()                                    {sCurrent = _prev;}
+        private:
+            Scope(const Scope&) =delete;
+            Scope& operator=(const Scope&) =delete;
+            HeapArena* const _prev;
+        };
+
+    protected:
+        ~HeapArena();
+
+    private:
+        ConcurrentArena* addSlab(ConcurrentArena *full, size_t minSize);
+
+        size_t const                    _slabSize;          // Capacity of a regular slab
+        std::atomic<ConcurrentArena*>   _curSlab {nullptr}; // Slab new blocks are carved from
+        mutable std::mutex              _mutex;             // Protects _slabs
+        std::vector<std::unique_ptr<ConcurrentArena>> _slabs;
+        bool                            _valuesThreadConfined {false};
+
+        static thread_local HeapArena*  sCurrent;
+    };
+
+
+    /** C++ allocator that takes memory from a HeapArena, or from the regular heap if it's
+        constructed with a null arena. Deallocation of arena memory is a no-op, so it should only
+        be used by containers owned by an object that keeps the arena alive. */
+    template <class T>
+    class HeapArenaAllocator {
+    public:
+        typedef T value_type;
+
+        HeapArenaAllocator(HeapArena *arena =nullptr) noexcept      :_arena(arena) { }
+
+        template <class U>
+        HeapArenaAllocator(const HeapArenaAllocator<U> &a) noexcept :_arena(a.arena()) { }
+
+        HeapArena* arena() const FLPURE                             {return _arena;}
+
+        [[nodiscard]] T* allocate(size_t n) {
+            if (_arena)
+                return (T*)_arena->alloc(n * sizeof(T));
+            else
+                return (T*)::operator new(n * sizeof(T));
+        }
+
+        void deallocate(T* p, size_t) noexcept {
+            if (!_arena)
+                ::operator delete(p);
+        }
+
+        template <class U>
+        bool operator== (const HeapArenaAllocator<U> &a) const  {return _arena == a.arena();}
+        template <class U>
+        bool operator!= (const HeapArenaAllocator<U> &a) const  {return _arena != a.arena();}
+
+    private:
+        HeapArena* _arena;
+    };
+
+} }
@@ -43,6 +43,11 @@ namespace fleece { namespace impl { namespace internal {
     }
 
 
+    HeapArray::~HeapArray() {
+        unlinkSharingChildren();
+    }
+
+
     void HeapArray::populate(unsigned fromIndex) {
         if (!_source)
             return;
@@ -70,6 +75,7 @@ namespace fleece { namespace impl { namespace internal {
     void HeapArray::resize(uint32_t newSize) {
         if (newSize == count())
             return;
+        ensureUnshared();
         _items.resize(newSize, ValueSlot(Null()));
         setChanged(true);
     }
@@ -79,6 +85,7 @@ namespace fleece { namespace impl { namespace internal {
         throwIf(where > count(), OutOfRange, "insert position is past end of array");
         if (n == 0)
             return;
+        ensureUnshared();
         populate(where);
         _items.insert(_items.begin() + where,  n, ValueSlot(Null()));
         setChanged(true);
@@ -89,6 +96,7 @@ namespace fleece { namespace impl { namespace internal {
         throwIf(where + n > count(), OutOfRange, "remove range is past end of array");
         if (n == 0)
             return;
+        ensureUnshared();
         populate(where + n);
         auto at = _items.begin() + where;
         _items.erase(at, at + n);
@@ -99,6 +107,7 @@ namespace fleece { namespace impl { namespace internal {
     HeapCollection* HeapArray::getMutable(uint32_t index, tags ifType) {
         if (index >= count())
             return nullptr;
+        ensureUnshared();
         Retained<HeapCollection> result = nullptr;
         auto &mval = _items[index];
         if (mval) {
@@ -128,12 +137,14 @@ namespace fleece { namespace impl { namespace internal {
 #if DEBUG
         assert_precondition(index<_items.size());
 #endif
+        ensureUnshared();
         setChanged(true);
         return _items[index];
     }
 
 
     ValueSlot& HeapArray::appending() {
+        ensureUnshared();
         setChanged(true);
         _items.emplace_back();
         return _items.back();
@@ -95,8 +95,9 @@ namespace fleece { namespace impl { namespace internal {
     protected:
         friend class impl::Array;
         friend class impl::MutableArray;
+        friend class HeapCollection;
 
-        ~HeapArray() =default;
+        ~HeapArray();
         const ValueSlot* first();          // Called by Array::impl
 
     private:
@@ -23,19 +23,286 @@
 #include "Encoder.hh"
 #include "SharedKeys.hh"
 #include "betterassert.hh"
+#include <algorithm>
+#include <new>
 
 namespace fleece { namespace impl { namespace internal {
+    using namespace std;
+
+
+#pragma mark - KEYMAP:
+
+
+    // Makes sure a vector can add an item without reallocating (so without throwing.)
+    template <class V>
+    static void reserveOneMore(V &v, size_t maxCapacity =SIZE_MAX) {
+        if (v.size() == v.capacity())
+            v.reserve(min(max(2 * v.size(), size_t(4)), maxCapacity));
+    }
+
+
+    keyMap::keyMap(HeapArena *arena)
+    :_chunks(arena)
+    ,_index(arena)
+    ,_blocks(arena)
+    ,_free(arena)
+    { }
+
+
+    keyMap::keyMap(const keyMap &other)
+    :keyMap(other.arena())
+    {
+        *this = other;
+    }
+
+
+    keyMap& keyMap::operator= (const keyMap &other) {
+        if (&other != this) {
+            clear();
+            for (auto &entry : other)
+                insert(entry.first) = entry.second;    // appends, since `other` is sorted
+        }
+        return *this;
+    }
+
+
+    keyMap::~keyMap() {
+        clear();
+        freeBlocks();
+    }
+
+
+    uint32_t keyMap::hashKey(const key_t &key) noexcept {
+        if (key.shared())
+            return uint32_t(key.asInt()) * 0x9E3779B1;      // Fibonacci hashing
+        else
+            return key.asString().hash();
+    }
+
+
+    // Returns the position in _index of the bucket holding the key, or SIZE_MAX if not found.
+    size_t keyMap::findInIndex(const key_t &key) const noexcept {
+        size_t mask = _index.size() - 1;
+        for (size_t i = hashKey(key) & mask; ; i = (i + 1) & mask) {
+            value_type *entry = _index[i];
+            if (!entry)
+                return SIZE_MAX;
+            else if (entry->first == key)
+                return i;
+        }
+    }
+
+
+    void keyMap::addToIndex(value_type *entry) noexcept {
+        size_t mask = _index.size() - 1;
+        size_t i = hashKey(entry->first) & mask;
+        while (_index[i])
+            i = (i + 1) & mask;
+        _index[i] = entry;
+    }
+
+
+    // Empties a bucket, then shifts back any following buckets in the same probe sequence, so
+    // that no lookup will stop early at the hole.
+    void keyMap::removeFromIndex(size_t hole) noexcept {
+        size_t mask = _index.size() - 1;
+        for (size_t i = (hole + 1) & mask; _index[i]; i = (i + 1) & mask) {
+            size_t home = hashKey(_index[i]->first) & mask;
+            if (((i - home) & mask) >= ((i - hole) & mask)) {
+                _index[hole] = _index[i];
+                hole = i;
+            }
+        }
+        _index[hole] = nullptr;
+    }
+
+
+    // Makes sure takeEntry() has an entry to return, allocating a new block if necessary.
+    void keyMap::reserveEntry() {
+        if (!_free.empty())
+            return;
+        if (_blocksUsed > 0 && _lastBlockUsed < blockSize(_blocksUsed - 1))
+            return;
+        if (_blocksUsed == _blocks.size()) {
+            reserveOneMore(_blocks);
+            HeapArenaAllocator<value_type> allocator(arena());
+            _blocks.push_back(allocator.allocate(blockSize(_blocks.size())));
+        }
+        ++_blocksUsed;
+        _lastBlockUsed = 0;
+    }
+
+
+    // Returns uninitialized memory for an entry. reserveEntry() must have been called first.
+    keyMap::value_type* keyMap::takeEntry() noexcept {
+        if (!_free.empty()) {
+            value_type *entry = _free.back();
+            _free.pop_back();
+            return entry;
+        }
+        return _blocks[_blocksUsed - 1] + _lastBlockUsed++;
+    }
+
+
+    void keyMap::freeBlocks() noexcept {
+        HeapArenaAllocator<value_type> allocator(arena());
+        for (size_t b = 0; b < _blocks.size(); ++b)
+            allocator.deallocate(_blocks[b], blockSize(b));
+        _blocks.clear();
+        _free.clear();
+        _blocksUsed = _lastBlockUsed = 0;
+    }
+
+
+    // Returns the index of the chunk whose keys' range includes the key, or would if it were
+    // added: the last chunk whose first key is not greater. (If there are no chunks, returns 0.)
+    size_t keyMap::chunkFor(const key_t &key) const noexcept {
+        auto c = upper_bound(_chunks.begin(), _chunks.end(), key,
+                             [](const key_t &k, const chunk &ch) {return k < ch.front()->first;});
+        return (c == _chunks.begin()) ? 0 : (c - _chunks.begin() - 1);
+    }
+
+
+    ValueSlot* keyMap::find(const key_t &key) const noexcept {
+        if (_index.empty()) {
+            for (auto &ch : _chunks) {
+                for (value_type *e : ch) {
+                    if (e->first == key)
+                        return &e->second;
+                }
+            }
+        } else {
+            size_t pos = findInIndex(key);
+            if (pos != SIZE_MAX)
+                return &_index[pos]->second;
+        }
+        return nullptr;
+    }
+
+
+    ValueSlot& keyMap::insert(key_t key) {
+        // First allocate everything that might be needed, so a failure leaves the map unchanged:
+        reserveEntry();
+
+        // Keep the hash table at most half full:
+        vector<value_type*> newIndex(_index.get_allocator());
+        if (!_index.empty() ? (2 * (_size + 1) > _index.size()) : (_size + 1 > kMaxLinearSearch))
+            newIndex.resize(max(2 * _index.size(), 4 * kMaxLinearSearch));
+
+        // Find where the key goes in sorted order. Adding a key past the end of a full chunk
+        // starts a new one; inserting it into a full chunk splits that chunk in half.
+        size_t c = chunkFor(key), pos = 0;
+        bool newLast = _chunks.empty(), split = false;
+        if (!newLast) {
+            chunk &ch = _chunks[c];
+            if (ch.back()->first < key)
+                pos = ch.size();
+            else
+                pos = upper_bound(ch.begin(), ch.end(), key,
+                                  [](const key_t &k, const value_type *e) {return k < e->first;})
+                        - ch.begin();
+            if (ch.size() < kMaxChunkSize)
+                reserveOneMore(ch, kMaxChunkSize);
+            else if (pos == ch.size() && c + 1 == _chunks.size())
+                newLast = true;
+            else
+                split = true;
+        }
+        chunk newChunk(_chunks.get_allocator());
+        if (newLast || split) {
+            newChunk.reserve(split ? kMaxChunkSize : 4);
+            reserveOneMore(_chunks);
+        }
+
+        // Now add the entry; nothing below can fail:
+        value_type *entry = new (takeEntry()) value_type(key, ValueSlot());
+        if (newLast) {
+            newChunk.push_back(entry);
+            _chunks.push_back(std::move(newChunk));
+        } else if (split) {
+            chunk &ch = _chunks[c];
+            size_t half = ch.size() / 2;
+            newChunk.assign(ch.begin() + half, ch.end());
+            ch.resize(half);
+            if (pos <= half)
+                ch.insert(ch.begin() + pos, entry);
+            else
+                newChunk.insert(newChunk.begin() + (pos - half), entry);
+            _chunks.insert(_chunks.begin() + c + 1, std::move(newChunk));
+        } else {
+            chunk &ch = _chunks[c];
+            ch.insert(ch.begin() + pos, entry);
+        }
+        ++_size;
+
+        if (!newIndex.empty()) {
+            _index.swap(newIndex);
+            for (auto &ch : _chunks) {
+                for (value_type *e : ch)
+                    addToIndex(e);
+            }
+        } else if (!_index.empty()) {
+            addToIndex(entry);
+        }
+        return entry->second;
+    }
+
+
+    bool keyMap::erase(const key_t &key) {
+        if (_size == 0)
+            return false;
+        size_t c = chunkFor(key);
+        chunk &ch = _chunks[c];
+        auto pos = lower_bound(ch.begin(), ch.end(), key,
+                               [](const value_type *e, const key_t &k) {return e->first < k;});
+        if (pos == ch.end() || !((*pos)->first == key))
+            return false;
+        value_type *entry = *pos;
+        _free.push_back(entry);
+        if (!_index.empty())
+            removeFromIndex(findInIndex(key));
+        ch.erase(pos);
+        if (ch.empty())
+            _chunks.erase(_chunks.begin() + c);
+        entry->~value_type();
+        --_size;
+        return true;
+    }
+
+
+    void keyMap::clear() noexcept {
+        for (auto &ch : _chunks) {
+            for (value_type *entry : ch)
+                entry->~value_type();
+        }
+        _chunks.clear();
+        _index.clear();
+        _free.clear();
+        _size = 0;
+        _blocksUsed = _lastBlockUsed = 0;      // Keep the blocks, to reuse
+    }
+
+
+#pragma mark - HEAPDICT:
+
 
     HeapDict::HeapDict(const Dict *d)
     :HeapCollection(kDictTag)
+    ,_map(arena())
     {
         if (d) {
             _count = d->count();
             if (d->isMutable()) {
                 auto hd = d->asMutable()->heapDict();
                 _source = hd->_source;
-                _map = hd->_map;
-                _backingSlices = hd->_backingSlices;
+                if (hd->arena() == arena()) {
+                    _map = hd->_map;
+                    _backingSlices = hd->_backingSlices;
+                } else {
+                    // The keys live in the other dict's arena, so I need my own copies:
+                    for (auto &entry : hd->_map)
+                        _map.insert(_allocateKey(entry.first)) = entry.second;
+                }
             } else {
                 _source = d;
             }
@@ -45,6 +312,11 @@ namespace fleece { namespace impl { namespace internal {
     }
 
 
+    HeapDict::~HeapDict() {
+        unlinkSharingChildren();
+    }
+
+
     void HeapDict::markChanged() {
         setChanged(true);
         _iterable = nullptr;
@@ -75,16 +347,16 @@ namespace fleece { namespace impl { namespace internal {
 
 
     ValueSlot* HeapDict::_findValueFor(key_t key) const noexcept {
-        auto it = _map.find(key);
-        if (it == _map.end())
-            return nullptr;
-        return const_cast<ValueSlot*>(&it->second);
+        return _map.find(key);
     }
 
 
     key_t HeapDict::_allocateKey(key_t key) {
         if (key.shared())
             return key;
+        HeapArena *arena = _map.arena();
+        if (arena)
+            return key_t(arena->copy(key.asString()));
         alloc_slice allocedKey(key.asString());
         _backingSlices.push_back(allocedKey);
         return key_t(allocedKey);
@@ -93,16 +365,17 @@ namespace fleece { namespace impl { namespace internal {
 
     ValueSlot& HeapDict::_makeValueFor(key_t key) {
         // Look in my map first:
-        auto it = _map.find(key);
-        if (it != _map.end())
-            return it->second;
+        ValueSlot *slot = _map.find(key);
+        if (slot)
+            return *slot;
         // If not in map, add it as an empty value:
-        return _map[key_t(_allocateKey(key))];                // creates a new value
+        return _map.insert(_allocateKey(key));
     }
 
 
     // this is the innards of the set() method
     ValueSlot& HeapDict::setting(slice stringKey) {
+        ensureUnshared();
         key_t key;
         ValueSlot *slotp = _findValueFor(stringKey);
         if (slotp) {
@@ -128,9 +401,9 @@ namespace fleece { namespace impl { namespace internal {
 
 
     const Value* HeapDict::get(int key) const noexcept {
-        auto it = _map.find(key);
-        if (it != _map.end())
-            return it->second.asValue();
+        ValueSlot* val = _map.find(key);
+        if (val)
+            return val->asValue();
         else
             return _source ? _source->get(key) : nullptr;
     }
@@ -146,15 +419,16 @@ namespace fleece { namespace impl { namespace internal {
 
 
     const Value* HeapDict::get(const key_t &key) const noexcept {
-        auto it = _map.find(key);
-        if (it != _map.end())
-            return it->second.asValue();
+        ValueSlot* val = _map.find(key);
+        if (val)
+            return val->asValue();
         else
             return _source ? _source->get(key) : nullptr;
     }
 
 
     HeapCollection* HeapDict::getMutable(slice stringKey, tags ifType) {
+        ensureUnshared();
         key_t key = encodeKey(stringKey);
         Retained<HeapCollection> result;
         ValueSlot* mval = _findValueFor(key);
@@ -163,7 +437,7 @@ namespace fleece { namespace impl { namespace internal {
         } else if (_source) {
             result = HeapCollection::mutableCopy(_source->get(key), ifType);
             if (result)
-                _map.emplace(_allocateKey(key), result.get());
+                _map.insert(_allocateKey(key)) = ValueSlot(result.get());
         }
         if (result)
             markChanged();
@@ -172,13 +446,14 @@ namespace fleece { namespace impl { namespace internal {
 
 
     void HeapDict::remove(slice stringKey) {
+        ensureUnshared();
         key_t key = encodeKey(stringKey);
         if (_source && _source->get(key)) {
-            auto it = _map.find(key);
-            if (it != _map.end()) {
-                if (_usuallyFalse(!it->second))
+            ValueSlot *slot = _map.find(key);
+            if (slot) {
+                if (_usuallyFalse(!*slot))
                     return;                             // already removed
-                it->second = ValueSlot();
+                *slot = ValueSlot();
             } else {
                 _makeValueFor(key);
             }
@@ -194,6 +469,7 @@ namespace fleece { namespace impl { namespace internal {
     void HeapDict::removeAll() {
         if (_count == 0)
             return;
+        ensureUnshared();
         _map.clear();
         _backingSlices.clear();
         if (_source) {
@@ -219,14 +495,10 @@ namespace fleece { namespace impl { namespace internal {
     }
 
 
-    bool HeapDict::tooManyAncestors() const {
-        auto grampaw = _source->getParent();
-        return grampaw && grampaw->getParent();
-    }
-
-
     void HeapDict::writeTo(Encoder &enc) {
-        if (enc.valueIsInBase(_source) && _map.size() + 1 < count() && !tooManyAncestors()) {
+        bool canInherit = enc.valueIsInBase(_source) && _map.size() + 1 < count();
+        bool squash = canInherit && enc.shouldSquash(_source, _map.size());
+        if (canInherit && !squash) {
             // Write just the changed keys, with _source as parent:
             enc.beginDictionary(_source, _map.size());
             for (auto &i : _map) {
@@ -236,7 +508,10 @@ namespace fleece { namespace impl { namespace internal {
             enc.endDictionary();
         } else {
             iterator iter(this);
-            enc.beginDictionary(iter.count());
+            if (squash)
+                enc.beginSquashedDictionary(iter.count());
+            else
+                enc.beginDictionary(iter.count());
             for (; iter; ++iter) {
                 enc.writeKey(iter.keyString());
                 enc.writeValue(iter.value());
@@ -251,7 +526,7 @@ namespace fleece { namespace impl { namespace internal {
             return;
         for (Dict::iterator i(_source); i; ++i) {
             slice key = i.keyString();
-            if (_map.find(key) == _map.end())
+            if (!_findValueFor(key))
                 set(key, i.value());
         }
         _source = nullptr;
@@ -9,7 +9,7 @@
 #include "ValueSlot.hh"
 #include "SharedKeys.hh"
 #include <deque>
-#include <map>
+#include <vector>
 
 namespace fleece { namespace impl {
     class Encoder;
@@ -19,6 +19,100 @@ namespace fleece { namespace impl {
 namespace fleece { namespace impl { namespace internal {
     class HeapArray;
 
+
+    /** The storage of a HeapDict's key-value pairs. The entries live in a series of blocks that
+        double in size, so an entry never moves once it's been added: pointers to its ValueSlot,
+        and to an inline value in it, stay valid until that entry is removed.
+        Small maps are searched linearly; once a map grows past kMaxLinearSearch entries it adds
+        an open-addressing hash table of entry pointers.
+        The entries are also kept sorted by key, which iteration and encoding need, in a series
+        of chunks of at most kMaxChunkSize pointers. Every insertion and removal updates this
+        order, so reading the map never changes it. */
+    class keyMap {
+    public:
+        using value_type = std::pair<key_t, ValueSlot>;
+
+    private:
+        template <class T> using vector = std::vector<T, HeapArenaAllocator<T>>;
+        using chunk = vector<value_type*>;
+
+    public:
+        template <class ENTRY>
+        class sortedIterator {
+        public:
+            sortedIterator(const chunk *c, size_t pos)  :_chunk(c), _pos(pos) { }
+            ENTRY& operator* () const                   {return *(*_chunk)[_pos];}
+            ENTRY* operator-> () const                  {return (*_chunk)[_pos];}
+            sortedIterator& operator++ () {
+                if (++_pos == _chunk->size()) {
+                    ++_chunk;
+                    _pos = 0;
+                }
+                return *this;
+            }
+            bool operator== (const sortedIterator &i) const {return _chunk == i._chunk && _pos == i._pos;}
+            bool operator!= (const sortedIterator &i) const {return !(*this == i);}
+        private:
+            const chunk* _chunk;
+            size_t _pos;
+        };
+
+        using iterator = sortedIterator<value_type>;
+        using const_iterator = sortedIterator<const value_type>;
+
+        explicit keyMap(HeapArena *arena =nullptr);
+        keyMap(const keyMap&);
+        keyMap& operator= (const keyMap&);
+        ~keyMap();
+
+        HeapArena* arena() const                    {return _chunks.get_allocator().arena();}
+
+        size_t size() const                         {return _size;}
+        bool empty() const                          {return _size == 0;}
+
+        /** Returns the ValueSlot for a key, or nullptr if the key isn't in the map. */
+        ValueSlot* find(const key_t&) const noexcept;
+
+        /** Adds a key, which must not already be in the map, with an empty ValueSlot. */
+        ValueSlot& insert(key_t);
+
+        /** Removes a key; returns false if it wasn't in the map. */
+        bool erase(const key_t&);
+
+        void clear() noexcept;
+
+        /** Iteration visits the entries in order of their keys. */
+        iterator begin()                            {return {_chunks.data(), 0};}
+        iterator end()                              {return {_chunks.data() + _chunks.size(), 0};}
+        const_iterator begin() const                {return {_chunks.data(), 0};}
+        const_iterator end() const                  {return {_chunks.data() + _chunks.size(), 0};}
+
+        static constexpr size_t kMaxLinearSearch = 16;
+        static constexpr size_t kMaxChunkSize = 128;
+
+    private:
+        static constexpr size_t kFirstBlockSize = 4;
+        static size_t blockSize(size_t blockNo)     {return kFirstBlockSize << blockNo;}
+
+        static uint32_t hashKey(const key_t&) noexcept FLPURE;
+        size_t findInIndex(const key_t&) const noexcept;
+        void addToIndex(value_type*) noexcept;
+        void removeFromIndex(size_t indexPos) noexcept;
+        size_t chunkFor(const key_t&) const noexcept;
+        void reserveEntry();
+        value_type* takeEntry() noexcept;
+        void freeBlocks() noexcept;
+
+        vector<chunk>               _chunks;            // Entries sorted by key; none empty
+        vector<value_type*>         _index;             // Hash table of entries; empty if small
+        vector<value_type*>         _blocks;            // Storage of entries (some unused)
+        vector<value_type*>         _free;              // Removed entries, available for reuse
+        size_t                      _size {0};          // Number of entries
+        size_t                      _blocksUsed {0};    // Number of blocks entries are taken from
+        size_t                      _lastBlockUsed {0}; // Number of entries taken from last one
+    };
+
+
     class HeapDict : public HeapCollection {
     public:
         HeapDict(const Dict* =nullptr);
@@ -61,9 +155,6 @@ namespace fleece { namespace impl { namespace internal {
         void writeTo(Encoder&);
 
 
-        using keyMap = std::map<key_t, ValueSlot>;
-
-
         class iterator {
         public:
             iterator(const HeapDict* NONNULL) noexcept;
@@ -99,8 +190,9 @@ namespace fleece { namespace impl { namespace internal {
     protected:
         friend class fleece::impl::Array;
         friend class fleece::impl::MutableDict;
+        friend class HeapCollection;
 
-        ~HeapDict() =default;
+        ~HeapDict();
         HeapArray* kvArray();
 
     private:
@@ -111,13 +203,12 @@ namespace fleece { namespace impl { namespace internal {
         ValueSlot* _findValueFor(key_t keyToFind) const noexcept;
         ValueSlot& _makeValueFor(key_t key);
         HeapCollection* getMutable(slice key, tags ifType);
-        bool tooManyAncestors() const;
 
         uint32_t _count {0};                        // Dict's actual count
         RetainedConst<Dict> _source;                // Original Dict I shadow, if any
         Retained<SharedKeys> _sharedKeys;           // Namespace of integer keys
         keyMap _map;                                // Actual storage of key-value pairs
-        std::deque<alloc_slice> _backingSlices;     // Backing storage of key slices
+        std::deque<alloc_slice> _backingSlices;     // Backing storage of key slices (if no arena)
         Retained<HeapArray> _iterable;              // All key-value pairs in sequence, for iterator
     };
     
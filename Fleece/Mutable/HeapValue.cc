@@ -38,12 +38,64 @@ namespace fleece { namespace impl { namespace internal {
 #ifdef __GNUC__
 #pragma GCC diagnostic pop
 #endif
-        return ::operator new(size + valueSize);
+        return allocate(size + valueSize);
     }
 
 
-    HeapValue::HeapValue(tags tag, int tiny) {
-        _pad = 0xFF;
+    // A block from `::operator new` is aligned to kHeapAlignment. A HeapValue allocated in a
+    // HeapArena is deliberately placed kArenaOffset bytes past such a boundary, and is preceded by
+    // a pointer to the arena, which it retains. So `deallocate` can tell from the address alone
+    // where the block came from, and find the arena.
+    // (The Value's offsetValue::_pad is also set to kArenaPad by the constructor, which checks the
+    // same thread-local current arena that `allocate` did.)
+
+    static constexpr size_t kHeapAlignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+    static constexpr size_t kArenaOffset = kHeapAlignment / 2;
+    static_assert(alignof(HeapValue) <= kArenaOffset, "arena offset misaligns HeapValues");
+
+    static inline bool isArenaBlock(const void *ptr) {
+        return (size_t(ptr) & (kHeapAlignment - 1)) == kArenaOffset;
+    }
+
+    static inline HeapArena* arenaOfBlock(const void *ptr) {
+        return ((HeapArena* const*)ptr)[-1];
+    }
+
+    void* HeapValue::allocate(size_t size) {
+        HeapArena *arena = HeapArena::current();
+        if (_usuallyTrue(!arena))
+            return ::operator new(size);
+        // Arena blocks are 8-byte aligned, so this leaves room for the arena pointer and padding:
+        auto block = (char*)arena->alloc(kHeapAlignment + size);
+        char *ptr = block + sizeof(HeapArena*);
+        ptr += (kArenaOffset - size_t(ptr)) & (kHeapAlignment - 1);
+        assert(isArenaBlock(ptr));
+        ((HeapArena**)ptr)[-1] = fleece::retain(arena);
+        return ptr;
+    }
+
+    void HeapValue::deallocate(void *ptr) noexcept {
+        if (_usuallyFalse(isArenaBlock(ptr)))
+            fleece::release(arenaOfBlock(ptr));     // The memory itself is freed with the arena
+        else
+            ::operator delete(ptr);
+    }
+
+
+    HeapArena* HeapValue::arena() const {
+        return isInArena() ? arenaOfBlock(this) : nullptr;
+    }
+
+
+    HeapValue::HeapValue() {
+        if (_usuallyFalse(isInArena()) && arena()->valuesThreadConfined())
+            setThreadConfined(true);
+    }
+
+
+    HeapValue::HeapValue(tags tag, int tiny)
+    :HeapValue()
+    {
         _header = uint8_t((tag << 4) | tiny);
     }
 
@@ -146,7 +198,7 @@ namespace fleece { namespace impl { namespace internal {
         if (!isHeapValue(v))
             return nullptr;
         auto ov = (offsetValue*)(size_t(v) & ~1);
-        assert_postcondition(ov->_pad == 0xFF);
+        assert_postcondition(ov->_pad == kHeapPad || ov->_pad == kArenaPad);
         return (HeapValue*)ov;
     }
 
@@ -188,6 +240,125 @@ namespace fleece { namespace impl { namespace internal {
     }
 
 
+    // Calls `fn` with each mutable collection stored in me (but not ones I share copy-on-write.)
+    template <class FN>
+    void HeapCollection::forEachNestedCollection(FN fn) {
+        auto visit = [&](const ValueSlot &slot) {
+            if (!slot.isCopyOnWrite()) {
+                if (HeapCollection *nested = slot.asMutableCollection())
+                    fn(nested);
+            }
+        };
+        if (tag() == kArrayTag) {
+            for (auto &slot : ((HeapArray*)this)->_items)
+                visit(slot);
+        } else {
+            for (auto &entry : ((HeapDict*)this)->_map)
+                visit(entry.second);
+        }
+    }
+
+
+    Retained<CopyOnWriteRef> HeapCollection::copyOnWriteRef() {
+        if (!_sharedRef) {
+            _sharedRef = new CopyOnWriteRef(this);
+            linkSharingChildren();
+        }
+        return _sharedRef;
+    }
+
+
+    // Makes every collection nested in me point back to its parent, so that modifying it will
+    // first unshare me.
+    void HeapCollection::linkSharingChildren() {
+        forEachNestedCollection([&](HeapCollection *nested) {
+            auto &parents = nested->_sharingParents;
+            if (std::find(parents.begin(), parents.end(), this) != parents.end())
+                return;     // Already linked, and so is everything nested in it
+            parents.push_back(this);
+            _hasSharingChildren = true;
+            nested->linkSharingChildren();
+        });
+    }
+
+
+    void HeapCollection::unlinkSharingChildren() {
+        if (!_hasSharingChildren)
+            return;
+        forEachNestedCollection([&](HeapCollection *nested) {
+            auto &parents = nested->_sharingParents;
+            auto i = std::find(parents.begin(), parents.end(), this);
+            if (i != parents.end())
+                parents.erase(i);
+        });
+        _hasSharingChildren = false;
+    }
+
+
+    void HeapCollection::unshare() {
+        // The shared collections I'm nested in would show my change, so they give their copies
+        // a snapshot first. That leaves me shared through a CopyOnWriteRef of my own:
+        if (_sharingParents.size() > 0) {
+            smallVector<HeapCollection*,1> parents = std::move(_sharingParents);
+            _sharingParents.clear();
+            for (HeapCollection *parent : parents)
+                parent->ensureUnshared();
+        }
+
+        // If the CopyOnWriteRef holds the only reference to me, only the copies can see me,
+        // so they should see the change. Otherwise they get my current state:
+        if (_sharedRef && refCount() > 1) {
+            Retained<HeapCollection> snapshot = copyOnWrite();
+            _sharedRef->_target = snapshot;
+            _sharedRef = nullptr;
+        }
+
+        // The snapshot shares my nested collections through their own CopyOnWriteRefs, and I'm
+        // about to change, so they needn't point to me any more:
+        unlinkSharingChildren();
+    }
+
+
+    Retained<HeapCollection> HeapCollection::copyOnWrite() {
+        Retained<HeapCollection> copy;
+        if (tag() == kArrayTag) {
+            copy = new HeapArray((const Array*)asValue());
+            ((HeapArray*)copy.get())->copyChildren(kCopyOnWrite);
+        } else {
+            copy = new HeapDict((const Dict*)asValue());
+            ((HeapDict*)copy.get())->copyChildren(kCopyOnWrite);
+        }
+        return copy;
+    }
+
+
+    CopyOnWriteRef::~CopyOnWriteRef() {
+        if (_target->_sharedRef == this)
+            _target->_sharedRef = nullptr;
+    }
+
+
+    Retained<HeapCollection> CopyOnWriteRef::copyForWriting() {
+        // If the caller's ValueSlot holds the only reference to me, and I hold the only reference
+        // to the target, nobody else can see the target any more:
+        if (refCount() == 1 && _target->refCount() == 1) {
+            if (_target->_sharedRef == this)
+                _target->_sharedRef = nullptr;
+            if (_target->_hasSharingChildren) {
+                // Its nested collections may still be reachable elsewhere; share them
+                // copy-on-write instead of directly:
+                _target->unlinkSharingChildren();
+                if (_target->tag() == kArrayTag)
+                    ((HeapArray*)_target.get())->copyChildren(kCopyOnWrite);
+                else
+                    ((HeapDict*)_target.get())->copyChildren(kCopyOnWrite);
+            }
+            return _target;
+        }
+        return _target->copyOnWrite();
+    }
+
+
     Retained<HeapCollection> HeapCollection::mutableCopy(const Value *v, tags ifType) {
         if (!v || v->tag() != ifType)
             return nullptr;
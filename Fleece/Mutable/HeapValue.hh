@@ -6,7 +6,9 @@
 
 #pragma once
 #include "Value.hh"
+#include "HeapArena.hh"
 #include "RefCounted.hh"
+#include "SmallVector.hh"
 
 namespace fleece { namespace impl {
     class ValueSlot;
@@ -15,11 +17,18 @@ namespace fleece { namespace impl {
         using namespace fleece::impl;
 
         struct offsetValue {
-            uint8_t _pad = 0xFF;                // Unused byte, to ensure _header is at an odd address
+            static constexpr uint8_t kHeapPad  = 0xFF;  // _pad value of a Value allocated by malloc
+            static constexpr uint8_t kArenaPad = 0xFE;  // _pad value of a Value in a HeapArena
+
+            uint8_t _pad;                       // Allocation tag; also puts _header at an odd address
             uint8_t _header;                    // Value header byte (tag | tiny)
 //          uint8_t _data[0];                   // Extra Value data (object is dynamically sized)
 
-            offsetValue() =default;
+            offsetValue()
+            :_pad(HeapArena::current() ? kArenaPad : kHeapPad)
+            { }
+
+            bool isInArena() const FLPURE           {return _pad == kArenaPad;}
         private:
             offsetValue(const offsetValue&) = delete;
             offsetValue(offsetValue&&) = delete;
@@ -51,9 +60,12 @@ namespace fleece { namespace impl {
             static const Value* retain(const Value *v);
             static void release(const Value *v);
 
-            void* operator new(size_t size)                 {return ::operator new(size);}
-            void operator delete(void* ptr)                 {::operator delete(ptr);}
-            void operator delete(void* ptr, size_t size)    {::operator delete(ptr);}
+            /** The HeapArena this Value was allocated in, or nullptr if it's on the regular heap. */
+            HeapArena* arena() const FLPURE;
+
+            void* operator new(size_t size)                 {return allocate(size);}
+            void operator delete(void* ptr)                 {deallocate(ptr);}
+            void operator delete(void* ptr, size_t size)    {deallocate(ptr);}
         protected:
             ~HeapValue() =default;
             static HeapValue* create(tags tag, int tiny, slice extraData);
@@ -63,13 +75,18 @@ namespace fleece { namespace impl {
             friend class fleece::impl::ValueSlot;
 
             static void* operator new(size_t size, size_t extraSize);
-            HeapValue() =default;
+            static void* allocate(size_t size);
+            static void deallocate(void *ptr) noexcept;
+            HeapValue();
             static HeapValue* createStr(internal::tags, slice s);
             template <class INT> static HeapValue* createInt(INT, bool isUnsigned);
         };
 
 
 
+        class CopyOnWriteRef;
+
+
         /** Abstract base class of Heap{Array,Dict}. */
         class HeapCollection : public HeapValue {
         public:
@@ -78,6 +95,9 @@ namespace fleece { namespace impl {
             bool isChanged() const FLPURE                          {return _changed;}
 
         protected:
+            friend class fleece::impl::ValueSlot;
+            friend class CopyOnWriteRef;
+
             HeapCollection(internal::tags tag)
             :HeapValue(tag, 0)
             ,_changed(false)
@@ -87,8 +107,59 @@ namespace fleece { namespace impl {
 
             void setChanged(bool c)                         {_changed = c;}
 
+            /** Must be called before modifying the collection. If copy-on-write copies are
+                sharing it, or a collection it's nested in, gives them a snapshot first. */
+            void ensureUnshared() {
+                if (_usuallyFalse(_sharedRef != nullptr || _sharingParents.size() > 0
+                                  || _hasSharingChildren))
+                    unshare();
+            }
+
+            /** Returns the reference through which copy-on-write copies share this collection. */
+            Retained<CopyOnWriteRef> copyOnWriteRef();
+
+            /** Returns a copy whose nested collections are shared copy-on-write. */
+            Retained<HeapCollection> copyOnWrite();
+
+            /** Removes me from my nested collections' lists of sharing parents. Subclasses
+                call this when destructed. */
+            void unlinkSharingChildren();
+
         private:
+            template <class FN> void forEachNestedCollection(FN);
+            void linkSharingChildren();
+            void unshare();
+
             bool _changed {false};
+            // A copy-on-write copy shares a nested collection through a CopyOnWriteRef, which
+            // sees everything nested in it too. So the collections nested in a shared one point
+            // back to their parents, and one of them being modified unshares its parents first.
+            bool _hasSharingChildren {false};       // True if nested collections point to me
+            CopyOnWriteRef* _sharedRef {nullptr};   // Not retained; it clears this when freed
+            smallVector<HeapCollection*,1> _sharingParents; // Shared collections I'm nested in
+        };
+
+
+        /** A ValueSlot of a copy-on-write copy refers to a nested collection it shares with the
+            source through one of these. The source goes on using the collection itself; before
+            the collection is changed, it points this at a snapshot of itself, so the copies don't
+            see the change. */
+        class CopyOnWriteRef : public RefCounted {
+        public:
+            explicit CopyOnWriteRef(HeapCollection *target)     :_target(target) { }
+
+            HeapCollection* target() const FLPURE               {return _target;}
+
+            /** Returns a collection the caller can modify in place of the target. */
+            Retained<HeapCollection> copyForWriting();
+
+        protected:
+            ~CopyOnWriteRef();
+
+        private:
+            friend class HeapCollection;
+
+            Retained<HeapCollection> _target;
         };
 
     } // end internal namespace
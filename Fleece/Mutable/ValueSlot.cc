@@ -28,69 +28,93 @@ namespace fleece { namespace impl {
     using namespace internal;
 
 
-    static_assert(sizeof(ValueSlot) == 8);
+    static_assert(sizeof(ValueSlot) == 16);
 
 
-    ValueSlot::ValueSlot()
-    :_pointer(0)
-    { }
+    ValueSlot::ValueSlot() {
+        _pointer = 0;
+        _extra = 0;
+    }
 
 
-    ValueSlot::ValueSlot(Null)
-    :_tag(kInlineTag)
-    {
+    ValueSlot::ValueSlot(Null) {
+        _pointer = 0;
+        _extra = 0;
+        _tag = kInlineTag;
         _inlineVal[0] = ((kSpecialTag << 4) | kSpecialValueNull);
     }
 
 
-    ValueSlot::ValueSlot(HeapCollection *md)
-    :_pointer( uint64_t(retain(md)->asValue()) )
-    { }
+    ValueSlot::ValueSlot(HeapCollection *md) {
+        _pointer = uint64_t(retain(md)->asValue());
+        _extra = 0;
+    }
 
 
-    ValueSlot::ValueSlot(const ValueSlot &other) noexcept
-    :_pointer(other._pointer)
-    {
-        if (isPointer())
-            retain(pointer());
+    ValueSlot::ValueSlot(const ValueSlot &other) noexcept {
+        _pointer = other._pointer;
+        _extra = other._extra;
+        retainValue();
     }
 
 
     ValueSlot& ValueSlot::operator= (const ValueSlot &other) noexcept {
         releaseValue();
         _pointer = other._pointer;
-        if (isPointer())
-            retain(pointer());
+        _extra = other._extra;
+        retainValue();
         return *this;
     }
 
 
     ValueSlot::ValueSlot(ValueSlot &&other) noexcept {
         _pointer = other._pointer;
+        _extra = other._extra;
         other._pointer = 0;
+        other._extra = 0;
     }
 
 
     ValueSlot& ValueSlot::operator= (ValueSlot &&other) noexcept {
-        release(asPointer());
+        releaseValue();
         _pointer = other._pointer;
+        _extra = other._extra;
         other._pointer = 0;
+        other._extra = 0;
         return *this;
     }
 
 
 
     ValueSlot::~ValueSlot() {
-        if (isPointer())
-            release(pointer());
+        releaseValue();
+    }
+
+
+    void ValueSlot::retainValue() {
+        if (isCopyOnWrite())
+            retain(copyOnWriteRef());
+        else if (isPointer())
+            retain(pointer());
     }
 
 
+    // Releases any pointer, and clears both words, so that inline bytes left in _extra can't be
+    // mistaken for kCopyOnWriteFlag once a pointer is stored.
     void ValueSlot::releaseValue() {
         if (isPointer()) {
-            release(pointer());
-            _pointer = 0;
+            if (_usuallyFalse(isCopyOnWrite()))
+                release(copyOnWriteRef());
+            else
+                release(pointer());
         }
+        _pointer = 0;
+        _extra = 0;
+    }
+
+
+    const Value* ValueSlot::sharedValue() const noexcept {
+        return copyOnWriteRef()->target()->asValue();
     }
 
 
@@ -103,11 +127,12 @@ namespace fleece { namespace impl {
         // This is a requirement for the tagging to work (see description in header):
         precondition((intptr_t(v) & 0xFF) != kInlineTag);
         precondition(v != nullptr);
-        if (_usuallyFalse(v == pointer()))
+        if (_usuallyFalse(v == pointer() && !isCopyOnWrite()))
             return;
         releaseValue();
         _pointer = uint64_t(size_t(retain(v)));
-        assert(isPointer());
+        _extra = 0;
+        assert(isPointer() && !isCopyOnWrite());
     }
 
 
@@ -177,7 +202,12 @@ namespace fleece { namespace impl {
         if (Encoder::isFloatRepresentable(d)) {
             set((float)d);
         } else {
-            setPointer(HeapValue::create(d)->asValue());
+            struct {
+                uint8_t filler = 0;
+                endian::littleEndianDouble le;
+            } data;
+            data.le = d;
+            setValue(kFloatTag, 8, {(char*)&data.le - 1, sizeof(data.le) + 1});
         }
         assert_postcondition(asValue()->asDouble() == d);
     }
@@ -231,6 +261,14 @@ namespace fleece { namespace impl {
     HeapCollection* ValueSlot::makeMutable(tags ifType) {
         if (isInline())
             return nullptr;
+        if (isCopyOnWrite()) {
+            // Replace the collection shared with the source by a copy of my own:
+            if (copyOnWriteRef()->target()->tag() != ifType)
+                return nullptr;
+            Retained<HeapCollection> copy = copyOnWriteRef()->copyForWriting();
+            set(copy->asValue());
+            return copy;
+        }
         Retained<HeapCollection> mval = HeapCollection::mutableCopy(pointer(), ifType);
         if (mval)
             set(mval->asValue());
@@ -239,9 +277,25 @@ namespace fleece { namespace impl {
 
 
     void ValueSlot::copyValue(CopyFlags flags) {
+        if (isCopyOnWrite()) {
+            if (flags & kCopyOnWrite)
+                return;
+            setPointer(sharedValue());      // Stop sharing, then copy the collection below
+        }
         const Value *value = asPointer();
         if (value && ((flags & kCopyImmutables) || value->isMutable())) {
-            bool recurse = (flags & kDeepCopy);
+            if ((flags & kCopyOnWrite) && value->isMutable()) {
+                // Share the Value. If it's a collection, share it through its CopyOnWriteRef, so
+                // a change made to it by the source won't show up here:
+                if (HeapCollection *coll = asMutableCollection()) {
+                    Retained<CopyOnWriteRef> ref = coll->copyOnWriteRef();
+                    releaseValue();
+                    _pointer = uint64_t(size_t(retain(ref.get())));
+                    _extra = kCopyOnWriteFlag;
+                }
+                return;
+            }
+            bool recurse = (flags & (kDeepCopy | kCopyOnWrite));
             Retained<HeapCollection> copy;
             switch (value->tag()) {
                 case kArrayTag:
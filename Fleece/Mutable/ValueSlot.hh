@@ -13,6 +13,7 @@ namespace fleece { namespace impl {
     namespace internal {
         class HeapArray;
         class HeapDict;
+        class CopyOnWriteRef;
     }
 
 
@@ -33,7 +34,10 @@ namespace fleece { namespace impl {
         bool empty() const FLPURE                              {return _pointer == 0;}
         explicit operator bool() const FLPURE                  {return !empty();}
 
-        const Value* asValue() const FLPURE     {return isPointer() ? pointer() : inlinePointer();}
+        const Value* asValue() const FLPURE {
+            return isPointer() ? (_usuallyFalse(isCopyOnWrite()) ? sharedValue() : pointer())
+                               : inlinePointer();
+        }
         const Value* asValueOrUndefined() const FLPURE;
 
         // Setters for the various Value types:
@@ -59,6 +63,7 @@ namespace fleece { namespace impl {
         void copyValue(CopyFlags);
 
     protected:
+        friend class internal::HeapCollection;
         friend class internal::HeapArray;
         friend class internal::HeapDict;
 
@@ -71,12 +76,17 @@ namespace fleece { namespace impl {
     private:
         bool isPointer() const noexcept FLPURE          {return _tag != kInlineTag;}
         bool isInline() const noexcept FLPURE           {return !isPointer();}
+        bool isCopyOnWrite() const noexcept FLPURE      {return isPointer() && _extra != 0;}
         const Value* pointer() const noexcept FLPURE    {return (const Value*)_pointer;}
-        const Value* asPointer() const noexcept FLPURE  {return (isPointer() ? pointer() : nullptr);}
+        const Value* asPointer() const noexcept FLPURE  {return isPointer() ? asValue() : nullptr;}
+        internal::CopyOnWriteRef* copyOnWriteRef() const noexcept FLPURE
+                                                        {return (internal::CopyOnWriteRef*)_pointer;}
+        const Value* sharedValue() const noexcept FLPURE;
         const Value* inlinePointer() const noexcept FLPURE {return (const Value*)&_inlineVal;}
         void setPointer(const Value*);
         void setInline(internal::tags valueTag, int tiny);
 
+        void retainValue();
         void releaseValue();
         void setValue(internal::tags valueTag, int tiny, slice bytes);
         template <class INT> void setInt(INT);
@@ -84,9 +94,12 @@ namespace fleece { namespace impl {
 
         // The data layout below looks weirder than it is! It's just a union of a pointer and
         // a byte array.
-        // It can store either a pointer to a Value, or 7 bytes of inline Value data.
+        // It can store either a pointer to a Value, or 15 bytes of inline Value data -- enough
+        // for any number, and for strings of up to 14 bytes.
         // The least significant byte of _pointer is used as a tag: if 0xFF the object is storing
-        // inline data, else it's a pointer.
+        // inline data, else it's a pointer. The other 8 bytes, _extra, are zero with a pointer,
+        // unless this is a copy-on-write copy's slot sharing a collection with the source: then
+        // _pointer points to a CopyOnWriteRef and _extra is kCopyOnWriteFlag.
         //
         // This works because any pointer stored by a ValueSlot will be a Fleece value, and
         // * Immutable Values (interior pointers in encoded data) are always even;
@@ -97,10 +110,18 @@ namespace fleece { namespace impl {
         // The #ifdefs are to ensure that the _tag byte lines up with the least significant
         // byte of _pointer, and _inlineVal doesn't.
 
-        static const auto kInlineCapacity = 7;
+        static const auto kInlineCapacity = 15;
 
         union {
-            uint64_t _pointer;                          // Pointer representation
+            struct {
+#ifdef __BIG_ENDIAN__
+                uint64_t _extra;
+#endif
+                uint64_t _pointer;                      // Pointer representation
+#ifdef __LITTLE_ENDIAN__
+                uint64_t _extra;                        // Rest of inline Value representation
+#endif
+            };
 
             struct {
 #ifdef __LITTLE_ENDIAN__
@@ -114,6 +135,7 @@ namespace fleece { namespace impl {
         };
 
         static constexpr uint8_t kInlineTag = 0xFF;
+        static constexpr uint64_t kCopyOnWriteFlag = 1;
     };
 
 } }
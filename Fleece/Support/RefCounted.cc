@@ -22,6 +22,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#if DEBUG
+#include <mutex>
+#include <unordered_map>
+#endif
+
 #ifdef _MSC_VER
 #include "asprintf.h"
 #endif
@@ -30,12 +35,60 @@ namespace fleece {
 
 #if !DEBUG
     __hot void RefCounted::_release() const noexcept {
-        if (--_refCount <= 0)
+        int32_t ref = _refCount.load(std::memory_order_relaxed);
+        if (ref & kThreadConfinedFlag) {
+            _refCount.store(--ref, std::memory_order_relaxed);
+            ref &= ~kThreadConfinedFlag;
+        } else {
+            ref = --_refCount;
+        }
+        if (ref <= 0)
             delete this;
     }
 #endif
 
 
+#if DEBUG
+    // The address of a thread-local variable identifies the current thread.
+    static const void* currentThreadMarker() noexcept {
+        static thread_local char sMarker;
+        return &sMarker;
+    }
+
+    // The thread each thread-confined object is confined to. This is a side table, so that
+    // RefCounted has the same layout in debug and release builds.
+    static std::mutex sConfinedThreadsMutex;
+
+    static std::unordered_map<const RefCounted*, const void*>& confinedThreads() {
+        // (Never freed, since objects may be released during static destruction)
+        static auto sConfinedThreads = new std::unordered_map<const RefCounted*, const void*>;
+        return *sConfinedThreads;
+    }
+#endif
+
+
+    void RefCounted::setThreadConfined(bool confined) noexcept {
+#if DEBUG
+        {
+            std::lock_guard<std::mutex> lock(sConfinedThreadsMutex);
+            if (confined)
+                confinedThreads()[this] = currentThreadMarker();
+            else
+                confinedThreads().erase(this);
+        }
+        int32_t ref = _refCount;
+        if (ref == kCarefulInitialRefCount || ref == kCarefulInitialConfinedRefCount) {
+            _refCount = confined ? kCarefulInitialConfinedRefCount : kCarefulInitialRefCount;
+            return;
+        }
+#endif
+        if (confined)
+            _refCount |= kThreadConfinedFlag;
+        else
+            _refCount &= ~kThreadConfinedFlag;
+    }
+
+
     __hot void release(const RefCounted *r) noexcept {
         if (r) r->_release();
     }
@@ -75,6 +128,17 @@ namespace fleece {
     RefCounted::~RefCounted() {
         // Store a garbage value to detect use-after-free
         int32_t oldRef = _refCount.exchange(-9999999);
+#if DEBUG
+        if (oldRef == kCarefulInitialConfinedRefCount
+                || (oldRef > 0 && (oldRef & kThreadConfinedFlag))) {
+            std::lock_guard<std::mutex> lock(sConfinedThreadsMutex);
+            confinedThreads().erase(this);
+            if (oldRef < 0)
+                oldRef = kCarefulInitialRefCount;
+        }
+#endif
+        if (oldRef > 0)
+            oldRef &= ~kThreadConfinedFlag;
         if (_usuallyFalse(oldRef != 0)) {
 #if DEBUG
             if (oldRef != kCarefulInitialRefCount)
@@ -99,13 +163,21 @@ namespace fleece {
 
 
     void RefCounted::_careful_retain() const noexcept {
+        bool confined = isThreadConfined();
+        if (confined)
+            _checkThread("retained");
         auto oldRef = _refCount++;
 
         // Special case: the initial retain of a new object that takes it to refCount 1
         if (oldRef == kCarefulInitialRefCount) {
             _refCount = 1;
             return;
+        } else if (oldRef == kCarefulInitialConfinedRefCount) {
+            _refCount = 1 | kThreadConfinedFlag;
+            return;
         }
+        if (confined)
+            oldRef &= ~kThreadConfinedFlag;
 
         // Otherwise, if the refCount was 0 we have a bug where another thread is destructing
         // the object, so this thread shouldn't have a reference at all.
@@ -116,7 +188,12 @@ namespace fleece {
 
 
     void RefCounted::_careful_release() const noexcept {
+        bool confined = isThreadConfined();
+        if (confined)
+            _checkThread("released");
         auto oldRef = _refCount--;
+        if (confined)
+            oldRef &= ~kThreadConfinedFlag;
 
         // If the refCount was 0 we have a bug where another thread is destructing
         // the object, so this thread shouldn't have a reference at all.
@@ -128,4 +205,31 @@ namespace fleece {
         if (oldRef == 1) delete this;
     }
 
+
+    // A thread-confined object's ref-count isn't updated atomically, so touching it from any
+    // other thread is a race that could corrupt the count. (This is called from retain and
+    // release, which are noexcept, so it aborts instead of throwing.)
+    void RefCounted::_checkThread(const char *what) const noexcept {
+#if DEBUG
+        const void *thread;
+        {
+            std::lock_guard<std::mutex> lock(sConfinedThreadsMutex);
+            auto i = confinedThreads().find(this);
+            thread = (i != confinedThreads().end()) ? i->second : nullptr;
+        }
+        if (_usuallyFalse(thread != currentThreadMarker())) {
+            char *message;
+            asprintf(&message, "Thread-confined RefCounted object <%s @ %p> %s on another thread",
+                     Unmangle(typeid(*this)).c_str(), this, what);
+#ifdef WarnError
+            WarnError("%s", message);
+#else
+            fprintf(stderr, "WARNING: %s\n", message);
+#endif
+            free(message);
+            abort();
+        }
+#endif
+    }
+
 }
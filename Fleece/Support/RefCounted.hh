@@ -33,7 +33,21 @@ namespace fleece {
     public:
         RefCounted()                            =default;
         
-        int refCount() const FLPURE             {return _refCount;}
+        int refCount() const FLPURE {
+            int32_t ref = _refCount;
+            return (ref > 0) ? (ref & ~kThreadConfinedFlag) : ref;
+        }
+
+        /** In thread-confined mode the ref-count is updated with plain, non-atomic arithmetic,
+            which is cheaper, but the object may then only be retained and released on the thread
+            that called this method. (Debug builds check this.) Calling it with `false` restores
+            the normal thread-safe mode, e.g. before handing the object to another thread. */
+        void setThreadConfined(bool confined) noexcept;
+
+        bool isThreadConfined() const FLPURE {
+            int32_t ref = _refCount.load(std::memory_order_relaxed);
+            return ref > 0 && (ref & kThreadConfinedFlag) != 0;
+        }
 
     protected:
         RefCounted(const RefCounted &)          { }
@@ -52,13 +66,27 @@ namespace fleece {
         void _retain() const noexcept           {_careful_retain();}
         void _release() const noexcept          {_careful_release();}
 #else
-        ALWAYS_INLINE void _retain() const noexcept   { ++_refCount; }
+        ALWAYS_INLINE void _retain() const noexcept {
+            int32_t ref = _refCount.load(std::memory_order_relaxed);
+            if (ref & kThreadConfinedFlag)
+                _refCount.store(ref + 1, std::memory_order_relaxed);
+            else
+                ++_refCount;
+        }
         void _release() const noexcept;
 #endif
 
+        // Thread-confined mode is flagged by this bit of _refCount. (An extra field would change
+        // the layout of subclasses like HeapValue; debug builds keep the thread in a side table.)
+        static constexpr int32_t kThreadConfinedFlag = 0x40000000;
+
         static constexpr int32_t kCarefulInitialRefCount = -6666666;
+        // (Initial ref-count of a new object made thread-confined before it's first retained)
+        static constexpr int32_t kCarefulInitialConfinedRefCount
+                                                = kCarefulInitialRefCount & ~kThreadConfinedFlag;
         void _careful_retain() const noexcept;
         void _careful_release() const noexcept;
+        void _checkThread(const char *what) const noexcept;
 
         mutable std::atomic<int32_t> _refCount
 #if DEBUG
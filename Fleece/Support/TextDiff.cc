@@ -0,0 +1,340 @@
+//
+// TextDiff.cc
+//
+// Copyright © 2020 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "TextDiff.hh"
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+#include <unordered_map>
+#include "betterassert.hh"
+
+namespace fleece {
+    using namespace std;
+
+    // Texts whose differing parts are at least this long are compared line by line first:
+    static constexpr size_t kMinLineDiffSize = 1024;
+
+    // ...as long as they both have at least this many lines:
+    static constexpr size_t kMinLineDiffLines = 4;
+
+
+    // Compares 8 bytes at a time. (Even without SIMD, this is several times faster than a byte
+    // loop on long runs of matching text.)
+    size_t TextDiff::commonPrefix(const uint8_t *a, const uint8_t *b, size_t maxLen) {
+        size_t i = 0;
+        for (; i + 8 <= maxLen; i += 8) {
+            uint64_t wa, wb;
+            memcpy(&wa, a + i, 8);
+            memcpy(&wb, b + i, 8);
+            if (wa != wb)
+                break;
+        }
+        while (i < maxLen && a[i] == b[i])
+            ++i;
+        return i;
+    }
+
+
+    size_t TextDiff::commonSuffix(const uint8_t *aEnd, const uint8_t *bEnd, size_t maxLen) {
+        size_t i = 0;
+        for (; i + 8 <= maxLen; i += 8) {
+            uint64_t wa, wb;
+            memcpy(&wa, aEnd - i - 8, 8);
+            memcpy(&wb, bEnd - i - 8, 8);
+            if (wa != wb)
+                break;
+        }
+        while (i < maxLen && aEnd[-1 - long(i)] == bEnd[-1 - long(i)])
+            ++i;
+        return i;
+    }
+
+
+    template <class T>
+    static size_t matchForward(const T *a, const T *b, size_t maxLen) {
+        size_t i = 0;
+        while (i < maxLen && a[i] == b[i])
+            ++i;
+        return i;
+    }
+
+    template <class T>
+    static size_t matchBackward(const T *aEnd, const T *bEnd, size_t maxLen) {
+        size_t i = 0;
+        while (i < maxLen && aEnd[-1 - long(i)] == bEnd[-1 - long(i)])
+            ++i;
+        return i;
+    }
+
+    template <>
+    size_t matchForward(const uint8_t *a, const uint8_t *b, size_t maxLen) {
+        return TextDiff::commonPrefix(a, b, maxLen);
+    }
+
+    template <>
+    size_t matchBackward(const uint8_t *aEnd, const uint8_t *bEnd, size_t maxLen) {
+        return TextDiff::commonSuffix(aEnd, bEnd, maxLen);
+    }
+
+
+    // Appends an operation to a list of chunks, combining it with the last one if possible.
+    void TextDiff::add(vector<Chunk> &chunks, Op op, size_t n) {
+        if (n == 0)
+            return;
+        if (op == kEqual) {
+            if (chunks.empty() || chunks.back().deleted || chunks.back().inserted)
+                chunks.push_back({n, 0, 0});
+            else
+                chunks.back().equal += n;
+        } else {
+            if (chunks.empty())
+                chunks.push_back({0, 0, 0});
+            (op == kDelete ? chunks.back().deleted : chunks.back().inserted) += n;
+        }
+    }
+
+
+    // Myers' diff of two sequences (of bytes, or of line numbers), in linear space. The edit graph
+    // is searched forwards from the start and backwards from the end at once; where the paths
+    // meet is a point on an optimal path, and the ranges before and after it are diffed
+    // recursively. <http://www.xmailserver.org/diff2.pdf>, section 4b.
+    // Each step of the search, and each item compared, counts as a step. Once there have been
+    // more than `maxSteps`, the ranges not yet diffed are treated as deleted and inserted.
+    template <class T>
+    class Myers {
+    public:
+        Myers(const T *a, const T *b, size_t &steps, size_t maxSteps, vector<TextDiff::Chunk> &out)
+        :_a(a), _b(b), _steps(steps), _maxSteps(maxSteps), _out(out)
+        { }
+
+        void diff(long aStart, long aEnd, long bStart, long bEnd) {
+            long prefix = (long)matchForward(&_a[aStart], &_b[bStart],
+                                             min(aEnd - aStart, bEnd - bStart));
+            aStart += prefix;
+            bStart += prefix;
+            long suffix = (long)matchBackward(&_a[aEnd], &_b[bEnd],
+                                              min(aEnd - aStart, bEnd - bStart));
+            aEnd -= suffix;
+            bEnd -= suffix;
+
+            TextDiff::add(_out, TextDiff::kEqual, prefix);
+            if (aStart == aEnd || bStart == bEnd || !bisect(aStart, aEnd, bStart, bEnd)) {
+                TextDiff::add(_out, TextDiff::kDelete, aEnd - aStart);
+                TextDiff::add(_out, TextDiff::kInsert, bEnd - bStart);
+            }
+            TextDiff::add(_out, TextDiff::kEqual, suffix);
+        }
+
+    private:
+        // Finds a point where the forward and backward paths meet, and diffs the ranges on either
+        // side of it. Returns false if it ran out of steps first.
+        bool bisect(long aStart, long aEnd, long bStart, long bEnd) {
+            const T *a = &_a[aStart], *b = &_b[bStart];
+            const long n = aEnd - aStart, m = bEnd - bStart, delta = n - m;
+            const bool forwardMeets = (delta & 1) != 0;
+            // Search d costs about d steps in each direction, so the steps left limit how far
+            // the search can go; that limits the size of the arrays, too:
+            if (_steps >= _maxSteps)
+                return false;
+            long maxD = min((n + m + 1) / 2, (long)sqrt(double(_maxSteps - _steps)) + 2);
+            long offset = maxD, size = 2 * maxD + 2;
+            // vf[offset+k] is the furthest x reached on diagonal k (= x - y) going forwards, and
+            // vb[offset+k] the same going backwards, measured from the ends; -1 if not yet reached.
+            vector<long> vf(size, -1), vb(size, -1);
+            vf[offset + 1] = vb[offset + 1] = 0;
+            // These trim the range of diagonals that have run off the edge of the graph:
+            long kfStart = 0, kfEnd = 0, kbStart = 0, kbEnd = 0;
+            for (long d = 0; d < maxD; ++d) {
+                for (long k = -d + kfStart; k <= d - kfEnd; k += 2) {
+                    long i = offset + k;
+                    long x = (k == -d || (k != d && vf[i-1] < vf[i+1])) ? vf[i+1] : vf[i-1] + 1;
+                    long y = x - k;
+                    if (x < n && y < m) {
+                        long len = (long)matchForward(&a[x], &b[y], min(n - x, m - y));
+                        x += len; y += len;
+                        _steps += len;
+                    }
+                    vf[i] = x;
+                    if (x > n) {
+                        kfEnd += 2;
+                    } else if (y > m) {
+                        kfStart += 2;
+                    } else if (forwardMeets) {
+                        long ib = offset + delta - k;
+                        if (ib >= 0 && ib < size && vb[ib] != -1 && x >= n - vb[ib]) {
+                            split(aStart, aEnd, bStart, bEnd, x, y);
+                            return true;
+                        }
+                    }
+                }
+                for (long k = -d + kbStart; k <= d - kbEnd; k += 2) {
+                    long i = offset + k;
+                    long x = (k == -d || (k != d && vb[i-1] < vb[i+1])) ? vb[i+1] : vb[i-1] + 1;
+                    long y = x - k;
+                    if (x < n && y < m) {
+                        long len = (long)matchBackward(&a[n - x], &b[m - y], min(n - x, m - y));
+                        x += len; y += len;
+                        _steps += len;
+                    }
+                    vb[i] = x;
+                    if (x > n) {
+                        kbEnd += 2;
+                    } else if (y > m) {
+                        kbStart += 2;
+                    } else if (!forwardMeets) {
+                        long iF = offset + delta - k;
+                        if (iF >= 0 && iF < size && vf[iF] != -1 && vf[iF] >= n - x) {
+                            long xf = vf[iF];
+                            split(aStart, aEnd, bStart, bEnd, xf, xf - (delta - k));
+                            return true;
+                        }
+                    }
+                }
+                _steps += 2 * d + 2;
+                if (_steps > _maxSteps)
+                    break;
+            }
+            return false;
+        }
+
+        void split(long aStart, long aEnd, long bStart, long bEnd, long x, long y) {
+            diff(aStart, aStart + x, bStart, bStart + y);
+            diff(aStart + x, aEnd, bStart + y, bEnd);
+        }
+
+        const T* const          _a;
+        const T* const          _b;
+        size_t&                 _steps;
+        size_t const            _maxSteps;
+        vector<TextDiff::Chunk>& _out;
+    };
+
+
+    bool TextDiff::diff(size_t maxSteps) {
+        _chunks.clear();
+        _steps = 0;
+        _maxSteps = maxSteps;
+
+        // The line diff works better without the common prefix and suffix:
+        size_t n = _old.size, m = _nuu.size;
+        auto oldBytes = (const uint8_t*)_old.buf, nuuBytes = (const uint8_t*)_nuu.buf;
+        size_t prefix = commonPrefix(oldBytes, nuuBytes, min(n, m));
+        size_t suffix = commonSuffix(oldBytes + n, nuuBytes + m, min(n, m) - prefix);
+        add(_chunks, kEqual, prefix);
+        if (n - prefix - suffix < kMinLineDiffSize || m - prefix - suffix < kMinLineDiffSize
+                || !diffLines(prefix, n - suffix, prefix, m - suffix)) {
+            diffBytes(prefix, n - suffix, prefix, m - suffix);
+        }
+        add(_chunks, kEqual, suffix);
+
+        snapToUTF8();
+        return _steps <= _maxSteps;
+    }
+
+
+    void TextDiff::diffBytes(size_t oldStart, size_t oldEnd, size_t nuuStart, size_t nuuEnd) {
+        Myers<uint8_t> myers((const uint8_t*)_old.buf, (const uint8_t*)_nuu.buf,
+                             _steps, _maxSteps, _chunks);
+        myers.diff(oldStart, oldEnd, nuuStart, nuuEnd);
+    }
+
+
+    // Diffs the lines of the two ranges, treating each distinct line as a single item, and then
+    // diffs the bytes of each run of changed lines. Returns false if there are too few lines.
+    bool TextDiff::diffLines(size_t oldStart, size_t oldEnd, size_t nuuStart, size_t nuuEnd) {
+        unordered_map<slice, uint32_t> lineIDs;
+        auto splitLines = [&](slice str, size_t start, size_t end,
+                              vector<uint32_t> &lines, vector<size_t> &offsets) {
+            for (size_t pos = start; pos < end; ) {
+                auto nl = (const uint8_t*)memchr(&str[pos], '\n', end - pos);
+                size_t lineEnd = nl ? (nl - (const uint8_t*)str.buf) + 1 : end;
+                slice line(&str[pos], lineEnd - pos);
+                lines.push_back(lineIDs.emplace(line, uint32_t(lineIDs.size())).first->second);
+                offsets.push_back(pos);
+                pos = lineEnd;
+            }
+            offsets.push_back(end);
+        };
+        vector<uint32_t> oldLines, nuuLines;
+        vector<size_t> oldOffsets, nuuOffsets;
+        splitLines(_old, oldStart, oldEnd, oldLines, oldOffsets);
+        splitLines(_nuu, nuuStart, nuuEnd, nuuLines, nuuOffsets);
+        if (oldLines.size() < kMinLineDiffLines || nuuLines.size() < kMinLineDiffLines)
+            return false;
+
+        vector<Chunk> lineChunks;
+        Myers<uint32_t> myers(oldLines.data(), nuuLines.data(), _steps, _maxSteps, lineChunks);
+        myers.diff(0, long(oldLines.size()), 0, long(nuuLines.size()));
+
+        size_t oldLine = 0, nuuLine = 0;
+        for (auto &c : lineChunks) {
+            add(_chunks, kEqual, oldOffsets[oldLine + c.equal] - oldOffsets[oldLine]);
+            oldLine += c.equal;
+            nuuLine += c.equal;
+            size_t oldPos = oldOffsets[oldLine], nuuPos = nuuOffsets[nuuLine];
+            oldLine += c.deleted;
+            nuuLine += c.inserted;
+            diffBytes(oldPos, oldOffsets[oldLine], nuuPos, nuuOffsets[nuuLine]);
+        }
+        return true;
+    }
+
+
+    // Moves chunk boundaries that fall within a UTF-8 character, by moving the character's bytes
+    // out of the equal run and into the adjacent edit.
+    void TextDiff::snapToUTF8() {
+        auto isContinuation = [](slice str, size_t pos) {
+            return pos < str.size && (str[pos] & 0xC0) == 0x80;
+        };
+        vector<Chunk> snapped;
+        snapped.reserve(_chunks.size());
+        size_t oldPos = 0, nuuPos = 0;          // Start of the current chunk's equal run
+        for (Chunk c : _chunks) {
+            if (!snapped.empty()) {
+                // The previous edit ends here, so it takes any continuation bytes:
+                auto &prev = snapped.back();
+                while (c.equal > 0 && isContinuation(_old, oldPos)) {
+                    --c.equal;
+                    ++prev.deleted;
+                    ++prev.inserted;
+                    ++oldPos;
+                    ++nuuPos;
+                }
+            }
+            if (c.deleted || c.inserted) {
+                // The edit starts after the equal run, so it takes the rest of a split character:
+                while (c.equal > 0 && (isContinuation(_old, oldPos + c.equal)
+                                       || isContinuation(_nuu, nuuPos + c.equal))) {
+                    --c.equal;
+                    ++c.deleted;
+                    ++c.inserted;
+                }
+            }
+            oldPos += c.equal + c.deleted;
+            nuuPos += c.equal + c.inserted;
+            if (c.equal == 0 && !snapped.empty()) {
+                snapped.back().deleted += c.deleted;
+                snapped.back().inserted += c.inserted;
+            } else {
+                snapped.push_back(c);
+            }
+        }
+        _chunks = move(snapped);
+    }
+
+}
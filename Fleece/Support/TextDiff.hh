@@ -0,0 +1,77 @@
+//
+// TextDiff.hh
+//
+// Copyright © 2020 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include "fleece/slice.hh"
+#include <vector>
+
+namespace fleece {
+
+    /** Finds the differences between two strings. The result is a list of Chunks, each of which
+        is a run of bytes common to both strings, followed by bytes deleted from the old string
+        and bytes inserted from the new one.
+
+        It uses Myers' O(ND) diff algorithm, in linear space, after trimming the common prefix
+        and suffix; long texts are first compared line by line, and then the changed lines byte by
+        byte. The work is limited to a number of steps (roughly, byte comparisons.) Past that, the
+        ranges that remain to be compared are just deleted and inserted, so the result depends
+        only on the input, but may be larger than the minimal diff.
+
+        Chunk boundaries never fall in the middle of a UTF-8 multibyte character. */
+    class TextDiff {
+    public:
+        struct Chunk {
+            size_t equal;           // Number of bytes that are the same in both strings,
+            size_t deleted;         // then the number of bytes deleted from the old string,
+            size_t inserted;        // then the number of bytes inserted from the new string.
+        };
+
+        TextDiff(slice oldStr, slice nuuStr)        :_old(oldStr), _nuu(nuuStr) { }
+
+        /** Computes the diff, taking at most about `maxSteps` steps. Returns false if it ran out
+            of steps, in which case the diff is correct but probably not minimal. */
+        bool diff(size_t maxSteps);
+
+        const std::vector<Chunk>& chunks() const    {return _chunks;}
+
+        /** The number of steps the diff took. */
+        size_t steps() const                        {return _steps;}
+
+        /** The number of bytes that are the same at the start of `a` and `b`. */
+        static size_t commonPrefix(const uint8_t *a, const uint8_t *b, size_t maxLen);
+
+        /** The number of bytes that are the same at the end of `a` and `b`; the pointers point
+            just past the ends. */
+        static size_t commonSuffix(const uint8_t *aEnd, const uint8_t *bEnd, size_t maxLen);
+
+    private:
+        template <class T> friend class Myers;
+        enum Op {kEqual, kDelete, kInsert};
+        static void add(std::vector<Chunk>&, Op, size_t n);
+
+        bool diffLines(size_t oldStart, size_t oldEnd, size_t nuuStart, size_t nuuEnd);
+        void diffBytes(size_t oldStart, size_t oldEnd, size_t nuuStart, size_t nuuEnd);
+        void snapToUTF8();
+
+        slice _old, _nuu;
+        std::vector<Chunk> _chunks;
+        size_t _steps {0}, _maxSteps {0};
+    };
+
+}
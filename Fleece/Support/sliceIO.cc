@@ -42,6 +42,10 @@
 #define O_BINARY 0
 #endif
 
+#if FL_HAVE_MMAP
+    #include <sys/mman.h>
+#endif
+
 
 namespace fleece {
 
@@ -80,6 +84,43 @@ namespace fleece {
         writeToFile(s, path, O_CREAT | O_APPEND);
     }
 
+
+#if FL_HAVE_MMAP
+
+    static void* mapFile(FILE *f, size_t size) {
+        void *mapped = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fileno(f), 0);
+        if (mapped == MAP_FAILED)
+            FleeceException::_throwErrno("Can't memory-map file");
+        return mapped;
+    }
+
+    mmap_slice::mmap_slice(FILE *f, size_t size)
+    :pure_slice(mapFile(f, size), size)
+    { }
+
+    mmap_slice::mmap_slice(mmap_slice &&other) noexcept
+    :pure_slice(other.buf, other.size)
+    {
+        other.set(nullptr, 0);
+    }
+
+    mmap_slice& mmap_slice::operator= (mmap_slice &&other) noexcept {
+        if (&other != this) {
+            if (buf)
+                ::munmap((void*)buf, size);
+            set(other.buf, other.size);
+            other.set(nullptr, 0);
+        }
+        return *this;
+    }
+
+    mmap_slice::~mmap_slice() {
+        if (buf)
+            ::munmap((void*)buf, size);
+    }
+
+#endif // FL_HAVE_MMAP
+
 }
 
 #endif // FL_HAVE_FILESYSTEM
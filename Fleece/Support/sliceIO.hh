@@ -26,6 +26,15 @@
 #define FL_HAVE_FILESYSTEM 1
 #endif
 
+// True if we can memory-map files.
+#ifndef FL_HAVE_MMAP
+    #if FL_HAVE_FILESYSTEM && !defined(_MSC_VER)
+        #define FL_HAVE_MMAP 1
+    #else
+        #define FL_HAVE_MMAP 0
+    #endif
+#endif
+
 #if FL_HAVE_FILESYSTEM
 
 namespace fleece {
@@ -36,6 +45,24 @@ namespace fleece {
     void writeToFile(slice s, const char *path);
     void appendToFile(slice s, const char *path);
 
+
+#if FL_HAVE_MMAP
+    /** A read-only memory-mapped file. The slice starts at the beginning of the file and has
+        the given size, which may be larger than the file; then data appended to the file later
+        becomes visible in the mapped range. (But don't read past the current end of the file:
+        that may crash with a SIGBUS.) */
+    struct mmap_slice : public pure_slice {
+        mmap_slice(FILE* NONNULL, size_t size);
+        mmap_slice(mmap_slice&&) noexcept;
+        mmap_slice& operator= (mmap_slice&&) noexcept;
+        ~mmap_slice();
+
+    private:
+        mmap_slice(const mmap_slice&) =delete;
+        mmap_slice& operator= (const mmap_slice&) =delete;
+    };
+#endif
+
 }
 
 #endif // FL_HAVE_FILESYSTEM
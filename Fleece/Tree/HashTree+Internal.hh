@@ -17,11 +17,16 @@
 //
 
 #pragma once
+#include "HashTree.hh"
 #include "fleece/slice.hh"
 #include "fleece/Fleece.hh"
 #include "Bitmap.hh"
 #include "Endian.hh"
+#include "function_ref.hh"
 #include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
 
 namespace fleece { namespace hashtree {
 
@@ -34,18 +39,41 @@ namespace fleece { namespace hashtree {
         Children:
             is a contiguous array of (8-byte) interior & leaf nodes
 
+        Collision Bucket:
+            A leaf node whose key is an Array, not a string. It holds keys with identical hashes:
+            the key Array contains the keys as strings, in ascending order, and the value is an
+            Array of their values in the same order.
+
+        Trailer:
+            magic    [4 bytes: "HTre"]
+            tag      [1 byte: always 1, which makes the trailer look like a leaf node]
+            version  [1 byte]
+            hash     [1 byte: HashID of the hash function]
+            flags    [1 byte: TrailerFlags]
+
+        Key Index Reference:
+            index    [4-byte offset, or 0 if the index is empty]
+            reserved [4 bytes]
+
         All numbers are little-endian.
         All offsets are byte counts backwards from the start of the containing node.
 
-        The root node is at the end of the data, so it starts 8 bytes before the end.
+        In format version 0 the root node is at the end of the data, so it starts 8 bytes
+        before the end, and the hash function is 32-bit FNV-1a.
+        In later versions the root node is followed by the 8-byte trailer. A root node can't be
+        a leaf, so the tag tells which format the last 8 bytes are in.
+        If the trailer has the kHasKeyIndex flag, the root node is preceded by a key index
+        reference, which points to the root page of the tree's key index. (The format of the
+        index is described in HashTreeKeyIndex.cc.)
      */
 
 
     union Node;
+    class Builder;
     class MutableInterior;
 
     // Types for the hash-array map:
-    using hash_t = uint32_t;
+    using hash_t = uint64_t;
     using bitmap_t = uint32_t;
     static constexpr int kBitShift = 5;                      // must be log2(8*sizeof(bitmap_t))
     static constexpr int kMaxChildren = 1 << kBitShift;
@@ -53,9 +81,55 @@ namespace fleece { namespace hashtree {
 
     // Hashes a key. The hash value for a key must always be the same no matter what platform or
     // software version this is, since the structure of the hash table depends on it.
-    FLPURE hash_t ComputeHash(slice key) noexcept;
+    FLPURE hash_t ComputeHash(slice key, HashID) noexcept;
+
+    // The functions ComputeHash calls, indexed by HashID. Only tests should change these, to
+    // weaker hash functions that force collisions.
+    using HashFunction = hash_t (*)(slice) noexcept;
+    extern HashFunction gHashFunctions[kNumHashIDs];
+
+
+    enum TrailerFlags : uint8_t {
+        kHasKeyIndex = 0x01,            // The root node is preceded by a KeyIndexRef
+    };
+
+    // The trailer that follows the root node, in format version 1 and later.
+    struct Trailer {
+        static constexpr uint8_t kCurrentVersion = 1;
+
+        explicit Trailer(HashID h, uint8_t f =0)    :hashID(h), flags(f) { }
+
+        bool isValid() const            {return memcmp(magic, "HTre", 4) == 0 && tag == 1
+                                                && version >= 1 && version <= kCurrentVersion
+                                                && hashID < kNumHashIDs;}
+
+        char    magic[4]    {'H', 'T', 'r', 'e'};
+        uint8_t tag         {1};
+        uint8_t version     {kCurrentVersion};
+        HashID  hashID;
+        uint8_t flags;
+    };
+
 
-    // Internal class representing a leaf node
+    // Precedes the root node of a tree that has a key index.
+    struct KeyIndexRef {
+        explicit KeyIndexRef(uint32_t indexPos)     :_indexOffset(indexPos) { }
+
+        // The root page of the index, or nullptr if the index is empty.
+        Array index() const {
+            if (_indexOffset == 0)
+                return nullptr;
+            return Value((FLValue)((const uint8_t*)this - _indexOffset)).asArray();
+        }
+
+        void makeRelativeTo(uint32_t pos)           {_indexOffset = pos - _indexOffset;}
+
+    private:
+        endian::uint32_le_unaligned _indexOffset;
+        endian::uint32_le_unaligned _reserved {0};
+    };
+
+    // Internal class representing a leaf node, or a collision bucket
     class Leaf {
     public:
         void validate() const;
@@ -64,11 +138,20 @@ namespace fleece { namespace hashtree {
         Value value() const;
         slice keyString() const;
 
-        hash_t hash() const             {return ComputeHash(keyString());}
+        bool isBucket() const           {return key().type() == kFLArray;}
+
+        hash_t hash(HashID h) const     {return ComputeHash(entryAt(0).first, h);}
+
+        bool matches(slice key) const   {return !isBucket() && keyString() == key;}
 
-        bool matches(slice key) const   {return keyString() == key;}
+        // Returns the value for a key, or nullptr if this leaf (or bucket) doesn't contain it.
+        Value get(slice key) const;
 
-        void dump(std::ostream&, unsigned indent) const;
+        // The number of keys: 1, or more if this is a bucket.
+        unsigned entryCount() const;
+        std::pair<slice,Value> entryAt(unsigned i) const;
+
+        void dump(std::ostream&, HashID, unsigned indent) const;
 
         uint32_t keyOffset() const             {return _keyOffset;}
         uint32_t valueOffset() const           {return _keyOffset;}
@@ -94,6 +177,7 @@ namespace fleece { namespace hashtree {
         endian::uint32_le_unaligned _valueOffset;
 
         friend union Node;
+        friend class Builder;
         friend class Interior;
         friend class MutableInterior;
     };
@@ -114,7 +198,7 @@ namespace fleece { namespace hashtree {
 
         bitmap_t bitmap() const;
 
-        void dump(std::ostream&, unsigned indent) const;
+        void dump(std::ostream&, HashID, unsigned indent) const;
 
         uint32_t childrenOffset() const             {return _childrenOffset;}
 
@@ -151,6 +235,26 @@ namespace fleece { namespace hashtree {
             return this;
         }
     };
+
+
+    // Writes the root node of a tree and returns its position. If `keyIndex` is true, the root
+    // is preceded by a KeyIndexRef to the index's root page at `keyIndexPos`, if any. A tree
+    // whose hash isn't FNV-1a, or that has a key index, gets a trailer after the root (and so
+    // can't be read by versions of Fleece that predate the trailer.)
+    uint32_t WriteRoot(Encoder&, Interior root, HashID,
+                       bool keyIndex =false, std::optional<uint32_t> keyIndexPos ={});
+
+    // Writes a key index and returns the position of its root page, or nothing if it's empty.
+    // If there's a `baseIndex`, it's updated: `changedKeys` are the keys that may have been
+    // added or removed since, and `containsKey` tells which of them are in the tree now.
+    // Otherwise the index is written from scratch, and `changedKeys` are all the keys.
+    // Either way, `changedKeys` must be in ascending order.
+    // `cutoff` is the Encoder's base cutoff, if any: pages of `baseIndex` that use data before
+    // it are copied instead of pointed to.
+    std::optional<uint32_t> WriteKeyIndex(Encoder&, Array baseIndex,
+                                          const std::vector<slice> &changedKeys,
+                                          function_ref<bool(slice)> containsKey,
+                                          const void *cutoff =nullptr);
     
 } }
 
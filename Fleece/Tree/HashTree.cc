@@ -27,6 +27,10 @@
 #include <string>
 #include "betterassert.hh"
 
+namespace fleece::wyhash {
+    #include "wyhash.h"
+}
+
 using namespace std;
 
 namespace fleece {
@@ -38,7 +42,7 @@ namespace fleece {
     namespace hashtree {
 
 
-        FLPURE hash_t ComputeHash(slice s) noexcept {
+        static hash_t FNV1a32Hash(slice s) noexcept {
             // FNV-1a hash function.
             // <https://en.wikipedia.org/wiki/Fowler–Noll–Vo_hash_function#FNV-1a_hash>
             auto byte = (const uint8_t*)s.buf;
@@ -49,6 +53,19 @@ namespace fleece {
             return h;
         }
 
+        static hash_t WyHash64(slice s) noexcept {
+            // (Unlike FLSlice_Hash, which uses a different function on 32-bit CPUs, this
+            // always produces the same output.)
+            return wyhash::wyhash(s.buf, s.size, 0, wyhash::_wyp);
+        }
+
+        HashFunction gHashFunctions[kNumHashIDs] = {&FNV1a32Hash, &WyHash64};
+
+        FLPURE hash_t ComputeHash(slice s, HashID h) noexcept {
+            return gHashFunctions[h](s);
+        }
+
+
         void Leaf::validate() const {
             assert(_keyOffset > 0);
             assert(_valueOffset > 0);
@@ -58,6 +75,40 @@ namespace fleece {
         Value Leaf::value() const               {return derefValue(_valueOffset & ~1);}
         slice Leaf::keyString() const           {return derefValue(_keyOffset).asString();}
 
+        unsigned Leaf::entryCount() const {
+            Value k = key();
+            return k.type() == kFLArray ? k.asArray().count() : 1;
+        }
+
+        pair<slice,Value> Leaf::entryAt(unsigned i) const {
+            Value k = key();
+            if (k.type() != kFLArray) {
+                assert_precondition(i == 0);
+                return {k.asString(), value()};
+            }
+            return {k.asArray().get(i).asString(), value().asArray().get(i)};
+        }
+
+        Value Leaf::get(slice keyStr) const {
+            Value k = key();
+            if (_usuallyTrue(k.type() != kFLArray))
+                return (k.asString() == keyStr) ? value() : nullptr;
+            // Collision bucket; binary-search its sorted keys:
+            Array keys = k.asArray();
+            uint32_t lo = 0, hi = keys.count();
+            while (lo < hi) {
+                uint32_t mid = (lo + hi) / 2;
+                int cmp = keys.get(mid).asString().compare(keyStr);
+                if (cmp == 0)
+                    return value().asArray().get(mid);
+                else if (cmp < 0)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            return nullptr;
+        }
+
         uint32_t Leaf::writeTo(Encoder &enc, bool writeKey) const {
             if (enc.base().containsAddress(this)) {
                 auto pos = int32_t((char*)this - (char*)enc.base().end());
@@ -71,13 +122,18 @@ namespace fleece {
             }
         }
 
-        void Leaf::dump(std::ostream &out, unsigned indent) const {
+        void Leaf::dump(std::ostream &out, HashID hashID, unsigned indent) const {
             char hashStr[30];
-            sprintf(hashStr, "[%08x ", hash());
-            out << string(2*indent, ' ') << hashStr << '"';
-            auto k = keyString();
-            out.write((char*)k.buf, k.size);
-            out << "\"=" << value().toJSONString() << "]";
+            sprintf(hashStr, "[%016llx ", (unsigned long long)hash(hashID));
+            out << string(2*indent, ' ') << hashStr;
+            if (isBucket()) {
+                out << key().toJSONString() << "=" << value().toJSONString() << "]";
+            } else {
+                out << '"';
+                auto k = keyString();
+                out.write((char*)k.buf, k.size);
+                out << "\"=" << value().toJSONString() << "]";
+            }
         }
 
         
@@ -116,23 +172,23 @@ namespace fleece {
             auto c = childAtIndex(0);
             for (unsigned n = childCount(); n > 0; --n, ++c) {
                 if (c->isLeaf())
-                    count += 1;
+                    count += c->leaf.entryCount();
                 else
                     count += ((Interior*)c)->leafCount();
             }
             return count;
         }
 
-        void Interior::dump(std::ostream &out, unsigned indent =1) const {
+        void Interior::dump(std::ostream &out, HashID hashID, unsigned indent =1) const {
             unsigned n = childCount();
             out << string(2*indent, ' ') << "[";
             auto child = childAtIndex(0);
             for (unsigned i = 0; i < n; ++i, ++child) {
                 out << "\n";
                 if (child->isLeaf())
-                    child->leaf.dump(out, indent+1);
+                    child->leaf.dump(out, hashID, indent+1);
                 else
-                    child->interior.dump(out, indent+1);
+                    child->interior.dump(out, hashID, indent+1);
             }
             out << " ]";
         }
@@ -176,25 +232,81 @@ namespace fleece {
             }
         }
 
+
+        uint32_t WriteRoot(Encoder &enc, Interior root, HashID hashID,
+                           bool keyIndex, optional<uint32_t> keyIndexPos)
+        {
+            if (keyIndex) {
+                KeyIndexRef ref(keyIndexPos ? *keyIndexPos : 0);
+                if (keyIndexPos)
+                    ref.makeRelativeTo((uint32_t)enc.nextWritePos());
+                enc.writeRaw({&ref, sizeof(ref)});
+            }
+            auto curPos = (uint32_t)enc.nextWritePos();
+            root.makeRelativeTo(curPos);
+            enc.writeRaw({&root, sizeof(root)});
+            if (hashID != kFNV1a32Hash || keyIndex) {
+                Trailer trailer(hashID, keyIndex ? kHasKeyIndex : 0);
+                enc.writeRaw({&trailer, sizeof(trailer)});
+            }
+            return curPos;
+        }
+
     }
 
     using namespace hashtree;
 
 
     const HashTree* HashTree::fromData(slice data) {
-        return (const HashTree*)offsetby(data.end(), -(ssize_t)sizeof(Interior));
+        static_assert(sizeof(Trailer) == sizeof(Node));
+        static_assert(sizeof(KeyIndexRef) == sizeof(Node));
+        if (data.size < sizeof(Interior))
+            return nullptr;
+        auto tree = (const HashTree*)offsetby(data.end(), -(ssize_t)sizeof(Interior));
+        auto trailer = tree->trailer();
+        if (trailer) {
+            size_t minSize = sizeof(Interior) + sizeof(Trailer);
+            if (trailer->flags & kHasKeyIndex)
+                minSize += sizeof(KeyIndexRef);
+            if (data.size < minSize || !trailer->isValid())
+                return nullptr;
+        }
+        return tree;
     }
 
 
+    // The last 8 bytes are either the root node (format version 0) or a trailer.
+    const Trailer* HashTree::trailer() const {
+        return ((const Node*)this)->isLeaf() ? (const Trailer*)this : nullptr;
+    }
+
     const Interior* HashTree::rootNode() const {
+        if (trailer())
+            return (const Interior*)this - 1;
         return (const Interior*)this;
     }
 
+    HashID HashTree::hashID() const {
+        auto t = trailer();
+        return t ? t->hashID : kFNV1a32Hash;
+    }
+
+    bool HashTree::hasKeyIndex() const {
+        auto t = trailer();
+        return t && (t->flags & kHasKeyIndex);
+    }
+
+    Array HashTree::keyIndex() const {
+        if (!hasKeyIndex())
+            return nullptr;
+        return ((const KeyIndexRef*)rootNode() - 1)->index();
+    }
+
     Value HashTree::get(slice key) const {
         auto root = rootNode();
-        auto leaf = root->findNearest(ComputeHash(key));
-        if (leaf && leaf->keyString() == key)
-            return leaf->value();
+        auto leaf = root->findNearest(ComputeHash(key, hashID()));
+        if (leaf)
+            return leaf->get(key);
         return nullptr;
     }
 
@@ -204,7 +316,7 @@ namespace fleece {
 
     void HashTree::dump(ostream &out) const {
         out << "HashTree [\n";
-        rootNode()->dump(out);
+        rootNode()->dump(out, hashID());
         out << "]\n";
     }
 
@@ -20,26 +20,83 @@
 #include "fleece/slice.hh"
 #include "fleece/Fleece.hh"
 #include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace fleece {
 
     class MutableHashTree;
 
     namespace hashtree {
+        // Identifies the hash function of a tree. These values are stored in the trailer, so
+        // they must never change.
+        enum HashID : uint8_t {
+            kFNV1a32Hash = 0,           // 32-bit FNV-1a, the hash of all format-version-0 trees
+            kWyHash64,                  // 64-bit wyhash
+            kNumHashIDs
+        };
+
+        // The hash function of new trees:
+        static constexpr HashID kDefaultHashID = kWyHash64;
+
         class Interior;
+        struct Trailer;
         class MutableInterior;
         class NodeRef;
         struct iteratorImpl;
+        struct sortedIteratorImpl;
     }
 
 
     /** The root of an immutable tree encoded alongside Fleece data. */
     class HashTree {
     public:
+        /** Returns the tree whose root is at the end of the data, or nullptr if the data is in
+            a newer or unrecognized format. */
         static const HashTree* fromData(slice data);
 
         Value get(slice) const;
 
+        /** The hash function the tree's structure is based on. */
+        hashtree::HashID hashID() const;
+
+        /** True if the tree has a key index, so its keys can be visited in order by a
+            `sorted_iterator`. (See MutableHashTree::setHasKeyIndex.) */
+        bool hasKeyIndex() const;
+
+
+        using Entry = std::pair<slice, Value>;
+
+        /** Writes a new tree containing the given keys and values to an Encoder, and returns
+            the position of its root node (like MutableHashTree::writeTo; and likewise, nothing is
+            written and 0 is returned if there are no entries.) This is faster and
+            uses much less memory than adding the entries to a MutableHashTree and writing that:
+            the entries are hashed and sorted by hash, and then the nodes are written bottom-up.
+            By default this runs on the calling thread; to hash and sort in parallel, pass a
+            `maxThreads` greater than 1, or 0 for one thread per CPU core.
+            The entries can be in any order. If a key appears more than once, its last value
+            is used. The tree won't have a key index. */
+        static uint32_t build(Encoder&, const Entry *begin, const Entry *end,
+                              hashtree::HashID =hashtree::kDefaultHashID,
+                              unsigned maxThreads =1);
+
+        /** Writes a new tree from a sequence of anything convertible to `Entry`, such as
+            `std::pair<alloc_slice,Value>`. */
+        template <class ITER>
+        static uint32_t build(Encoder &enc, ITER begin, ITER end,
+                              hashtree::HashID hashID =hashtree::kDefaultHashID,
+                              unsigned maxThreads =1)
+        {
+            if constexpr (std::is_convertible_v<ITER, const Entry*>) {
+                return build(enc, (const Entry*)begin, (const Entry*)end, hashID, maxThreads);
+            } else {
+                std::vector<Entry> entries(begin, end);
+                return build(enc, entries.data(), entries.data() + entries.size(),
+                             hashID, maxThreads);
+            }
+        }
+
         unsigned count() const;
 
         void dump(std::ostream &out) const;
@@ -62,8 +119,41 @@ namespace fleece {
             Value _value;
         };
 
+
+        /** Iterates over a tree's keys in ascending (or descending) order, using its key index.
+            The tree must have a key index. */
+        class sorted_iterator {
+        public:
+            /** Starts at the first key, or if `reverse` is true, the last. If a `prefix` is
+                given, only the keys that start with it are visited. */
+            explicit sorted_iterator(const HashTree*,
+                                     bool reverse =false,
+                                     slice prefix =nullslice);
+            sorted_iterator(sorted_iterator&&);
+            ~sorted_iterator();
+
+            /** Moves to the first key that's greater than or equal to `key`; or when iterating
+                in reverse, the last key that's less than or equal to it. Returns false if there
+                is no such key, leaving the iterator at the end. */
+            bool seek(slice key);
+
+            slice key() const noexcept                      {return _key;}
+            /** Looks up the current key's value in the tree. */
+            Value value() const                             {return _tree->get(_key);}
+            explicit operator bool() const noexcept         {return _key.buf != nullptr;}
+            sorted_iterator& operator ++();
+        private:
+            void setKey(slice);
+
+            const HashTree* _tree;
+            std::unique_ptr<hashtree::sortedIteratorImpl> _impl;
+            slice _key;
+        };
+
     private:
+        const hashtree::Trailer* trailer() const;
         const hashtree::Interior* rootNode() const;
+        Array keyIndex() const;
 
         friend class hashtree::MutableInterior;
         friend class MutableHashTree;
@@ -0,0 +1,282 @@
+//
+//  HashTreeBuilder.cc
+//
+// Copyright © 2018 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "HashTree.hh"
+#include "HashTree+Internal.hh"
+#include "TempArray.hh"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "betterassert.hh"
+
+using namespace std;
+
+namespace fleece {
+    namespace hashtree {
+
+        /*  Writes a HashTree bottom-up from a batch of entries, without building it in memory.
+
+            Each entry's hash is rearranged into a "path", whose most significant bits are the
+            child bit-number at the root, followed by the bit-number at the next level, etc.
+            Sorting the entries by path then groups them exactly as the tree does: at every
+            level, the entries under one child of an interior node are a contiguous run. So
+            once they're sorted, each node can be written by a single scan of its run.
+
+            The hashing and the sorting are parallelized. The sort is split up by partitioning
+            the entries by their root bit-number first, which gives up to 32 independent sorts.
+            To keep memory usage low, the items being sorted are just a path and an index into
+            the caller's array of entries. */
+        class Builder {
+        public:
+            Builder(HashID hashID, unsigned maxThreads)
+            :_hashID(hashID)
+            ,_maxThreads(maxThreads ? maxThreads : max(thread::hardware_concurrency(), 1u))
+            { }
+
+
+            uint32_t build(Encoder &enc, const HashTree::Entry *begin, const HashTree::Entry *end) {
+                if (begin == end)
+                    return 0;               // (like MutableHashTree::writeTo with an empty tree)
+                _entries = begin;
+                partition(hashEntries(end - begin));
+                sortPartitions();
+
+                Interior root = writeInterior(enc, _items.data(), _items.data() + _items.size(), 0);
+                return WriteRoot(enc, root, _hashID);
+            }
+
+
+        private:
+            struct Item {
+                uint64_t path;          // Hash, with its bit-numbers rearranged (see above)
+                size_t   index;         // Index in _entries
+            };
+
+            slice key(const Item &item) const       {return _entries[item.index].first;}
+            Value value(const Item &item) const     {return _entries[item.index].second;}
+
+            static constexpr unsigned kMaxLevel = (8*sizeof(hash_t) - 1) / kBitShift;
+            static constexpr size_t   kMinItemsPerThread = 10000;
+
+            // The number of bits of the hash consumed at a level; the last level gets the rest.
+            static unsigned levelBits(unsigned level) {
+                return min(unsigned(kBitShift), unsigned(8*sizeof(hash_t)) - level * kBitShift);
+            }
+
+            static uint64_t pathOf(hash_t hash) {
+                uint64_t path = 0;
+                for (unsigned level = 0; level <= kMaxLevel; ++level) {
+                    unsigned bits = levelBits(level);
+                    path = (path << bits) | ((hash >> (level * kBitShift)) & ((1u << bits) - 1));
+                }
+                return path;
+            }
+
+            // The bit-number of the child of a level's interior node, that an Item belongs under.
+            static unsigned childBitNumber(uint64_t path, unsigned level) {
+                unsigned bits = levelBits(level);
+                unsigned pos = unsigned(8*sizeof(hash_t)) - level * kBitShift - bits;
+                return unsigned(path >> pos) & ((1u << bits) - 1);
+            }
+
+            // Runs `fn(i)` for i in [0, n), on up to `_maxThreads` threads.
+            template <class FN>
+            void parallelFor(size_t n, size_t threadCount, FN fn) {
+                threadCount = min(threadCount, n);
+                if (threadCount <= 1) {
+                    for (size_t i = 0; i < n; ++i)
+                        fn(i);
+                    return;
+                }
+                atomic<size_t> next {0};
+                auto work = [&] {
+                    for (size_t i; (i = next++) < n; )
+                        fn(i);
+                };
+                vector<thread> threads;
+                for (size_t t = 1; t < threadCount; ++t)
+                    threads.emplace_back(work);
+                work();
+                for (auto &th : threads)
+                    th.join();
+            }
+
+
+            // Returns the paths of all the entries.
+            vector<uint64_t> hashEntries(size_t n) {
+                vector<uint64_t> paths(n);
+                size_t nChunks = max(size_t(1), min(size_t(_maxThreads), n / kMinItemsPerThread));
+                size_t chunkSize = (n + nChunks - 1) / nChunks;
+                parallelFor(nChunks, nChunks, [&](size_t chunk) {
+                    size_t stop = min(n, (chunk + 1) * chunkSize);
+                    for (size_t i = chunk * chunkSize; i < stop; ++i)
+                        paths[i] = pathOf(ComputeHash(_entries[i].first, _hashID));
+                });
+                return paths;
+            }
+
+
+            // Creates the items, grouped by their root bit-number.
+            void partition(const vector<uint64_t> &paths) {
+                size_t counts[kMaxChildren] = {};
+                for (auto path : paths)
+                    ++counts[childBitNumber(path, 0)];
+                size_t pos[kMaxChildren];
+                _partitionStarts[0] = 0;
+                for (unsigned bit = 0; bit < kMaxChildren; ++bit) {
+                    pos[bit] = _partitionStarts[bit];
+                    _partitionStarts[bit + 1] = _partitionStarts[bit] + counts[bit];
+                }
+                _items.resize(paths.size());
+                for (size_t i = 0; i < paths.size(); ++i)
+                    _items[pos[childBitNumber(paths[i], 0)]++] = {paths[i], i};
+            }
+
+
+            // Sorts each partition by path, then key, then index; and removes all but the last
+            // of each set of duplicate keys.
+            void sortPartitions() {
+                size_t ends[kMaxChildren];
+                unsigned threadCount = (_items.size() >= kMinItemsPerThread) ? _maxThreads : 1;
+                parallelFor(kMaxChildren, threadCount, [&](size_t bit) {
+                    Item *begin = _items.data() + _partitionStarts[bit];
+                    Item *end   = _items.data() + _partitionStarts[bit + 1];
+                    sort(begin, end, [&](const Item &a, const Item &b) {
+                        if (a.path != b.path)
+                            return a.path < b.path;
+                        int cmp = key(a).compare(key(b));
+                        return cmp < 0 || (cmp == 0 && a.index < b.index);
+                    });
+                    Item *dst = begin;
+                    for (Item *src = begin; src != end; ++src) {
+                        if (src + 1 != end && src[1].path == src->path && key(src[1]) == key(*src))
+                            continue;       // skip, since a later duplicate supersedes this item
+                        *dst++ = *src;
+                    }
+                    ends[bit] = dst - _items.data();
+                });
+
+                // Close up the gaps left by duplicates:
+                size_t dst = 0;
+                for (unsigned bit = 0; bit < kMaxChildren; ++bit) {
+                    size_t src = _partitionStarts[bit];
+                    _partitionStarts[bit] = dst;
+                    if (dst != src)
+                        move(_items.data() + src, _items.data() + ends[bit], _items.data() + dst);
+                    dst += ends[bit] - src;
+                }
+                _partitionStarts[kMaxChildren] = dst;
+                _items.resize(dst);
+            }
+
+
+            // Writes the interior node containing the (sorted) items in [begin, end). Like
+            // MutableInterior::writeTo, it writes child interior nodes, then leaf values, then
+            // leaf keys, then the child nodes themselves.
+            Interior writeInterior(Encoder &enc, const Item *begin, const Item *end, unsigned level) {
+                // Find the runs of items belonging to each child:
+                const Item* runs[kMaxChildren + 1];
+                bitmap_t bitmap = 0;
+                unsigned n = 0;
+                for (const Item *item = begin; item != end; ) {
+                    unsigned bit = childBitNumber(item->path, level);
+                    bitmap |= bitmap_t(1) << bit;
+                    runs[n++] = item;
+                    do {
+                        ++item;
+                    } while (item != end && childBitNumber(item->path, level) == bit);
+                }
+                runs[n] = end;
+
+                // A run is a leaf (or bucket) if all its items have the same hash:
+                auto isLeaf = [&](unsigned i) {
+                    return runs[i]->path == (runs[i+1] - 1)->path;
+                };
+
+                TempArray(nodes, Node, n);
+                for (unsigned i = 0; i < n; ++i) {
+                    if (!isLeaf(i)) {
+                        assert(level < kMaxLevel);
+                        nodes[i].interior = writeInterior(enc, runs[i], runs[i+1], level + 1);
+                    }
+                }
+                for (unsigned i = 0; i < n; ++i) {
+                    if (isLeaf(i))
+                        nodes[i].leaf._valueOffset = writeLeaf(enc, runs[i], runs[i+1], false);
+                }
+                for (unsigned i = 0; i < n; ++i) {
+                    if (isLeaf(i))
+                        nodes[i].leaf._keyOffset = writeLeaf(enc, runs[i], runs[i+1], true);
+                }
+
+                const auto childrenPos = (uint32_t)enc.nextWritePos();
+                auto curPos = childrenPos;
+                for (unsigned i = 0; i < n; ++i) {
+                    if (isLeaf(i))
+                        nodes[i].leaf.makeRelativeTo(curPos);
+                    else
+                        nodes[i].interior.makeRelativeTo(curPos);
+                    curPos += sizeof(nodes[i]);
+                }
+                enc.writeRaw({nodes, n * sizeof(nodes[0])});
+                return Interior(bitmap, childrenPos);
+            }
+
+
+            // Writes the key or value of a leaf; or if there are multiple items, an Array of the
+            // keys or of the values, making it a collision bucket (like MutableBucket::writeTo.)
+            uint32_t writeLeaf(Encoder &enc, const Item *begin, const Item *end, bool writeKey) {
+                if (end - begin == 1) {
+                    if (writeKey)
+                        enc.writeString(key(*begin));
+                    else
+                        enc.writeValue(value(*begin));
+                } else {
+                    enc.beginArray(end - begin);
+                    for (auto item = begin; item != end; ++item) {
+                        if (writeKey)
+                            enc.writeString(key(*item));
+                        else
+                            enc.writeValue(value(*item));
+                    }
+                    enc.endArray();
+                }
+                return (uint32_t)enc.finishItem();
+            }
+
+
+            HashID const            _hashID;
+            unsigned const          _maxThreads;
+            const HashTree::Entry*  _entries;
+            vector<Item>            _items;
+            size_t                  _partitionStarts[kMaxChildren + 1];
+        };
+
+    }
+
+
+    using namespace hashtree;
+
+    uint32_t HashTree::build(Encoder &enc, const Entry *begin, const Entry *end,
+                             HashID hashID, unsigned maxThreads)
+    {
+        return Builder(hashID, maxThreads).build(enc, begin, end);
+    }
+
+}
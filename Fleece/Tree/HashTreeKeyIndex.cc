@@ -0,0 +1,473 @@
+//
+//  HashTreeKeyIndex.cc
+//
+// Copyright © 2018 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "HashTree.hh"
+#include "HashTree+Internal.hh"
+#include "Encoder.hh"
+#include <algorithm>
+#include <vector>
+#include "betterassert.hh"
+
+using namespace std;
+
+namespace fleece {
+    namespace hashtree {
+
+        /*
+            Key index format:
+
+            The key index is a B+tree of Fleece Arrays, stored alongside the hash tree, that
+            lists the tree's keys in ascending order (as compared by `slice::compare`.)
+
+            Leaf Page:
+                An Array of key strings, in ascending order.
+            Interior Page:
+                An Array of [key, child, key, child, ...], where each child is a page and the key
+                before it is its lowest key. The children are in ascending order.
+
+            All leaf pages are at the same depth. The strings are usually pointers to the keys
+            of the hash tree's leaves, so the index costs only a few bytes per key.
+
+            When a tree is modified, only the pages containing added or removed keys are
+            rewritten, along with the interior pages above them; the other pages are re-used, so
+            in a delta they're just pointers back into the base data. Pages that overflow are
+            split, but underfull pages aren't merged, and empty pages are removed.
+         */
+
+        static constexpr size_t kMaxPageSize = 64;       // Max keys/children of a page
+
+        static bool isLeafPage(Array page) {
+            return page.get(1).type() != kFLArray;
+        }
+
+
+        class KeyIndexWriter {
+        public:
+            KeyIndexWriter(Encoder &enc,
+                           const vector<slice> &changedKeys,
+                           function_ref<bool(slice)> containsKey,
+                           const void *cutoff)
+            :_enc(enc)
+            ,_changedKeys(changedKeys)
+            ,_containsKey(containsKey)
+            ,_cutoff(cutoff)
+            { }
+
+
+            optional<uint32_t> write(Array baseIndex) {
+                vector<PageRef> pages;
+                if (baseIndex) {
+                    update(baseIndex, _changedKeys.begin(), _changedKeys.end(), pages);
+                } else {
+                    vector<Key> keys;
+                    keys.reserve(_changedKeys.size());
+                    for (slice key : _changedKeys) {
+                        if (_containsKey(key))
+                            keys.push_back({key, nullptr});
+                    }
+                    addLeafPages(move(keys), pages);
+                }
+
+                // Add levels of interior pages until there's a single root page:
+                while (pages.size() > 1) {
+                    vector<PageRef> parents;
+                    addInteriorPages(move(pages), parents);
+                    pages = move(parents);
+                }
+                if (pages.empty())
+                    return nullopt;
+
+                auto &root = pages[0];
+                if (root.page) {
+                    writePage(*root.page);
+                } else if (_enc.base().containsAddress(FLValue(root.existing))
+                                && !usesDataBeforeCutoff(root.existing)) {
+                    auto pos = int32_t((char*)FLValue(root.existing) - (char*)_enc.base().end());
+                    return uint32_t(pos);
+                } else {
+                    _enc.writeValue(root.existing);
+                }
+                return (uint32_t)_enc.finishItem();
+            }
+
+
+        private:
+            using ChangeIter = vector<slice>::const_iterator;
+
+            struct Key {
+                slice str;
+                Value value;        // The string Value in an existing page, if any
+            };
+
+            struct Page;
+
+            // Refers to either an existing page or a new one.
+            struct PageRef {
+                Key                 first;      // The page's lowest key
+                Value               existing;
+                unique_ptr<Page>    page;
+            };
+
+            struct Page {
+                vector<Key>     keys;           // (if it's a leaf page)
+                vector<PageRef> children;       // (if it's an interior page)
+            };
+
+
+            // Appends to `out` the updated version of `page`, given the changed keys that fall
+            // within its range, and returns true if it changed.
+            bool update(Array page, ChangeIter begin, ChangeIter end, vector<PageRef> &out) {
+                if (isLeafPage(page)) {
+                    if (begin == end) {
+                        addExisting(page, out);
+                        return false;
+                    }
+                    // Merge the existing keys with the changed ones:
+                    vector<Key> keys;
+                    keys.reserve(page.count() + (end - begin));
+                    Array::iterator i(page);
+                    for (auto change = begin; i || change != end; ) {
+                        int cmp = !i ? 1 : (change == end ? -1 : i->asString().compare(*change));
+                        if (cmp < 0) {
+                            keys.push_back({i->asString(), *i});
+                            ++i;
+                        } else {
+                            if (_containsKey(*change))
+                                keys.push_back(cmp == 0 ? Key{i->asString(), *i}
+                                                        : Key{*change, nullptr});
+                            if (cmp == 0)
+                                ++i;
+                            ++change;
+                        }
+                    }
+                    addLeafPages(move(keys), out);
+                    return true;
+
+                } else {
+                    // Each child gets the changed keys from its lowest key up to the next
+                    // child's; except the first child also gets any keys lower than its own.
+                    uint32_t n = page.count() / 2;
+                    vector<PageRef> children;
+                    children.reserve(n);
+                    bool changed = false;
+                    for (uint32_t i = 0; i < n; ++i) {
+                        ChangeIter childEnd = end;
+                        if (i + 1 < n)
+                            childEnd = lower_bound(begin, end, page.get(2*(i+1)).asString());
+                        Array child = page.get(2*i + 1).asArray();
+                        changed |= update(child, begin, childEnd, children);
+                        begin = childEnd;
+                    }
+                    if (!changed) {
+                        addExisting(page, out);
+                        return false;
+                    }
+                    addInteriorPages(move(children), out);
+                    return true;
+                }
+            }
+
+
+            // True if an existing page can't be pointed to, because it uses data before the
+            // Encoder's base cutoff. (Writing it with `writeValue` copies it instead.)
+            bool usesDataBeforeCutoff(Value page) const {
+                return _cutoff && !impl::Encoder::minUsed((const impl::Value*)FLValue(page),
+                                                          _cutoff);
+            }
+
+
+            static void addExisting(Array page, vector<PageRef> &out) {
+                Value first = page.get(0);
+                out.push_back({{first.asString(), first}, page, nullptr});
+            }
+
+
+            // The index range of part `i` of `n` equal parts of `size` items.
+            static pair<size_t,size_t> split(size_t size, size_t n, size_t i) {
+                return {size * i / n, size * (i + 1) / n};
+            }
+
+            // Appends to `out` new leaf pages containing `keys`.
+            static void addLeafPages(vector<Key> &&keys, vector<PageRef> &out) {
+                size_t nPages = (keys.size() + kMaxPageSize - 1) / kMaxPageSize;
+                for (size_t p = 0; p < nPages; ++p) {
+                    auto [start, stop] = split(keys.size(), nPages, p);
+                    auto page = make_unique<Page>();
+                    page->keys.assign(&keys[start], &keys[stop - 1] + 1);
+                    out.push_back({keys[start], nullptr, move(page)});
+                }
+            }
+
+            // Appends to `out` new interior pages containing `children`.
+            static void addInteriorPages(vector<PageRef> &&children, vector<PageRef> &out) {
+                size_t nPages = (children.size() + kMaxPageSize - 1) / kMaxPageSize;
+                for (size_t p = 0; p < nPages; ++p) {
+                    auto [start, stop] = split(children.size(), nPages, p);
+                    auto page = make_unique<Page>();
+                    for (size_t i = start; i < stop; ++i)
+                        page->children.push_back(move(children[i]));
+                    Key first = page->children[0].first;
+                    out.push_back({first, nullptr, move(page)});
+                }
+            }
+
+
+            void writeKey(const Key &key) {
+                if (key.value)
+                    _enc.writeValue(key.value);
+                else
+                    _enc.writeString(key.str);
+            }
+
+            void writePage(const Page &page) {
+                if (page.children.empty()) {
+                    _enc.beginArray(page.keys.size());
+                    for (auto &key : page.keys)
+                        writeKey(key);
+                } else {
+                    _enc.beginArray(2 * page.children.size());
+                    for (auto &child : page.children) {
+                        writeKey(child.first);
+                        if (child.page)
+                            writePage(*child.page);
+                        else
+                            _enc.writeValue(child.existing);
+                    }
+                }
+                _enc.endArray();
+            }
+
+
+            Encoder&                    _enc;
+            const vector<slice>&        _changedKeys;
+            function_ref<bool(slice)>   _containsKey;
+            const void*                 _cutoff;
+        };
+
+
+        optional<uint32_t> WriteKeyIndex(Encoder &enc, Array baseIndex,
+                                         const vector<slice> &changedKeys,
+                                         function_ref<bool(slice)> containsKey,
+                                         const void *cutoff)
+        {
+            return KeyIndexWriter(enc, changedKeys, containsKey, cutoff).write(baseIndex);
+        }
+
+
+#pragma mark - SORTED ITERATOR:
+
+
+        struct sortedIteratorImpl {
+            struct pos {
+                Array page;
+                int index;          // Index of the current key, or child (not Array index!)
+            };
+
+            static int count(const pos &p) {
+                return int(isLeafPage(p.page) ? p.page.count() : p.page.count() / 2);
+            }
+
+            Array const         root;
+            bool const          reverse;
+            alloc_slice const   prefix;
+            vector<pos>         path;       // From the root page to the current leaf page
+
+            sortedIteratorImpl(Array root_, bool reverse_, slice prefix_)
+            :root(root_)
+            ,reverse(reverse_)
+            ,prefix(prefix_)
+            { }
+
+            slice currentKey() const {
+                if (path.empty())
+                    return nullslice;
+                auto &leaf = path.back();
+                slice key = leaf.page.get(leaf.index).asString();
+                return hasPrefix(key) ? key : slice();
+            }
+
+            bool hasPrefix(slice key) const {
+                return !prefix || key.hasPrefix(prefix);
+            }
+
+            // Positions the iterator at the first (or last) key in the page's subtree.
+            void descendToEdge(Array page) {
+                while (true) {
+                    pos p {page, 0};
+                    if (reverse)
+                        p.index = count(p) - 1;
+                    path.push_back(p);
+                    if (isLeafPage(page))
+                        return;
+                    page = page.get(2*p.index + 1).asArray();
+                }
+            }
+
+            // Moves to the first key, or in reverse, the last.
+            void seekToFirst() {
+                path.clear();
+                if (root)
+                    descendToEdge(root);
+            }
+
+            // Moves to the next (or previous) key; returns false at the end.
+            bool next() {
+                if (path.empty())
+                    return false;
+                int delta = reverse ? -1 : 1;
+                auto &leaf = path.back();
+                leaf.index += delta;
+                if (leaf.index >= 0 && leaf.index < count(leaf))
+                    return true;
+                // Go up until a page has another child, then down to its first/last key:
+                path.pop_back();
+                while (!path.empty()) {
+                    auto &p = path.back();
+                    p.index += delta;
+                    if (p.index >= 0 && p.index < count(p)) {
+                        descendToEdge(p.page.get(2*p.index + 1).asArray());
+                        return true;
+                    }
+                    path.pop_back();
+                }
+                return false;
+            }
+
+            // Moves to the first key >= `key`; or in reverse, the last key <= `key`, or if
+            // `exclusive` is true, the last key < `key`. Returns false if there's none.
+            bool seek(slice key, bool exclusive =false) {
+                path.clear();
+                if (!root)
+                    return false;
+                // Descend to the page whose range includes `key`:
+                Array page = root;
+                auto before = [&](slice pageKey) {
+                    int cmp = pageKey.compare(key);
+                    return (reverse && exclusive) ? cmp < 0 : cmp <= 0;
+                };
+                while (!isLeafPage(page)) {
+                    // Find the last child whose lowest key is before `key`, or else the first:
+                    int lo = 1, hi = int(page.count() / 2);
+                    while (lo < hi) {
+                        int mid = (lo + hi) / 2;
+                        if (before(page.get(2*mid).asString()))
+                            lo = mid + 1;
+                        else
+                            hi = mid;
+                    }
+                    path.push_back({page, lo - 1});
+                    page = page.get(2*(lo - 1) + 1).asArray();
+                }
+
+                // Count the keys in the leaf page that are before `key`:
+                int lo = 0, hi = int(page.count());
+                while (lo < hi) {
+                    int mid = (lo + hi) / 2;
+                    if (before(page.get(mid).asString()))
+                        lo = mid + 1;
+                    else
+                        hi = mid;
+                }
+                if (reverse) {
+                    path.push_back({page, lo - 1});
+                    if (lo == 0) {
+                        // Every key is after `key` (since this is the first leaf page):
+                        path.clear();
+                        return false;
+                    }
+                    return true;
+                } else {
+                    // `lo` is the first key after `key`; back up over an exact match:
+                    if (lo > 0 && page.get(lo - 1).asString() == key)
+                        --lo;
+                    path.push_back({page, lo});
+                    if (lo < int(page.count()))
+                        return true;
+                    // The key is after this page, so move to the start of the next one:
+                    path.back().index = lo - 1;
+                    return next();
+                }
+            }
+
+            // Like `seek`, but if `key` is outside the range of the prefix, moves to the nearest
+            // key with the prefix in the direction of iteration (if there is one.)
+            void seekWithPrefix(slice key) {
+                if (!reverse ? (key < prefix)
+                             : (key > prefix && !hasPrefix(key)))
+                    seekPrefix();
+                else
+                    seek(key);
+            }
+
+            // Moves to the first key with the prefix; or in reverse, the last.
+            void seekPrefix() {
+                if (!prefix) {
+                    seekToFirst();
+                } else if (!reverse) {
+                    seek(prefix);
+                } else {
+                    // Find the lowest string after all those with the prefix, by incrementing
+                    // the last byte that isn't 0xFF and removing the ones after it:
+                    alloc_slice after(prefix.buf, prefix.size);     // (a copy, not a reference)
+                    while (after.size > 0 && after[after.size - 1] == 0xFF)
+                        after.shorten(after.size - 1);
+                    if (after.size == 0) {
+                        seekToFirst();
+                    } else {
+                        ++((uint8_t*)after.buf)[after.size - 1];
+                        seek(after, true);
+                    }
+                }
+            }
+        };
+
+    }
+
+    using namespace hashtree;
+
+
+    HashTree::sorted_iterator::sorted_iterator(const HashTree *tree, bool reverse, slice prefix)
+    :_tree(tree)
+    {
+        assert_precondition(tree->hasKeyIndex());
+        _impl.reset(new sortedIteratorImpl(tree->keyIndex(), reverse, prefix));
+        _impl->seekPrefix();
+        setKey(_impl->currentKey());
+    }
+
+    HashTree::sorted_iterator::sorted_iterator(sorted_iterator&&) =default;
+    HashTree::sorted_iterator::~sorted_iterator() =default;
+
+    void HashTree::sorted_iterator::setKey(slice key) {
+        _key = key;
+        if (!key)
+            _impl->path.clear();     // at end
+    }
+
+    bool HashTree::sorted_iterator::seek(slice key) {
+        _impl->seekWithPrefix(key);
+        setKey(_impl->currentKey());
+        return !!_key;
+    }
+
+    HashTree::sorted_iterator& HashTree::sorted_iterator::operator++() {
+        setKey(_impl->next() ? _impl->currentKey() : slice());
+        return *this;
+    }
+
+}
@@ -12,8 +12,10 @@
 #include "MutableNode.hh"
 #include "fleece/Mutable.hh"
 #include "Bitmap.hh"
+#include "TempArray.hh"
 #include "HeapArray.hh"
 #include "HeapDict.hh"
+#include "Encoder.hh"
 #include <algorithm>
 #include <ostream>
 #include <string>
@@ -26,11 +28,14 @@ namespace fleece {
     using namespace hashtree;
 
 
-    MutableHashTree::MutableHashTree()
+    MutableHashTree::MutableHashTree(HashID hashID)
+    :_hashID(hashID)
     { }
 
     MutableHashTree::MutableHashTree(const HashTree *tree)
     :_imRoot(tree)
+    ,_hashID(tree ? tree->hashID() : kDefaultHashID)
+    ,_hasKeyIndex(tree && tree->hasKeyIndex())
     { }
 
     MutableHashTree::~MutableHashTree() {
@@ -43,6 +48,11 @@ namespace fleece {
         if (_root)
             _root->deleteTree();
         _root = other._root;
+        _hashID = other._hashID;
+        _hasKeyIndex = other._hasKeyIndex;
+        _pageSize = other._pageSize;
+        _rewriteCutoff = other._rewriteCutoff;
+        _changedKeys = move(other._changedKeys);
         other._imRoot = nullptr;
         other._root = nullptr;
         return *this;
@@ -53,6 +63,10 @@ namespace fleece {
         if (_root)
             _root->deleteTree();
         _root = nullptr;
+        _hashID = imTree ? imTree->hashID() : kDefaultHashID;
+        _hasKeyIndex = imTree && imTree->hasKeyIndex();
+        _rewriteCutoff = nullptr;
+        _changedKeys.clear();
         return *this;
     }
 
@@ -76,18 +90,10 @@ namespace fleece {
 
     Value MutableHashTree::get(slice key) const {
         if (_root) {
-            Target target(key);
+            Target target(key, _hashID);
             NodeRef leaf = _root->findNearest(target.hash);
-            if (leaf) {
-                if (leaf.isMutable()) {
-                    auto mleaf = (MutableLeaf*)leaf.asMutable();
-                    if (mleaf->matches(target))
-                        return mleaf->_value;
-                } else {
-                    if (leaf.asImmutable()->leaf.matches(key))
-                        return leaf.asImmutable()->leaf.value();
-                }
-            }
+            if (leaf)
+                return leaf.get(target);
         } else if (_imRoot) {
             return _imRoot->get(key);
         }
@@ -97,10 +103,25 @@ namespace fleece {
     bool MutableHashTree::insert(slice key, InsertCallback callback) {
         if (!_root)
             _root = MutableInterior::newRoot(_imRoot);
-        auto result = _root->insert(Target(key, &callback), 0);
-        if (!result)
-            return false;
-        _root = result;
+        if (!baseKeyIndex()) {
+            auto result = _root->insert(Target(key, _hashID, &callback), 0);
+            if (!result)
+                return false;
+            _root = result;
+        } else {
+            // The base tree's key index will need updating if this adds a key:
+            bool added = false;
+            InsertCallback trackingCallback = [&](Value oldValue) {
+                added = !oldValue;
+                return callback(oldValue);
+            };
+            auto result = _root->insert(Target(key, _hashID, &trackingCallback), 0);
+            if (!result)
+                return false;
+            _root = result;
+            if (added)
+                keyChanged(key);
+        }
         return true;
     }
 
@@ -117,7 +138,21 @@ namespace fleece {
                 return false;
             _root = MutableInterior::newRoot(_imRoot);
         }
-        return _root->remove(Target(key), 0);
+        if (!_root->remove(Target(key, _hashID), 0))
+            return false;
+        if (baseKeyIndex())
+            keyChanged(key);
+        return true;
+    }
+
+
+    Array MutableHashTree::baseKeyIndex() const {
+        return _imRoot ? _imRoot->keyIndex() : nullptr;
+    }
+
+    void MutableHashTree::keyChanged(slice key) {
+        if (_changedKeys.find(key) == _changedKeys.end())
+            _changedKeys.emplace(key);
     }
 
 
@@ -145,15 +180,382 @@ namespace fleece {
         return result;
     }
 
+    namespace hashtree {
+
+        // Finds the leaves of an immutable tree that use data before a cutoff address, in
+        // themselves, in their keys or values, or in the interior nodes above them.
+        class OldDataFinder {
+        public:
+            OldDataFinder(const void *cutoff, MutableHashTree::MinUsedCache *cache)
+            :_cutoff(cutoff), _cache(cache) { }
+
+            void scan(const Interior *root) {
+                if ((const void*)root < _cutoff)
+                    addFirstKey(root);
+                scanInterior(root);
+            }
+
+            // Scans a key index; returns true if it uses old data, so it has to be rewritten.
+            bool scanKeyIndex(Array root) {
+                return scanKeyIndexPage(root) == nullptr;
+            }
+
+            vector<slice> keys;                         // Keys of the leaves using old data
+            const void* minUsed {nullptr};              // Lowest address used by other leaves
+
+        private:
+            // Returns the lowest address used by a subtree, or nullptr if any of it uses old data.
+            const void* scanInterior(const Interior *node) {
+                if (auto cached = lookup(node); cached)
+                    return cached;
+                unsigned n = node->childCount();
+                if (n == 0)
+                    return node;
+                const Node *children = node->childAtIndex(0);
+                const void *subtreeMin = children;
+                if ((const void*)children < _cutoff) {
+                    addFirstKey(node);          // The node will be rewritten along with the leaf
+                    subtreeMin = nullptr;
+                } else {
+                    use(children);
+                }
+                for (unsigned i = 0; i < n; ++i) {
+                    const void *childMin;
+                    if (children[i].isLeaf())
+                        childMin = scanLeaf(children[i].leaf);
+                    else
+                        childMin = scanInterior(&children[i].interior);
+                    if (!childMin)
+                        subtreeMin = nullptr;
+                    else if (subtreeMin)
+                        subtreeMin = std::min(subtreeMin, childMin);
+                }
+                return remember(node, subtreeMin);
+            }
+
+            const void* scanLeaf(const Leaf &leaf) {
+                const void *keyMin = minAddressUsed(leaf.key());
+                const void *valueMin = minAddressUsed(leaf.value());
+                if (!keyMin || !valueMin) {
+                    keys.push_back(leaf.entryAt(0).first);
+                    return nullptr;
+                }
+                return std::min(keyMin, valueMin);
+            }
+
+            // Returns the lowest address used by a key index page and the pages under it, or
+            // nullptr if any of it uses old data.
+            const void* scanKeyIndexPage(Array page) {
+                auto v = (const impl::Value*)FLValue(page);
+                if (auto cached = lookup(v); cached)
+                    return cached;
+                const void *pageMin = v;
+                if (pageMin < _cutoff)
+                    return nullptr;
+                for (Array::iterator i(page); i && pageMin; ++i) {
+                    const void *itemMin;
+                    if (Array child = i->asArray(); child)
+                        itemMin = scanKeyIndexPage(child);
+                    else
+                        itemMin = impl::Encoder::minUsed((const impl::Value*)FLValue(*i), _cutoff);
+                    pageMin = itemMin ? std::min(pageMin, itemMin) : nullptr;
+                }
+                if (pageMin)
+                    use(pageMin);
+                return remember(v, pageMin);
+            }
+
+            void addFirstKey(const Interior *node) {
+                while (node->childCount() > 0) {
+                    const Node *child = node->childAtIndex(0);
+                    if (child->isLeaf()) {
+                        keys.push_back(child->leaf.entryAt(0).first);
+                        return;
+                    }
+                    node = &child->interior;
+                }
+            }
+
+            void use(const void *addr) {
+                if (!minUsed || addr < minUsed)
+                    minUsed = addr;
+            }
+
+            // Returns the lowest address used by a Value, or nullptr if that's before the cutoff.
+            const void* minAddressUsed(Value value) {
+                auto v = (const impl::Value*)FLValue(value);
+                if (auto cached = lookup(v); cached)
+                    return cached;
+                const void *result = remember(v, impl::Encoder::minUsed(v, _cutoff));
+                if (result)
+                    use(result);
+                return result;
+            }
+
+            // Immutable data always uses the same addresses, so the results can be cached:
+            const void* lookup(const void *addr) {
+                if (!_cache)
+                    return nullptr;
+                auto i = _cache->find(addr);
+                if (i == _cache->end())
+                    return nullptr;
+                if (i->second < _cutoff) {
+                    _cache->erase(i);
+                    return nullptr;
+                }
+                use(i->second);
+                return i->second;
+            }
+
+            const void* remember(const void *addr, const void *min) {
+                if (_cache && min)
+                    (*_cache)[addr] = min;
+                return min;
+            }
+
+            const void* const _cutoff;
+            MutableHashTree::MinUsedCache* const _cache;
+        };
+
+    }
+
+
+    const void* MutableHashTree::rewriteDataBefore(const void *cutoff, MinUsedCache *cache) {
+        if (!_imRoot)
+            return nullptr;
+        OldDataFinder finder(cutoff, cache);
+        finder.scan(_imRoot->rootNode());
+        Array keyIndex = _hasKeyIndex ? baseKeyIndex() : nullptr;
+        bool rewriteKeyIndex = keyIndex && finder.scanKeyIndex(keyIndex);
+        if (finder.keys.empty() && !rewriteKeyIndex)
+            return finder.minUsed;
+        for (slice key : finder.keys)
+            insert(key, [](Value value) {return value;});
+        // Writing the tree writes its key index, copying the pages that use old data:
+        if (!_root)
+            _root = MutableInterior::newRoot(_imRoot);
+        _rewriteCutoff = cutoff;
+        // The rewritten leaves may still point to any data after the cutoff:
+        return (finder.minUsed && finder.minUsed < cutoff) ? finder.minUsed : cutoff;
+    }
+
+
+    namespace hashtree {
+
+        // Writes a tree laid out for paged storage (see MutableHashTree::setPageSize.)
+        // Subtrees already in the Encoder's base are referred to, as usual.
+        //
+        // First come the leaves' keys and values. Then the interior nodes' arrays of children,
+        // grouped into blocks that don't straddle page boundaries: a subtree that fits in a page
+        // is one block; otherwise a node's block holds its array plus the arrays of as many of
+        // its children (the biggest first) as fit, so a lookup through those children reads one
+        // page fewer.
+        class PagedTreeWriter {
+        public:
+            PagedTreeWriter(Encoder &enc, size_t pageSize)
+            :_enc(enc), _pageSize(pageSize)
+            { }
+
+            Interior write(MutableInterior *root) {
+                writeLeaves(NodeRef(root));
+                // (Leave room for the root node and trailer that come after the root's block.)
+                return writeBlock(NodeRef(root), _pageSize - 4 * sizeof(Node)).interior;
+            }
+
+        private:
+            static const void* identity(NodeRef node) {
+                return node.isMutable() ? (const void*)node.asMutable() : node.asImmutable();
+            }
+
+            bool inBase(NodeRef node) const {
+                return !node.isMutable() && _enc.base().containsAddress(node.asImmutable());
+            }
+
+            static bitmap_t bitmapOf(NodeRef node) {
+                return node.isMutable() ? ((MutableInterior*)node.asMutable())->bitmap()
+                                        : node.asImmutable()->interior.bitmap();
+            }
+
+            static size_t arraySize(NodeRef node) {
+                return node.childCount() * sizeof(Node);
+            }
+
+            // Writes the keys and values of the leaves under an interior node, remembering their
+            // positions. Returns the size of the node's part of the index: its children, and
+            // those of the interior nodes under it.
+            size_t writeLeaves(NodeRef node) {
+                if (inBase(node))
+                    return 0;
+                unsigned n = node.childCount();
+                size_t size = arraySize(node);
+                for (unsigned i = 0; i < n; ++i) {
+                    NodeRef child = node.childAtIndex(i);
+                    if (child.isLeaf()) {
+                        // (Each key goes right after its value, so they're usually in one page.)
+                        auto valuePos = child.writeTo(_enc, false);
+                        _leafPos.emplace(identity(child), Leaf(child.writeTo(_enc, true), valuePos));
+                    } else {
+                        size += writeLeaves(child);
+                    }
+                }
+                _indexSize[identity(node)] = size;
+                return size;
+            }
+
+            // Writes the block headed by an interior node, after the blocks under it.
+            Node writeBlock(NodeRef node, size_t capacity) {
+                if (inBase(node))
+                    return node.writeTo(_enc);
+                if (_indexSize.at(identity(node)) <= capacity)
+                    return writeSubtree(node, true);
+
+                // Choose the children whose arrays go in my block:
+                unsigned n = node.childCount();
+                vector<unsigned> candidates;
+                for (unsigned i = 0; i < n; ++i) {
+                    NodeRef child = node.childAtIndex(i);
+                    if (!child.isLeaf() && !inBase(child))
+                        candidates.push_back(i);
+                }
+                sort(candidates.begin(), candidates.end(), [&](unsigned a, unsigned b) {
+                    return _indexSize.at(identity(node.childAtIndex(a)))
+                         > _indexSize.at(identity(node.childAtIndex(b)));
+                });
+                size_t blockSize = arraySize(node);
+                vector<bool> inBlock(n);
+                for (unsigned i : candidates) {
+                    size_t size = arraySize(node.childAtIndex(i));
+                    if (blockSize + size <= capacity) {
+                        inBlock[i] = true;
+                        blockSize += size;
+                    }
+                }
+
+                // Write everything under my block, staging the arrays that go in it:
+                TempArray(nodes, Node, n);
+                vector<vector<Node>> childArrays(n);
+                for (unsigned i = 0; i < n; ++i) {
+                    NodeRef child = node.childAtIndex(i);
+                    if (child.isLeaf()) {
+                        nodes[i].leaf = _leafPos.at(identity(child));
+                    } else if (!inBlock[i]) {
+                        nodes[i] = writeBlock(child, _pageSize);
+                    } else {
+                        unsigned cn = child.childCount();
+                        childArrays[i].resize(cn);
+                        for (unsigned j = 0; j < cn; ++j) {
+                            NodeRef grandchild = child.childAtIndex(j);
+                            if (grandchild.isLeaf())
+                                childArrays[i][j].leaf = _leafPos.at(identity(grandchild));
+                            else
+                                childArrays[i][j] = writeBlock(grandchild, _pageSize);
+                        }
+                    }
+                }
+
+                // Now write the block:
+                startBlock(blockSize);
+                for (unsigned i = 0; i < n; ++i) {
+                    if (inBlock[i])
+                        nodes[i] = writeArray(node.childAtIndex(i), childArrays[i].data());
+                }
+                return writeArray(node, nodes);
+            }
+
+            // Writes a subtree that fits in a page, without splitting it across pages.
+            Node writeSubtree(NodeRef node, bool isTop) {
+                if (inBase(node))
+                    return node.writeTo(_enc);
+                if (isTop)
+                    startBlock(_indexSize.at(identity(node)));
+                unsigned n = node.childCount();
+                TempArray(nodes, Node, n);
+                for (unsigned i = 0; i < n; ++i) {
+                    NodeRef child = node.childAtIndex(i);
+                    if (child.isLeaf())
+                        nodes[i].leaf = _leafPos.at(identity(child));
+                    else
+                        nodes[i] = writeSubtree(child, false);
+                }
+                return writeArray(node, nodes);
+            }
+
+            // Writes an interior node's array of children, given their absolute positions.
+            Node writeArray(NodeRef node, Node nodes[]) {
+                unsigned n = node.childCount();
+                const auto childrenPos = (uint32_t)_enc.nextWritePos();
+                auto curPos = childrenPos;
+                for (unsigned i = 0; i < n; ++i) {
+                    if (node.childAtIndex(i).isLeaf())
+                        nodes[i].leaf.makeRelativeTo(curPos);
+                    else
+                        nodes[i].interior.makeRelativeTo(curPos);
+                    curPos += sizeof(Node);
+                }
+                _enc.writeRaw({nodes, n * sizeof(Node)});
+                Node result;
+                result.interior = Interior(bitmapOf(node), childrenPos);
+                return result;
+            }
+
+            // If a block of this size would straddle a page boundary, skips to the next page.
+            void startBlock(size_t size) {
+                size_t pagePos = (_enc.base().size + _enc.nextWritePos()) % _pageSize;
+                if (pagePos + size > _pageSize && size <= _pageSize)
+                    pad(_pageSize - pagePos);
+            }
+
+            // Writes unused bytes. (Nothing points to them.)
+            void pad(size_t size) {
+                static constexpr uint8_t kZeroes[256] = { };
+                size &= ~size_t(1);             // Values have to stay 2-byte aligned
+                while (size > 0) {
+                    size_t n = std::min(size, sizeof(kZeroes));
+                    _enc.writeRaw({kZeroes, n});
+                    size -= n;
+                }
+            }
+
+            Encoder&                                _enc;
+            size_t const                            _pageSize;
+            std::unordered_map<const void*,Leaf>   _leafPos;    // Leaf -> its key & value positions
+            std::unordered_map<const void*,size_t> _indexSize;  // Interior -> size of its index
+        };
+
+    }
+
+
     uint32_t MutableHashTree::writeTo(Encoder &enc) {
-        if (_root) {
-            return _root->writeRootTo(enc);
-        } else if (_imRoot) {
-            unique_ptr<MutableInterior> tempRoot( MutableInterior::newRoot(_imRoot) );
-            return tempRoot->writeRootTo(enc);
-        } else {
+        if (!_root && !_imRoot)
             return 0;
+        MutableInterior *mutableRoot = _root;
+        unique_ptr<MutableInterior> tempRoot;
+        if (!mutableRoot) {
+            tempRoot.reset(MutableInterior::newRoot(_imRoot));
+            mutableRoot = tempRoot.get();
         }
+        Interior root = _pageSize ? PagedTreeWriter(enc, _pageSize).write(mutableRoot)
+                                  : mutableRoot->writeTo(enc);
+
+        // The key index comes after the tree's nodes, so its strings can point to their keys.
+        optional<uint32_t> keyIndexPos;
+        if (_hasKeyIndex)
+            keyIndexPos = writeKeyIndex(enc);
+        return WriteRoot(enc, root, _hashID, _hasKeyIndex, keyIndexPos);
+    }
+
+    optional<uint32_t> MutableHashTree::writeKeyIndex(Encoder &enc) {
+        auto containsKey = [&](slice key) {return !!get(key);};
+        Array baseIndex = baseKeyIndex();
+        vector<slice> keys;
+        if (baseIndex) {
+            keys.assign(_changedKeys.begin(), _changedKeys.end());
+        } else {
+            for (iterator i(*this); i; ++i)
+                keys.push_back(i.key());
+            sort(keys.begin(), keys.end());
+        }
+        return WriteKeyIndex(enc, baseIndex, keys, containsKey, _rewriteCutoff);
     }
 
     void MutableHashTree::dump(std::ostream &out) {
@@ -163,7 +565,7 @@ namespace fleece {
             out << "MutableHashTree {";
             if (_root) {
                 out << "\n";
-                _root->dump(out);
+                _root->dump(out, _hashID);
             }
             out << "}\n";
         }
@@ -186,6 +588,7 @@ namespace fleece {
             pos current;
             pos stack[kMaxDepth];
             unsigned depth;
+            unsigned entryIndex {0}, entryCount {0};    // Position in a collision bucket
 
             iteratorImpl(NodeRef root)
             :current {root, -1}
@@ -193,12 +596,16 @@ namespace fleece {
             { }
 
             pair<slice,Value> next() {
+                if (++entryIndex < entryCount)
+                    return node.entryAt(entryIndex);    // Next key in the current bucket
+
                 while (unsigned(++current.index) >= current.parent.childCount()) {
                     if (depth > 0) {
                         // Pop the stack:
                         current = stack[--depth];
                     } else {
                         node.reset();      // at end
+                        entryCount = 0;
                         return {};
                     }
                 }
@@ -215,14 +622,10 @@ namespace fleece {
                     current = {node, 0};
                 }
 
-                // Return the current leaf's key/value:
-                if (node.isMutable()) {
-                    auto leaf = ((MutableLeaf*)node.asMutable());
-                    return {leaf->_key, leaf->_value};
-                } else {
-                    auto &leaf = node.asImmutable()->leaf;
-                    return {leaf.keyString(), leaf.value()};
-                }
+                // Return the current leaf's (or bucket's first) key/value:
+                entryIndex = 0;
+                entryCount = node.entryCount();
+                return node.entryAt(0);
             }
         };
 
@@ -9,6 +9,9 @@
 #include "fleece/slice.hh"
 #include <functional>
 #include <memory>
+#include <optional>
+#include <set>
+#include <unordered_map>
 
 namespace fleece {
     class MutableArray;
@@ -23,7 +26,13 @@ namespace fleece {
 
     class MutableHashTree {
     public:
-        MutableHashTree();
+        /** Creates an empty tree that will use the given hash function. The default one is
+            faster than FNV-1a, but trees that use it can't be read by older versions of Fleece. */
+        explicit MutableHashTree(hashtree::HashID =hashtree::kDefaultHashID);
+
+        /** Creates a mutable tree based on an immutable one, whose data must remain valid as
+            long as this object exists. If values in the data will be modified or are in hash
+            collision buckets, the data should be in a Doc so they can be retained. */
         MutableHashTree(const HashTree*);
         ~MutableHashTree();
 
@@ -37,8 +46,18 @@ namespace fleece {
 
         unsigned count() const;
 
+        hashtree::HashID hashID() const         {return _hashID;}
+
         bool isChanged() const                  {return _root != nullptr;}
 
+        /** True if `writeTo` will write a key index, so that the written tree's keys can be
+            iterated in order with a HashTree::sorted_iterator. This is initially true if the
+            tree is based on an immutable tree with a key index, else false.
+            The existing index is updated incrementally: only its pages containing keys that
+            have been added or removed are rewritten. */
+        bool hasKeyIndex() const                {return _hasKeyIndex;}
+        void setHasKeyIndex(bool k)             {_hasKeyIndex = k;}
+
         using InsertCallback = std::function<Value(Value)>;
 
         void set(slice key, Value);
@@ -47,15 +66,47 @@ namespace fleece {
 
         uint32_t writeTo(Encoder&);
 
+        /** If nonzero, `writeTo` lays out the tree for storage that's read a page at a time:
+            first the leaves' values and keys, then the interior nodes, clustered into blocks
+            that don't straddle page boundaries, each holding a node and as many of its
+            descendants as fit. A lookup then touches fewer pages. (The format is the same, just
+            arranged differently.) The default is 0. */
+        void setPageSize(size_t pageSize)           {_pageSize = pageSize;}
+        size_t pageSize() const                     {return _pageSize;}
+
+        /** Remembers the lowest address used by immutable nodes and Values. It stays valid as
+            long as the memory they're in isn't unmapped or reused. */
+        using MinUsedCache = std::unordered_map<const void*, const void*>;
+
+        /** For compacting a file that the tree is stored in: marks as changed every leaf that
+            uses any of the base data before `cutoff` -- in its key, in its value or anything the
+            value points to, or in the interior nodes above it -- so that `writeTo` writes it
+            again. The Encoder needs the matching cutoff (see Encoder::amend), so that the values
+            are copied instead of pointed to.
+            If the tree has a key index, its pages that use that data are rewritten too.
+            Returns the lowest address of the base data that the tree may still use (which is no
+            higher than `cutoff` if anything was marked), or nullptr if there's none.
+            Passing a cache makes repeated calls much faster, since they can skip the subtrees
+            and values they've already looked at. */
+        const void* rewriteDataBefore(const void *cutoff, MinUsedCache* =nullptr);
+
         void dump(std::ostream &out);
 
         using iterator = HashTree::iterator;
         
     private:
         hashtree::NodeRef rootNode() const;
+        Array baseKeyIndex() const;
+        void keyChanged(slice key);
+        std::optional<uint32_t> writeKeyIndex(Encoder&);
 
         const HashTree* _imRoot {nullptr};
         hashtree::MutableInterior* _root {nullptr};
+        hashtree::HashID _hashID;
+        bool _hasKeyIndex {false};
+        size_t _pageSize {0};
+        const void* _rewriteCutoff {nullptr};           // Set by rewriteDataBefore
+        std::set<alloc_slice, std::less<>> _changedKeys;   // Keys added/removed since _imRoot
 
         friend class HashTree::iterator;
     };
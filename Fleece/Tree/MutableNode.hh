@@ -13,6 +13,8 @@
 #include "fleece/Mutable.hh"
 #include "fleece/slice.hh"
 #include "TempArray.hh"
+#include <algorithm>
+#include <vector>
 #include "betterassert.hh"
 
 namespace fleece { namespace hashtree {
@@ -25,13 +27,16 @@ namespace fleece { namespace hashtree {
     // Base class of nodes within a MutableHashTree.
     class MutableNode {
     public:
-        MutableNode(unsigned capacity)
+        static constexpr int kBucketCapacity = -1;      // _capacity of a MutableBucket
+
+        MutableNode(int capacity)
         :_capacity(int8_t(capacity))
         {
             assert_precondition(capacity <= kMaxChildren);
         }
 
-        bool isLeaf() const FLPURE     {return _capacity == 0;}
+        bool isLeaf() const FLPURE     {return _capacity <= 0;}    // (a bucket is a leaf too)
+        bool isBucket() const FLPURE   {return _capacity < 0;}
 
         static void encodeOffset(offset_t &o, size_t curPos) {
             assert_precondition((ssize_t)curPos > o);
@@ -52,9 +57,13 @@ namespace fleece { namespace hashtree {
     class MutableLeaf : public MutableNode {
     public:
         MutableLeaf(const Target &t, Value v)
+        :MutableLeaf(t.key, t.hash, v)
+        { }
+
+        MutableLeaf(slice key, hash_t hash, Value v)
         :MutableNode(0)
-        ,_key(t.key)
-        ,_hash(t.hash)
+        ,_key(key)
+        ,_hash(hash)
         ,_value(v)
         { }
 
@@ -72,7 +81,7 @@ namespace fleece { namespace hashtree {
 
         void dump(std::ostream &out, unsigned indent) {
             char hashStr[30];
-            sprintf(hashStr, "{%08x ", _hash);
+            sprintf(hashStr, "{%016llx ", (unsigned long long)_hash);
             out << string(2*indent, ' ') << hashStr << '"';
             out.write((char*)_key.buf, _key.size);
             out << "\"=" << _value.toJSONString() << "}";
@@ -84,6 +93,100 @@ namespace fleece { namespace hashtree {
     };
 
 
+    // A leaf node that holds two or more keys with identical hashes, sorted by key.
+    class MutableBucket : public MutableNode {
+    public:
+        // Creates a bucket containing the key(s) of an existing leaf or bucket.
+        MutableBucket(NodeRef leaf, hash_t hash)
+        :MutableNode(kBucketCapacity)
+        ,_hash(hash)
+        {
+            unsigned n = leaf.entryCount();
+            _entries.reserve(n + 1);
+            for (unsigned i = 0; i < n; ++i) {
+                auto entry = leaf.entryAt(i);
+                _entries.emplace_back(alloc_slice(entry.first), entry.second);
+            }
+        }
+
+        unsigned count() const                  {return unsigned(_entries.size());}
+
+        pair<slice,Value> entryAt(unsigned i) const {
+            return {_entries[i].first, _entries[i].second};
+        }
+
+        Value get(slice key) const {
+            auto i = find(key);
+            return (i != _entries.end() && i->first == key) ? Value(i->second) : Value();
+        }
+
+        // Adds or updates a key. The callback is given the existing value, if any, and returns
+        // the new one. Returns false if the callback returned nullptr.
+        bool insert(const Target &target) {
+            assert_precondition(target.hash == _hash);
+            auto i = find(target.key);
+            bool exists = (i != _entries.end() && i->first == target.key);
+            Value val = (*target.insertCallback)(exists ? Value(i->second) : Value());
+            if (!val)
+                return false;
+            if (exists)
+                i->second = val;
+            else
+                _entries.emplace(i, alloc_slice(target.key), val);
+            return true;
+        }
+
+        bool remove(slice key) {
+            auto i = find(key);
+            if (i == _entries.end() || i->first != key)
+                return false;
+            _entries.erase(i);
+            return true;
+        }
+
+        // Writes an Array of the keys or of the values, and returns its position.
+        uint32_t writeTo(Encoder &enc, bool writeKey) {
+            enc.beginArray(_entries.size());
+            for (auto &entry : _entries) {
+                if (writeKey)
+                    enc.writeString(entry.first);
+                else
+                    enc.writeValue(entry.second);
+            }
+            enc.endArray();
+            return (uint32_t)enc.finishItem();
+        }
+
+        void dump(std::ostream &out, unsigned indent) {
+            char hashStr[30];
+            sprintf(hashStr, "{%016llx ", (unsigned long long)_hash);
+            out << string(2*indent, ' ') << hashStr << "<";
+            for (auto &entry : _entries) {
+                out << (&entry == &_entries[0] ? "\"" : ", \"");
+                out.write((char*)entry.first.buf, entry.first.size);
+                out << "\"=" << entry.second.toJSONString();
+            }
+            out << ">}";
+        }
+
+        hash_t const _hash;
+
+    private:
+        using Entry = pair<alloc_slice, RetainedValue>;
+
+        vector<Entry>::iterator find(slice key) {
+            return lower_bound(_entries.begin(), _entries.end(), key,
+                               [](const Entry &entry, slice k) {return entry.first < k;});
+        }
+
+        vector<Entry>::const_iterator find(slice key) const {
+            return const_cast<MutableBucket*>(this)->find(key);
+        }
+
+        vector<Entry> _entries;
+    };
+
+
     // An interior node holds a small compact hash table mapping to Nodes.
     class MutableInterior : public MutableNode {
     public:
@@ -100,6 +203,10 @@ namespace fleece { namespace hashtree {
             return _bitmap.bitCount();
         }
 
+        bitmap_t bitmap() const {
+            return bitmap_t(_bitmap);
+        }
+
 
         NodeRef childAtIndex(unsigned index) {
             assert_precondition(index < capacity());
@@ -112,7 +219,9 @@ namespace fleece { namespace hashtree {
             for (unsigned i = 0; i < n; ++i) {
                 auto child = _children[i].asMutable();
                 if (child) {
-                    if (child->isLeaf())
+                    if (child->isBucket())
+                        delete (MutableBucket*)child;
+                    else if (child->isLeaf())
                         delete (MutableLeaf*)child;
                     else
                         ((MutableInterior*)child)->deleteTree();
@@ -127,17 +236,12 @@ namespace fleece { namespace hashtree {
             unsigned n = childCount();
             for (unsigned i = 0; i < n; ++i) {
                 auto child = _children[i];
-                if (child.isMutable()) {
-                    if (child.asMutable()->isLeaf())
-                        count += 1;
-                    else
-                        count += ((MutableInterior*)child.asMutable())->leafCount();
-                } else {
-                    if (child.asImmutable()->isLeaf())
-                        count += 1;
-                    else
-                        count += child.asImmutable()->interior.leafCount();
-                }
+                if (child.isLeaf())
+                    count += child.entryCount();
+                else if (child.isMutable())
+                    count += ((MutableInterior*)child.asMutable())->leafCount();
+                else
+                    count += child.asImmutable()->interior.leafCount();
             }
             return count;
         }
@@ -163,7 +267,7 @@ namespace fleece { namespace hashtree {
         // Recursive insertion method. On success returns either 'this', or a new node that
         // replaces 'this'. On failure (i.e. callback returned nullptr) returns nullptr.
         MutableInterior* insert(const Target &target, unsigned shift) {
-            assert_precondition(shift + kBitShift < 8*sizeof(hash_t));//FIX: //TODO: Handle hash collisions
+            assert_precondition(shift < 8*sizeof(hash_t));
             unsigned bitNo = childBitNumber(target.hash, shift);
             if (!hasChild(bitNo)) {
                 // No child -- add a leaf:
@@ -184,9 +288,26 @@ namespace fleece { namespace hashtree {
                     else
                         childRef = new MutableLeaf(target, val);
                     return this;
+                } else if (childRef.hash(target.hashID) == target.hash) {
+                    // Hash collision! Put the keys in a bucket:
+                    MutableNode *mchild = childRef.asMutable();
+                    auto bucket = (mchild && mchild->isBucket()) ? (MutableBucket*)mchild : nullptr;
+                    bool newBucket = !bucket;
+                    if (newBucket)
+                        bucket = new MutableBucket(childRef, target.hash);
+                    if (!bucket->insert(target)) {
+                        if (newBucket)
+                            delete bucket;
+                        return nullptr;
+                    }
+                    if (newBucket) {
+                        delete (MutableLeaf*)childRef.asMutable();
+                        childRef = bucket;
+                    }
+                    return this;
                 } else {
                     // Nope, need to promote the leaf to an interior node & add new key:
-                    MutableInterior *node = promoteLeaf(childRef, shift);
+                    MutableInterior *node = promoteLeaf(childRef, shift, target.hashID);
                     auto insertedNode = node->insert(target, shift+kBitShift);
                     if (!insertedNode) {
                         delete node;
@@ -198,19 +319,22 @@ namespace fleece { namespace hashtree {
             } else {
                 // Progress down to interior node...
                 auto child = (MutableInterior*)childRef.asMutable();
+                MutableInterior *copied = nullptr;
                 if (!child)
-                    child = mutableCopy(&childRef.asImmutable()->interior, 1);
-                child = child->insert(target, shift+kBitShift);
-                if (child)
-                    childRef = child;
-                //FIX: This can leak if child is created by mutableCopy, but then
+                    child = copied = mutableCopy(&childRef.asImmutable()->interior, 1);
+                auto insertedNode = child->insert(target, shift+kBitShift);
+                if (!insertedNode) {
+                    delete copied;      // (its children are all immutable)
+                    return nullptr;
+                }
+                childRef = insertedNode;
                 return this;
             }
         }
 
 
         bool remove(Target target, unsigned shift) {
-            assert_precondition(shift + kBitShift < 8*sizeof(hash_t));
+            assert_precondition(shift < 8*sizeof(hash_t));
             unsigned bitNo = childBitNumber(target.hash, shift);
             if (!hasChild(bitNo))
                 return false;
@@ -222,6 +346,8 @@ namespace fleece { namespace hashtree {
                     removeChild(bitNo, childIndex);
                     delete (MutableLeaf*)childRef.asMutable();
                     return true;
+                } else if (childRef.isBucket() && childRef.hash(target.hashID) == target.hash) {
+                    return removeFromBucket(_children[childIndex], target);
                 } else {
                     return false;
                 }
@@ -296,21 +422,12 @@ namespace fleece { namespace hashtree {
         }
 
 
-        offset_t writeRootTo(Encoder &enc) {
-            auto intNode = writeTo(enc);
-            auto curPos = (offset_t)enc.nextWritePos();
-            intNode.makeRelativeTo(curPos);
-            enc.writeRaw({&intNode, sizeof(intNode)});
-            return offset_t(curPos);
-        }
-
-
-        void dump(std::ostream &out, unsigned indent =1) const {
+        void dump(std::ostream &out, HashID hashID, unsigned indent =1) const {
             unsigned n = childCount();
             out << string(2*indent, ' ') << "{";
             for (unsigned i = 0; i < n; ++i) {
                 out << "\n";
-                _children[i].dump(out, indent+1);
+                _children[i].dump(out, hashID, indent+1);
             }
             out << " }";
         }
@@ -339,17 +456,36 @@ namespace fleece { namespace hashtree {
 
         static MutableInterior* mutableCopy(const Interior *iNode, unsigned extraCapacity =0) {
             auto childCount = iNode->childCount();
-            auto node = newNode(childCount + extraCapacity);
+            auto node = newNode(min(childCount + extraCapacity, unsigned(kMaxChildren)));
             node->_bitmap = asBitmap(iNode->bitmap());
             for (unsigned i = 0; i < childCount; ++i)
                 node->_children[i] = NodeRef(iNode->childAtIndex(i));
             return node;
         }
 
-        static MutableInterior* promoteLeaf(NodeRef& childLeaf, unsigned shift) {
+        static bool removeFromBucket(NodeRef &bucketRef, const Target &target) {
+            auto bucket = (MutableBucket*)bucketRef.asMutable();
+            if (!bucket) {
+                if (!bucketRef.get(target))
+                    return false;
+                bucket = new MutableBucket(bucketRef, target.hash);
+                bucketRef = bucket;
+            }
+            if (!bucket->remove(target.key))
+                return false;
+            if (bucket->count() == 1) {
+                // Only one key left, so turn the bucket back into a plain leaf:
+                auto entry = bucket->entryAt(0);
+                bucketRef = new MutableLeaf(entry.first, bucket->_hash, entry.second);
+                delete bucket;
+            }
+            return true;
+        }
+
+        static MutableInterior* promoteLeaf(NodeRef& childLeaf, unsigned shift, HashID hashID) {
             unsigned level = shift / kBitShift;
             MutableInterior* node = newNode(2 + (level<1) + (level<3));
-            unsigned childBitNo = childBitNumber(childLeaf.hash(), shift+kBitShift);
+            unsigned childBitNo = childBitNumber(childLeaf.hash(hashID), shift+kBitShift);
             node = node->addChild(childBitNo, childLeaf);
             return node;
         }
@@ -367,10 +503,11 @@ namespace fleece { namespace hashtree {
 
         MutableInterior* grow() {
             assert_precondition(capacity() < kMaxChildren);
-            auto replacement = (MutableInterior*)realloc(this,
-                                    sizeof(MutableInterior) + (capacity()+1)*sizeof(NodeRef));
-            if (!replacement)
-                throw std::bad_alloc();
+            // (Not realloc, since the memory comes from `operator new`, not malloc.)
+            size_t size = sizeof(MutableInterior) + capacity()*sizeof(NodeRef);
+            auto replacement = (MutableInterior*)::operator new(size + sizeof(NodeRef));
+            memcpy((void*)replacement, this, size);
+            ::operator delete(this);
             replacement->_capacity++;
             return replacement;
         }
@@ -26,20 +26,67 @@ namespace fleece { namespace hashtree {
         return isMutable() ? _asMutable()->isLeaf() : _asImmutable()->isLeaf();
     }
 
-    hash_t NodeRef::hash() const {
+    bool NodeRef::isBucket() const {
+        return isMutable() ? _asMutable()->isBucket()
+                           : (_asImmutable()->isLeaf() && _asImmutable()->leaf.isBucket());
+    }
+
+    hash_t NodeRef::hash(HashID hashID) const {
         assert_precondition(isLeaf());
-        return isMutable() ? ((MutableLeaf*)_asMutable())->_hash : _asImmutable()->leaf.hash();
+        if (!isMutable())
+            return _asImmutable()->leaf.hash(hashID);
+        else if (_asMutable()->isBucket())
+            return ((MutableBucket*)_asMutable())->_hash;
+        else
+            return ((MutableLeaf*)_asMutable())->_hash;
     }
 
     Value NodeRef::value() const {
-        assert_precondition(isLeaf());
+        assert_precondition(isLeaf() && !isBucket());
         return isMutable() ? ((MutableLeaf*)_asMutable())->_value : _asImmutable()->leaf.value();
     }
 
     bool NodeRef::matches(Target target) const {
         assert_precondition(isLeaf());
-        return isMutable() ? ((MutableLeaf*)_asMutable())->matches(target)
-                           : _asImmutable()->leaf.matches(target.key);
+        if (!isMutable())
+            return _asImmutable()->leaf.matches(target.key);
+        else if (_asMutable()->isBucket())
+            return false;
+        else
+            return ((MutableLeaf*)_asMutable())->matches(target);
+    }
+
+    Value NodeRef::get(const Target &target) const {
+        assert_precondition(isLeaf());
+        if (!isMutable())
+            return _asImmutable()->leaf.get(target.key);
+        else if (_asMutable()->isBucket())
+            return ((MutableBucket*)_asMutable())->get(target.key);
+        else if (((MutableLeaf*)_asMutable())->matches(target))
+            return ((MutableLeaf*)_asMutable())->_value;
+        else
+            return nullptr;
+    }
+
+    unsigned NodeRef::entryCount() const {
+        assert_precondition(isLeaf());
+        if (!isMutable())
+            return _asImmutable()->leaf.entryCount();
+        else if (_asMutable()->isBucket())
+            return ((MutableBucket*)_asMutable())->count();
+        else
+            return 1;
+    }
+
+    pair<slice,Value> NodeRef::entryAt(unsigned i) const {
+        assert_precondition(isLeaf());
+        if (!isMutable())
+            return _asImmutable()->leaf.entryAt(i);
+        else if (_asMutable()->isBucket())
+            return ((MutableBucket*)_asMutable())->entryAt(i);
+        auto leaf = (MutableLeaf*)_asMutable();
+        assert_precondition(i == 0);
+        return {leaf->_key, leaf->_value};
     }
 
     unsigned NodeRef::childCount() const {
@@ -67,19 +114,22 @@ namespace fleece { namespace hashtree {
 
     uint32_t NodeRef::writeTo(Encoder &enc, bool writeKey) {
         assert_precondition(isLeaf());
-        if (isMutable())
+        if (isMutable() && _asMutable()->isBucket())
+            return ((MutableBucket*)asMutable())->writeTo(enc, writeKey);
+        else if (isMutable())
             return ((MutableLeaf*)asMutable())->writeTo(enc, writeKey);
         else
             return asImmutable()->leaf.writeTo(enc, writeKey);
     }
 
-    void NodeRef::dump(ostream &out, unsigned indent) const {
+    void NodeRef::dump(ostream &out, HashID hashID, unsigned indent) const {
         if (isMutable())
-            isLeaf() ? ((MutableLeaf*)_asMutable())->dump(out, indent)
-                     : ((MutableInterior*)_asMutable())->dump(out, indent);
+            isBucket() ? ((MutableBucket*)_asMutable())->dump(out, indent)
+                : isLeaf() ? ((MutableLeaf*)_asMutable())->dump(out, indent)
+                           : ((MutableInterior*)_asMutable())->dump(out, hashID, indent);
         else
-            isLeaf() ? _asImmutable()->leaf.dump(out, indent)
-                     : _asImmutable()->interior.dump(out, indent);
+            isLeaf() ? _asImmutable()->leaf.dump(out, hashID, indent)
+                     : _asImmutable()->interior.dump(out, hashID, indent);
     }
 
 } } 
@@ -17,8 +17,8 @@ namespace fleece { namespace hashtree {
 
     // Specifies an insertion/deletion
     struct Target {
-        explicit Target(slice k, MutableHashTree::InsertCallback *callback =nullptr)
-        :key(k), hash(ComputeHash(k)), insertCallback(callback)
+        explicit Target(slice k, HashID h, MutableHashTree::InsertCallback *callback =nullptr)
+        :key(k), hash(ComputeHash(k, h)), hashID(h), insertCallback(callback)
         { }
 
         bool operator== (const Target &b) const {
@@ -27,6 +27,7 @@ namespace fleece { namespace hashtree {
 
         slice const key;
         hash_t const hash;
+        HashID const hashID;
         MutableHashTree::InsertCallback *insertCallback {nullptr};
     };
 
@@ -54,17 +55,22 @@ namespace fleece { namespace hashtree {
             return isMutable() ? nullptr : _asImmutable();
         }
 
-        bool isLeaf() const FLPURE;
-        hash_t hash() const FLPURE;
-        bool matches(Target) const FLPURE;
-        Value value() const FLPURE;
+        bool isLeaf() const FLPURE;         // true for a plain leaf or a collision bucket
+        bool isBucket() const FLPURE;
+        hash_t hash(HashID) const FLPURE;
+        bool matches(Target) const FLPURE;  // only a plain leaf can match
+        Value value() const FLPURE;         // only for a plain leaf
+
+        Value get(const Target&) const FLPURE;
+        unsigned entryCount() const FLPURE;
+        std::pair<slice,Value> entryAt(unsigned i) const FLPURE;
 
         unsigned childCount() const FLPURE;
         NodeRef childAtIndex(unsigned index) const FLPURE;
 
         Node writeTo(Encoder &enc);
         uint32_t writeTo(Encoder &enc, bool writeKey);
-        void dump(std::ostream&, unsigned indent) const;
+        void dump(std::ostream&, HashID, unsigned indent) const;
 
     private:
         MutableNode* _asMutable() const         {return (MutableNode*)(_addr & ~1);}
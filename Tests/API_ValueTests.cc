@@ -149,6 +149,29 @@ TEST_CASE("API Paths", "[API][Encoder]") {
 }
 
 
+TEST_CASE("API Path sets", "[API][Encoder]") {
+    alloc_slice fleeceData = readTestFile(kBigJSONTestFileName);
+    Doc doc = Doc::fromJSON(fleeceData);
+    auto root = doc.root();
+
+    FLError error = kFLNoError;
+    FLSlice specs[] = {"$[32].name"_sl, "[32].friends[0].name"_sl, "[32].nope"_sl};
+    KeyPathSet paths(specs, 3, &error);
+    REQUIRE(paths);
+    CHECK(paths.count() == 3);
+    FLValue values[3];
+    CHECK(paths.eval(root, values) == 2);
+    CHECK(Value(values[0]).asString() == "Mendez Tran"_sl);
+    CHECK(Value(values[1]) == root[KeyPath("[32].friends[0].name"_sl, &error)]);
+    CHECK(values[2] == nullptr);
+
+    FLSlice badSpecs[] = {"foo"_sl, "bar[x]"_sl};
+    KeyPathSet badPaths(badSpecs, 2, &error);
+    CHECK(!badPaths);
+    CHECK(error != kFLNoError);
+}
+
+
 TEST_CASE("API Undefined", "[API]") {
     Encoder enc;
     enc.beginArray();
@@ -232,3 +255,20 @@ TEST_CASE("API MutableDict", "[API]") {
     REQUIRE(d.get("x"_sl));
     CHECK(d.get("x"_sl).asInt() == 1234);
 }
+
+TEST_CASE("API KeyPath elements", "[API]") {
+    FLError error;
+    FLKeyPath path = FLKeyPath_New("foo[2][*]..bar"_sl, &error);
+    REQUIRE(path);
+    FLSlice key;
+    int32_t index;
+    CHECK(FLKeyPath_GetElement(path, 0, &key, &index));
+    CHECK(slice(key) == "foo"_sl);
+    CHECK(FLKeyPath_GetElement(path, 1, &key, &index));
+    CHECK(!key.buf);
+    CHECK(index == 2);
+    CHECK(!FLKeyPath_GetElement(path, 2, &key, &index));    // wildcard
+    CHECK(!FLKeyPath_GetElement(path, 3, &key, &index));    // descendant
+    CHECK(!FLKeyPath_GetElement(path, 4, &key, &index));
+    FLKeyPath_Free(path);
+}
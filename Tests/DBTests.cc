@@ -0,0 +1,605 @@
+//
+//  DBTests.cc
+//  Fleece
+//
+// Copyright © 2018 Couchbase. All rights reserved.
+//
+
+#include "FleeceTests.hh"
+#include "DB.hh"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <random>
+#include <thread>
+
+#if FL_HAVE_MMAP
+
+using namespace std;
+using namespace fleece;
+
+static const char* kDBPath = kTempDir "fleece_db_test.fleecedb";
+
+
+static Doc makeDoc(int i) {
+    char json[100];
+    sprintf(json, "{\"i\": %d, \"name\": \"Document number %d\"}", i, i);
+    return Doc::fromJSON(slice(json));
+}
+
+
+static alloc_slice docKey(int i) {
+    char key[20];
+    sprintf(key, "doc-%d", i);
+    return alloc_slice(key);
+}
+
+
+TEST_CASE("DB Basics", "[DB]") {
+    {
+        DB db(kDBPath, DB::kEraseAndWrite);
+        CHECK(db.count() == 0);
+        CHECK(db.dataSize() == 0);
+        CHECK(!db.get("doc-1"_sl));
+        CHECK(!db.getMutable("doc-1"_sl));
+
+        for (int i = 0; i < 100; ++i)
+            db.put(docKey(i), makeDoc(i).asDict());
+        CHECK(db.isChanged());
+        CHECK(db.count() == 100);
+        db.commitChanges();
+        CHECK(!db.isChanged());
+        CHECK(db.dataSize() > 0);
+        CHECK(db.count() == 100);
+        CHECK(db.get("doc-17"_sl)["i"_sl].asInt() == 17);
+    }
+    {
+        DB db(kDBPath, DB::kWrite);
+        CHECK(db.count() == 100);
+        for (int i = 0; i < 100; ++i)
+            CHECK(db.get(docKey(i))["name"_sl].asString() == makeDoc(i).asDict()["name"_sl].asString());
+
+        // Modify a document in place, and delete one:
+        MutableDict doc = db.getMutable("doc-17"_sl);
+        REQUIRE(doc);
+        doc["i"_sl] = 1717;
+        doc["new"_sl] = true;
+        CHECK(db.remove("doc-50"_sl));
+        CHECK(!db.remove("doc-50"_sl));
+        CHECK(!db.remove("nonexistent"_sl));
+        size_t sizeBefore = db.dataSize();
+        db.commitChanges();
+        CHECK(db.dataSize() > sizeBefore);
+        CHECK(db.count() == 99);
+
+        // Revert some changes:
+        db.put("doc-50"_sl, makeDoc(50).asDict());
+        db.remove("doc-1"_sl);
+        CHECK(db.count() == 99);
+        db.revertChanges();
+        CHECK(!db.isChanged());
+        CHECK(!db.get("doc-50"_sl));
+        CHECK(db.get("doc-1"_sl));
+    }
+    {
+        DB db(kDBPath, DB::kReadOnly);
+        CHECK(db.count() == 99);
+        Dict doc = db.get("doc-17"_sl);
+        CHECK(doc["i"_sl].asInt() == 1717);
+        CHECK(doc["new"_sl].asBool() == true);
+        CHECK(doc["name"_sl].asString() == "Document number 17"_sl);
+        CHECK(!db.get("doc-50"_sl));
+
+        unsigned n = 0;
+        for (DB::iterator i(db); i; ++i) {
+            CHECK(i.key().hasPrefix("doc-"_sl));
+            CHECK(i.value()["name"_sl].asString().hasPrefix("Document number "_sl));
+            ++n;
+        }
+        CHECK(n == 99);
+    }
+}
+
+
+TEST_CASE("DB Growth", "[DB]") {
+    // Commit enough data that the file outgrows its initial mapping and has to be remapped.
+    static constexpr int kNumDocs = 20000;
+    Doc big = Doc::fromJSON("{\"filler\": \"Lorem ipsum dolor sit amet, consectetur adipiscing "
+                            "elit, sed do eiusmod tempor incididunt ut labore et dolore magna\"}"_sl);
+    {
+        DB db(kDBPath, DB::kEraseAndWrite);
+        Dict first;
+        for (int i = 0; i < kNumDocs; ++i) {
+            MutableDict doc = big.asDict().mutableCopy();
+            doc["i"_sl] = i;
+            db.put(docKey(i), doc);
+            if (i % 1000 == 999) {
+                db.commitChanges();
+                if (!first)
+                    first = db.get(docKey(0));
+            }
+        }
+        CHECK(db.dataSize() > (2 << 20));       // (the initial mapping is 1MB)
+        CHECK(db.count() == kNumDocs);
+        // A Dict read before the remapping is still valid:
+        CHECK(first["i"_sl].asInt() == 0);
+        for (int i = 0; i < kNumDocs; i += 97)
+            CHECK(db.get(docKey(i))["i"_sl].asInt() == i);
+    }
+    {
+        DB db(kDBPath, DB::kReadOnly);
+        CHECK(db.count() == kNumDocs);
+        for (int i = 0; i < kNumDocs; i += 97)
+            CHECK(db.get(docKey(i))["i"_sl].asInt() == i);
+    }
+}
+
+
+TEST_CASE("DB Recovery", "[DB]") {
+    static constexpr int kDocsPerCommit = 5;
+    static const char* kCopyPath = kTempDir "fleece_db_test_copy.fleecedb";
+
+    // Make a file with several commits, noting where each one ends:
+    vector<size_t> commitEnds;
+    {
+        DB db(kDBPath, DB::kEraseAndWrite);
+        db.setSyncMode(DB::kNoSync);
+        commitEnds.push_back(db.fileSize());
+        for (int c = 0; c < 4; ++c) {
+            for (int i = 0; i < kDocsPerCommit; ++i)
+                db.put(docKey(c * kDocsPerCommit + i), makeDoc(i).asDict());
+            db.commitChanges();
+            commitEnds.push_back(db.fileSize());
+        }
+    }
+    alloc_slice file = readFile(kDBPath);
+    REQUIRE(file.size == commitEnds.back());
+
+    auto commitsBefore = [&](size_t len) {
+        return unsigned(upper_bound(commitEnds.begin(), commitEnds.end(), len)
+                        - commitEnds.begin()) - 1;
+    };
+
+    // Truncate the file at every offset, as though a crash interrupted the writing of it:
+    // the DB should come back as of the last complete commit.
+    for (size_t len = 0; len <= file.size; ++len) {
+        INFO("Truncated to " << len << " bytes");
+        writeToFile(file.upTo(len), kCopyPath);
+        DB db(kCopyPath, DB::kReadOnly);
+        if (len < commitEnds[0]) {
+            CHECK(db.count() == 0);
+        } else {
+            unsigned commits = commitsBefore(len);
+            CHECK(db.count() == commits * kDocsPerCommit);
+            CHECK(db.fileSize() == commitEnds[commits]);
+        }
+    }
+
+    // Opening a damaged file for writing truncates it, and commits then continue normally:
+    for (size_t len : {size_t(0), size_t(3), commitEnds[1] + 1, file.size - 1}) {
+        INFO("Truncated to " << len << " bytes");
+        writeToFile(file.upTo(len), kCopyPath);
+        unsigned commits = (len < commitEnds[0]) ? 0 : commitsBefore(len);
+        {
+            DB db(kCopyPath, DB::kWrite);
+            CHECK(db.fileSize() == commitEnds[commits]);
+            CHECK(readFile(kCopyPath).size == commitEnds[commits]);
+            db.put("extra"_sl, makeDoc(99).asDict());
+            db.commitChanges();
+        }
+        DB db(kCopyPath, DB::kReadOnly);
+        CHECK(db.count() == commits * kDocsPerCommit + 1);
+        CHECK(db.get("extra"_sl)["i"_sl].asInt() == 99);
+    }
+
+    // A corrupted byte in the last commit invalidates it (but not the earlier ones):
+    alloc_slice damaged(slice{file});
+    const_cast<uint8_t&>(damaged[(commitEnds[3] + commitEnds[4]) / 2]) ^= 0x40;
+    writeToFile(damaged, kCopyPath);
+    DB db(kCopyPath, DB::kReadOnly);
+    CHECK(db.count() == 3 * kDocsPerCommit);
+    CHECK(db.fileSize() == commitEnds[3]);
+}
+
+
+TEST_CASE("DB Compaction", "[DB]") {
+    static constexpr int kNumDocs = 2000;
+    {
+        DB db(kDBPath, DB::kEraseAndWrite);
+        db.setSyncMode(DB::kNoSync);
+        for (int i = 0; i < kNumDocs; ++i)
+            db.put(docKey(i), makeDoc(i).asDict());
+        db.commitChanges();
+        // Update every document a few times, leaving the earlier versions as garbage:
+        for (int round = 1; round <= 3; ++round) {
+            for (int i = 0; i < kNumDocs; ++i) {
+                MutableDict doc = db.getMutable(docKey(i));
+                doc["round"_sl] = round;
+                if (i % 100 == 99)
+                    db.commitChanges();
+            }
+            db.commitChanges();
+        }
+        CHECK(db.liveDataStart() == 8);
+
+        MutableDict retained = db.getMutable(docKey(7));
+        db.revertChanges();
+
+        // Compact in small steps until all the data that was in the file has been processed:
+        size_t endPos = db.fileSize();
+        size_t totalReclaimed = 0, totalWritten = 0;
+        unsigned steps = 0;
+        while (db.liveDataStart() < endPos) {
+            size_t liveStart = db.liveDataStart(), fileSize = db.fileSize();
+            DB::CompactionStats stats = db.compact(16 * 1024);
+            CHECK(stats.bytesReclaimed > 0);
+            CHECK(db.liveDataStart() == liveStart + stats.bytesReclaimed);
+            CHECK(db.fileSize() == fileSize + stats.bytesWritten);
+            CHECK(!db.isChanged());
+            totalReclaimed += stats.bytesReclaimed;
+            totalWritten += stats.bytesWritten;
+            REQUIRE(++steps < 1000);
+        }
+        CHECK(steps > 1);
+        // Most of the file was garbage, so it was cheap to reclaim:
+        CHECK(totalReclaimed >= endPos - 8);
+        CHECK(totalWritten < totalReclaimed / 2);
+
+        // A MutableDict made before compaction is still valid:
+        CHECK(retained["i"_sl].asInt() == 7);
+        CHECK(retained["name"_sl].asString() == "Document number 7"_sl);
+
+        CHECK(db.count() == kNumDocs);
+        for (int i = 0; i < kNumDocs; ++i) {
+            Dict doc = db.get(docKey(i));
+            CHECK(doc["i"_sl].asInt() == i);
+            CHECK(doc["round"_sl].asInt() == 3);
+        }
+
+        // Commits still work normally afterwards:
+        db.put("extra"_sl, makeDoc(99).asDict());
+        db.commitChanges();
+    }
+    {
+        DB db(kDBPath, DB::kWrite);
+        CHECK(db.count() == kNumDocs + 1);
+        for (int i = 0; i < kNumDocs; ++i)
+            CHECK(db.get(docKey(i))["round"_sl].asInt() == 3);
+        CHECK(db.get("extra"_sl)["i"_sl].asInt() == 99);
+        // Compact all the live data at once, with nothing retaining the old data this time:
+        db.compact(SIZE_MAX);
+        CHECK(db.fileSize() - db.liveDataStart() < db.count() * 100);
+        for (int i = 0; i < kNumDocs; ++i)
+            CHECK(db.get(docKey(i))["name"_sl].asString() == makeDoc(i).asDict()["name"_sl].asString());
+    }
+}
+
+
+TEST_CASE("DB Snapshots", "[DB]") {
+    static constexpr int kNumDocs = 200, kNumCommits = 300, kNumReaders = 4;
+    DB db(kDBPath, DB::kEraseAndWrite);
+    db.setSyncMode(DB::kNoSync);
+    CHECK(db.snapshot().count() == 0);
+
+    // Every commit sets all the documents' "gen" to the same value, so a consistent snapshot
+    // has the same "gen" in every document:
+    auto writeGeneration = [&](int gen) {
+        for (int i = 0; i < kNumDocs; ++i) {
+            MutableDict doc = makeDoc(i).asDict().mutableCopy();
+            doc["gen"_sl] = gen;
+            db.put(docKey(i), doc);
+        }
+        db.commitChanges();
+    };
+    auto generationOf = [&](const DB::Snapshot &snap) -> int64_t {
+        if (snap.count() != kNumDocs)
+            return -1;
+        int64_t gen = snap.get(docKey(0))["gen"_sl].asInt();
+        for (int i = 1; i < kNumDocs; ++i) {
+            if (snap.get(docKey(i))["gen"_sl].asInt() != gen)
+                return -1;
+        }
+        return gen;
+    };
+
+    writeGeneration(0);
+    DB::Snapshot first = db.snapshot();
+    CHECK(first.commitPos() == db.fileSize());
+    writeGeneration(1);
+    CHECK(generationOf(first) == 0);
+    CHECK(generationOf(db.snapshot()) == 1);
+    CHECK(db.snapshot().commitPos() > first.commitPos());
+
+    // Now read snapshots on other threads while the DB is being written and compacted.
+    // (Catch isn't thread-safe, so the readers just count problems.)
+    atomic<bool> writing {true};
+    atomic<int> inconsistent {0}, wentBackwards {0}, changed {0}, snapshotsRead {0};
+    auto reader = [&] {
+        int64_t lastGen = 0;
+        while (writing) {
+            DB::Snapshot snap = db.snapshot();
+            int64_t gen = generationOf(snap);
+            if (gen < 0)
+                ++inconsistent;
+            else if (gen < lastGen)
+                ++wentBackwards;
+            lastGen = gen;
+            this_thread::yield();
+            if (generationOf(snap) != gen)
+                ++changed;
+            ++snapshotsRead;
+        }
+    };
+    vector<future<void>> readers;
+    for (int r = 0; r < kNumReaders; ++r)
+        readers.push_back(async(launch::async, reader));
+    for (int gen = 2; gen < kNumCommits; ++gen) {
+        writeGeneration(gen);
+        db.compact(64 * 1024);
+    }
+    writing = false;
+    for (auto &r : readers)
+        r.get();
+
+    CHECK(inconsistent == 0);
+    CHECK(wentBackwards == 0);
+    CHECK(changed == 0);
+    CHECK(snapshotsRead > 0);
+    CHECK(db.liveDataStart() > first.commitPos());
+    // The first snapshot is still intact, even though compaction has passed it:
+    CHECK(generationOf(first) == 0);
+    CHECK(generationOf(db.snapshot()) == kNumCommits - 1);
+}
+
+
+TEST_CASE("DB Group Commit", "[DB]") {
+    static constexpr int kNumThreads = 8, kCommitsPerThread = 20;
+    DB db(kDBPath, DB::kEraseAndWrite);
+    db.setSyncMode(DB::kNoSync);
+    db.setGroupCommitWindow(chrono::milliseconds(10));
+
+    // (The first changes applied in each group see an unchanged tree.)
+    atomic<int> groups {0};
+    auto writer = [&](int thread) {
+        for (int i = 0; i < kCommitsPerThread; ++i) {
+            db.groupCommit([&](DB &db) {
+                if (!db.isChanged())
+                    ++groups;
+                db.put(docKey(thread * kCommitsPerThread + i),
+                       makeDoc(thread * kCommitsPerThread + i).asDict());
+            });
+        }
+    };
+    vector<future<void>> writers;
+    for (int t = 0; t < kNumThreads; ++t)
+        writers.push_back(async(launch::async, writer, t));
+    for (auto &w : writers)
+        w.get();
+
+    CHECK(!db.isChanged());
+    CHECK(db.count() == kNumThreads * kCommitsPerThread);
+    CHECK(groups < kNumThreads * kCommitsPerThread);
+    for (int i = 0; i < kNumThreads * kCommitsPerThread; ++i)
+        CHECK(db.get(docKey(i))["i"_sl].asInt() == i);
+
+    // If a caller's changes fail, its group is reverted:
+    CHECK_THROWS_AS(db.groupCommit([](DB &db) {
+                        db.put("bad"_sl, makeDoc(0).asDict());
+                        throw std::runtime_error("oops");
+                    }), std::runtime_error);
+    CHECK(!db.isChanged());
+    CHECK(!db.get("bad"_sl));
+    db.groupCommit([](DB &db) {db.remove(docKey(0));});
+    CHECK(db.count() == kNumThreads * kCommitsPerThread - 1);
+
+    DB reopened(kDBPath, DB::kReadOnly);
+    CHECK(reopened.count() == kNumThreads * kCommitsPerThread - 1);
+}
+
+
+TEST_CASE("DB Errors", "[DB]") {
+    CHECK_THROWS(DB(kTempDir "no_such_dir/db.fleecedb", DB::kCreateAndWrite));
+    writeToFile("Nope"_sl, kDBPath);          // too short to be a HashTree
+    CHECK_THROWS(DB(kDBPath, DB::kReadOnly));
+}
+
+
+// Picks integers in [0, n) with a Zipfian distribution, like YCSB's default request
+// distribution: a few "hot" items are chosen much more often than the rest. The items are
+// scattered, so the hot ones aren't adjacent.
+class ZipfianGenerator {
+public:
+    ZipfianGenerator(uint64_t n, double theta =0.99)
+    :_n(n), _theta(theta)
+    {
+        for (uint64_t i = 1; i <= n; ++i)
+            _zetan += 1.0 / pow(double(i), theta);
+        double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+        _alpha = 1.0 / (1.0 - theta);
+        _eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / _zetan);
+    }
+
+    template <class RNG>
+    uint64_t operator() (RNG &rng) {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * _zetan;
+        uint64_t rank;
+        if (uz < 1.0)
+            rank = 0;
+        else if (uz < 1.0 + pow(0.5, _theta))
+            rank = 1;
+        else
+            rank = uint64_t(_n * pow(_eta * u - _eta + 1.0, _alpha));
+        return (min(rank, _n - 1) * 2654435761u) % _n;
+    }
+
+private:
+    uint64_t _n;
+    double _theta, _zetan {0}, _alpha, _eta;
+};
+
+
+TEST_CASE("Perf DB YCSB", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static constexpr int kNumRecords = 100000;
+    static constexpr int kNumOps = 500000;
+    static constexpr int kOpsPerCommit = 1000;
+
+    // Each record is a Dict of 10 fields of 100 bytes, as in YCSB's default workloads:
+    vector<alloc_slice> keys;
+    for (int i = 0; i < kNumRecords; ++i) {
+        char key[30];
+        sprintf(key, "user%012d", i);
+        keys.emplace_back(key);
+    }
+    mt19937 rng(0x5EED);
+    vector<Doc> records;
+    for (int r = 0; r < 100; ++r) {
+        Encoder enc;
+        enc.beginDict();
+        for (int f = 0; f < 10; ++f) {
+            char field[10], value[101];
+            sprintf(field, "field%d", f);
+            for (int c = 0; c < 100; ++c)
+                value[c] = char('a' + rng() % 26);
+            enc.writeKey(field);
+            enc.writeString(slice(value, 100));
+        }
+        enc.endDict();
+        records.push_back(enc.finishDoc());
+    }
+
+    struct Workload {const char *name; int readPercent;};
+    static constexpr Workload kWorkloads[] = {
+        {"read-heavy (95/5)",  95},
+        {"mixed (50/50)",      50},
+        {"write-heavy (5/95)",  5},
+    };
+
+    // Runs a workload against a store, given functions to read a record, update one, and
+    // commit; reports the time per operation.
+    auto run = [&](const Workload &workload, auto read, auto update, auto commit) {
+        mt19937 opRNG(1234);
+        ZipfianGenerator zipf(kNumRecords);
+        int64_t sum = 0;
+        Benchmark bench;
+        bench.start();
+        for (int op = 1; op <= kNumOps; ++op) {
+            slice key = keys[zipf(opRNG)];
+            if (int(opRNG() % 100) < workload.readPercent)
+                sum += read(key)["field0"_sl].asString().size;
+            else
+                update(key, records[opRNG() % records.size()].asDict());
+            if (op % kOpsPerCommit == 0)
+                commit();
+        }
+        commit();
+        bench.stop();
+        CHECK(sum > 0);
+        fprintf(stderr, "    %-20s ", workload.name);
+        bench.printReport(1.0/kNumOps, "op");
+    };
+
+    fprintf(stderr, "YCSB-style workloads, %d records, %d ops, commit every %d ops:\n",
+            kNumRecords, kNumOps, kOpsPerCommit);
+
+    fprintf(stderr, "  In-memory MutableHashTree:\n");
+    for (auto &workload : kWorkloads) {
+        MutableHashTree tree;
+        for (int i = 0; i < kNumRecords; ++i)
+            tree.set(keys[i], records[i % records.size()].asDict());
+        run(workload,
+            [&](slice key) {return tree.get(key).asDict();},
+            [&](slice key, Dict value) {tree.set(key, value);},
+            [&] { });
+    }
+
+    fprintf(stderr, "  DB:\n");
+    for (auto &workload : kWorkloads) {
+        DB db(kDBPath, DB::kEraseAndWrite);
+        db.setSyncMode(DB::kNoSync);        // (measure the DB, not the disk)
+        for (int i = 0; i < kNumRecords; ++i)
+            db.put(keys[i], records[i % records.size()].asDict());
+        db.commitChanges();
+        size_t loadedSize = db.dataSize();
+        run(workload,
+            [&](slice key) {return db.get(key);},
+            [&](slice key, Dict value) {db.put(key, value);},
+            [&] {db.commitChanges();});
+        fprintf(stderr, "    (file grew from %.1f MB to %.1f MB)\n",
+                loadedSize / 1.0e6, db.dataSize() / 1.0e6);
+    }
+
+    static constexpr size_t kCompactionStep = 256 * 1024;
+    fprintf(stderr, "  DB, compacting %zuKB after every commit:\n", kCompactionStep / 1024);
+    for (auto &workload : kWorkloads) {
+        DB db(kDBPath, DB::kEraseAndWrite);
+        db.setSyncMode(DB::kNoSync);
+        for (int i = 0; i < kNumRecords; ++i)
+            db.put(keys[i], records[i % records.size()].asDict());
+        db.commitChanges();
+        DB::CompactionStats total;
+        run(workload,
+            [&](slice key) {return db.get(key);},
+            [&](slice key, Dict value) {db.put(key, value);},
+            [&] {
+                db.commitChanges();
+                auto stats = db.compact(kCompactionStep);
+                total.bytesReclaimed += stats.bytesReclaimed;
+                total.bytesWritten += stats.bytesWritten;
+            });
+        fprintf(stderr, "    (%.1f MB live of %.1f MB; reclaimed %.1f MB, write amplification %.2f)\n",
+                (db.fileSize() - db.liveDataStart()) / 1.0e6, db.fileSize() / 1.0e6,
+                total.bytesReclaimed / 1.0e6, total.writeAmplification());
+    }
+}
+
+TEST_CASE("Perf DB Group Commit", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static constexpr int kCommitsPerRun = 6400;
+    Doc doc = makeDoc(1);
+
+    fprintf(stderr, "Group commits of one put each, %d per run, synced:\n", kCommitsPerRun);
+    for (auto window : {chrono::microseconds(0), chrono::microseconds(200)}) {
+        for (int nThreads : {1, 8, 64}) {
+            DB db(kDBPath, DB::kEraseAndWrite);
+            db.setGroupCommitWindow(window);
+            atomic<int> groups {0};
+            vector<vector<double>> latencies(nThreads);
+            auto writer = [&](int thread) {
+                for (int i = thread; i < kCommitsPerRun; i += nThreads) {
+                    Stopwatch st;
+                    db.groupCommit([&](DB &db) {
+                        if (!db.isChanged())
+                            ++groups;
+                        db.put(docKey(i), doc.asDict());
+                    });
+                    latencies[thread].push_back(st.elapsed());
+                }
+            };
+            Stopwatch total;
+            vector<future<void>> writers;
+            for (int t = 0; t < nThreads; ++t)
+                writers.push_back(async(launch::async, writer, t));
+            for (auto &w : writers)
+                w.get();
+            double elapsed = total.elapsed();
+            CHECK(db.count() == kCommitsPerRun);
+
+            vector<double> all;
+            for (auto &l : latencies)
+                all.insert(all.end(), l.begin(), l.end());
+            sort(all.begin(), all.end());
+            auto percentile = [&](double p) {return all[size_t(p * (all.size() - 1))] * 1.0e6;};
+            fprintf(stderr, "    window %3lldus, %2d threads: %7.0f commits/sec, %5.1f per group; "
+                            "latency p50 %6.0fus, p99 %6.0fus, max %6.0fus\n",
+                    (long long)window.count(), nThreads, kCommitsPerRun / elapsed,
+                    double(kCommitsPerRun) / groups, percentile(0.5), percentile(0.99),
+                    percentile(1.0));
+        }
+    }
+}
+
+#endif // FL_HAVE_MMAP
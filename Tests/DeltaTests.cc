@@ -19,7 +19,14 @@
 #include "FleeceTests.hh"
 #include "FleeceImpl.hh"
 #include "JSONDelta.hh"
+#include "ThreeWayMerge.hh"
+#include "JSON5.hh"
+#include "MutableDict.hh"
+#include "MutableArray.hh"
+#include "Stopwatch.hh"
+#include <algorithm>
 #include <iostream>
+#include <random>
 
 namespace fleece { namespace impl {
     extern bool gCompatibleDeltas;
@@ -70,6 +77,19 @@ static void checkDelta(const char *json1, const char *json2, const char *deltaEx
         INFO("value2 reconstituted:  " << toJSONString(v2_reconstituted) << " ;  should be:  " << toJSONString(v2) << " ;  delta: " << jsonDelta);
         CHECK(v2_reconstituted->isEqual(v2));
     }
+
+    // The Fleece delta should have the same contents, and apply the same way:
+    alloc_slice fleeceDelta = JSONDelta::createFleece(v1, v2);
+    const Value *fleeceDeltaValue = Value::fromData(fleeceDelta);
+    REQUIRE(fleeceDeltaValue);
+    alloc_slice parsedJSONDelta = JSONConverter::convertJSON(slice(ConvertJSON5(std::string(jsonDelta))));
+    CHECK(fleeceDeltaValue->isEqual(Value::fromData(parsedJSONDelta)));
+    if (v1) {
+        alloc_slice f2_reconstituted = JSONDelta::applyFleece(v1, fleeceDeltaValue);
+        auto v2_reconstituted = Value::fromData(f2_reconstituted);
+        INFO("value2 reconstituted from Fleece:  " << toJSONString(v2_reconstituted));
+        CHECK(v2_reconstituted->isEqual(v2));
+    }
 }
 
 
@@ -85,7 +105,6 @@ TEST_CASE("Delta scalars", "[delta]") {
 
 TEST_CASE("Delta strings", "[delta]") {
     JSONDelta::gMinStringDiffLength = 36;
-    JSONDelta::gTextDiffTimeout = -1; // No timeout since it has platform-specific effects
 
     // Empty string
     checkDelta("'hi'", "''", "[\"\"]");
@@ -104,11 +123,11 @@ TEST_CASE("Delta strings", "[delta]") {
     // Modify string
     checkDelta("'to wound the autumnal city. So howled out for the world to give him a name.  The in-dark answered with the wind.'",
                "'To wound the eternal city. So he howled out for the world to give him its name. The in-dark answered with wind.'",
-               "[\"1-1+T|12=5-4+eter|13=3+he |37=1-3+its|6=1-27=4-5=\",0,2]");
+               "[\"1-1+T|12=5-4+eter|14=3+e h|36=1-3+its|7=1-25=4-6=\",0,2]");
     // Insert in middle
     checkDelta("'to wound the autumnal city. The in-dark answered with the wind.'",
                "'to wound the autumnal city. So howled out for the world to give him a name. The in-dark answered with the wind.'",
-               "[\"27=48+ So howled out for the world to give him a name.|36=\",0,2]");
+               "[\"28=48+So howled out for the world to give him a name. |35=\",0,2]");
     // Inefficient delta
     checkDelta("'Lorem ipsum dolor sit amet, assueverit sadipscing usu ea, mei efficiantur intellegebat in, iudico ullamcorper ei ius. Ius quaeque eripuit instructior ea, et ipsum doctus quo, pri decore ornatus et. Te wisi omittantur interpretaris quo, in audire prompta nominati vim. Dicat epicuri delectus sit eu.'",
                "'Ex quo prima efficiantur, an pro modus pertinax. Magna tractatos qualisque vim id. Eum at omnis inani, labore possim nec id. Exerci audire eam eu, summo liberavisse mel ei. Homero ponderum ea his, cum id impedit fuisset.'",
@@ -129,7 +148,7 @@ TEST_CASE("Delta strings UTF-8", "[delta]") {
     // Multi-byte UTF-8 chars, with patches occurring in midst of UTF-8 sequences:
     checkDelta(u8"'モバイルデータベースは将来のものです。 ある日、私たちのデータが端に集まります。'",
                u8"'モバイルデータベースがここにあります。 あなたのデータはすべて端にあります。'",
-               u8"[\"30=49-37+がここにあります。 あなた|12=3-12+はすべて|6=3-3-3+あ|12=\",0,2]");
+               u8"[\"30=49-37+がここにあります。 あなた|12=15-21+はすべて端にあ|12=\",0,2]");
 
     // Here the C7/C6 bytes can't be included in the preceding XXX/YYY diff:
     checkDelta("'<aaaaaaaaXXX\xC7\x88zzzzzzzz>'",
@@ -138,7 +157,7 @@ TEST_CASE("Delta strings UTF-8", "[delta]") {
 
     checkDelta(u8"'யாமறிந்த மொழிகளிலே தமிழ்மொழி போல் இனிதாவது எங்கும் காணோம், பாமரராய் விலங்குகளாய், உலகனைத்தும் இகழ்ச்சிசொலப் பான்மை கெட்டு, நாமமது தமிழரெனக் கொண்டு இங்கு வாழ்ந்திடுதல் நன்றோ? சொல்லீர்! தேமதுரத் இகழ்ச்சிசொலப் உலகமெலாம் பரவும்வகை செய்தல் வேண்டும்.'",
                u8"'யாமறிந்த மொழிகளிலே தமிழ்மொழி போல் இனிதாவது எங்கும் காணோம், பாமரராய் விலங்குகளாய், உலகனைத்தும் இகழ்ச்சிசொலப் பான்மை கெட்டு, நாமமது தமிழரெனக் கொண்டு இங்கு வாழ்ந்திடுதல் நன்றோ? கொண்டு! தேமதுரத் தமிழோசை உலகமெலாம் பரவும்வகை செய்தல் வேண்டும்.'",
-               "[\"476=3-3+க|3=3-3+ண|3=12-6+டு|27=21-6+தம|3=15-12+ழோசை|104=\",0,2]");
+               "[\"476=24-18+கொண்டு|27=39-21+தமிழோசை|104=\",0,2]");
 
     JSONDelta::gMinStringDiffLength = 60;
 }
@@ -201,6 +220,346 @@ TEST_CASE("Delta nested arrays", "[delta]") {
 }
 
 
+TEST_CASE("Delta array edits", "[delta]") {
+    // By default, array items are compared by index:
+    checkDelta("[1, 2, 3, 4, 5, 6, 7, 8]", "[0, 1, 2, 3, 4, 5, 6, 7, 8]",
+               "{\"0\":0,\"1\":1,\"2\":2,\"3\":3,\"4\":4,\"5\":5,\"6\":6,\"7\":7,\"8-\":[8]}");
+
+    // With edit scripts enabled, insertions, deletions and moves that shift items' indexes
+    // use one:
+    JSONDelta::gArrayEditScripts = true;
+    checkDelta("[1, 2, 3, 4, 5, 6, 7, 8]", "[0, 1, 2, 3, 4, 5, 6, 7, 8]",
+               "[\"1+8=\",[0],4]");
+    checkDelta("[1, 2, 3, 5, 6, 7]", "[1, 2, 3, 4, 5]", "[\"3=1+1=2-\",[4],4]");
+    checkDelta("[1, 2, 3, 4, 5, 6, 7, 8]", "[2, 3, 4, 5, 6, 7, 8]",
+               "[\"1-7=\",[],4]");
+    checkDelta("[1, 2, 3, 4, 5, 6, 7, 8]", "[1, 2, 3, 4, 'x', 5, 6, 7, 8]",
+               "[\"4=1+4=\",[\"x\"],4]");
+    checkDelta("['alpha', 'beta', 'gamma', 'delta', 'epsilon', 'zeta']",
+               "['beta', 'gamma', 'delta', 'epsilon', 'zeta', 'alpha']",
+               "[\"1-5=1@0|\",[],4]");
+    checkDelta("['alpha', 'beta', 'gamma', 'delta', 'epsilon', 'zeta']",
+               "['delta', 'epsilon', 'zeta', 'alpha', 'beta', 'gamma']",
+               "[\"3-3=3@0|\",[],4]");
+    checkDelta("[{a: 1, b: 'hello'}, {a: 2, b: 'there'}, {a: 3, b: 'world'}]",
+               "[{a: 0}, {a: 1, b: 'hello'}, {a: 2, b: 'there!'}, {a: 3, b: 'world'}]",
+               "[\"1+1=1~1=\",[{a:0},{b:\"there!\"}],4]");
+    checkDelta("[[1, 2, 3, 4], [5, 6, 7, 8]]", "[[0, 1, 2, 3, 4], [5, 6, 7, 8]]",
+               "{\"0\":[\"1+4=\",[0],4]}");
+    JSONDelta::gArrayEditScripts = false;
+}
+
+
+TEST_CASE("Delta array edits, budget", "[delta]") {
+    // With no budget for the Myers diff, moved runs are still found:
+    auto saved = JSONDelta::gMaxArrayDiffEdits;
+    JSONDelta::gArrayEditScripts = true;
+    JSONDelta::gMaxArrayDiffEdits = 1;
+    checkDelta("['alpha', 'beta', 'gamma', 'delta', 'epsilon', 'zeta']",
+               "['delta', 'epsilon', 'zeta', 'alpha', 'beta', 'gamma']",
+               "[\"6-3@3|3@0|\",[],4]");
+    // And with array diffs disabled, items are compared by index:
+    JSONDelta::gMaxArrayDiffEdits = 0;
+    checkDelta("[1, 2, 3, 4, 5, 6, 7, 8]", "[0, 1, 2, 3, 4, 5, 6, 7, 8]",
+               "{\"0\":0,\"1\":1,\"2\":2,\"3\":3,\"4\":4,\"5\":5,\"6\":6,\"7\":7,\"8-\":[8]}");
+    JSONDelta::gMaxArrayDiffEdits = saved;
+    JSONDelta::gArrayEditScripts = false;
+}
+
+
+TEST_CASE("Delta array sizes", "[delta]") {
+    Retained<Doc> doc = Doc::fromJSON(readTestFile(kBigJSONTestFileName));
+    const Array *people = doc->asArray();
+    REQUIRE(people);
+    std::vector<const Value*> items;
+    for (Array::iterator i(people); i; ++i)
+        items.push_back(i.value());
+    auto n = items.size();
+
+    auto check = [&](const char *what, std::vector<const Value*> newItems) {
+        Encoder enc;
+        enc.beginArray();
+        for (auto item : newItems)
+            enc.writeValue(item);
+        enc.endArray();
+        Retained<Doc> newDoc = enc.finishDoc();
+        const Array *newPeople = newDoc->asArray();
+
+        // Compare with an index-based delta (without text diffs, which are slow here and
+        // barely make it smaller:)
+        auto savedLength = JSONDelta::gMinStringDiffLength;
+        JSONDelta::gMinStringDiffLength = SIZE_MAX;
+        alloc_slice indexDelta = JSONDelta::create(people, newPeople);
+        JSONDelta::gMinStringDiffLength = savedLength;
+        JSONDelta::gArrayEditScripts = true;
+        alloc_slice delta = JSONDelta::create(people, newPeople);
+        JSONDelta::gArrayEditScripts = false;
+        fprintf(stderr, "    %-28s: %7zu bytes (by index: %7zu)\n", what, delta.size, indexDelta.size);
+        CHECK(delta.size < indexDelta.size / 10);
+
+        alloc_slice applied = JSONDelta::apply(people, delta);
+        CHECK(Value::fromData(applied)->isEqual(newPeople));
+    };
+
+    auto v = items;
+    v.insert(v.begin(), items[n/2]);
+    check("Insert at start", v);
+
+    v = items;
+    v.erase(v.begin() + 10, v.begin() + 20);
+    check("Delete 10 near start", v);
+
+    v = items;
+    std::rotate(v.begin(), v.begin() + 100, v.end());
+    check("Move 100 to end", v);
+
+    v = items;
+    std::rotate(v.begin(), v.begin() + n/2, v.end());
+    check("Swap halves", v);
+
+    v = items;
+    std::reverse(v.begin() + 100, v.begin() + 150);
+    check("Reverse 50", v);
+
+    v = items;
+    std::shuffle(v.begin(), v.end(), std::mt19937(12345));
+    check("Shuffle", v);
+}
+
+
+#if FL_HAVE_FILESYSTEM
+TEST_CASE("Delta applied to file", "[delta]") {
+    // Write the people as a Dict keyed by ID:
+    static const char *kPath = kTempDir"fleecedelta.fleece";
+    {
+        Retained<Doc> doc = Doc::fromJSON(readTestFile(kBigJSONTestFileName));
+        FILE *out = fopen(kPath, "wb");
+        REQUIRE(out);
+        Encoder enc(out);
+        enc.beginDictionary();
+        for (Array::iterator i(doc->asArray()); i; ++i) {
+            enc.writeKey(i.value()->asDict()->get("_id"_sl)->asString());
+            enc.writeValue(i.value());
+        }
+        enc.endDictionary();
+        enc.end();
+        fclose(out);
+    }
+
+    // Modify it a few times, appending each delta to the file:
+    for (int round = 0; round < 4; ++round) {
+        alloc_slice data = readFile(kPath);
+        Retained<Doc> oldDoc = Doc::fromFleece(data);
+        const Dict *old = oldDoc->asDict();
+        REQUIRE(old);
+        Retained<MutableDict> nuu = MutableDict::newDict(old);
+        slice id = Dict::iterator(old).keyString();
+        switch (round) {
+            case 0: nuu->getMutableDict(id)->set("age"_sl, 99); break;
+            case 1: nuu->getMutableDict(id)->getMutableArray("tags"_sl)->remove(1, 2); break;
+            case 2: nuu->remove(id); break;
+            case 3: nuu->set("new"_sl, "person"_sl); break;
+        }
+        alloc_slice delta = JSONDelta::create(old, nuu);
+        REQUIRE(delta);
+
+        FILE *out = fopen(kPath, "ab");
+        REQUIRE(out);
+        Encoder::InheritanceStats stats;
+        {
+            Encoder enc(out);
+            enc.setBase(data);
+            JSONDelta::apply(old, delta, false, enc);
+            enc.end();
+            stats = enc.inheritanceStats();
+        }
+        fclose(out);
+
+        // Only the changes were appended, except that the third delta in a row would give the
+        // root Dict too many ancestors, so it's squashed:
+        alloc_slice newData = readFile(kPath);
+        INFO("Round " << round << ": delta " << delta);
+        if (round == 2) {
+            CHECK(stats.squashedDicts == 1);
+            CHECK(newData.size - data.size > 10000);
+        } else {
+            CHECK(stats.squashedDicts == 0);
+            CHECK(stats.averageAncestors() == (round == 1 ? 2.0 : 1.0));
+            CHECK(newData.size - data.size < 200);
+        }
+        CHECK(memcmp(newData.buf, data.buf, data.size) == 0);
+        const Value *result = Value::fromData(newData);
+        REQUIRE(result);
+        CHECK(result->toJSON() == nuu->toJSON());   // (isEqual would see re-encoded Dicts' widths)
+    }
+}
+#endif
+
+
+#pragma mark - MERGE:
+
+
+// Encodes the people as a Dict keyed by ID.
+static alloc_slice peopleByID() {
+    Retained<Doc> doc = Doc::fromJSON(readTestFile(kBigJSONTestFileName));
+    Encoder enc;
+    enc.beginDictionary();
+    for (Array::iterator i(doc->asArray()); i; ++i) {
+        enc.writeKey(i.value()->asDict()->get("_id"_sl)->asString());
+        enc.writeValue(i.value());
+    }
+    enc.endDictionary();
+    return enc.finish();
+}
+
+
+// Returns `data` with a delta appended that changes its root to `changes`.
+static alloc_slice appendChanges(alloc_slice data, const Value *changes) {
+    Encoder enc;
+    enc.setBase(data);
+    enc.reuseBaseStrings();
+    enc.writeValue(changes);
+    data.append(enc.finish());
+    return data;
+}
+
+
+static void checkMerge(const char *base, const char *ours, const char *theirs,
+                       const char *expected, std::vector<std::string> expectedConflicts = {})
+{
+    auto parse = [](const char *json5) {return Doc::fromJSON(ConvertJSON5(json5));};
+    Retained<Doc> baseDoc = base ? parse(base) : nullptr;
+    Retained<Doc> oursDoc = parse(ours), theirsDoc = parse(theirs), expectedDoc = parse(expected);
+    ThreeWayMerge::Conflicts conflicts;
+    alloc_slice merged = ThreeWayMerge::merge(baseDoc ? baseDoc->root() : nullptr,
+                                              oursDoc->root(), theirsDoc->root(), &conflicts);
+    const Value *result = Value::fromData(merged);
+    INFO("Merge of " << ours << " and " << theirs << " got " << toJSONString(result));
+    CHECK(result->isEqual(expectedDoc->root()));
+    std::vector<std::string> paths;
+    for (auto &conflict : conflicts)
+        paths.push_back(conflict.path);
+    CHECK(paths == expectedConflicts);
+}
+
+
+TEST_CASE("Merge scalars", "[merge]") {
+    checkMerge("1", "1", "1", "1");
+    checkMerge("1", "2", "1", "2");
+    checkMerge("1", "1", "3", "3");
+    checkMerge("1", "2", "2", "2");
+    checkMerge("1", "2", "3", "2", {""});
+    checkMerge(nullptr, "'a'", "'a'", "'a'");
+    checkMerge(nullptr, "'a'", "'b'", "'a'", {""});
+    checkMerge("1", "{a:1}", "1", "{a:1}");
+    checkMerge("[1]", "[1]", "{a:1}", "{a:1}");
+}
+
+
+TEST_CASE("Merge dicts", "[merge]") {
+    // Changes to different keys:
+    checkMerge("{a:1, b:2, c:3}",
+               "{a:10, b:2, c:3, d:4}",
+               "{a:1, c:30, e:5}",
+               "{a:10, c:30, d:4, e:5}");
+    // Both sides made the same changes:
+    checkMerge("{a:1, b:2}",
+               "{a:1, c:3}",
+               "{a:1, c:3}",
+               "{a:1, c:3}");
+    // Nested dicts, and conflicts:
+    checkMerge("{a:1, b:{x:1, y:2}, c:3}",
+               "{a:2, b:{x:5, y:2}, c:3}",
+               "{a:3, b:{x:1, y:6}}",
+               "{a:2, b:{x:5, y:6}}",
+               {".a"});
+    checkMerge("{k:1}", "{}",     "{k:2}", "{}",     {".k"});
+    checkMerge("{k:1}", "{k:2}",  "{}",    "{k:2}",  {".k"});
+    checkMerge("{}",    "{k:1}",  "{k:2}", "{k:1}",  {".k"});
+    // Both sides added a Dict with the same key:
+    checkMerge("{}", "{k:{x:1}}", "{k:{y:2}}", "{k:{x:1, y:2}}");
+    checkMerge("{}", "{'a b':{x:1}}", "{'a b':{x:2}}", "{'a b':{x:1}}", {"[\"a b\"].x"});
+}
+
+
+TEST_CASE("Merge arrays", "[merge]") {
+    // Changes to different items:
+    checkMerge("[1, 2, 3]", "[9, 2, 3]", "[1, 2, 8]", "[9, 2, 8]");
+    checkMerge("[{a:1}, 2]", "[{a:1, b:2}, 2]", "[{c:3}, 2]", "[{b:2, c:3}, 2]");
+    // Insertions and removals that don't overlap:
+    checkMerge("[1, 2, 3, 4, 5]", "[0, 1, 2, 3, 4, 5]", "[1, 2, 3, 5]", "[0, 1, 2, 3, 5]");
+    checkMerge("[1, 2, 3, 4, 5]", "[1, 2, 3, 5]", "[0, 1, 2, 3, 4, 5]", "[0, 1, 2, 3, 5]");
+    checkMerge("[1, 2, 3]", "[1, 2, 3, 4]", "[1, 9, 3]", "[1, 9, 3, 4]");
+    checkMerge("[1, 2, 3]", "[1, 7, 2, 3]", "[1, 9, 3]", "[1, 7, 9, 3]");
+    // Both sides made the same edit:
+    checkMerge("[1, 2, 3]", "[1, 4, 2, 3]", "[1, 4, 2, 3]", "[1, 4, 2, 3]");
+    // Overlapping edits:
+    checkMerge("{a:[1, 2, 3]}", "{a:[1, 4, 2, 3]}", "{a:[1, 5, 2, 3]}", "{a:[1, 4, 2, 3]}",
+               {".a"});
+    checkMerge("{a:[1, 2, 3]}", "{a:[1, 3]}", "{a:[1, 5, 3]}", "{a:[1, 3]}", {".a"});
+    checkMerge("{people:[{name:'a', age:1}, {name:'b'}]}",
+               "{people:[{name:'a', age:2}, {name:'c'}]}",
+               "{people:[{name:'a', age:1}, {name:'d'}]}",
+               "{people:[{name:'a', age:2}, {name:'c'}]}",
+               {".people[1].name"});
+}
+
+
+TEST_CASE("Merge deltas", "[merge]") {
+    // Our revision is a delta appended to the base, as it would be in a file:
+    Retained<Doc> baseDoc = Doc::fromFleece(peopleByID(), Doc::kTrusted);
+    alloc_slice baseData = baseDoc->allocedData();
+    const Dict *base = baseDoc->asDict();
+    REQUIRE(base->count() >= 4);
+    std::vector<slice> ids;
+    for (Dict::iterator i(base); i; ++i)
+        ids.push_back(i.keyString());
+
+    Retained<MutableDict> ourChanges = MutableDict::newDict(base);
+    ourChanges->getMutableDict(ids[0])->set("age"_sl, 99);
+    ourChanges->remove(ids[1]);
+    alloc_slice oursData = appendChanges(baseData, ourChanges);
+    Retained<Doc> oursDoc = Doc::fromFleece(oursData, Doc::kTrusted);
+    const Dict *ours = oursDoc->asDict();
+    base = Value::fromTrustedData(oursData.upTo(baseData.size))->asDict();
+
+    // Their revision is a mutable copy of the base:
+    Retained<MutableDict> theirs = MutableDict::newDict(base);
+    theirs->getMutableDict(ids[0])->set("name"_sl, "Zed"_sl);
+    theirs->getMutableDict(ids[2])->set("age"_sl, 98);
+    theirs->set("new"_sl, "person"_sl);
+    bool deleteConflict = GENERATE(false, true);
+    if (deleteConflict)
+        theirs->getMutableDict(ids[1])->set("age"_sl, 97);
+
+    Encoder enc;
+    enc.setBase(oursData);
+    auto conflicts = ThreeWayMerge::merge(base, ours, theirs, enc);
+    alloc_slice merged = enc.finish();
+    // Only the changes are written, as a delta to our revision:
+    CHECK(merged.size < 200);
+    alloc_slice mergedData = oursData;
+    mergedData.append(merged);
+
+    Retained<MutableDict> expected = MutableDict::newDict(ours);
+    expected->getMutableDict(ids[0])->set("name"_sl, "Zed"_sl);
+    expected->getMutableDict(ids[2])->set("age"_sl, 98);
+    expected->set("new"_sl, "person"_sl);
+    const Value *result = Value::fromData(mergedData);
+    REQUIRE(result);
+    CHECK(result->toJSON() == expected->toJSON());  // (isEqual would see re-encoded Dicts' widths)
+
+    if (deleteConflict) {
+        REQUIRE(conflicts.size() == 1);
+        CHECK(conflicts[0].path == "." + std::string(ids[1]));
+        CHECK(conflicts[0].ours == nullptr);
+        CHECK(conflicts[0].theirs == theirs->get(ids[1]));
+    } else {
+        CHECK(conflicts.empty());
+    }
+}
+
+
 static void checkDelta(const Value *left, const Value *right, const Value *expectedDelta) {
     if (!expectedDelta)
         expectedDelta = Dict::kEmpty;
@@ -257,6 +616,177 @@ TEST_CASE("JSONDiffPatch test suite", "[delta]") {
 
 
 
+TEST_CASE("Perf Fleece vs JSON deltas", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    // Collect the left/right pairs of the JsonDiffPatch test suite:
+    auto input = readTestFile("DeltaTests.json5");
+    alloc_slice encoded = JSONConverter::convertJSON(slice(ConvertJSON5(std::string(input))));
+    const Dict *testSuites = Value::fromData(encoded)->asDict();
+    REQUIRE(testSuites);
+    std::vector<std::pair<const Value*,const Value*>> cases;
+    for (Dict::iterator i_suite(testSuites); i_suite; ++i_suite) {
+        for (Array::iterator i_test(i_suite.value()->asArray()); i_test; ++i_test) {
+            const Dict *test = i_test.value()->asDict();
+            auto left = test ? test->get("left"_sl) : nullptr;
+            auto right = test ? test->get("right"_sl) : nullptr;
+            if (left && right) {
+                cases.emplace_back(left, right);
+                cases.emplace_back(right, left);
+            }
+        }
+    }
+
+    static constexpr int kRepeat = 2000;
+    std::vector<alloc_slice> jsonDeltas, fleeceDeltas;
+    size_t jsonSize = 0, fleeceSize = 0;
+    Stopwatch jsonCreate(false), fleeceCreate(false), jsonApply(false), fleeceApply(false);
+    for (auto &c : cases) {
+        alloc_slice delta;
+        jsonCreate.start();
+        for (int i = 0; i < kRepeat; ++i)
+            delta = JSONDelta::create(c.first, c.second);
+        jsonCreate.stop();
+        jsonSize += delta.size;
+        jsonDeltas.push_back(delta);
+
+        fleeceCreate.start();
+        for (int i = 0; i < kRepeat; ++i)
+            delta = JSONDelta::createFleece(c.first, c.second);
+        fleeceCreate.stop();
+        fleeceSize += delta.size;
+        fleeceDeltas.push_back(delta);
+    }
+    for (size_t n = 0; n < cases.size(); ++n) {
+        alloc_slice result;
+        jsonApply.start();
+        for (int i = 0; i < kRepeat; ++i)
+            result = JSONDelta::apply(cases[n].first, jsonDeltas[n]);
+        jsonApply.stop();
+        CHECK(Value::fromData(result)->isEqual(cases[n].second));
+
+        fleeceApply.start();
+        for (int i = 0; i < kRepeat; ++i)
+            result = JSONDelta::applyFleece(cases[n].first, Value::fromData(fleeceDeltas[n]));
+        fleeceApply.stop();
+        CHECK(Value::fromData(result)->isEqual(cases[n].second));
+    }
+    fprintf(stderr, "%zu deltas: JSON %zu bytes, Fleece %zu bytes\n",
+            cases.size(), jsonSize, fleeceSize);
+    double n = kRepeat * cases.size() / 1e6;
+    fprintf(stderr, "Create: JSON %.3f us, Fleece %.3f us\n",
+            jsonCreate.elapsed() / n, fleeceCreate.elapsed() / n);
+    fprintf(stderr, "Apply:  JSON %.3f us, Fleece %.3f us\n",
+            jsonApply.elapsed() / n, fleeceApply.elapsed() / n);
+}
+
+
+TEST_CASE("Perf text deltas", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    // Make texts out of the people's "about" paragraphs, one per line:
+    Retained<Doc> doc = Doc::fromJSON(readTestFile(kBigJSONTestFileName));
+    std::vector<std::string> paragraphs;
+    for (Array::iterator i(doc->asArray()); i; ++i)
+        paragraphs.emplace_back(i.value()->asDict()->get("about"_sl)->asString());
+
+    for (bool lines : {true, false}) {
+        for (size_t size : {1000, 100000, 1000000}) {
+            std::string text;
+            for (size_t i = 0; text.size() < size; ++i)
+                text += std::to_string(i) + ": " + paragraphs[i % paragraphs.size()]
+                        + (lines ? "\n" : " ");
+            text.resize(size);
+
+            // Make ten random edits:
+            std::string newText = text;
+            std::mt19937 rng(size);
+            for (int i = 0; i < 10; ++i) {
+                size_t pos = rng() % (newText.size() - 20);
+                switch (rng() % 3) {
+                    case 0: newText.erase(pos, 1 + rng() % 20); break;
+                    case 1: newText.insert(pos, "Lorem ipsum "); break;
+                    case 2: newText.replace(pos, 5, "dolor"); break;
+                }
+            }
+
+            Encoder enc;
+            enc.beginArray();
+            enc.writeString(text);
+            enc.writeString(newText);
+            enc.endArray();
+            Retained<Doc> texts = enc.finishDoc();
+            const Value *oldValue = texts->asArray()->get(0), *newValue = texts->asArray()->get(1);
+
+            int repeat = int(10000000 / size);
+            alloc_slice delta;
+            Stopwatch st;
+            for (int i = 0; i < repeat; ++i)
+                delta = JSONDelta::create(oldValue, newValue);
+            double time = st.elapsedMS() / repeat;
+            alloc_slice result = JSONDelta::apply(oldValue, delta);
+            CHECK(Value::fromData(result)->isEqual(newValue));
+            fprintf(stderr, "%8zu bytes, %s: %9.3f ms, delta is %5zu bytes\n",
+                    size, (lines ? "lines  " : "no lines"), time, delta.size);
+        }
+    }
+}
+
+
+
+TEST_CASE("Perf three-way merge", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    Retained<Doc> baseDoc = Doc::fromFleece(peopleByID(), Doc::kTrusted);
+    alloc_slice baseData = baseDoc->allocedData();
+    const Dict *base = baseDoc->asDict();
+    std::vector<slice> ids;
+    for (Dict::iterator i(base); i; ++i)
+        ids.push_back(i.keyString());
+
+    for (size_t changes : {1, 10, 100}) {
+        if (2 * changes > ids.size())
+            break;
+        // Each side changes different people. Ours are appended to the base, and theirs are
+        // a mutable copy of it:
+        Retained<MutableDict> ourChanges = MutableDict::newDict(base);
+        for (size_t i = 0; i < changes; ++i)
+            ourChanges->getMutableDict(ids[2*i])->set("age"_sl, 99);
+        alloc_slice oursData = appendChanges(baseData, ourChanges);
+        Retained<Doc> oursDoc = Doc::fromFleece(oursData, Doc::kTrusted);
+        const Dict *ours = oursDoc->asDict();
+        const Dict *sharedBase = Value::fromTrustedData(oursData.upTo(baseData.size))->asDict();
+        Retained<MutableDict> theirs = MutableDict::newDict(sharedBase);
+        for (size_t i = 0; i < changes; ++i)
+            theirs->getMutableDict(ids[2*i + 1])->set("name"_sl, "Zed"_sl);
+
+        // The same documents without shared storage, so every value has to be compared:
+        Retained<Doc> baseCopy = Doc::fromJSON(base->toJSON()),
+                      oursCopy = Doc::fromJSON(ours->toJSON()),
+                      theirsCopy = Doc::fromJSON(theirs->toJSON());
+
+        static constexpr int kRepeat = 1000;
+        alloc_slice shared, copied;
+        Stopwatch st;
+        for (int i = 0; i < kRepeat; ++i) {
+            Encoder enc;
+            enc.setBase(oursData);
+            ThreeWayMerge::merge(sharedBase, ours, theirs, enc);
+            shared = enc.finish();
+        }
+        double sharedTime = st.elapsedMS() / kRepeat;
+        st.reset();
+        for (int i = 0; i < kRepeat; ++i)
+            copied = ThreeWayMerge::merge(baseCopy->root(), oursCopy->root(), theirsCopy->root());
+        double copiedTime = st.elapsedMS() / kRepeat;
+        alloc_slice merged = oursData;
+        merged.append(shared);
+        CHECK(Value::fromData(merged)->isEqual(Value::fromData(copied)));
+        fprintf(stderr, "%3zu changes each to %zu docs: shared %7.3f ms, %6zu bytes; "
+                        "copied %7.3f ms\n",
+                changes, ids.size(), sharedTime, shared.size, copiedTime);
+    }
+}
+
+
+
 // Based on utf8_check.c by Markus Kuhn, 2005
 // https://www.cl.cam.ac.uk/~mgk25/ucs/utf8_check.c
 static bool isValidUTF8(fleece::slice sl) noexcept
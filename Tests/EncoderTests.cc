@@ -21,6 +21,7 @@
 #include "JSONConverter.hh"
 #include "KeyTree.hh"
 #include "Path.hh"
+#include "DeepIterator.hh"
 #include "Internal.hh"
 #include "jsonsl.h"
 #include "mn_wordlist.h"
@@ -705,6 +706,63 @@ public:
     }
 #endif
 
+
+#if FL_HAVE_FILESYSTEM
+    TEST_CASE_METHOD(EncoderTests, "Encode Dict To File", "[Encoder]") {
+        // Keys of kMaxSharedStringSize bytes or less are kept by the string table; longer ones
+        // aren't, and neither are any if uniqueStrings is off. Either way they must get sorted.
+        bool unique = GENERATE(true, false);
+        INFO("uniqueStrings=" << unique);
+        const std::string keys[] = {std::string(40, 'z'), std::string(17, 'y'), std::string(16, 'x'),
+                                    std::string(15, 'w'), std::string(14, 'v'), "ab", "a"};
+        {
+            FILE *out = fopen(kTempDir"fleecetemp.fleece", "wb");
+            REQUIRE(out != nullptr);
+            Encoder fenc(out);
+            fenc.uniqueStrings(unique);
+            fenc.beginDictionary();
+            int n = 0;
+            for (auto &key : keys) {
+                fenc.writeKey(slice(key));
+                fenc.writeInt(n++);
+            }
+            fenc.endDictionary();
+            fenc.end();
+            fclose(out);
+        }
+
+        alloc_slice newDoc = readFile(kTempDir"fleecetemp.fleece");
+        REQUIRE(newDoc);
+        auto dict = Value::fromData(newDoc)->asDict();
+        REQUIRE(dict);
+        CHECK(dict->count() == 7);
+        int n = 0;
+        for (auto &key : keys) {
+            auto value = dict->get(slice(key));
+            REQUIRE(value);
+            CHECK(value->asInt() == n++);
+        }
+    }
+#endif
+
+
+    TEST_CASE_METHOD(EncoderTests, "Base used", "[Encoder]") {
+        alloc_slice base = JSONConverter::convertJSON("{\"a\":[\"some string\",[1234567]],\"b\":\"another string\"}"_sl);
+        auto baseDict = Value::fromTrustedData(base)->asDict();
+        auto a = baseDict->get("a"_sl);
+
+        Encoder enc2;
+        enc2.setBase(base);
+        enc2.beginArray();
+        enc2.writeValue(a);
+        enc2.endArray();
+        enc2.finish();
+        // The range starts at the lowest address reachable from `a`, not at `a` itself:
+        const void *minAddr = Encoder::minUsed(a, nullptr);
+        CHECK(minAddr < (const void*)a);
+        CHECK(enc2.baseUsed() == slice(minAddr, base.end()));
+    }
+
 #if FL_HAVE_TEST_FILES
     TEST_CASE_METHOD(EncoderTests, "FindPersonByIndexSorted", "[Encoder]") {
         auto doc = readTestFile("1000people.fleece");
@@ -792,6 +850,152 @@ public:
 #endif
     }
 
+    TEST_CASE_METHOD(EncoderTests, "Path sets", "[Encoder]") {
+        auto input = readTestFile(kBigJSONTestFileName);
+        JSONConverter jr(enc);
+        jr.encodeJSON(input);
+        enc.end();
+        alloc_slice fleeceData = enc.finish();
+        const Value *root = Value::fromData(fleeceData);
+
+        CHECK(Path{"[0].friends[1].name"} == Path{"$[0].friends[1].name"});
+        CHECK(Path{"[0].friends[1].name"} != Path{"[0].friends[1].id"});
+        CHECK(Path{"[0].friends[1].name"} != Path{"[0].friends[2].name"});
+
+        // Paths with common prefixes, missing values, and duplicates:
+        const char* const kPaths[] = {"[0].name", "[0].age", "[0].friends[1].name",
+            "[32].name", "[0].friends[1].id", "[0].nope.name", "[0].friends[-1].name",
+            "$", "[-1].name", "[0].name", "[0].friends", "[0].friends[99].name",
+            "[0].name.first", "[0]"};
+        const size_t n = sizeof(kPaths) / sizeof(kPaths[0]);
+        PathSet paths;
+        for (size_t i = 0; i < n; ++i)
+            CHECK(paths.add(Path(slice(kPaths[i]))) == i);
+        CHECK(paths.count() == n);
+
+        const Value* values[n];
+        CHECK(paths.eval(root, values) == n - 3);
+        for (size_t i = 0; i < n; ++i) {
+            INFO("Path " << kPaths[i]);
+            CHECK(values[i] == Path(slice(kPaths[i])).eval(root));
+        }
+        CHECK(values[0]->asString() == "Glenda Morse"_sl);
+        CHECK(values[7] == root);
+
+        // Evaluating on another root uses the same steps:
+        const Value *person = root->asArray()->get(3);
+        CHECK(paths.eval(root->asArray(), values) == n - 3);
+        CHECK(paths.eval(person, values) == 1);
+        CHECK(values[7] == person);
+        CHECK(paths.eval(nullptr, values) == 0);
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "Path queries", "[Encoder]") {
+        auto input = readTestFile(kBigJSONTestFileName);
+        JSONConverter jr(enc);
+        jr.encodeJSON(input);
+        enc.end();
+        alloc_slice fleeceData = enc.finish();
+        const Value *root = Value::fromData(fleeceData);
+        auto people = root->asArray();
+
+        auto query = [&](const char *specifier) {
+            std::vector<const Value*> results;
+            Path path{slice(specifier)};
+            for (Path::iterator i(path, root); i; ++i)
+                results.push_back(i.value());
+            return results;
+        };
+
+        // Parsing, and converting back to strings:
+        for (auto spec : {"[*].name", "..name", "..*", "[0].friends[?(@.id == 2)].name",
+                          "[?(@.gender != 'male')]", "[?(@.friends[0])].age", "\\*"}) {
+            INFO("Path " << spec);
+            Path path{slice(spec)};
+            CHECK(std::string(path) == spec);
+            CHECK(Path(slice(std::string(path))) == path);
+        }
+        CHECK(Path{"$.*"} == Path{"[*]"});
+        CHECK(Path{"[*]"} != Path{"\\*"});
+        CHECK(Path{"[?(@.id == 2)]"} != Path{"[?(@.id == 3)]"});
+        CHECK(Path{"[0].name"}.isSingular());
+        CHECK(!Path{"[0]..name"}.isSingular());
+        for (auto spec : {"[*", "a..", "a...b", "[?(@.x == 1]", "[?(x == 1)]", "[?(@.x = 1)]",
+                          "[?(@.x == )]", "[?(@.x == 'a)]", "[?(@.x == nope)]"}) {
+            INFO("Path " << spec);
+            CHECK_THROWS_AS(Path(slice(spec)), FleeceException);
+        }
+        CHECK_THROWS_AS(PathSet().add(Path{"[*].name"}), FleeceException);
+
+        // Wildcards:
+        auto names = query("[*].name");
+        REQUIRE(names.size() == kBigJSONTestCount);
+        for (uint32_t i = 0; i < kBigJSONTestCount; ++i)
+            CHECK(names[i] == people->get(i)->asDict()->get("name"_sl));
+        CHECK(Path{"[*].name"}.eval(root) == names[0]);
+        CHECK(query("$.*").size() == kBigJSONTestCount);
+        CHECK(query("[*].nope").empty());
+        CHECK(query("[*].name[*]").empty());
+
+        size_t nFriends = 0, nFemales = 0, nThirty = 0;
+        for (Array::iterator i(people); i; ++i) {
+            auto person = i.value()->asDict();
+            nFriends += person->get("friends"_sl)->asArray()->count();
+            if (person->get("gender"_sl)->asString() == "female"_sl)
+                ++nFemales;
+            if (person->get("age"_sl)->asInt() == 30)
+                ++nThirty;
+        }
+        CHECK(query("[*].friends[*].name").size() == nFriends);
+        CHECK(query("[*].friends[-1].id").size() == kBigJSONTestCount);
+
+        // Recursive descent, compared with a DeepIterator:
+        size_t nNames = 0, nValues = 0;
+        for (DeepIterator i(root); i; ++i) {
+            if (i.keyString() == "name"_sl)
+                ++nNames;
+            ++nValues;
+        }
+        CHECK(nNames == kBigJSONTestCount + nFriends);
+        names = query("..name");
+        CHECK(names.size() == nNames);
+        // (Values are visited depth-first, and "friends" sorts before "name":)
+        CHECK(names[0]->asString() == "Magdalena Moore"_sl);
+        CHECK(names[3] == people->get(0)->asDict()->get("name"_sl));
+        CHECK(query("..*").size() == nValues - 1);
+        CHECK(query("[0]..id").size() == 3);
+        CHECK(query("[0]..tags[1]").size() == 1);
+
+        // Filters:
+        CHECK(query("[?(@.gender == \"female\")].name").size() == nFemales);
+        CHECK(query("[?(@.gender == 'female')]").size() == nFemales);
+        CHECK(query("[?(@.gender != 'female')]").size() == kBigJSONTestCount - nFemales);
+        CHECK(query("[?(@.age == 30)]").size() == nThirty);
+        CHECK(query("[?( @.age==30.0 )]").size() == nThirty);
+        CHECK(query("[?(@.isActive == true)]").size() + query("[?(@.isActive == false)]").size()
+                == kBigJSONTestCount);
+        CHECK(query("[?(@.nope)]").empty());
+        CHECK(query("[?(@.nope != null)]").size() == kBigJSONTestCount);
+        CHECK(query("[?(@.friends[2])]").size() == kBigJSONTestCount);
+        CHECK(query("[0].tags[?(@ == 'laborum')]").size() == 2);
+        auto friends = query("[0].friends[?(@.id != 1)].name");
+        REQUIRE(friends.size() == 2);
+        CHECK(friends[0]->asString() == "Magdalena Moore"_sl);
+        CHECK(friends[1]->asString() == "Owens Everett"_sl);
+        CHECK(query("..friends[?(@.name == 'Owens Everett')].id").size() >= 1);
+        CHECK(query("[?(@.name == 'a)]b')]").empty());
+
+        // Edge cases:
+        Path path{"[*]"};
+        CHECK(!Path::iterator(path, nullptr));
+        CHECK(!Path::iterator(path, people->get(0)->asDict()->get("age"_sl)));
+        Path singular{"[0].name"};
+        Path::iterator i(singular, root);
+        REQUIRE(i);
+        CHECK(i.value() == names[3]);
+        CHECK(!++i);
+    }
+
     TEST_CASE_METHOD(EncoderTests, "Resuse Encoder", "[Encoder]") {
         enc.beginDictionary();
         enc.writeKey("foo");
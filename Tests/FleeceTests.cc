@@ -18,7 +18,16 @@
 
 #include "FleeceTests.hh"
 #include "fleece/slice.hh"
+#include <algorithm>
+#include <atomic>
 #include <fcntl.h>
+#include <new>
+
+#if defined(__APPLE__)
+    #include <malloc/malloc.h>
+#elif defined(_MSC_VER) || defined(__linux__)
+    #include <malloc.h>
+#endif
 
 #if !FL_HAVE_TEST_FILES
 #include "50peopleJSON.h"
@@ -41,6 +50,7 @@
 
 namespace fleece_test {
 
+
     std::string sliceToHex(slice result) {
         std::string hex;
         for (size_t i = 0; i < result.size; i++) {
@@ -113,3 +123,130 @@ namespace fleece_test {
 
 
 }
+
+
+#pragma mark - HEAP TRACKING:
+
+
+namespace fleece_test {
+
+    static std::atomic<int>       sHeapTrackers {0};    // Number of HeapTrackers in existence
+    static std::atomic<size_t>    sHeapAllocations {0};
+    static std::atomic<ptrdiff_t> sHeapBytesInUse {0}, sHeapBytesPeak {0};
+
+
+    HeapTracker::HeapTracker() {
+        ++sHeapTrackers;
+        reset();
+    }
+
+    HeapTracker::~HeapTracker() {
+        --sHeapTrackers;
+    }
+
+    void HeapTracker::reset() {
+        _startAllocations = sHeapAllocations;
+        _startBytes = sHeapBytesPeak = sHeapBytesInUse.load();
+    }
+
+    size_t HeapTracker::allocations() const {
+        return sHeapAllocations - _startAllocations;
+    }
+
+    size_t HeapTracker::peakBytes() const {
+        return size_t(std::max(sHeapBytesPeak - _startBytes, ptrdiff_t(0)));
+    }
+
+
+    // The actual size of a heap block, which may be more than was asked for.
+    static size_t heapBlockSize(void *p, size_t alignment) {
+#if defined(__APPLE__)
+        return malloc_size(p);
+#elif defined(_MSC_VER)
+        return alignment ? _aligned_msize(p, alignment, 0) : _msize(p);
+#elif defined(__linux__)
+        return malloc_usable_size(p);
+#else
+        return 0;
+#endif
+    }
+
+
+    static void* heapAlloc(size_t size, size_t alignment) noexcept {
+        void *p;
+#ifdef _MSC_VER
+        p = alignment ? _aligned_malloc(size, alignment) : malloc(size);
+#else
+        if (alignment) {
+            if (posix_memalign(&p, alignment, size) != 0)
+                p = nullptr;
+        } else {
+            p = malloc(size);
+        }
+#endif
+        if (p && sHeapTrackers > 0) {
+            ++sHeapAllocations;
+            ptrdiff_t inUse = (sHeapBytesInUse += heapBlockSize(p, alignment));
+            ptrdiff_t peak = sHeapBytesPeak;
+            while (inUse > peak && !sHeapBytesPeak.compare_exchange_weak(peak, inUse))
+                ;
+        }
+        return p;
+    }
+
+
+    static void* heapAllocOrThrow(size_t size, size_t alignment) {
+        void *p = heapAlloc(size, alignment);
+        if (!p)
+            throw std::bad_alloc();
+        return p;
+    }
+
+
+    static void heapFree(void *p, size_t alignment) noexcept {
+        if (!p)
+            return;
+        if (sHeapTrackers > 0)
+            sHeapBytesInUse -= heapBlockSize(p, alignment);
+#ifdef _MSC_VER
+        if (alignment) {
+            _aligned_free(p);
+            return;
+        }
+#endif
+        free(p);
+    }
+
+}
+
+
+// Replacements for all the forms of the global allocation operators, so that HeapTracker can
+// see every allocation and deallocation:
+
+using fleece_test::heapAllocOrThrow;
+using fleece_test::heapAlloc;
+using fleece_test::heapFree;
+using std::align_val_t;
+using std::nothrow_t;
+
+void* operator new  (size_t s)                               {return heapAllocOrThrow(s, 0);}
+void* operator new[](size_t s)                               {return heapAllocOrThrow(s, 0);}
+void* operator new  (size_t s, const nothrow_t&) noexcept    {return heapAlloc(s, 0);}
+void* operator new[](size_t s, const nothrow_t&) noexcept    {return heapAlloc(s, 0);}
+void* operator new  (size_t s, align_val_t a)                {return heapAllocOrThrow(s, size_t(a));}
+void* operator new[](size_t s, align_val_t a)                {return heapAllocOrThrow(s, size_t(a));}
+void* operator new  (size_t s, align_val_t a, const nothrow_t&) noexcept {return heapAlloc(s, size_t(a));}
+void* operator new[](size_t s, align_val_t a, const nothrow_t&) noexcept {return heapAlloc(s, size_t(a));}
+
+void operator delete  (void *p) noexcept                     {heapFree(p, 0);}
+void operator delete[](void *p) noexcept                     {heapFree(p, 0);}
+void operator delete  (void *p, size_t) noexcept             {heapFree(p, 0);}
+void operator delete[](void *p, size_t) noexcept             {heapFree(p, 0);}
+void operator delete  (void *p, const nothrow_t&) noexcept   {heapFree(p, 0);}
+void operator delete[](void *p, const nothrow_t&) noexcept   {heapFree(p, 0);}
+void operator delete  (void *p, align_val_t a) noexcept      {heapFree(p, size_t(a));}
+void operator delete[](void *p, align_val_t a) noexcept      {heapFree(p, size_t(a));}
+void operator delete  (void *p, size_t, align_val_t a) noexcept {heapFree(p, size_t(a));}
+void operator delete[](void *p, size_t, align_val_t a) noexcept {heapFree(p, size_t(a));}
+void operator delete  (void *p, align_val_t a, const nothrow_t&) noexcept {heapFree(p, size_t(a));}
+void operator delete[](void *p, align_val_t a, const nothrow_t&) noexcept {heapFree(p, size_t(a));}
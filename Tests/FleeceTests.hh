@@ -22,6 +22,7 @@
 #include "JSON5.hh"
 #include "sliceIO.hh"
 #include "Benchmark.hh"
+#include <cstddef>
 #include <ostream>
 #include <cfloat>
 #include <cmath>
@@ -88,6 +89,32 @@ namespace fleece_test {
 
     // Converts JSON5 to JSON; helps make JSON test input more readable!
     static inline std::string json5(const std::string &s)      {return fleece::ConvertJSON5(s);}
+
+    // While a HeapTracker exists, the tests' replacements of the global `operator new` and
+    // `operator delete` keep track of heap allocations made on all threads. (The rest of the
+    // time they just call malloc and free, so they don't skew benchmarks.)
+    class HeapTracker {
+    public:
+        HeapTracker();
+        ~HeapTracker();
+
+        // Starts counting over from zero.
+        void reset();
+
+        // The number of heap allocations made since the tracker was created or reset.
+        size_t allocations() const;
+
+        // The most heap memory that's been in use since the tracker was created or reset, beyond
+        // what was in use at that time. (Zero on platforms that can't tell the size of a block.)
+        size_t peakBytes() const;
+
+    private:
+        HeapTracker(const HeapTracker&) =delete;
+        HeapTracker& operator=(const HeapTracker&) =delete;
+
+        size_t _startAllocations;
+        ptrdiff_t _startBytes;
+    };
 }
 
 using namespace fleece_test;
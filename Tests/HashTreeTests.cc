@@ -10,8 +10,15 @@
 #include "HashTree+Internal.hh"     // for ComputeHash
 #include "Doc.hh"
 #include "PlatformCompat.hh"
+#include "sliceIO.hh"
 #include <iostream>
 #include <set>
+#include <thread>
+#if FL_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 using namespace fleece;
@@ -53,7 +60,7 @@ public:
         for (size_t i = 0; i < N; i++) {
             if (verbose)
                 cerr << "\n##### Inserting #" << (i)
-                          << ", " << hex << hashtree::ComputeHash(keys[i]) << dec << "\n";
+                          << ", " << hex << hashtree::ComputeHash(keys[i], tree.hashID()) << dec << "\n";
             tree.set(keys[i], values.get(uint32_t(i)));
             if (verbose)
                 tree.dump(cerr);
@@ -193,8 +200,9 @@ TEST_CASE_METHOD(HashTreeTests, "Tiny MutableHashTree Write", "[HashTree]") {
     tree.set(key, val);
 
     alloc_slice data = encodeTree();
-    REQUIRE(data.size == 30); // could change if encoding changes
+    REQUIRE(data.size == 38); // could change if encoding changes
     cerr << data.size << " bytes encoded: " << data.hexString() << "\n";
+    CHECK(data.from(data.size - 8) == "HTre\x01\x01\x01\x00"_sl);
 
     // Now read it as an immutable HashTree:
     const HashTree *tree = HashTree::fromData(data);
@@ -206,6 +214,68 @@ TEST_CASE_METHOD(HashTreeTests, "Tiny MutableHashTree Write", "[HashTree]") {
 }
 
 
+TEST_CASE_METHOD(HashTreeTests, "HashTree Format Versions", "[HashTree]") {
+    // The hashes must never change, on any platform:
+    CHECK(hashtree::ComputeHash("foo"_sl, hashtree::kFNV1a32Hash) == 0xa9f37ed7);
+    CHECK(hashtree::ComputeHash("foo"_sl, hashtree::kWyHash64) == 0x3cf6db29eb6627da);
+    CHECK(tree.hashID() == hashtree::kWyHash64);
+
+    createItems(100);
+    for (auto hashID : {hashtree::kFNV1a32Hash, hashtree::kWyHash64}) {
+        MutableHashTree mtree(hashID);
+        for (uint32_t i = 0; i < 50; ++i)
+            mtree.set(keys[i], values.get(i));
+        Encoder enc;
+        enc.suppressTrailer();
+        mtree.writeTo(enc);
+        alloc_slice data = enc.finish();
+
+        // A FNV-1a tree is written in the original format, with no trailer:
+        slice lastBytes = data.from(data.size - 8);
+        CHECK(lastBytes.hasPrefix("HTre"_sl) == (hashID != hashtree::kFNV1a32Hash));
+
+        const HashTree *itree = HashTree::fromData(data);
+        REQUIRE(itree);
+        CHECK(itree->hashID() == hashID);
+        CHECK(itree->count() == 50);
+        for (uint32_t i = 0; i < 100; ++i) {
+            Value value = itree->get(keys[i]);
+            if (i < 50)
+                CHECK(value.asInt() == i);
+            else
+                CHECK(!value);
+        }
+
+        // A mutable copy keeps the hash function, and so does a delta:
+        MutableHashTree mtree2(itree);
+        CHECK(mtree2.hashID() == hashID);
+        for (uint32_t i = 50; i < 100; ++i)
+            mtree2.set(keys[i], values.get(i));
+        Encoder enc2;
+        enc2.amend(data, false);
+        enc2.suppressTrailer();
+        mtree2.writeTo(enc2);
+        alloc_slice delta = enc2.finish();
+        alloc_slice total(data.size + delta.size);
+        memcpy((void*)&total[0],         data.buf, data.size);
+        memcpy((void*)&total[data.size], delta.buf, delta.size);
+        itree = HashTree::fromData(total);
+        REQUIRE(itree);
+        CHECK(itree->hashID() == hashID);
+        CHECK(itree->count() == 100);
+        for (uint32_t i = 0; i < 100; ++i)
+            CHECK(itree->get(keys[i]).asInt() == i);
+
+        if (hashID != hashtree::kFNV1a32Hash) {
+            // A trailer from a future version isn't readable:
+            alloc_slice future(data);
+            ((uint8_t*)future.buf)[future.size - 3] = 99;
+            CHECK(HashTree::fromData(future) == nullptr);
+        }
+    }
+}
+
+
 TEST_CASE_METHOD(HashTreeTests, "Bigger MutableHashTree Write", "[HashTree]") {
     static constexpr int N = 100;
     createItems(N);
@@ -345,6 +415,575 @@ TEST_CASE_METHOD(HashTreeTests, "HashTree Re-Encode Delta", "[HashTree]") {
 }
 
 
+TEST_CASE_METHOD(HashTreeTests, "HashTree Page Layout", "[HashTree]") {
+    static constexpr unsigned N = 20000;
+    static constexpr size_t kPageSize = 4096;
+    createItems(N + 100);
+    insertItems(N);
+    alloc_slice regular = encodeTree();
+
+    tree.setPageSize(kPageSize);
+    alloc_slice paged = encodeTree();
+    CHECK(paged != regular);
+    CHECK(paged.size < regular.size + regular.size / 5);  // (padding doesn't waste much)
+
+    const HashTree *itree = HashTree::fromData(paged);
+    REQUIRE(itree);
+    CHECK(itree->count() == N);
+    for (unsigned i = 0; i < N; ++i)
+        CHECK(itree->get(keys[i]).asInt() == int64_t(i));
+
+    // Write a delta in the same layout:
+    tree = itree;
+    tree.setPageSize(kPageSize);
+    for (unsigned i = N; i < N + 100; ++i)
+        tree.set(keys[i], values.get(uint32_t(i)));
+    for (unsigned i = 0; i < N; i += 7)
+        CHECK(tree.remove(keys[i]));
+    Encoder enc;
+    enc.amend(paged, false);
+    enc.suppressTrailer();
+    tree.writeTo(enc);
+    alloc_slice delta = enc.finish();
+    CHECK(delta.size < paged.size / 2);
+
+    alloc_slice total(paged.size + delta.size);
+    memcpy((void*)&total[0],          paged.buf, paged.size);
+    memcpy((void*)&total[paged.size], delta.buf, delta.size);
+    itree = HashTree::fromData(total);
+    REQUIRE(itree);
+    CHECK(itree->count() == N + 100 - (N + 6) / 7);
+    for (unsigned i = 0; i < N + 100; ++i) {
+        if (i < N && i % 7 == 0)
+            CHECK(!itree->get(keys[i]));
+        else
+            CHECK(itree->get(keys[i]).asInt() == int64_t(i));
+    }
+}
+
+
+// Weak hash functions that make lots of keys collide. The first puts all keys in four buckets
+// in the root node; the second makes keys differ only in the top two bits of their hashes, so
+// the tree has to go to its maximum depth.
+static hashtree::hash_t shallowCollidingHash(slice key) noexcept {
+    hashtree::hash_t h = 0;
+    for (size_t i = 0; i < key.size; i++)
+        h += key[i];
+    return h % 4;
+}
+
+static hashtree::hash_t deepCollidingHash(slice key) noexcept {
+    return (shallowCollidingHash(key) << 62) | 0x0BADF00D;
+}
+
+struct UsingHashFunction {
+    UsingHashFunction(hashtree::HashFunction fn)
+    :_saved(hashtree::gHashFunctions[hashtree::kDefaultHashID])
+    {
+        hashtree::gHashFunctions[hashtree::kDefaultHashID] = fn;
+    }
+    ~UsingHashFunction() {
+        hashtree::gHashFunctions[hashtree::kDefaultHashID] = _saved;
+    }
+private:
+    hashtree::HashFunction _saved;
+};
+
+
+TEST_CASE_METHOD(HashTreeTests, "HashTree Collisions", "[HashTree]") {
+    static constexpr unsigned N = 200;
+    hashtree::HashFunction hashFn;
+    SECTION("Shallow") {
+        hashFn = &shallowCollidingHash;
+    }
+    SECTION("Deep") {
+        hashFn = &deepCollidingHash;
+    }
+    UsingHashFunction using_(hashFn);
+    createItems(N);
+    insertItems(N/2);
+    checkTree(N/2);
+    checkIterator(N/2);
+    CHECK(tree.get(keys[N-1]) == nullptr);
+
+    // Update a key in a bucket, and check that a failed insert doesn't change anything:
+    tree.set(keys[7], values.get(70));
+    CHECK(tree.get(keys[7]).asInt() == 70);
+    CHECK(!tree.insert(keys[7], [](Value) {return nullptr;}));
+    CHECK(!tree.insert(keys[N-1], [](Value) {return nullptr;}));
+    CHECK(tree.get(keys[7]).asInt() == 70);
+    CHECK(tree.count() == N/2);
+    tree.set(keys[7], values.get(7));
+
+    // Write it, and read it as an immutable HashTree. Modifying a bucket copies its values, so
+    // the data has to be in a Doc for them to be retained:
+    alloc_slice data = encodeTree();
+    Retained<impl::Doc> dataDoc = new impl::Doc(data, impl::Doc::kDontParse);
+    const HashTree *itree = HashTree::fromData(data);
+    CHECK(itree->count() == N/2);
+    for (unsigned i = 0; i < N; ++i) {
+        Value value = itree->get(keys[i]);
+        if (i < N/2)
+            CHECK(value.asInt() == i);
+        else
+            CHECK(!value);
+    }
+    set<slice> keysSeen;
+    for (HashTree::iterator i(itree); i; ++i) {
+        CHECK(i.key() == keys[i.value().asInt()]);
+        CHECK(keysSeen.insert(i.key()).second);
+    }
+    CHECK(keysSeen.size() == N/2);
+
+    // Modify the immutable tree's buckets, and write a delta:
+    tree = itree;
+    for (unsigned i = N/2; i < N; ++i)
+        tree.set(keys[i], values.get(i));
+    for (unsigned i = 0; i < N; i += 3)
+        CHECK(tree.remove(keys[i]));
+    CHECK(!tree.remove(keys[0]));
+    for (unsigned i = 0; i < N; ++i) {
+        Value value = tree.get(keys[i]);
+        if (i % 3)
+            CHECK(value.asInt() == i);
+        else
+            CHECK(!value);
+    }
+    CHECK(tree.count() == N - (N + 2) / 3);
+
+    Encoder enc;
+    enc.amend(data, false);
+    enc.suppressTrailer();
+    tree.writeTo(enc);
+    alloc_slice delta = enc.finish();
+    alloc_slice total(data.size + delta.size);
+    memcpy((void*)&total[0],         data.buf, data.size);
+    memcpy((void*)&total[data.size], delta.buf, delta.size);
+
+    Retained<impl::Doc> totalDoc = new impl::Doc(total, impl::Doc::kDontParse);
+    itree = HashTree::fromData(total);
+    CHECK(itree->count() == N - (N + 2) / 3);
+    for (unsigned i = 0; i < N; ++i) {
+        Value value = itree->get(keys[i]);
+        if (i % 3)
+            CHECK(value.asInt() == i);
+        else
+            CHECK(!value);
+    }
+
+    // Remove all but one key from a bucket:
+    tree = itree;
+    for (unsigned i = 1; i < N - 1; ++i) {
+        if (i % 3)
+            CHECK(tree.remove(keys[i]));
+    }
+    CHECK(tree.count() == 1);
+    CHECK(tree.get(keys[N-1]).asInt() == int(N-1));
+    checkIterator(1);
+}
+
+
+TEST_CASE_METHOD(HashTreeTests, "HashTree Bulk Build", "[HashTree]") {
+    size_t N;
+    hashtree::HashFunction hashFn = hashtree::gHashFunctions[hashtree::kDefaultHashID];
+    SECTION("Regular") {
+        N = 50000;      // enough to be split between threads
+    }
+    SECTION("Colliding") {
+        N = 200;
+        hashFn = &shallowCollidingHash;
+    }
+    UsingHashFunction using_(hashFn);
+    createItems(N);
+    insertItems();
+    alloc_slice incremental = encodeTree();
+
+    // The entries are out of order, and some keys first appear with the wrong value, which
+    // should be overridden by the later entry:
+    vector<pair<alloc_slice,Value>> entries;
+    for (size_t i = 0; i < N; i += 5)
+        entries.emplace_back(keys[i], values.get(uint32_t(N - 1 - i)));
+    for (size_t i = 0; i < N; ++i) {
+        size_t j = (i * 7919) % N;
+        entries.emplace_back(keys[j], values.get(uint32_t(j)));
+    }
+
+    auto build = [&](unsigned maxThreads) {
+        Encoder enc;
+        enc.suppressTrailer();
+        CHECK(HashTree::build(enc, entries.begin(), entries.end(),
+                              hashtree::kDefaultHashID, maxThreads) > 0);
+        return enc.finish();
+    };
+    alloc_slice data = build(1);
+    CHECK(build(8) == data);
+    CHECK(data == incremental);     // Same tree as writing a MutableHashTree!
+
+    const HashTree *itree = HashTree::fromData(data);
+    REQUIRE(itree);
+    CHECK(itree->hashID() == hashtree::kDefaultHashID);
+    CHECK(itree->count() == N);
+    for (size_t i = 0; i < N; ++i)
+        CHECK(itree->get(keys[i]).asInt() == int64_t(i));
+    set<slice> keysSeen;
+    for (HashTree::iterator i(itree); i; ++i) {
+        CHECK(i.key() == keys[i.value().asInt()]);
+        CHECK(keysSeen.insert(i.key()).second);
+    }
+    CHECK(keysSeen.size() == N);
+}
+
+
+TEST_CASE("HashTree Bulk Build Empty", "[HashTree]") {
+    Encoder enc;
+    vector<HashTree::Entry> entries;
+    CHECK(HashTree::build(enc, entries.begin(), entries.end()) == 0);
+    CHECK(enc.bytesWritten() == 0);
+}
+
+
+static vector<slice> sortedKeys(const HashTree *tree, bool reverse =false, slice prefix =nullslice) {
+    vector<slice> result;
+    for (HashTree::sorted_iterator i(tree, reverse, prefix); i; ++i) {
+        CHECK(i.value() == tree->get(i.key()));
+        result.push_back(i.key());
+    }
+    return result;
+}
+
+
+TEST_CASE_METHOD(HashTreeTests, "HashTree Key Index", "[HashTree]") {
+    static constexpr size_t N = 5000;    // enough for three levels of index pages
+    createItems(N);
+    insertItems();
+    CHECK(!tree.hasKeyIndex());
+    CHECK(!HashTree::fromData(encodeTree())->hasKeyIndex());
+
+    tree.setHasKeyIndex(true);
+    alloc_slice data = encodeTree();
+    Retained<impl::Doc> dataDoc = new impl::Doc(data, impl::Doc::kDontParse);
+    const HashTree *itree = HashTree::fromData(data);
+    REQUIRE(itree);
+    CHECK(itree->hasKeyIndex());
+    CHECK(itree->count() == N);
+
+    // Iterate forwards and backwards:
+    vector<slice> expected(keys.begin(), keys.end());
+    sort(expected.begin(), expected.end());
+    CHECK(sortedKeys(itree) == expected);
+    CHECK(sortedKeys(itree, true) == vector<slice>(expected.rbegin(), expected.rend()));
+
+    // Seek:
+    for (slice target : {"0"_sl, "1"_sl, "12 five"_sl, "12 fivf"_sl, "499 ninf"_sl, "nine"_sl,
+                         "two two"_sl, "zz"_sl}) {
+        HashTree::sorted_iterator i(itree);
+        auto e = lower_bound(expected.begin(), expected.end(), target);
+        CHECK(i.seek(target) == (e != expected.end()));
+        CHECK(i.key() == (e != expected.end() ? *e : slice()));
+
+        HashTree::sorted_iterator r(itree, true);
+        auto re = upper_bound(expected.begin(), expected.end(), target);
+        CHECK(r.seek(target) == (re != expected.begin()));
+        CHECK(r.key() == (re != expected.begin() ? re[-1] : slice()));
+        if (r) {
+            ++r;
+            CHECK(r.key() == (re - 1 != expected.begin() ? re[-2] : slice()));
+        }
+    }
+
+    // Prefix scans:
+    for (slice prefix : {"12 "_sl, "4"_sl, "one"_sl, "zebra"_sl}) {
+        vector<slice> withPrefix;
+        for (slice key : expected)
+            if (key.hasPrefix(prefix))
+                withPrefix.push_back(key);
+        CHECK(sortedKeys(itree, false, prefix) == withPrefix);
+        CHECK(sortedKeys(itree, true, prefix) == vector<slice>(withPrefix.rbegin(),
+                                                               withPrefix.rend()));
+    }
+    HashTree::sorted_iterator i(itree, false, "12 "_sl);
+    CHECK(i.seek("0"_sl));
+    CHECK(i.key() == "12 eight"_sl);
+    CHECK(!i.seek("13"_sl));
+    HashTree::sorted_iterator r(itree, true, "12 "_sl);
+    CHECK(r.seek("9"_sl));
+    CHECK(r.key() == "12 zero"_sl);
+    CHECK(!r.seek("12"_sl));
+
+    // Add and remove some keys, and write a delta. Only a few index pages are rewritten:
+    MutableHashTree tree2(itree);
+    CHECK(tree2.hasKeyIndex());
+    vector<alloc_slice> newKeys = {alloc_slice("0000"), alloc_slice("22 twenty"),
+                                   alloc_slice("~~~")};
+    for (auto &key : newKeys)
+        tree2.set(key, values.get(0));
+    for (size_t i = 0; i < N; i += 50)
+        CHECK(tree2.remove(keys[i]));
+    tree2.set(keys[1], values.get(0));      // (just changes a value)
+    Encoder enc;
+    enc.amend(data, false);
+    enc.suppressTrailer();
+    tree2.writeTo(enc);
+    alloc_slice delta = enc.finish();
+    CHECK(delta.size < data.size / 4);
+    alloc_slice total(data.size + delta.size);
+    memcpy((void*)&total[0],         data.buf, data.size);
+    memcpy((void*)&total[data.size], delta.buf, delta.size);
+
+    Retained<impl::Doc> totalDoc = new impl::Doc(total, impl::Doc::kDontParse);
+    itree = HashTree::fromData(total);
+    REQUIRE(itree->hasKeyIndex());
+    for (size_t i = 0; i < N; i += 50)
+        expected.erase(find(expected.begin(), expected.end(), keys[i]));
+    for (auto &key : newKeys)
+        expected.push_back(key);
+    sort(expected.begin(), expected.end());
+    CHECK(itree->count() == expected.size());
+    CHECK(sortedKeys(itree) == expected);
+    CHECK(sortedKeys(itree, true) == vector<slice>(expected.rbegin(), expected.rend()));
+
+    // Rewriting the data before the delta copies the key index too, so nothing points there:
+    {
+        MutableHashTree tree4(itree);
+        const void *cutoff = &total[data.size];
+        const void *minUsed = tree4.rewriteDataBefore(cutoff);
+        CHECK(minUsed >= cutoff);
+        CHECK(tree4.isChanged());
+        CHECK(tree4.hasKeyIndex());
+        Encoder enc4;
+        enc4.amend(total, false, false, delta.size);
+        enc4.suppressTrailer();
+        tree4.writeTo(enc4);
+        alloc_slice delta4 = enc4.finish();
+        alloc_slice total4(total.size + delta4.size);
+        memset((void*)&total4[0], 0, data.size);
+        memcpy((void*)&total4[data.size],  &total[data.size], delta.size);
+        memcpy((void*)&total4[total.size], delta4.buf, delta4.size);
+
+        Retained<impl::Doc> total4Doc = new impl::Doc(total4, impl::Doc::kDontParse);
+        const HashTree *itree4 = HashTree::fromData(total4);
+        REQUIRE(itree4->hasKeyIndex());
+        CHECK(itree4->count() == expected.size());
+        CHECK(sortedKeys(itree4) == expected);
+        CHECK(sortedKeys(itree4, true) == vector<slice>(expected.rbegin(), expected.rend()));
+
+        // After which nothing uses that data:
+        MutableHashTree tree5(itree4);
+        CHECK(tree5.rewriteDataBefore(&total4[data.size]) >= (const void*)&total4[data.size]);
+        CHECK(!tree5.isChanged());
+    }
+
+    // Removing every key leaves an empty index:
+    MutableHashTree tree3(itree);
+    for (slice key : expected)
+        CHECK(tree3.remove(key));
+    Encoder enc3;
+    tree3.writeTo(enc3);
+    alloc_slice data3 = enc3.finish();
+    itree = HashTree::fromData(data3);
+    CHECK(itree->hasKeyIndex());
+    CHECK(!HashTree::sorted_iterator(itree));
+}
+
+
+TEST_CASE("Perf HashTree Hash Functions", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static constexpr size_t kNumKeys = 1000000;
+    static constexpr int kSamples = 3;
+
+    // Keys resembling document IDs, 40 to 100 bytes long:
+    vector<alloc_slice> keys;
+    keys.reserve(kNumKeys);
+    for (size_t i = 0; i < kNumKeys; i++) {
+        char buf[120];
+        size_t len = 40 + (i * 7919) % 61;
+        snprintf(buf, sizeof(buf), "doc-%08zx-%s", i * 2654435761u,
+                 "0123456789abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstuvwxyz"
+                 "0123456789abcdefghijklmnopqrstuvwxyz");
+        keys.emplace_back(buf, len);
+    }
+    Doc doc = Doc::fromJSON("[1234]"_sl);
+    Value value = doc.asArray().get(0);
+
+    for (auto hashID : {hashtree::kFNV1a32Hash, hashtree::kWyHash64}) {
+        fprintf(stderr, "%s, %zu keys:\n",
+                (hashID == hashtree::kFNV1a32Hash ? "FNV-1a 32-bit" : "wyhash 64-bit"), kNumKeys);
+        Benchmark hashBench, insertBench, getBench, imGetBench;
+        for (int sample = 0; sample < kSamples; ++sample) {
+            hashtree::hash_t total = 0;
+            hashBench.start();
+            for (auto &key : keys)
+                total += hashtree::ComputeHash(key, hashID);
+            hashBench.stop();
+            CHECK(total != 0);
+
+            MutableHashTree tree(hashID);
+            insertBench.start();
+            for (auto &key : keys)
+                tree.set(key, value);
+            insertBench.stop();
+
+            getBench.start();
+            for (auto &key : keys)
+                if (_usuallyFalse(!tree.get(key))) abort();
+            getBench.stop();
+
+            Encoder enc;
+            enc.suppressTrailer();
+            tree.writeTo(enc);
+            alloc_slice data = enc.finish();
+            const HashTree *itree = HashTree::fromData(data);
+            imGetBench.start();
+            for (auto &key : keys)
+                if (_usuallyFalse(!itree->get(key))) abort();
+            imGetBench.stop();
+            CHECK(itree->count() == kNumKeys);
+        }
+        fprintf(stderr, "    hash:          "); hashBench.printReport(1.0/kNumKeys, "key");
+        fprintf(stderr, "    insert:        "); insertBench.printReport(1.0/kNumKeys, "key");
+        fprintf(stderr, "    get:           "); getBench.printReport(1.0/kNumKeys, "key");
+        fprintf(stderr, "    immutable get: "); imGetBench.printReport(1.0/kNumKeys, "key");
+    }
+}
+
+
+TEST_CASE("Perf HashTree Bulk Build", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static constexpr size_t kNumKeys = 1000000;
+    static constexpr int kSamples = 3;
+
+    vector<alloc_slice> keys;
+    keys.reserve(kNumKeys);
+    for (size_t i = 0; i < kNumKeys; i++) {
+        char buf[50];
+        snprintf(buf, sizeof(buf), "doc-%08zx-%zu", i * 2654435761u, i);
+        keys.emplace_back(buf);
+    }
+    Doc doc = Doc::fromJSON("[1234]"_sl);
+    Value value = doc.asArray().get(0);
+    vector<HashTree::Entry> entries;
+    entries.reserve(kNumKeys);
+    for (auto &key : keys)
+        entries.emplace_back(key, value);
+
+    // Runs `fn` kSamples times, and reports its time and peak heap usage. (The Encoder's output
+    // buffer isn't counted, since it isn't allocated with `operator new`.)
+    auto measure = [&](const char *name, auto fn) {
+        Benchmark bench;
+        size_t peak = 0, size = 0;
+        for (int sample = 0; sample < kSamples; ++sample) {
+            HeapTracker heap;
+            bench.start();
+            alloc_slice data = fn();
+            bench.stop();
+            peak = max(peak, heap.peakBytes());
+            size = data.size;
+            CHECK(HashTree::fromData(data)->count() == kNumKeys);
+        }
+        fprintf(stderr, "%-24s peak heap %5.1f MB, tree %5.1f MB, time ",
+                name, peak / 1.0e6, size / 1.0e6);
+        bench.printReport(1.0/kNumKeys, "key");
+    };
+
+    fprintf(stderr, "Building a HashTree of %zu keys:\n", kNumKeys);
+    measure("MutableHashTree:", [&] {
+        MutableHashTree tree;
+        for (auto &key : keys)
+            tree.set(key, value);
+        Encoder enc;
+        enc.suppressTrailer();
+        tree.writeTo(enc);
+        return enc.finish();
+    });
+    for (unsigned threads : {1u, 0u}) {
+        char name[40];
+        snprintf(name, sizeof(name), "build, %u thread(s):",
+                 threads ? threads : thread::hardware_concurrency());
+        measure(name, [&] {
+            Encoder enc;
+            enc.suppressTrailer();
+            HashTree::build(enc, entries.data(), entries.data() + entries.size(),
+                            hashtree::kDefaultHashID, threads);
+            return enc.finish();
+        });
+    }
+}
+
+
+#if FL_HAVE_MMAP && defined(__linux__)
+TEST_CASE("Perf HashTree Page Layout", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static constexpr size_t kNumKeys = 200000, kNumLookups = 2000;
+    static constexpr size_t kPageSize = 4096;
+    static const char* kPath = kTempDir "fleece_hashtree_pages.fleece";
+
+    vector<alloc_slice> keys;
+    Encoder valueEnc;
+    valueEnc.beginArray();
+    for (size_t i = 0; i < kNumKeys; i++) {
+        char buf[150];
+        snprintf(buf, sizeof(buf), "doc-%08zx-%zu", i * 2654435761u, i);
+        keys.emplace_back(buf);
+        snprintf(buf, sizeof(buf), "Value of item %zu, which is long enough to take up a "
+                 "realistic amount of space in the file", i);
+        valueEnc.writeString(buf);
+    }
+    valueEnc.endArray();
+    Doc values = valueEnc.finishDoc();
+    MutableHashTree tree;
+    for (size_t i = 0; i < kNumKeys; i++)
+        tree.set(keys[i], values.asArray().get(uint32_t(i)));
+
+    // Writes the tree to a file, then looks up keys in a cold memory-mapping of it, counting
+    // how many pages each lookup reads in (according to mincore.)
+    auto measure = [&](const char *name, size_t pageSize) {
+        tree.setPageSize(pageSize);
+        Encoder enc;
+        enc.suppressTrailer();
+        tree.writeTo(enc);
+        alloc_slice data = enc.finish();
+        writeToFile(data, kPath);
+
+        FILE *f = fopen(kPath, "rb");
+        REQUIRE(f);
+        mmap_slice mapped(f, data.size);
+        auto start = (uint8_t*)mapped.buf;
+        size_t mappedPages = (data.size + kPageSize - 1) / kPageSize;
+        vector<unsigned char> residency(mappedPages);
+        auto evict = [&] {
+            madvise(start, data.size, MADV_DONTNEED);
+            posix_fadvise(fileno(f), 0, 0, POSIX_FADV_DONTNEED);
+            madvise(start, data.size, MADV_RANDOM);     // no read-ahead
+        };
+        auto residentPages = [&] {
+            mincore(start, data.size, residency.data());
+            return count_if(residency.begin(), residency.end(), [](auto r) {return r & 1;});
+        };
+        fsync(fileno(f));
+
+        const HashTree *itree = HashTree::fromData(mapped.upTo(data.size));
+        size_t totalPages = 0, maxPages = 0;
+        for (size_t n = 0; n < kNumLookups; n++) {
+            size_t i = (n * 7919) % kNumKeys;
+            evict();
+            size_t before = residentPages();
+            CHECK(itree->get(keys[i]).asString().size > 0);
+            size_t pages = residentPages() - before;
+            totalPages += pages;
+            maxPages = max(maxPages, pages);
+        }
+        fprintf(stderr, "%-18s file %5.1f MB; pages touched per cold get: average %.2f, max %zu\n",
+                name, data.size / 1.0e6, double(totalPages) / kNumLookups, maxPages);
+        fclose(f);
+    };
+
+    fprintf(stderr, "HashTree of %zu keys, %zu cold lookups:\n", kNumKeys, kNumLookups);
+    measure("Default layout:", 0);
+    measure("Page layout:", kPageSize);
+}
+#endif
+
+
 #if 0 // currently throws an exception; debug this later --jens Feb 2020
 TEST_CASE("Perf TreeSearch", "[.Perf]") {
     static const int kSamples = 500000;
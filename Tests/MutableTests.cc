@@ -21,7 +21,11 @@
 #include "MutableArray.hh"
 #include "MutableDict.hh"
 #include "Doc.hh"
+#include "HeapArena.hh"
+#include "Internal.hh"
+#include <functional>
 #include <iostream>
+#include <thread>
 
 namespace fleece {
     using namespace fleece::impl;
@@ -521,6 +525,91 @@ namespace fleece {
     }
 
 
+    TEST_CASE("Copy-on-write copy", "[Mutable]") {
+        Retained<MutableDict> leaf = MutableDict::newDict();
+        leaf->set("name"_sl, "leaf"_sl);
+        Retained<MutableArray> list = MutableArray::newArray();
+        list->append(leaf);
+        list->append(17);
+        Retained<MutableDict> root = MutableDict::newDict();
+        root->set("list"_sl, list);
+        root->set("n"_sl, 1);
+
+        Retained<MutableDict> copy = root->copy(kCopyOnWrite);
+        CHECK(copy != root);
+        CHECK(copy->isEqual(root));
+        CHECK(copy->get("list"_sl) == list);                // nested collections are shared
+
+        // Changing a nested collection of the source directly doesn't affect the copy:
+        list->append(18);
+        CHECK(list->count() == 3);
+        CHECK(root->get("list"_sl) == list);                // (the source is untouched)
+        const Array *copyListValue = copy->get("list"_sl)->asArray();
+        CHECK(copyListValue != list);
+        CHECK(copyListValue->count() == 2);
+        CHECK(copyListValue->get(0) == leaf);               // (still shared)
+
+        // Modifying through the copy copies only the path to the change:
+        MutableArray *copyList = copy->getMutableArray("list"_sl);
+        REQUIRE(copyList);
+        CHECK(copyList != list);
+        CHECK(copyList->get(0) == leaf);                    // (still shared)
+        MutableDict *copyLeaf = copyList->getMutableDict(0);
+        REQUIRE(copyLeaf);
+        CHECK(copyLeaf != leaf);
+        copyLeaf->set("name"_sl, "copied leaf"_sl);
+        copyList->append(19);
+        copy->set("n"_sl, 2);
+
+        CHECK(root->get("n"_sl)->asInt() == 1);
+        CHECK(list->count() == 3);
+        CHECK(list->get(2)->asInt() == 18);
+        CHECK(leaf->get("name"_sl)->asString() == "leaf"_sl);
+        CHECK(copy->get("n"_sl)->asInt() == 2);
+        CHECK(copyList->count() == 3);
+        CHECK(copyList->get(2)->asInt() == 19);
+        CHECK(copyLeaf->get("name"_sl)->asString() == "copied leaf"_sl);
+
+        // The source modifies its own collections in place:
+        CHECK(root->getMutableArray("list"_sl) == list);
+        CHECK(list->getMutableDict(0) == leaf);
+        leaf->set("name"_sl, "root leaf"_sl);
+        CHECK(copyLeaf->get("name"_sl)->asString() == "copied leaf"_sl);
+
+        // A second copy, made after those changes, sees them but not later ones, even ones made
+        // directly to a collection nested two levels deep that was gotten before the copy:
+        Retained<MutableDict> copy2 = root->copy(kCopyOnWrite);
+        leaf->set("name"_sl, "changed again"_sl);
+        CHECK(root->get("list"_sl)->asArray()->get(0) == leaf);   // (the source is untouched)
+        root->set("n"_sl, 3);
+        const Dict *copy2Leaf = copy2->get("list"_sl)->asArray()->get(0)->asDict();
+        CHECK(copy2Leaf->get("name"_sl)->asString() == "root leaf"_sl);
+        CHECK(copy2->get("n"_sl)->asInt() == 1);
+
+        // The same, with the grandchild changed in other ways, and more deeply nested:
+        Retained<MutableArray> deep = MutableArray::newArray();
+        deep->append(1);
+        leaf->set("deep"_sl, deep);
+        Retained<MutableDict> copy4 = root->copy(kCopyOnWrite);
+        deep->append(2);
+        leaf->remove("name"_sl);
+        list->getMutableDict(0)->set("added"_sl, true);
+        const Dict *copy4Leaf = copy4->get("list"_sl)->asArray()->get(0)->asDict();
+        CHECK(copy4Leaf->toJSONString() == "{\"deep\":[1],\"name\":\"changed again\"}");
+        CHECK(leaf->toJSONString() == "{\"added\":true,\"deep\":[1,2]}");
+        CHECK(root->get("list"_sl)->asArray()->get(0) == leaf);
+        copy4 = nullptr;
+
+        // Once nothing else refers to a shared collection, the copy takes it over without copying:
+        Retained<MutableDict> copy3 = copy2->copy(kCopyOnWrite);
+        copy2 = nullptr;
+        root = nullptr;
+        list = nullptr;
+        const Value *copy3List = copy3->get("list"_sl);
+        CHECK(copy3->getMutableArray("list"_sl) == copy3List);
+    }
+
+
 #pragma mark - ENCODING:
 
 
@@ -796,6 +885,84 @@ namespace fleece {
     }
 
 
+    TEST_CASE("Squashing dict deltas", "[Mutable]") {
+        Encoder enc0;
+        enc0.beginDictionary();
+        for (int i = 0; i < 100; ++i) {
+            char key[10];
+            sprintf(key, "k%03d", i);
+            enc0.writeKey(slice(key));
+            enc0.writeInt(i);
+        }
+        enc0.endDictionary();
+        alloc_slice data = enc0.finish();
+
+        // Changes one key, and appends the dict to `data`:
+        auto appendChange = [&](int round, const Encoder::SquashPolicy &policy) {
+            Retained<Doc> doc = Doc::fromFleece(data, Doc::kTrusted);
+            Retained<MutableDict> dict = MutableDict::newDict(doc->asDict());
+            dict->set("k000"_sl, round);
+            Encoder enc;
+            enc.setBase(data);
+            enc.setSquashPolicy(policy);
+            enc.writeValue(dict);
+            data.append(enc.finish());
+            return enc.inheritanceStats();
+        };
+
+        SECTION("Max ancestors") {
+            // Every third delta would have three ancestors, so it's squashed:
+            for (int round = 1; round <= 9; ++round) {
+                auto stats = appendChange(round, {});
+                CHECK(stats.squashedDicts == (round % 3 == 0));
+                CHECK(stats.inheritedDicts == (round % 3 != 0));
+                CHECK(stats.averageAncestors() == round % 3);
+            }
+        }
+
+        SECTION("Max lookup cost") {
+            // Each delta adds about 2.6 comparisons to a lookup in the base's 7.7, so the sixth
+            // goes over 3x:
+            for (int round = 1; round <= 6; ++round) {
+                auto stats = appendChange(round, {100, 3.0});
+                CHECK(stats.squashedDicts == (round == 6));
+            }
+        }
+
+        SECTION("Explicit squash") {
+            for (int round = 1; round <= 5; ++round)
+                appendChange(round, {100, 100.0});
+            const Dict *chained = Value::fromTrustedData(data)->asDict();
+
+            Encoder enc;
+            enc.setBase(data);
+            // Asking doesn't count; only writing the Dict whole does:
+            CHECK(enc.shouldSquash(chained, 1));
+            CHECK(enc.inheritanceStats().squashedDicts == 0);
+            enc.writeSquashed(chained);
+            CHECK(enc.inheritanceStats().squashedDicts == 1);
+            alloc_slice squashedData = data;
+            squashedData.append(enc.finish());
+            const Dict *squashed = Value::fromTrustedData(squashedData)->asDict();
+            CHECK(squashed->isEqual(chained));
+            CHECK(squashed->get("k000"_sl)->asInt() == 5);
+            CHECK(squashed->count() == 100);
+
+#ifndef NDEBUG
+            // Looking up every key takes fewer comparisons:
+            auto comparisons = [](const Dict *dict) {
+                unsigned start = internal::gTotalComparisons;
+                for (Dict::iterator i(dict); i; ++i)
+                    CHECK(dict->get(i.keyString()) == i.value());
+                return internal::gTotalComparisons - start;
+            };
+            unsigned chainedCount = comparisons(chained), squashedCount = comparisons(squashed);
+            CHECK(squashedCount < chainedCount);
+#endif
+        }
+    }
+
+
     TEST_CASE("Compaction", "[Mutable]") {
         static constexpr size_t kMaxDataSize = 1000;
         alloc_slice data;
@@ -919,4 +1086,305 @@ namespace fleece {
         std::cerr << "(Packed data would be " << packedData.size << " bytes)\n";
     }
 
+
+    TEST_CASE("Large MutableDict", "[Mutable]") {
+        // Enough keys to make HeapDict switch from linear search to its hash table:
+        static constexpr int kCount = 1000;
+        std::vector<int> order(kCount);
+        for (int i = 0; i < kCount; ++i)
+            order[i] = i;
+        srandom(42);
+        for (int i = kCount - 1; i > 0; --i)
+            std::swap(order[i], order[random() % (i + 1)]);
+
+        auto keyFor = [](int i) {
+            char key[20];
+            sprintf(key, "k%05d", i);
+            return std::string(key);
+        };
+
+        Retained<MutableDict> md = MutableDict::newDict();
+        for (int i : order)
+            md->set(slice(keyFor(i)), i);
+        CHECK(md->count() == kCount);
+
+        // Remove every third key, in random order:
+        for (int i : order) {
+            if (i % 3 == 0)
+                md->remove(slice(keyFor(i)));
+        }
+        md->remove("nonexistent"_sl);
+        CHECK(md->count() == kCount - (kCount + 2) / 3);
+        for (int i = 0; i < kCount; ++i) {
+            const Value *v = md->get(slice(keyFor(i)));
+            if (i % 3 == 0) {
+                CHECK(v == nullptr);
+            } else {
+                REQUIRE(v);
+                CHECK(v->asInt() == i);
+            }
+        }
+
+        // Iteration and encoding are in sorted order:
+        int expected = 1;
+        for (MutableDict::iterator i(md); i; ++i) {
+            CHECK(i.keyString() == slice(keyFor(expected)));
+            CHECK(i.value()->asInt() == expected);
+            expected += (expected % 3 == 2) ? 2 : 1;
+        }
+        CHECK(expected >= kCount);
+
+        Encoder enc;
+        enc.writeValue(md);
+        alloc_slice data = enc.finish();
+        const Dict *dict = Value::fromData(data)->asDict();
+        REQUIRE(dict);
+        CHECK(dict->count() == md->count());
+        CHECK(dict->get("k00998"_sl)->asInt() == 998);
+        CHECK(dict->get("k00999"_sl) == nullptr);
+        CHECK(dict->isEqualToDict(md));
+
+        // Re-add some removed keys, and remove everything:
+        md->set("k00000"_sl, "zero"_sl);
+        CHECK(md->get("k00000"_sl)->asString() == "zero"_sl);
+        md->removeAll();
+        CHECK(md->count() == 0);
+        CHECK(md->get("k00001"_sl) == nullptr);
+        CHECK(!MutableDict::iterator(md));
+    }
+
+
+    TEST_CASE("MutableDict inline values stay put", "[Mutable]") {
+        // A pointer to a small inline value must stay valid while other keys are added, even
+        // when it's the value being stored:
+        Retained<MutableDict> md = MutableDict::newDict();
+        md->set("a"_sl, 17);
+        md->set("s"_sl, "short"_sl);
+        const Value *a = md->get("a"_sl), *s = md->get("s"_sl);
+        for (int i = 0; i < 1000; ++i) {
+            char key[20];
+            sprintf(key, "k%d", i);
+            md->set(slice(key), (i % 2) ? a : s);
+        }
+        CHECK(md->get("a"_sl) == a);
+        CHECK(a->asInt() == 17);
+        CHECK(s->asString() == "short"_sl);
+        CHECK(md->get("k999"_sl)->asInt() == 17);
+        CHECK(md->get("k998"_sl)->asString() == "short"_sl);
+
+        md->remove("k500"_sl);
+        md->set("k1000"_sl, 1000);
+        CHECK(md->get("a"_sl) == a);
+        CHECK(md->count() == 1002);
+    }
+
+
+    TEST_CASE("Mutable values in HeapArena", "[Mutable]") {
+        static constexpr int kCount = 1000;
+        Retained<HeapArena> arena = new HeapArena;
+        Retained<MutableDict> md;
+        size_t allocs;
+        {
+            HeapArena::Scope scope(arena);
+            HeapTracker heap;
+            md = MutableDict::newDict();
+            for (int i = 0; i < kCount; ++i) {
+                char key[20];
+                sprintf(key, "key-%04d", i);
+                if (i % 10 == 0) {
+                    Retained<MutableArray> array = MutableArray::newArray();
+                    array->append("a fairly long string value"_sl);
+                    md->set(slice(key), array);
+                } else {
+                    md->set(slice(key), i);
+                }
+            }
+            allocs = heap.allocations();
+        }
+        // Every HeapValue, dict entry and key should have come from the arena's slabs:
+        CHECK(arena->slabCount() > 1);
+        CHECK(allocs < 2 * arena->slabCount() + kCount / 10 + 20);
+        std::cerr << "Built dict with " << allocs << " heap allocations; arena has "
+                  << arena->slabCount() << " slabs, " << arena->bytesAllocated() << " bytes\n";
+
+        CHECK(md->count() == kCount);
+        CHECK(md->get("key-0123"_sl)->asInt() == 123);
+        CHECK(md->get("key-0120"_sl)->asArray()->get(0)->asString() == "a fairly long string value"_sl);
+        int n = 0;
+        slice prevKey;
+        for (MutableDict::iterator i(md); i; ++i, ++n) {
+            CHECK(i.keyString() > prevKey);
+            prevKey = i.keyString();
+        }
+        CHECK(n == kCount);
+
+        // Values created outside the Scope use the regular heap, and copies take their keys
+        // out of the arena:
+        Retained<MutableDict> copy = MutableDict::newDict(md, kDeepCopy);
+        md = nullptr;
+        CHECK(copy->get("key-0999"_sl)->asInt() == 999);
+        CHECK(copy->get("key-0990"_sl)->asArray()->count() == 1);
+
+        // The arena stays alive as long as a Value in it does:
+        HeapArena *arenaPtr = arena;
+        Retained<MutableArray> array;
+        {
+            HeapArena::Scope scope(arena);
+            array = MutableArray::newArray();
+            array->append("in the arena"_sl);
+        }
+        arena = nullptr;
+        CHECK(arenaPtr->slabCount() > 0);
+        CHECK(array->get(0)->asString() == "in the arena"_sl);
+        array = nullptr;
+    }
+
+
+    TEST_CASE("Thread-confined mutable values", "[Mutable]") {
+        Retained<HeapArena> arena = new HeapArena;
+        arena->setValuesThreadConfined(true);
+        Retained<MutableDict> md;
+        {
+            HeapArena::Scope scope(arena);
+            md = MutableDict::newDict();
+            Retained<MutableArray> array = MutableArray::newArray();
+            array->append("a string that's too long to be inline"_sl);
+            md->set("array"_sl, array);
+            md->set("int"_sl, 12345678);
+        }
+        auto hd = internal::HeapValue::asHeapValue(md);
+        CHECK(hd->isThreadConfined());
+        CHECK(hd->refCount() == 1);
+        CHECK(!arena->isThreadConfined());
+
+        // Copies made outside the arena's Scope are regular values:
+        Retained<MutableDict> copy = md->copy(kDeepCopy);
+        CHECK(!internal::HeapValue::asHeapValue(copy)->isThreadConfined());
+        auto array = md->getMutableArray("array"_sl);
+        CHECK(internal::HeapValue::asHeapValue(array)->isThreadConfined());
+        CHECK(copy->get("array"_sl)->asArray()->get(0)->asString() ==
+              "a string that's too long to be inline"_sl);
+
+        // Taking an object out of thread-confined mode lets it move to another thread:
+        hd->setThreadConfined(false);
+        std::thread([&] {
+            Retained<MutableDict> md2 = md;
+            CHECK(md2->get("int"_sl)->asInt() == 12345678);
+        }).join();
+        CHECK(hd->refCount() == 1);
+    }
+
+    TEST_CASE("Inline small values", "[Mutable]") {
+        static constexpr uint32_t kCount = 100;
+        static const slice kStrings[] = {""_sl, "x"_sl, "hello"_sl, "hello world"_sl,
+                                         "fourteen bytes"_sl};
+        Retained<MutableArray> ma = MutableArray::newArray(kCount);
+        Retained<MutableDict> md = MutableDict::newDict();
+        for (uint32_t i = 0; i < 10; ++i)
+            md->set(slice(kStrings[i % 5]), nullValue);
+
+        // Short strings and numbers (including doubles) are stored inside the ValueSlot:
+        HeapTracker heap;
+        for (uint32_t i = 0; i < kCount; ++i) {
+            switch (i % 4) {
+                case 0:  ma->set(i, kStrings[i % 5]); break;
+                case 1:  ma->set(i, i * M_PI); break;
+                case 2:  ma->set(i, int64_t(i) << 40); break;
+                default: ma->set(i, float(i) / 8); break;
+            }
+        }
+        for (uint32_t i = 0; i < 5; ++i)
+            md->set(kStrings[i], 1.0 / (i + 3));
+        CHECK(heap.allocations() == 0);
+
+        for (uint32_t i = 0; i < kCount; ++i) {
+            switch (i % 4) {
+                case 0:  CHECK(ma->get(i)->asString() == kStrings[i % 5]); break;
+                case 1:  CHECK(ma->get(i)->asDouble() == i * M_PI);
+                         CHECK(ma->get(i)->isDouble()); break;
+                case 2:  CHECK(ma->get(i)->asInt() == int64_t(i) << 40); break;
+                default: CHECK(ma->get(i)->asFloat() == float(i) / 8); break;
+            }
+        }
+        for (uint32_t i = 0; i < 5; ++i)
+            CHECK(md->get(kStrings[i])->asDouble() == 1.0 / (i + 3));
+
+        // Longer strings still go on the heap:
+        ma->set(0, "fifteen bytes!!"_sl);
+        CHECK(heap.allocations() == 1);
+        CHECK(ma->get(0)->asString() == "fifteen bytes!!"_sl);
+
+        Encoder enc;
+        enc.writeValue(ma);
+        Retained<Doc> doc = enc.finishDoc();
+        CHECK(doc->root()->asArray()->get(1)->asDouble() == M_PI);
+        CHECK(doc->root()->asArray()->get(4)->asString() == "fourteen bytes"_sl);
+    }
+
+
+    TEST_CASE("Overwriting inline values with pointers", "[Mutable]") {
+        // Inline values fill the slot's second word, which has to be cleared when a pointer is
+        // stored, or it looks like a copy-on-write reference:
+        Retained<MutableArray> ma = MutableArray::newArray(1);
+
+        SECTION("Inline string, then heap string") {
+            ma->set(0, "fourteen bytes"_sl);
+            ma->set(0, "this is a much longer string value"_sl);
+            CHECK(ma->get(0)->asString() == "this is a much longer string value"_sl);
+        }
+        SECTION("Inline double, then collection") {
+            ma->set(0, M_PI);
+            Retained<MutableDict> md = MutableDict::newDict();
+            md->set("x"_sl, 1);
+            ma->set(0, md);
+            CHECK(ma->get(0) == md);
+            CHECK(ma->getMutableDict(0) == md);
+        }
+        SECTION("Heap, then inline, then heap") {
+            ma->set(0, "this is a much longer string value"_sl);
+            ma->set(0, "fourteen bytes"_sl);
+            CHECK(ma->get(0)->asString() == "fourteen bytes"_sl);
+            ma->set(0, "another much longer string value"_sl);
+            CHECK(ma->get(0)->asString() == "another much longer string value"_sl);
+        }
+
+        ma = nullptr;       // releasing the slot mustn't crash either
+    }
+
+
+    TEST_CASE("Overwriting ValueSlots", "[Mutable]") {
+        // Every kind of value, inline or not, replaced by every other kind. Each dict starts out
+        // as a copy-on-write copy, so its slot first holds a reference to a shared collection:
+        Retained<MutableDict> shared = MutableDict::newDict();
+        shared->set("x"_sl, 1);
+        Retained<MutableDict> source = MutableDict::newDict();
+        source->set("k"_sl, shared);
+
+        using Setter = std::function<void(MutableDict*)>;
+        const std::pair<const char*, Setter> kSetters[] = {
+            {"null",        [](MutableDict *d) {d->set("k"_sl, nullValue);}},
+            {"true",        [](MutableDict *d) {d->set("k"_sl, true);}},
+            {"1234",        [](MutableDict *d) {d->set("k"_sl, 1234);}},
+            {"1099511627776", [](MutableDict *d) {d->set("k"_sl, int64_t(1) << 40);}},
+            {"0.125",       [](MutableDict *d) {d->set("k"_sl, 0.125f);}},
+            {"0.1",         [](MutableDict *d) {d->set("k"_sl, 0.1);}},
+            {"\"fourteen bytes\"", [](MutableDict *d) {d->set("k"_sl, "fourteen bytes"_sl);}},
+            {"\"a string too long to go inline\"",
+                            [](MutableDict *d) {d->set("k"_sl, "a string too long to go inline"_sl);}},
+            {"[]",          [](MutableDict *d) {d->set("k"_sl, MutableArray::newArray());}},
+            {"{\"x\":1}",   [&](MutableDict *d) {d->set("k"_sl, shared);}},
+        };
+        for (auto &first : kSetters) {
+            for (auto &second : kSetters) {
+                INFO("Setting " << first.first << " then " << second.first);
+                Retained<MutableDict> d = source->copy(kCopyOnWrite);
+                CHECK(d->get("k"_sl)->toJSONString() == "{\"x\":1}");
+                first.second(d);
+                CHECK(d->get("k"_sl)->toJSONString() == first.first);
+                second.second(d);
+                CHECK(d->get("k"_sl)->toJSONString() == second.first);
+            }
+        }
+    }
+
 }
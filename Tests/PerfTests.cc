@@ -19,7 +19,14 @@
 #include "FleeceTests.hh"
 #include "FleeceImpl.hh"
 #include "JSONConverter.hh"
+#include "DeepIterator.hh"
 #include "Doc.hh"
+#include "HeapArena.hh"
+#include "MutableArray.hh"
+#include "MutableDict.hh"
+#include "ParallelForEach.hh"
+#include "Path.hh"
+#include "Stopwatch.hh"
 #include "varint.hh"
 #include <chrono>
 #include <stdlib.h>
@@ -283,4 +290,285 @@ TEST_CASE("Perf DictSearch", "[.Perf]") {
     bench.printReport();
 }
 
+
+TEST_CASE("Perf PathSet", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const int kRepeat = 200;
+    alloc_slice input = readTestFile("1000people.fleece");
+    if (!input)
+        abort();
+    auto people = Value::fromTrustedData(input)->asArray();
+
+    // 30 properties of a person:
+    static const char* const kPaths[] = {"_id", "type", "index", "guid", "isActive", "balance",
+        "picture", "age", "eyeColor", "name", "gender", "company", "email", "phone", "address",
+        "registered", "latitude", "longitude", "tags[0]", "tags[1]", "tags[2]", "tags[-1]",
+        "friends[0].id", "friends[0].name", "friends[1].id", "friends[1].name",
+        "friends[2].id", "friends[2].name", "friends[-1].name", "nope.name"};
+    static constexpr size_t n = sizeof(kPaths) / sizeof(kPaths[0]);
+    std::vector<Path> paths;
+    PathSet pathSet;
+    for (auto spec : kPaths) {
+        paths.emplace_back(slice(spec));
+        pathSet.add(paths.back());
+    }
+
+    const Value* values[n];
+    size_t found1 = 0, found2 = 0;
+    Stopwatch st;
+    for (int r = 0; r < kRepeat; ++r) {
+        for (Array::iterator i(people); i; ++i) {
+            for (size_t p = 0; p < n; ++p) {
+                values[p] = paths[p].eval(i.value());
+                if (values[p])
+                    ++found1;
+            }
+        }
+    }
+    double separateTime = st.elapsed();
+    st.reset();
+    for (int r = 0; r < kRepeat; ++r) {
+        for (Array::iterator i(people); i; ++i)
+            found2 += pathSet.eval(i.value(), values);
+    }
+    double setTime = st.elapsed();
+    CHECK(found1 == found2);
+    double docs = kRepeat * people->count();
+    fprintf(stderr, "%zu paths: separately %.3f us/doc, as a PathSet %.3f us/doc\n",
+            n, separateTime / docs * 1e6, setTime / docs * 1e6);
+}
+
+
+TEST_CASE("Perf Path queries", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const int kRepeat = 100;
+    alloc_slice input = readTestFile("1000people.fleece");
+    if (!input)
+        abort();
+    auto root = Value::fromTrustedData(input);
+
+    // Selective queries only visit the values on the way to a match; recursive ones visit all:
+    static const char* const kQueries[] = {"[*].name", "[*].friends[-1].name",
+        "[?(@.age == 30)].name", "[*].friends[?(@.id == 1)].name", "..name", "..friends..name",
+        "..*"};
+    for (auto spec : kQueries) {
+        Path path{slice(spec)};
+        size_t found = 0;
+        Stopwatch st;
+        for (int r = 0; r < kRepeat; ++r) {
+            for (Path::iterator i(path, root); i; ++i)
+                ++found;
+        }
+        double time = st.elapsed();
+        fprintf(stderr, "%-36s %5zu matches in %8.3f us\n",
+                spec, found / kRepeat, time / kRepeat * 1e6);
+    }
+
+    // For comparison, a DeepIterator visiting every value:
+    size_t found = 0;
+    Stopwatch st;
+    for (int r = 0; r < kRepeat; ++r) {
+        for (DeepIterator i(root); i; ++i) {
+            if (i.keyString() == "name"_sl)
+                ++found;
+        }
+    }
+    fprintf(stderr, "%-36s %5zu matches in %8.3f us\n",
+            "(DeepIterator, key == \"name\")", found / kRepeat, st.elapsed() / kRepeat * 1e6);
+}
+
+
+TEST_CASE("Perf parallel aggregation", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static constexpr uint32_t kRecords = 2000000;
+    Encoder enc;
+    enc.beginArray(kRecords);
+    for (uint32_t i = 0; i < kRecords; ++i) {
+        enc.beginDictionary(4);
+        enc.writeKey("id");
+        enc.writeUInt(i);
+        enc.writeKey("value");
+        enc.writeDouble(i * 0.25);
+        enc.writeKey("tags");
+        enc.beginArray(3);
+        enc.writeString("red");
+        enc.writeString("green");
+        enc.writeUInt(i % 7);
+        enc.endArray();
+        enc.writeKey("pos");
+        enc.beginDictionary(2);
+        enc.writeKey("x");
+        enc.writeInt(i % 1000);
+        enc.writeKey("y");
+        enc.writeInt(i / 1000);
+        enc.endDictionary();
+        enc.endDictionary();
+    }
+    enc.endArray();
+    alloc_slice data = enc.finish();
+    auto records = Value::fromTrustedData(data)->asArray();
+    fprintf(stderr, "Synthetic doc: %u records, %.1f MB; %u cores\n",
+            kRecords, data.size / 1e6, std::thread::hardware_concurrency());
+
+    auto addDoubles = [](double &total, const double &part) {total += part;};
+    auto addCounts = [](size_t &total, const size_t &part) {total += part;};
+    double time1[2] = {};
+    for (unsigned threads : {1, 2, 4, 8, 16}) {
+        // Sum of one property of each record:
+        Stopwatch st;
+        double sum = parallelReduce(records, 0.0, [](double &total, const Value *record) {
+            total += ((const Dict*)record)->get("value"_sl)->asDouble();
+        }, addDoubles, threads);
+        double sumTime = st.elapsed();
+
+        // Count of all numbers in the document:
+        st.reset();
+        size_t count = parallelDeepReduce(records, size_t(0), [](size_t &n, DeepIterator &i) {
+            if (i.value()->type() == kNumber)
+                ++n;
+        }, addCounts, threads);
+        double countTime = st.elapsed();
+
+        CHECK(sum == 0.25 * (double(kRecords) * (kRecords - 1) / 2));
+        CHECK(count == 5 * size_t(kRecords));
+        if (threads == 1) {
+            time1[0] = sumTime;
+            time1[1] = countTime;
+        }
+        fprintf(stderr, "%2u threads: sum %8.3f ms (x%.2f), deep count %8.3f ms (x%.2f)\n",
+                threads, sumTime * 1e3, time1[0] / sumTime, countTime * 1e3, time1[1] / countTime);
+    }
+}
+
+
+TEST_CASE("Perf MutableCopy HeapArena", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const int kSamples = 100;
+    auto doc = Doc::fromFleece(readTestFile("1000people.fleece"), Doc::kTrusted);
+    auto root = doc->asArray();
+
+    for (int useArena = 0; useArena <= 1; ++useArena) {
+        fprintf(stderr, "Deep-copying 1000 people into mutable Values, %s arena...\n",
+                (useArena ? "with" : "without"));
+        Benchmark bench;
+        size_t allocs = 0;
+        for (int i = 0; i < kSamples; i++) {
+            HeapTracker heap;
+            bench.start();
+            {
+                Retained<HeapArena> arena = useArena ? new HeapArena : nullptr;
+                HeapArena::Scope scope(arena);
+                Retained<MutableArray> copy = MutableArray::newArray(root,
+                                                            CopyFlags(kDeepCopy | kCopyImmutables));
+                REQUIRE(copy->count() == root->count());
+            }
+            bench.stop();
+            allocs = heap.allocations();
+        }
+        bench.printReport();
+        fprintf(stderr, "    %zu heap allocations per copy\n", allocs);
+    }
+}
+
+TEST_CASE("Perf MutableDict", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    for (int size : {10, 100, 10000}) {
+        const int kSamples = 2000000 / size;
+        std::vector<std::string> keys;
+        for (int i = 0; i < size; ++i)
+            keys.push_back(std::to_string(random()));
+
+        Benchmark setBench, getBench, iterBench, encodeBench;
+        for (int s = 0; s < kSamples; ++s) {
+            setBench.start();
+            Retained<MutableDict> md = MutableDict::newDict();
+            for (auto &key : keys)
+                md->set(slice(key), 1234);
+            setBench.stop();
+
+            getBench.start();
+            for (auto &key : keys)
+                REQUIRE(md->get(slice(key)) != nullptr);
+            getBench.stop();
+
+            iterBench.start();
+            int n = 0;
+            for (MutableDict::iterator i(md); i; ++i)
+                ++n;
+            REQUIRE(n == size);
+            iterBench.stop();
+
+            encodeBench.start();
+            Encoder enc;
+            enc.writeValue(md);
+            REQUIRE(enc.finish());
+            encodeBench.stop();
+        }
+        fprintf(stderr, "MutableDict with %d keys:\n", size);
+        fprintf(stderr, "    set:     "); setBench.printReport(1.0/size, "key");
+        fprintf(stderr, "    get:     "); getBench.printReport(1.0/size, "key");
+        fprintf(stderr, "    iterate: "); iterBench.printReport(1.0/size, "key");
+        fprintf(stderr, "    encode:  "); encodeBench.printReport(1.0/size, "key");
+    }
+}
+
+TEST_CASE("Perf MutableDict fork", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const int kSamples = 1000;
+    // Build a fully-mutable document with 100 Dicts of 100 items each:
+    Retained<MutableDict> doc = MutableDict::newDict();
+    for (int i = 0; i < 100; ++i) {
+        Retained<MutableDict> child = MutableDict::newDict();
+        for (int j = 0; j < 100; ++j)
+            child->set(slice(std::to_string(j)), j);
+        doc->set(slice(std::to_string(i)), child);
+    }
+
+    for (CopyFlags flags : {kDeepCopy, kCopyOnWrite}) {
+        fprintf(stderr, "Forking 10k-item doc and changing one item, %s...\n",
+                (flags == kDeepCopy ? "deep copy" : "copy-on-write"));
+        Benchmark bench;
+        for (int i = 0; i < kSamples; i++) {
+            bench.start();
+            Retained<MutableDict> fork = doc->copy(flags);
+            fork->getMutableDict("42"_sl)->set("17"_sl, -1);
+            bench.stop();
+            REQUIRE(doc->get("42"_sl)->asDict()->get("17"_sl)->asInt() == 17);
+        }
+        bench.printReport();
+    }
+}
+
+TEST_CASE("Perf MutableDict thread-confined", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const int kSamples = 100;
+    static const int kCount = 10000;
+    for (int confined = 0; confined <= 1; ++confined) {
+        fprintf(stderr, "Building and freeing a MutableDict of %d arrays, %s...\n",
+                kCount, (confined ? "thread-confined" : "thread-safe"));
+        Benchmark bench;
+        for (int i = 0; i < kSamples; i++) {
+            bench.start();
+            {
+                Retained<HeapArena> arena = new HeapArena;
+                arena->setValuesThreadConfined(confined);
+                HeapArena::Scope scope(arena);
+                Retained<MutableDict> md = MutableDict::newDict();
+                for (int k = 0; k < kCount; ++k) {
+                    Retained<MutableArray> array = MutableArray::newArray();
+                    for (int j = 0; j < 10; ++j)
+                        array->append("this string is too long to be inline"_sl);
+                    md->set(slice(std::to_string(k)), array);
+                }
+                for (MutableDict::iterator iter(md); iter; ++iter) {
+                    Retained<MutableArray> array = (MutableArray*)iter.value()->asArray();
+                    REQUIRE(array->count() == 10);
+                }
+            }
+            bench.stop();
+        }
+        bench.printReport(1.0/kCount, "array");
+    }
+}
+
 #endif // !FL_EMBEDDED
@@ -23,6 +23,7 @@
 #include "TempArray.hh"
 #include "sliceIO.hh"
 #include "Base64.hh"
+#include "TextDiff.hh"
 #include <iostream>
 #include <future>
 
@@ -330,3 +331,131 @@ TEST_CASE("Base64 encode and decode", "[Base64]") {
         CHECK(decoded == in);
     }
 }
+
+
+// Checks that the chunks turn `oldStr` into `nuuStr`, and returns the total bytes inserted.
+static size_t checkTextDiff(const string &oldStr, const string &nuuStr,
+                            const vector<TextDiff::Chunk> &chunks)
+{
+    auto isCharStart = [](const string &str, size_t pos) {
+        return pos >= str.size() || (uint8_t(str[pos]) & 0xC0) != 0x80;
+    };
+    string result;
+    size_t oldPos = 0, nuuPos = 0, inserted = 0;
+    for (auto &c : chunks) {
+        REQUIRE(oldPos + c.equal + c.deleted <= oldStr.size());
+        REQUIRE(nuuPos + c.equal + c.inserted <= nuuStr.size());
+        result += oldStr.substr(oldPos, c.equal);
+        oldPos += c.equal;
+        nuuPos += c.equal;
+        CHECK(isCharStart(oldStr, oldPos));
+        CHECK(isCharStart(nuuStr, nuuPos));
+        oldPos += c.deleted;
+        result += nuuStr.substr(nuuPos, c.inserted);
+        nuuPos += c.inserted;
+        inserted += c.inserted;
+        CHECK(isCharStart(oldStr, oldPos));
+        CHECK(isCharStart(nuuStr, nuuPos));
+    }
+    CHECK(oldPos == oldStr.size());
+    CHECK(result == nuuStr);
+    return inserted;
+}
+
+
+TEST_CASE("TextDiff", "[TextDiff]") {
+    string oldStr = "The quick brown fox jumps over the lazy dog.";
+    string nuuStr = "The quick red fox jumped over the lazy dog!";
+    TextDiff differ(oldStr, nuuStr);
+    CHECK(differ.diff(1000000));
+    CHECK(checkTextDiff(oldStr, nuuStr, differ.chunks()) == 5);     // "ed", "ed", "!"
+
+    // Identical and empty strings:
+    TextDiff same(oldStr, oldStr);
+    CHECK(same.diff(1000000));
+    REQUIRE(same.chunks().size() == 1);
+    CHECK(same.chunks()[0].equal == oldStr.size());
+    TextDiff empty(""_sl, nuuStr);
+    CHECK(empty.diff(1000000));
+    CHECK(checkTextDiff("", nuuStr, empty.chunks()) == nuuStr.size());
+}
+
+
+TEST_CASE("TextDiff UTF-8", "[TextDiff]") {
+    // U+00E9 and U+00E8 share their first byte, which must not be left in the equal run:
+    string oldStr = u8"caf\u00e9 au lait", nuuStr = u8"caf\u00e8 au lait";
+    TextDiff differ(oldStr, nuuStr);
+    CHECK(differ.diff(1000000));
+    REQUIRE(differ.chunks().size() == 2);
+    CHECK(differ.chunks()[0].equal == 3);
+    CHECK(differ.chunks()[0].deleted == 2);
+    CHECK(differ.chunks()[0].inserted == 2);
+    CHECK(differ.chunks()[1].equal == 8);
+    checkTextDiff(oldStr, nuuStr, differ.chunks());
+
+    // Characters of different lengths, with shared trailing bytes:
+    oldStr = u8"\u30E2\u30D0\u30A4\u30EB \u00E9t\u00E9 \U0001F600!";
+    nuuStr = u8"\u30E2\u30D1\u30A4\u30EB \u00C9t\u00E9 \U0001F601!";
+    TextDiff differ2(oldStr, nuuStr);
+    CHECK(differ2.diff(1000000));
+    checkTextDiff(oldStr, nuuStr, differ2.chunks());
+}
+
+
+TEST_CASE("TextDiff step limit", "[TextDiff]") {
+    // Two unrelated pseudo-random texts take many steps to diff:
+    string oldStr, nuuStr;
+    uint32_t r = 12345;
+    for (int i = 0; i < 2000; ++i) {
+        r = r * 1103515245 + 12345;
+        oldStr += char('a' + (r >> 16) % 4);
+        nuuStr += char('a' + (r >> 24) % 4);
+    }
+    TextDiff full(oldStr, nuuStr);
+    CHECK(full.diff(100000000));
+    size_t fullInserted = checkTextDiff(oldStr, nuuStr, full.chunks());
+
+    // With too few steps the diff is still correct, just bigger:
+    TextDiff limited(oldStr, nuuStr);
+    CHECK(!limited.diff(1000));
+    CHECK(limited.steps() < 10000);
+    size_t limitedInserted = checkTextDiff(oldStr, nuuStr, limited.chunks());
+    CHECK(limitedInserted > fullInserted);
+
+    // And the result depends only on the input:
+    TextDiff again(oldStr, nuuStr);
+    again.diff(1000);
+    REQUIRE(again.chunks().size() == limited.chunks().size());
+    for (size_t i = 0; i < again.chunks().size(); ++i) {
+        CHECK(again.chunks()[i].equal == limited.chunks()[i].equal);
+        CHECK(again.chunks()[i].deleted == limited.chunks()[i].deleted);
+        CHECK(again.chunks()[i].inserted == limited.chunks()[i].inserted);
+    }
+}
+
+
+TEST_CASE("TextDiff lines", "[TextDiff]") {
+    // A text long enough to be diffed line by line, with a line deleted, one changed, and one
+    // inserted:
+    string oldStr, nuuStr;
+    for (int i = 0; i < 200; ++i) {
+        string line = "This is line number " + to_string(i) + " of the text.\n";
+        oldStr += line;
+        if (i == 20)
+            continue;
+        else if (i == 100)
+            line = "This is line number 100 of the edited text.\n";
+        else if (i == 150)
+            nuuStr += "A new line.\n";
+        nuuStr += line;
+    }
+    TextDiff differ(oldStr, nuuStr);
+    CHECK(differ.diff(1000000));
+    CHECK(checkTextDiff(oldStr, nuuStr, differ.chunks()) <= 7 + 12);
+    size_t deleted = 0;
+    for (auto &c : differ.chunks())
+        deleted += c.deleted;
+    CHECK(deleted <= 36);       // line 20
+    // Only the changed lines were compared byte by byte:
+    CHECK(differ.steps() < 2000);
+}
@@ -25,8 +25,12 @@
 #include "Pointer.hh"
 #include "varint.hh"
 #include "DeepIterator.hh"
+#include "Encoder.hh"
+#include "ParallelForEach.hh"
 #include "SharedKeys.hh"
 #include "Doc.hh"
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <sstream>
 
@@ -177,6 +181,182 @@ namespace fleece {
     }
 
 
+    TEST_CASE("DeepIterator reuse") {
+        auto input = readTestFile("1person.fleece");
+        auto person = Value::fromData(input);
+
+        vector<string> paths;
+        for (DeepIterator i(person); i; ++i)
+            paths.push_back(i.pathString());
+        REQUIRE(paths.size() > 10);
+
+        // Once a reused iterator and path string have grown, they don't allocate any more:
+        // (No CHECKs inside the loop, since they allocate.)
+        DeepIterator i(nullptr);
+        string path;
+        HeapTracker heap;
+        for (int pass = 0; pass < 3; ++pass) {
+            heap.reset();
+            size_t n = 0;
+            bool same = true;
+            for (i.reset(person); i; ++i) {
+                i.pathString(path);
+                same = same && n < paths.size() && path == paths[n];
+                ++n;
+            }
+            size_t allocs = heap.allocations();
+            CHECK(same);
+            CHECK(n == paths.size());
+            if (pass > 0)
+                CHECK(allocs == 0);
+        }
+
+#if FL_HAVE_TEST_FILES
+        // Iterating each person in a big array with the same iterator:
+        auto peopleData = readTestFile("1000people.fleece");
+        auto people = Value::fromTrustedData(peopleData)->asArray();
+        size_t count = 0, freshCount = 0, freshAllocs = 0;
+        for (int pass = 0; pass < 2; ++pass) {
+            heap.reset();
+            count = 0;
+            for (Array::iterator p(people); p; ++p) {
+                for (i.reset(p.value()); i; ++i)
+                    ++count;
+            }
+            if (pass > 0)
+                CHECK(heap.allocations() == 0);
+        }
+        heap.reset();
+        for (Array::iterator p(people); p; ++p) {
+            for (DeepIterator fresh(p.value()); fresh; ++fresh)
+                ++freshCount;
+        }
+        freshAllocs = heap.allocations();
+        CHECK(count == freshCount);
+        CHECK(freshAllocs >= people->count());  // (a new iterator allocates its path)
+
+        // And the whole array at once:
+        for (int pass = 0; pass < 2; ++pass) {
+            heap.reset();
+            size_t total = 0;
+            for (i.reset(people); i; ++i)
+                ++total;
+            size_t allocs = heap.allocations();
+            CHECK(total == count + 1);
+            if (pass > 0)
+                CHECK(allocs == 0);
+        }
+#endif
+    }
+
+
+    TEST_CASE("Parallel iteration") {
+        static constexpr uint32_t kCount = 100000;
+        Encoder enc;
+        enc.beginArray();
+        for (uint32_t i = 0; i < kCount; ++i)
+            enc.writeUInt(i);
+        enc.endArray();
+        alloc_slice numbersData = enc.finish();
+        auto numbers = Value::fromTrustedData(numbersData)->asArray();
+
+        for (unsigned threads : {1u, 4u, 0u}) {
+            INFO("maxThreads = " << threads);
+            vector<uint8_t> visited(kCount, 0);
+            atomic<bool> wrongItem {false};
+            parallelForEach(numbers, [&](const Value *item, uint32_t index) {
+                if (item->asUnsigned() != index)
+                    wrongItem = true;
+                ++visited[index];
+            }, threads);
+            CHECK(!wrongItem);
+            CHECK(size_t(count(visited.begin(), visited.end(), 1)) == kCount);
+
+            auto sum = parallelReduce(numbers, uint64_t(0),
+                                      [](uint64_t &total, const Value *item) {
+                                          total += item->asUnsigned();
+                                      },
+                                      [](uint64_t &total, const uint64_t &part) {total += part;},
+                                      threads);
+            CHECK(sum == uint64_t(kCount) * (kCount - 1) / 2);
+
+            // A bool result (which mustn't end up in a vector<bool>):
+            bool allNumbers = parallelReduce(numbers, true,
+                                             [](bool &all, const Value *item) {
+                                                 all = all && item->type() == kNumber;
+                                             },
+                                             [](bool &all, const bool &part) {all = all && part;},
+                                             threads);
+            CHECK(allNumbers);
+        }
+        CHECK(parallelRangeCount(0, 4) == 0);
+        CHECK(parallelRangeCount(10, 4) == 1);
+        CHECK(parallelRangeCount(kCount, 1) == 1);
+        CHECK(parallelRangeCount(kCount, 4) == 32);
+
+        // An exception thrown on any thread is rethrown:
+        CHECK_THROWS_AS(parallelForEach(numbers, [](const Value*, uint32_t index) {
+            if (index == 54321)
+                FleeceException::_throw(InvalidData, "oops");
+        }, 4), FleeceException);
+
+        // Deep iteration of a Dict of Arrays:
+        static constexpr uint32_t kDictCount = 1000;
+        enc.beginDictionary();
+        for (uint32_t i = 0; i < kDictCount; ++i) {
+            enc.writeKey("k" + to_string(i));
+            enc.beginArray();
+            enc.writeUInt(i);
+            enc.writeString("x");
+            enc.beginDictionary();
+            enc.writeKey("n");
+            enc.writeUInt(i);
+            enc.endDictionary();
+            enc.endArray();
+        }
+        enc.endDictionary();
+        alloc_slice dictData = enc.finish();
+        auto dict = Value::fromTrustedData(dictData);
+
+        atomic<size_t> nValues {0}, nItems {0};
+        atomic<bool> wrongKey {false};
+        parallelDeepForEach(dict, [&](DeepIterator &i, slice key, uint32_t) {
+            ++nValues;
+            if (i.path().empty()) {
+                ++nItems;
+                auto n = i.value()->asArray()->get(0)->asUnsigned();
+                if (key != slice("k" + to_string(n)))
+                    wrongKey = true;
+            }
+        }, 4);
+        CHECK(nValues == 5 * kDictCount);
+        CHECK(nItems == kDictCount);
+        CHECK(!wrongKey);
+
+        auto sum = parallelDeepReduce(dict, uint64_t(0),
+                                      [](uint64_t &total, DeepIterator &i) {
+                                          if (i.value()->type() == kNumber)
+                                              total += i.value()->asUnsigned();
+                                      },
+                                      [](uint64_t &total, const uint64_t &part) {total += part;},
+                                      4);
+        CHECK(sum == uint64_t(kDictCount) * (kDictCount - 1));
+
+#if FL_HAVE_TEST_FILES
+        // Compare with a DeepIterator on the calling thread:
+        auto peopleData = readTestFile("1000people.fleece");
+        auto people = Value::fromTrustedData(peopleData);
+        size_t serialCount = 0;
+        for (DeepIterator i(people); i; ++i)
+            ++serialCount;
+        auto parallelCount = parallelDeepReduce(people, size_t(0),
+                                                [](size_t &n, DeepIterator&) {++n;},
+                                                [](size_t &n, const size_t &part) {n += part;});
+        CHECK(parallelCount == serialCount - 1);    // (it doesn't visit the root)
+#endif
+    }
+
+
     TEST_CASE("Doc", "[SharedKeys]") {
         const Dict *root;
         {
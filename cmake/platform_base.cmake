@@ -16,12 +16,15 @@ function(set_source_files_base)
         Fleece/Core/Encoder.cc
         Fleece/Core/JSONConverter.cc
         Fleece/Core/JSONDelta.cc
+        Fleece/Core/ParallelForEach.cc
         Fleece/Core/Path.cc
         Fleece/Core/Pointer.cc
         Fleece/Core/SharedKeys.cc
+        Fleece/Core/ThreeWayMerge.cc
         Fleece/Core/Value+Dump.cc
         Fleece/Core/Value.cc
         Fleece/Integration/MContext.cc
+        Fleece/Mutable/HeapArena.cc
         Fleece/Mutable/HeapArray.cc
         Fleece/Mutable/HeapDict.cc
         Fleece/Mutable/HeapValue.cc
@@ -44,9 +47,12 @@ function(set_source_files_base)
         Fleece/Support/slice_stream.cc
         Fleece/Support/sliceIO.cc
         Fleece/Support/StringTable.cc
+        Fleece/Support/TextDiff.cc
         Fleece/Support/varint.cc
         Fleece/Support/Writer.cc
         Fleece/Tree/HashTree.cc
+        Fleece/Tree/HashTreeBuilder.cc
+        Fleece/Tree/HashTreeKeyIndex.cc
         Fleece/Tree/MutableHashTree.cc
         Fleece/Tree/NodeRef.cc
         vendor/jsonsl/jsonsl.c
@@ -67,6 +73,7 @@ function(set_test_source_files_base)
     set(
         ${BASE_SSS_RESULT}
         Tests/API_ValueTests.cc
+        Tests/DBTests.cc
         Tests/DeltaTests.cc
         Tests/EncoderTests.cc
         Tests/FleeceTests.cc
@@ -78,6 +85,7 @@ function(set_test_source_files_base)
         Tests/SharedKeysTests.cc
         Tests/SupportTests.cc
         Tests/ValueTests.cc
+        Experimental/DB.cc
         Experimental/KeyTree.cc
         PARENT_SCOPE
     )
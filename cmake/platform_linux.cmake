@@ -35,6 +35,7 @@ function(setup_build)
     target_link_libraries(
         FleeceStatic INTERFACE
         dl
+        pthread
     )
 
     target_compile_definitions(